@@ -32,7 +32,8 @@ Game::Game(const Engine& engine) :
     m_blackToMove(true),
     m_blackResigned(false),
     m_passes(0),
-    m_moveNum(0)
+    m_moveNum(0),
+    m_reusable(false)
 {
     m_fileName = QUuid::createUuid().toRfc4122().toHex();
 }
@@ -174,6 +175,46 @@ bool Game::gameStart(const VersionTuple &min_version,
     // check any return values.
     checkVersion(min_version);
     QTextStream(stdout) << "Engine has started." << Qt::endl;
+    return gameSetup(sgf, moves);
+}
+
+bool Game::gameReuse(const Engine& engine,
+                     const QString &sgf,
+                     const int moves) {
+    // Games started from an sgf file leave its settings behind, and
+    // the options are fixed when the engine is launched.
+    if (!m_reusable || !sgf.isEmpty()
+        || state() != QProcess::Running
+        || engine.m_binary != m_engine.m_binary
+        || engine.m_options != m_engine.m_options) {
+        return false;
+    }
+    m_fileName = QUuid::createUuid().toRfc4122().toHex();
+    m_winner.clear();
+    m_moveDone.clear();
+    m_result.clear();
+    m_isHandicap = false;
+    m_resignation = false;
+    m_blackToMove = true;
+    m_blackResigned = false;
+    m_passes = 0;
+    m_moveNum = 0;
+    if (!sendGtpCommand("clear_board")) {
+        return false;
+    }
+    if (engine.m_network != m_engine.m_network) {
+        QTextStream(stdout) << "Loading network " << engine.m_network << Qt::endl;
+        if (!sendGtpCommand("sai-loadnet " + engine.m_network)) {
+            return false;
+        }
+    }
+    m_engine = engine;
+    QTextStream(stdout) << "Engine has been reused." << Qt::endl;
+    return gameSetup(sgf, moves);
+}
+
+bool Game::gameSetup(const QString &sgf, const int moves) {
+    m_reusable = sgf.isEmpty();
     //If there is an sgf file to start playing from then it will contain
     //whether there is handicap in use. If there is no sgf file then instead,
     //check whether there are any handicap commands to send (these fail
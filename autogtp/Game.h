@@ -63,6 +63,12 @@ public:
     bool gameStart(const VersionTuple& min_version,
                    const QString &sgf = QString(),
                    const int moves = 0);
+    // Starts a new game in the engine that is already running, loading
+    // the network of engine if it changed. Returns false if the engine
+    // cannot be reused and has to be started again.
+    bool gameReuse(const Engine& engine,
+                   const QString &sgf = QString(),
+                   const int moves = 0);
     void move();
     bool waitForMove() { return waitReady(); }
     bool readMove();
@@ -116,7 +122,9 @@ private:
     bool m_blackResigned;
     int m_passes;
     int m_moveNum;
+    bool m_reusable;
     bool sendGtpCommand(QString cmd);
+    bool gameSetup(const QString &sgf, const int moves);
     void checkVersion(const VersionTuple &min_version);
     bool waitReady();
     bool eatNewLine();
@@ -0,0 +1,153 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <QCryptographicHash>
+#include <QFile>
+#include <QFileInfo>
+#include <QHttpMultiPart>
+#include <QMetaObject>
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QNetworkRequest>
+#include <QUrl>
+#include <future>
+#include <memory>
+#include "HttpClient.h"
+
+HttpClient::HttpClient()
+    : m_manager(new QNetworkAccessManager) {
+    m_manager->moveToThread(&m_thread);
+    QObject::connect(&m_thread, &QThread::finished,
+                     m_manager, &QObject::deleteLater);
+    m_thread.start();
+}
+
+HttpClient::~HttpClient() {
+    m_thread.quit();
+    m_thread.wait();
+}
+
+HttpClient::Reply HttpClient::finish(QNetworkReply *reply) {
+    Reply r;
+    r.ok = reply->error() == QNetworkReply::NoError;
+    r.status = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+    r.body = reply->readAll();
+    r.error = reply->errorString();
+    reply->deleteLater();
+    return r;
+}
+
+void HttpClient::startPost(const QString &url, const QStringList &form,
+                           Callback done) {
+    auto multi = new QHttpMultiPart(QHttpMultiPart::FormDataType);
+    for (const auto &field : form) {
+        const auto eq = field.indexOf('=');
+        const auto name = field.left(eq);
+        const auto value = field.mid(eq + 1);
+        QHttpPart part;
+        if (value.startsWith('@')) {
+            auto file = new QFile(value.mid(1), multi);
+            if (!file->open(QIODevice::ReadOnly)) {
+                delete multi;
+                Reply r;
+                r.error = "Cannot open " + value.mid(1);
+                done(r);
+                return;
+            }
+            part.setHeader(QNetworkRequest::ContentTypeHeader,
+                           "application/octet-stream");
+            part.setHeader(QNetworkRequest::ContentDispositionHeader,
+                           "form-data; name=\"" + name + "\"; filename=\""
+                           + QFileInfo(value.mid(1)).fileName() + "\"");
+            part.setBodyDevice(file);
+        } else {
+            part.setHeader(QNetworkRequest::ContentDispositionHeader,
+                           "form-data; name=\"" + name + "\"");
+            part.setBody(value.toUtf8());
+        }
+        multi->append(part);
+    }
+    auto reply = m_manager->post(QNetworkRequest(QUrl(url)), multi);
+    multi->setParent(reply);
+    QObject::connect(reply, &QNetworkReply::finished, [reply, done]() {
+        done(finish(reply));
+    });
+}
+
+void HttpClient::startDownload(const QString &url, const QString &fileName,
+                               QString *sha256, Callback done) {
+    auto file = std::make_shared<QFile>(fileName);
+    if (!file->open(QIODevice::WriteOnly)) {
+        Reply r;
+        r.error = "Cannot write " + fileName;
+        done(r);
+        return;
+    }
+    auto hash = std::make_shared<QCryptographicHash>(QCryptographicHash::Sha256);
+    auto reply = m_manager->get(QNetworkRequest(QUrl(url)));
+    // Hashed and written as it arrives, so that the file is not read
+    // again to check it and is never held in memory.
+    auto write = [reply, file, hash]() {
+        const auto data = reply->readAll();
+        hash->addData(data);
+        file->write(data);
+    };
+    QObject::connect(reply, &QNetworkReply::readyRead, write);
+    QObject::connect(reply, &QNetworkReply::finished,
+                     [reply, file, hash, write, sha256, done]() {
+        write();
+        file->close();
+        const auto r = finish(reply);
+        if (!r.ok) {
+            file->remove();
+        } else if (sha256) {
+            *sha256 = hash->result().toHex();
+        }
+        done(r);
+    });
+}
+
+HttpClient::Reply HttpClient::wait(std::function<void(Callback)> start) {
+    std::promise<Reply> promise;
+    auto result = promise.get_future();
+    QMetaObject::invokeMethod(m_manager, [&promise, start]() {
+        start([&promise](const Reply &r) { promise.set_value(r); });
+    }, Qt::QueuedConnection);
+    return result.get();
+}
+
+HttpClient::Reply HttpClient::post(const QString &url, const QStringList &form) {
+    return wait([this, url, form](Callback done) {
+        startPost(url, form, done);
+    });
+}
+
+void HttpClient::postAsync(const QString &url, const QStringList &form,
+                           Callback done) {
+    QMetaObject::invokeMethod(m_manager, [this, url, form, done]() {
+        startPost(url, form, done);
+    }, Qt::QueuedConnection);
+}
+
+HttpClient::Reply HttpClient::download(const QString &url,
+                                       const QString &fileName,
+                                       QString *sha256) {
+    return wait([this, url, fileName, sha256](Callback done) {
+        startDownload(url, fileName, sha256, done);
+    });
+}
@@ -0,0 +1,70 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef HTTPCLIENT_H
+#define HTTPCLIENT_H
+
+#include <QByteArray>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+#include <functional>
+
+class QNetworkAccessManager;
+class QNetworkReply;
+
+// The HTTP client of autogtp. One QNetworkAccessManager on a thread of
+// its own keeps the connections to the server alive, so that only the
+// first request pays for the TLS handshake, and runs several requests at
+// once. The blocking calls can be made from any thread, which doesn't
+// need an event loop.
+class HttpClient {
+public:
+    struct Reply {
+        bool ok{false};
+        int status{0};
+        QByteArray body;
+        QString error;
+    };
+    using Callback = std::function<void(const Reply &)>;
+
+    HttpClient();
+    ~HttpClient();
+
+    // POST a multipart form. The fields are given as curl -F takes them,
+    // name=value, or name=@file to send the contents of the file.
+    Reply post(const QString &url, const QStringList &form);
+    // Same, without waiting. done is called on the thread of the client.
+    void postAsync(const QString &url, const QStringList &form, Callback done);
+    // GET the url into the file, which is written as the data arrives,
+    // and set sha256 to the hex digest of it.
+    Reply download(const QString &url, const QString &fileName,
+                   QString *sha256 = nullptr);
+
+private:
+    void startPost(const QString &url, const QStringList &form, Callback done);
+    void startDownload(const QString &url, const QString &fileName,
+                       QString *sha256, Callback done);
+    Reply wait(std::function<void(Callback)> start);
+    static Reply finish(QNetworkReply *reply);
+
+    QThread m_thread;
+    QNetworkAccessManager *m_manager;
+};
+
+#endif
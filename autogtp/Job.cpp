@@ -66,12 +66,28 @@ WaitJob::WaitJob(QString gpu, Management *parent) :
 {
 }
 
+ProductionJob::~ProductionJob() {
+    if (m_game) {
+        m_game->gameQuit();
+    }
+}
+
 Result ProductionJob::execute(){
     Result res(Result::Error);
-    Game game(m_engine);
-    if (!game.gameStart(m_leelazMinVersion, m_sgf, m_moves)) {
-        return res;
+    // Keep the engine of the previous game if possible, it saves
+    // loading the network and setting up the GPU for every game.
+    if (m_game && !m_game->gameReuse(m_engine, m_sgf, m_moves)) {
+        m_game->gameQuit();
+        m_game.reset();
     }
+    if (!m_game) {
+        m_game = std::make_unique<Game>(m_engine);
+        if (!m_game->gameStart(m_leelazMinVersion, m_sgf, m_moves)) {
+            m_game.reset();
+            return res;
+        }
+    }
+    auto& game = *m_game;
     if (!m_sgf.isEmpty()) {
         QFile::remove(m_sgf + ".sgf");
         if (m_restore) {
@@ -90,6 +106,7 @@ Result ProductionJob::execute(){
     do {
         game.move();
         if (!game.waitForMove()) {
+            m_game.reset();
             return res;
         }
         game.readMove();
@@ -121,7 +138,10 @@ Result ProductionJob::execute(){
     default:
         break;
     }
-    game.gameQuit();
+    if (m_state.loadRelaxed() != RUNNING) {
+        game.gameQuit();
+        m_game.reset();
+    }
     return res;
 }
 
@@ -26,6 +26,7 @@
 #include <QObject>
 #include <QAtomicInt>
 #include <QTextStream>
+#include <memory>
 class Management;
 using VersionTuple = std::tuple<int, int, int>;
 
@@ -63,11 +64,12 @@ class ProductionJob : public Job {
     Q_OBJECT
 public:
     ProductionJob(QString gpu, Management *parent);
-    ~ProductionJob() = default;
+    ~ProductionJob();
     void init(const Order &o);
     Result execute();
 private:
     Engine m_engine;
+    std::unique_ptr<Game> m_game;
     QString m_sgf;
     QString m_selfplay_id;
     bool m_debug;
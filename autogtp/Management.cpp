@@ -73,7 +73,8 @@ Management::Management(const int gpus,
     m_gamesLeft(maxGames),
     m_threadsLeft(gpus * games),
     m_delNetworks(delNetworks),
-    m_lockFile(nullptr) {
+    m_lockFile(nullptr),
+    m_uploads(m_http, authForm()) {
 }
 
 void Management::runTuningProcess(const QString &tuneCmdLine) {
@@ -108,6 +109,7 @@ Order Management::getWork(const QFileInfo &file) {
 }
 
 void Management::giveAssignments() {
+    m_uploads.start();
     sendAllGames();
 
     //Make the OpenCl tuning before starting the threads
@@ -244,6 +246,8 @@ void  Management::printTimingInfo(float duration) {
         << total_time_s.count() / m_gamesPlayed << " seconds/game, "
         << total_time_millis.count() / m_movesMade.loadRelaxed()  << " ms/move"
         << ", last game took " << int(duration) << " seconds." << Qt::endl;
+    QTextStream(stdout)
+        << "Upload backlog: " << m_uploads.backlog() << " game(s)." << Qt::endl;
 }
 
 QString Management::getOption(const QJsonObject &ob, const QString &key, const QString &opt, const QString &defValue) {
@@ -362,10 +366,6 @@ Order Management::getWorkInternal(bool tuning) {
 }
 
     */
-    QString prog_cmdline("curl");
-#ifdef WIN32
-    prog_cmdline.append(".exe");
-#endif
     QString url;
     url.append(m_serverUrl+"get-task/");
     if (tuning) {
@@ -375,28 +375,17 @@ Order Management::getWorkInternal(bool tuning) {
         if (!m_leelaversion.isEmpty())
             url.append("/"+m_leelaversion);
     }
-    QStringList arguments;
-    arguments << "-s" << "-J";
-    if (!m_username.isEmpty() && !m_password.isEmpty())
-        arguments << "-F" << "username=" + m_username << "-F" << "password=" + m_hashedPassword;
-    else
-        arguments << "-F" << "key=" + m_publicAuthKey;
-    arguments << url;
-    QProcess curl;
-    curl.start(prog_cmdline, arguments);
-    curl.waitForFinished(-1);
-
-    if (curl.exitCode()) {
-        throw NetworkException("Curl returned non-zero exit code "
-                               + std::to_string(curl.exitCode()));
+    const auto reply = m_http.post(url, authForm());
+    if (!reply.ok) {
+        throw NetworkException("Getting task failed: "
+                               + reply.error.toStdString());
         return o;
     }
     QJsonDocument doc;
     QJsonParseError parseError;
-    QByteArray curlOutput = curl.readAllStandardOutput();
-    doc = QJsonDocument::fromJson(curlOutput, &parseError);
+    doc = QJsonDocument::fromJson(reply.body, &parseError);
     if (parseError.error != QJsonParseError::NoError) {
-        QTextStream(stdout) << "Getting task returned: " << curlOutput << Qt::endl;
+        QTextStream(stdout) << "Getting task returned: " << reply.body << Qt::endl;
         std::string errorString = parseError.errorString().toUtf8().constData();
         throw NetworkException("JSON parse error: " + errorString);
     }
@@ -598,61 +587,34 @@ void Management::fetchNetwork(const QString &net, const QString &hash) {
     if (networkExists(name, hash)) {
         return;
     }
-    if (QFileInfo::exists(name)) {
-        QFile f_gz(name);
-        // Curl refuses to overwrite, so make sure to delete the gzipped
-        // network if it exists
-        f_gz.remove();
-    }
 
-    QString prog_cmdline("curl");
-#ifdef WIN32
-    prog_cmdline.append(".exe");
-#endif
-    // Be quiet, but output the real file name we saved.
-    // Use the filename from the server.
-    prog_cmdline.append(" -s -J -o " + name + " ");
-    prog_cmdline.append(" -w %{filename_effective}");
-    prog_cmdline.append(" "+m_serverUrl + name);
-
-    QProcess curl;
-    curl.start(prog_cmdline);
-    curl.waitForFinished(-1);
-
-    if (curl.exitCode()) {
-        throw NetworkException("Curl returned non-zero exit code "
-                               + std::to_string(curl.exitCode()));
-    }
-
-    QByteArray output = curl.readAllStandardOutput();
-    QString outstr(output);
-    QStringList outlst = outstr.split("\n");
-    QString outfile = outlst[0];
-    QTextStream(stdout) << "Net filename: " << outfile << Qt::endl;
+    // The download is hashed as it is written, so a damaged network is
+    // caught here and retried with the task.
+    QString gzipHash;
+    const auto reply = m_http.download(m_serverUrl + name, name, &gzipHash);
+    if (!reply.ok) {
+        throw NetworkException("Downloading network failed: "
+                               + reply.error.toStdString());
+    }
+    if (gzipHash != hash) {
+        QFile::remove(name);
+        throw NetworkException("Downloaded network hash doesn't match, calculated: "
+                               + gzipHash.toStdString() + " it should be: "
+                               + hash.toStdString());
+    }
+    QTextStream(stdout) << "Net filename: " << name << Qt::endl;
     return;
 }
 
 QString Management::fetchGameData(const QString &name, const QString &extension) {
-    QString prog_cmdline("curl");
-#ifdef WIN32
-    prog_cmdline.append(".exe");
-#endif
-
     const auto fileName = QUuid::createUuid().toRfc4122().toHex();
 
-    // Be quiet, but output the real file name we saved.
-    // Use the filename from the server.
-    prog_cmdline.append(" -s -J -o " + fileName + "." + extension);
-    prog_cmdline.append(" -w %{filename_effective}");
-    prog_cmdline.append(" "+m_serverUrl + "view/" + name + "." + extension);
-
-    QProcess curl;
-    curl.start(prog_cmdline);
-    curl.waitForFinished(-1);
-
-    if (curl.exitCode()) {
-        throw NetworkException("Curl returned non-zero exit code "
-                               + std::to_string(curl.exitCode()));
+    const auto reply = m_http.download(
+        m_serverUrl + "view/" + name + "." + extension,
+        fileName + "." + extension);
+    if (!reply.ok) {
+        throw NetworkException("Downloading game data failed: "
+                               + reply.error.toStdString());
     }
 
     return fileName;
@@ -673,18 +635,6 @@ void Management::archiveFiles(const QString &fileName) {
         }
     }
 }
-void Management::cleanupFiles(const QString &fileName) {
-    QDir dir;
-    QStringList filters;
-    filters << fileName + ".*";
-    dir.setNameFilters(filters);
-    dir.setFilter(QDir::Files | QDir::NoSymLinks);
-    QFileInfoList list = dir.entryInfoList();
-    for (int i = 0; i < list.size(); ++i) {
-        QFile(list.at(i).fileName()).remove();
-    }
-}
-
 void Management::gzipFile(const QString &fileName) {
     QString gzipCmd ="gzip";
 #ifdef WIN32
@@ -694,106 +644,17 @@ void Management::gzipFile(const QString &fileName) {
     QProcess::execute(gzipCmd);
 }
 
-void Management::saveCurlCmdLine(const QStringList &prog_cmdline, const QString &name) {
-    QString fileName = "curl_save" + QUuid::createUuid().toRfc4122().toHex() + ".bin";
-    QLockFile lf(fileName + ".lock");
-    lf.lock();
-    QFile f(fileName);
-    if (!f.open(QIODevice::WriteOnly | QIODevice::Text)) {
-        return;
-    }
-    QTextStream out(&f);
-    out << name << Qt::endl;
-    out << prog_cmdline.size() << Qt::endl;
-    QStringList::ConstIterator it = prog_cmdline.constBegin();
-    while (it != prog_cmdline.constEnd()) {
-        out << *it << " " << Qt::endl;
-        ++it;
-    }
-    f.close();
-}
-
 void Management::sendAllGames() {
-    QDir dir;
-    QStringList filters;
-    filters << "curl_save*.bin";
-    dir.setNameFilters(filters);
-    dir.setFilter(QDir::Files | QDir::NoSymLinks);
-    QFileInfoList list = dir.entryInfoList();
-    for (int i = 0; i < list.size(); ++i) {
-        QFileInfo fileInfo = list.at(i);
-        QLockFile lf(fileInfo.fileName()+".lock");
-        if (!lf.tryLock(10)) {
-            continue;
-        }
-        QFile file(fileInfo.fileName());
-        if (!file.open(QFile::ReadOnly)) {
-            continue;
-        }
-        QTextStream in(&file);
-        QString name;
-        QString tmp;
-        QStringList lines;
-        int count;
-        in >> name;
-        in >> count;
-        count = 2 * count - 1;
-        for (int i = 0; i < count; i++) {
-            in >> tmp;
-            lines << tmp;
-        }
-        file.close();
-        bool sent = false;
-
-        try {
-            sent = sendCurl(lines);
-            if (sent) {
-                QTextStream(stdout) << "File: " << file.fileName() << " sent" << Qt::endl;
-                file.remove();
-                cleanupFiles(name);
-                if (i+1 < list.size()) {
-                    QThread::sleep(10);
-                }
-            }
-        } catch (const NetworkException &ex) {
-            QTextStream(stdout)
-                << "Network connection to server failed." << Qt::endl;
-            QTextStream(stdout)
-                << ex.what() << Qt::endl;
-            QTextStream(stdout)
-                    << "Retrying when next game is finished."
-                    << Qt::endl;
-        }
-    }
+    m_uploads.addSaved();
 }
 
-bool Management::sendCurl(const QStringList &lines, const QStringList &args) {
-    QString prog("curl");
-#ifdef WIN32
-    prog.append(".exe");
-#endif
-    QStringList arguments;
-    arguments << "-f";
+QStringList Management::authForm() const {
+    QStringList form;
     if (!m_username.isEmpty() && !m_password.isEmpty())
-        arguments << "-F" << "username=" + m_username << "-F" << "password=" + m_hashedPassword;
+        form << "username=" + m_username << "password=" + m_hashedPassword;
     else
-        arguments << "-F" << "key=" + m_publicAuthKey;
-    arguments << args;
-    for (const QString& s: lines)
-        arguments << s.split(' ');
-    QProcess curl;
-    curl.start(prog, arguments);
-    curl.waitForFinished(-1);
-    if (curl.exitCode()) {
-        QTextStream(stdout) << "Upload failed. Curl Exit code: "
-            << curl.exitCode() << Qt::endl;
-        QTextStream(stdout) << curl.readAllStandardOutput();
-        throw NetworkException("Curl returned non-zero exit code "
-                                   + std::to_string(curl.exitCode()));
-        return false;
-    }
-    QTextStream(stdout) << curl.readAllStandardOutput();
-    return (curl.exitCode() == 0);
+        form << "key=" + m_publicAuthKey;
+    return form;
 }
 
 /*
@@ -812,8 +673,6 @@ https://zero.sjeng.org/submit-match
 void Management::uploadResult(const QMap<QString,QString> &r, const QMap<QString,QString> &l) {
     QTextStream(stdout) << "Uploading match: " << r["file"] << ".sgf for networks ";
     QTextStream(stdout) << l["firstNet"] << " and " << l["secondNet"] << Qt::endl;
-    archiveFiles(r["file"]);
-    gzipFile(r["file"] + ".sgf");
     QStringList prog_cmdline;
     if (r["winner"] == "black") {
         prog_cmdline.append("-F winnerhash=" + l["firstNet"]);
@@ -831,30 +690,11 @@ void Management::uploadResult(const QMap<QString,QString> &r, const QMap<QString
     prog_cmdline.append("-F sgf=@"+ r["file"] + ".sgf.gz");
     prog_cmdline.append(m_serverUrl+"submit-match");
 
-    bool sent = false;
-    for (auto retries = 0; retries < MAX_RETRIES; retries++) {
-        try {
-            sent = sendCurl(prog_cmdline);
-            break;
-        } catch (const NetworkException &ex) {
-            QTextStream(stdout)
-                << "Network connection to server failed." << Qt::endl;
-            QTextStream(stdout)
-                << ex.what() << Qt::endl;
-            auto retry_delay =
-                std::min<int>(
-                    RETRY_DELAY_MIN_SEC * std::pow(1.5, retries),
-                    RETRY_DELAY_MAX_SEC);
-            QTextStream(stdout) << "Retrying in " << retry_delay << " s."
-                                << Qt::endl;
-            QThread::sleep(retry_delay);
-        }
-    }
-    if (!sent) {
-        saveCurlCmdLine(prog_cmdline, r["file"]);
-        return;
-    }
-    cleanupFiles(r["file"]);
+    const auto file = r["file"];
+    m_uploads.add(file, prog_cmdline, QStringList(), [this, file] {
+        archiveFiles(file);
+        gzipFile(file + ".sgf");
+    });
 }
 
 
@@ -870,8 +710,6 @@ https://zero.sjeng.org/submit
 
 void Management::uploadData(const QMap<QString,QString> &r, const QMap<QString,QString> &l) {
     QTextStream(stdout) << "Uploading game: " << r["file"] << ".sgf for network " << l["network"] << Qt::endl;
-    archiveFiles(r["file"]);
-    gzipFile(r["file"] + ".sgf");
     QStringList prog_cmdline;
     if (l.contains("selfplay_id"))
         prog_cmdline.append("-F selfplay_id="+l["selfplay_id"]);
@@ -888,31 +726,11 @@ void Management::uploadData(const QMap<QString,QString> &r, const QMap<QString,Q
     QStringList prog_other_args;
     prog_other_args << "-F" << ("options=" + l["original_options"]);
 
-    bool sent = false;
-    for (auto retries = 0; retries < MAX_RETRIES; retries++) {
-        try {
-            sent = sendCurl(prog_cmdline, prog_other_args);
-            break;
-        } catch (const NetworkException &ex) {
-            QTextStream(stdout)
-                << "Network connection to server failed." << Qt::endl;
-            QTextStream(stdout)
-                << ex.what() << Qt::endl;
-            auto retry_delay =
-                std::min<int>(
-                    RETRY_DELAY_MIN_SEC * std::pow(1.5, retries),
-                    RETRY_DELAY_MAX_SEC);
-            QTextStream(stdout) << "Retrying in " << retry_delay << " s."
-                                << Qt::endl;
-            QThread::sleep(retry_delay);
-        }
-    }
-    if (!sent) {
-        QTextStream(stdout) << "PROVA\n";
-        saveCurlCmdLine(prog_cmdline, r["file"]);
-        return;
-    }
-    cleanupFiles(r["file"]);
+    const auto file = r["file"];
+    m_uploads.add(file, prog_cmdline, prog_other_args, [this, file] {
+        archiveFiles(file);
+        gzipFile(file + ".sgf");
+    });
 }
 
 void Management::checkStoredGames() {
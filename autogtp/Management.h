@@ -30,6 +30,8 @@
 #include <QVector>
 #include <chrono>
 #include <stdexcept>
+#include "HttpClient.h"
+#include "UploadQueue.h"
 #include "Worker.h"
 
 constexpr int AUTOGTP_VERSION = 18;
@@ -94,6 +96,8 @@ private:
     bool m_delNetworks;
     QLockFile *m_lockFile;
     QString m_leelaversion;
+    HttpClient m_http;
+    UploadQueue m_uploads;
 
     Order getWorkInternal(bool tuning);
     Order getWork(bool tuning = false);
@@ -111,10 +115,8 @@ private:
     void printTimingInfo(float duration);
     void runTuningProcess(const QString &tuneCmdLine);
     void gzipFile(const QString &fileName);
-    bool sendCurl(const QStringList &lines, const QStringList &args = QStringList());
-    void saveCurlCmdLine(const QStringList &prog_cmdline, const QString &name);
+    QStringList authForm() const;
     void archiveFiles(const QString &fileName);
-    void cleanupFiles(const QString &fileName);
     void uploadData(const QMap<QString,QString> &r, const QMap<QString,QString> &l);
     void uploadResult(const QMap<QString, QString> &r, const QMap<QString, QString> &l);
 };
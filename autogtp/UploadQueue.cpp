@@ -0,0 +1,229 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#include <QDateTime>
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QLockFile>
+#include <QMutexLocker>
+#include <QTextStream>
+#include <QUuid>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include "UploadQueue.h"
+
+constexpr int MAX_IN_FLIGHT = 4;
+constexpr int UPLOAD_ATTEMPTS = 5;          // Then wait for the next game
+constexpr int UPLOAD_DELAY_MIN_SEC = 30;
+constexpr int UPLOAD_DELAY_MAX_SEC = 60 * 60;  // 1 hour
+
+UploadQueue::UploadQueue(HttpClient &http, const QStringList &auth)
+    : m_http(http),
+    m_auth(auth) {
+}
+
+UploadQueue::~UploadQueue() {
+    {
+        QMutexLocker locker(&m_mutex);
+        m_stop = true;
+        // The replies still to come call back into the queue.
+        while (m_inFlight > 0) {
+            m_wakeup.wakeAll();
+            m_wakeup.wait(&m_mutex);
+        }
+        m_wakeup.wakeAll();
+    }
+    wait();
+}
+
+void UploadQueue::add(const QString &name, const QStringList &lines,
+                      const QStringList &args, std::function<void()> prepare) {
+    Upload upload;
+    upload.name = name;
+    upload.lines = lines;
+    upload.args = args;
+    upload.prepare = prepare;
+    QMutexLocker locker(&m_mutex);
+    m_queue.push_back(std::move(upload));
+    m_wakeup.wakeAll();
+}
+
+void UploadQueue::addSaved() {
+    QDir dir;
+    QStringList filters;
+    filters << "curl_save*.bin";
+    dir.setNameFilters(filters);
+    dir.setFilter(QDir::Files | QDir::NoSymLinks);
+    QFileInfoList list = dir.entryInfoList();
+    for (int i = 0; i < list.size(); ++i) {
+        QFileInfo fileInfo = list.at(i);
+        auto lock = std::make_shared<QLockFile>(fileInfo.fileName() + ".lock");
+        if (!lock->tryLock(10)) {
+            continue;
+        }
+        QFile file(fileInfo.fileName());
+        if (!file.open(QFile::ReadOnly)) {
+            continue;
+        }
+        Upload upload;
+        QTextStream in(&file);
+        QString tmp;
+        int count;
+        in >> upload.name;
+        in >> count;
+        count = 2 * count - 1;
+        for (int i = 0; i < count; i++) {
+            in >> tmp;
+            upload.lines << tmp;
+        }
+        file.close();
+        upload.saveName = fileInfo.fileName();
+        upload.lock = lock;
+
+        QMutexLocker locker(&m_mutex);
+        m_queue.push_back(std::move(upload));
+        m_wakeup.wakeAll();
+    }
+}
+
+int UploadQueue::backlog() {
+    QMutexLocker locker(&m_mutex);
+    return int(m_queue.size()) + m_inFlight;
+}
+
+void UploadQueue::run() {
+    QMutexLocker locker(&m_mutex);
+    while (!m_stop) {
+        const auto now = QDateTime::currentMSecsSinceEpoch();
+        auto next = m_queue.end();
+        auto delay = ULONG_MAX;
+        if (m_inFlight < MAX_IN_FLIGHT) {
+            for (auto it = m_queue.begin(); it != m_queue.end(); ++it) {
+                if (it->notBefore <= now) {
+                    next = it;
+                    break;
+                }
+                delay = std::min(delay, (unsigned long)(it->notBefore - now));
+            }
+        }
+        if (next == m_queue.end()) {
+            m_wakeup.wait(&m_mutex, delay);
+            continue;
+        }
+        auto upload = std::move(*next);
+        m_queue.erase(next);
+        m_inFlight++;
+        locker.unlock();
+        send(std::move(upload));
+        locker.relock();
+    }
+}
+
+// The form of an upload, with the curl -F syntax of autogtp versions
+// that ran curl, so that the uploads they left behind are still sent.
+void UploadQueue::save(Upload &upload) {
+    QString fileName = "curl_save" + QUuid::createUuid().toRfc4122().toHex() + ".bin";
+    upload.lock = std::make_shared<QLockFile>(fileName + ".lock");
+    upload.lock->lock();
+    QFile f(fileName);
+    if (!f.open(QIODevice::WriteOnly | QIODevice::Text)) {
+        return;
+    }
+    QTextStream out(&f);
+    out << upload.name << Qt::endl;
+    out << upload.lines.size() << Qt::endl;
+    QStringList::ConstIterator it = upload.lines.constBegin();
+    while (it != upload.lines.constEnd()) {
+        out << *it << " " << Qt::endl;
+        ++it;
+    }
+    f.close();
+    upload.saveName = fileName;
+}
+
+void UploadQueue::cleanupFiles(const QString &fileName) {
+    QDir dir;
+    QStringList filters;
+    filters << fileName + ".*";
+    dir.setNameFilters(filters);
+    dir.setFilter(QDir::Files | QDir::NoSymLinks);
+    QFileInfoList list = dir.entryInfoList();
+    for (int i = 0; i < list.size(); ++i) {
+        QFile(list.at(i).fileName()).remove();
+    }
+}
+
+void UploadQueue::send(Upload upload) {
+    if (upload.prepare) {
+        upload.prepare();
+        upload.prepare = nullptr;
+    }
+    if (upload.saveName.isEmpty()) {
+        save(upload);
+    }
+    QStringList tokens;
+    for (const QString& s: upload.lines)
+        tokens << s.split(' ', Qt::SkipEmptyParts);
+    tokens << upload.args;
+    QString url;
+    QStringList form = m_auth;
+    for (auto i = 0; i < tokens.size(); i++) {
+        if (tokens[i] == "-F" && i + 1 < tokens.size()) {
+            form << tokens[++i];
+        } else {
+            url = tokens[i];
+        }
+    }
+    m_http.postAsync(url, form, [this, upload](const HttpClient::Reply &reply) {
+        done(upload, reply);
+    });
+}
+
+void UploadQueue::done(Upload upload, const HttpClient::Reply &reply) {
+    QTextStream(stdout) << reply.body;
+    if (reply.ok) {
+        QFile::remove(upload.saveName);
+        cleanupFiles(upload.name);
+        QTextStream(stdout) << "File: " << upload.saveName << " sent" << Qt::endl;
+    }
+
+    QMutexLocker locker(&m_mutex);
+    m_inFlight--;
+    if (!reply.ok) {
+        QTextStream(stdout) << "Upload of " << upload.name << " failed: "
+                            << reply.error << Qt::endl;
+        if (++upload.attempts < UPLOAD_ATTEMPTS && !m_stop) {
+            const auto delay =
+                std::min<int>(
+                    UPLOAD_DELAY_MIN_SEC * std::pow(1.5, upload.attempts - 1),
+                    UPLOAD_DELAY_MAX_SEC);
+            QTextStream(stdout) << "Retrying in " << delay << " s." << Qt::endl;
+            upload.notBefore = QDateTime::currentMSecsSinceEpoch() + delay * 1000LL;
+            m_queue.push_back(std::move(upload));
+        } else {
+            // Dropping the lock leaves it to addSaved().
+            QTextStream(stdout)
+                    << "Retrying when next game is finished."
+                    << Qt::endl;
+        }
+    }
+    m_wakeup.wakeAll();
+}
@@ -0,0 +1,87 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+
+#ifndef UPLOADQUEUE_H
+#define UPLOADQUEUE_H
+
+#include <QMutex>
+#include <QString>
+#include <QStringList>
+#include <QThread>
+#include <QWaitCondition>
+#include <deque>
+#include <functional>
+#include <memory>
+#include "HttpClient.h"
+
+class QLockFile;
+
+// Uploads the finished games on a thread of its own, so that the workers
+// never wait for the server. A few uploads are in flight at once over the
+// connections HttpClient keeps open, and a failed one is retried with a
+// growing delay. Each game is saved as a curl_save file before it is
+// sent and removed once the server accepted it, so the games still queued
+// when autogtp stops are sent by the next run.
+class UploadQueue : public QThread {
+public:
+    UploadQueue(HttpClient &http, const QStringList &auth);
+    ~UploadQueue();
+
+    // Queue the upload of a game, given by the curl -F fields of its form
+    // and the url last. prepare runs on the upload thread before the form
+    // is saved, to compress the files it sends.
+    void add(const QString &name, const QStringList &lines,
+             const QStringList &args, std::function<void()> prepare);
+    // Queue the saved uploads that nobody is sending: those of previous
+    // runs, and the ones that ran out of retries.
+    void addSaved();
+    // Games waiting for the server, in the queue or in flight.
+    int backlog();
+
+protected:
+    void run() override;
+
+private:
+    struct Upload {
+        QString name;
+        QStringList lines;
+        QStringList args;
+        std::function<void()> prepare;
+        QString saveName;
+        // Held while the upload is queued, so addSaved() skips it.
+        std::shared_ptr<QLockFile> lock;
+        int attempts{0};
+        qint64 notBefore{0};
+    };
+
+    void save(Upload &upload);
+    static void cleanupFiles(const QString &name);
+    void send(Upload upload);
+    void done(Upload upload, const HttpClient::Reply &reply);
+
+    HttpClient &m_http;
+    QStringList m_auth;
+    QMutex m_mutex;
+    QWaitCondition m_wakeup;
+    std::deque<Upload> m_queue;
+    int m_inFlight{0};
+    bool m_stop{false};
+};
+
+#endif
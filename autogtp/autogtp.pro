@@ -11,6 +11,7 @@ equals(QT_MAJOR_VERSION, $$QT_REQ_MAJOR_VERSION):lessThan(QT_MINOR_VERSION, $$QT
 
 
 TARGET = autogtp
+QT += network
 CONFIG   += c++14
 CONFIG   += warn_on
 CONFIG   += console
@@ -23,7 +24,9 @@ SOURCES += main.cpp \
     Worker.cpp \
     Order.cpp \
     Job.cpp \
-    Management.cpp
+    Management.cpp \
+    HttpClient.cpp \
+    UploadQueue.cpp
 
 HEADERS += \
     Game.h \
@@ -32,4 +35,6 @@ HEADERS += \
     Order.h \
     Result.h \
     Management.h \
+    HttpClient.h \
+    UploadQueue.h \
     Console.h
@@ -0,0 +1,119 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+// Round trip of HttpClient against tests/test_server.py: the task
+// request, a network download and a game upload, as autogtp does them.
+// Usage: httpclient_test http://127.0.0.1:port/
+
+#include <QCoreApplication>
+#include <QCryptographicHash>
+#include <QFile>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QTextStream>
+#include <cstdlib>
+#include <future>
+#include "../HttpClient.h"
+
+namespace {
+
+int failures = 0;
+
+void check(bool ok, const QString &what) {
+    QTextStream(stdout) << (ok ? "ok   " : "FAIL ") << what << Qt::endl;
+    if (!ok) {
+        failures++;
+    }
+}
+
+QJsonObject json(const HttpClient::Reply &reply) {
+    return QJsonDocument::fromJson(reply.body).object();
+}
+
+QString sha256(const QString &fileName) {
+    QFile file(fileName);
+    if (!file.open(QIODevice::ReadOnly)) {
+        return QString();
+    }
+    return QCryptographicHash::hash(file.readAll(),
+                                    QCryptographicHash::Sha256).toHex();
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    QCoreApplication app(argc, argv);
+    if (argc != 2) {
+        QTextStream(stderr) << "Usage: " << argv[0] << " server_url" << Qt::endl;
+        return EXIT_FAILURE;
+    }
+    const QString url = argv[1];
+    HttpClient http;
+
+    // The task, with the form autogtp authenticates with.
+    const auto task = http.post(url + "get-task/21",
+                                {"key=secret", "username=tester"});
+    check(task.ok && task.status == 200, "get-task: " + task.error);
+    const auto fields = json(task).value("form").toObject();
+    check(fields.value("key").toString() == "secret"
+          && fields.value("username").toString() == "tester",
+          "get-task form fields");
+    const auto network = json(task).value("network").toString();
+    check(!network.isEmpty(), "get-task names a network");
+
+    // The network, hashed as it is written.
+    const auto netFile = network + ".gz";
+    QString hash;
+    const auto download = http.download(url + "networks/" + netFile,
+                                        netFile, &hash);
+    check(download.ok && download.status == 200,
+          "network download: " + download.error);
+    check(hash == network, "network hash " + hash);
+    check(sha256(netFile) == network, "network file on disk");
+
+    // A missing file fails and leaves nothing behind.
+    const auto missing = http.download(url + "networks/missing.gz",
+                                       "missing.gz");
+    check(!missing.ok && missing.status == 404, "missing network fails");
+    check(!QFile::exists("missing.gz"), "missing network not kept");
+
+    // A game upload, in the background as UploadQueue sends it.
+    std::promise<HttpClient::Reply> uploaded;
+    http.postAsync(url + "submit",
+                   {"networkhash=" + network, "sgf=@" + netFile},
+                   [&uploaded](const HttpClient::Reply &reply) {
+                       uploaded.set_value(reply);
+                   });
+    const auto upload = uploaded.get_future().get();
+    check(upload.ok && upload.status == 200, "upload: " + upload.error);
+    const auto received = json(upload).value("form").toObject();
+    check(received.value("networkhash").toString() == network,
+          "upload form field");
+    const auto sgf = received.value("sgf").toObject();
+    check(sgf.value("filename").toString() == netFile
+          && sgf.value("sha256").toString() == network,
+          "upload file " + sgf.value("filename").toString());
+
+    // A file that can't be read is reported without a request.
+    const auto unreadable = http.post(url + "submit", {"sgf=@missing.gz"});
+    check(!unreadable.ok && unreadable.status == 0, "unreadable upload fails");
+
+    QFile::remove(netFile);
+    QTextStream(stdout) << failures << " failure(s)" << Qt::endl;
+    return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,15 @@
+TARGET = httpclient_test
+QT += network
+QT -= gui
+CONFIG   += c++14
+CONFIG   += warn_on
+CONFIG   += console
+CONFIG   -= app_bundle
+
+TEMPLATE = app
+
+SOURCES += httpclient_test.cpp \
+    ../HttpClient.cpp
+
+HEADERS += \
+    ../HttpClient.h
@@ -0,0 +1,9 @@
+#!/bin/sh
+# Build with qmake first, then run from this directory.
+set -e
+PORT=${PORT:-8765}
+./test_server.py $PORT &
+SERVER=$!
+trap 'kill $SERVER' EXIT
+sleep 1
+./httpclient_test http://127.0.0.1:$PORT/
@@ -0,0 +1,70 @@
+#!/usr/bin/env python3
+#
+# A stand-in for the SAI server, for httpclient_test. It answers
+# get-task with the form it was sent and the hash of a network, serves
+# that network, and answers submit with the fields and files it got.
+#
+# Usage: test_server.py port
+
+import email.parser
+import email.policy
+import hashlib
+import http.server
+import json
+import os
+import sys
+
+NETWORK = os.urandom(100000)
+NETWORK_HASH = hashlib.sha256(NETWORK).hexdigest()
+
+
+def parse_form(headers, body):
+    message = email.parser.BytesParser(policy=email.policy.HTTP).parsebytes(
+        b"Content-Type: " + headers["Content-Type"].encode() + b"\r\n\r\n"
+        + body)
+    form = {}
+    for part in message.iter_parts():
+        name = part.get_param("name", header="content-disposition")
+        data = part.get_payload(decode=True)
+        if part.get_filename() is not None:
+            form[name] = {"filename": part.get_filename(),
+                          "sha256": hashlib.sha256(data).hexdigest()}
+        else:
+            form[name] = data.decode()
+    return form
+
+
+class Handler(http.server.BaseHTTPRequestHandler):
+    protocol_version = "HTTP/1.1"
+
+    def reply(self, code, body, content_type="application/json"):
+        self.send_response(code)
+        self.send_header("Content-Type", content_type)
+        self.send_header("Content-Length", str(len(body)))
+        self.end_headers()
+        self.wfile.write(body)
+
+    def do_GET(self):
+        if self.path == "/networks/" + NETWORK_HASH + ".gz":
+            self.reply(200, NETWORK, "application/octet-stream")
+        else:
+            self.reply(404, b"Not found", "text/plain")
+
+    def do_POST(self):
+        body = self.rfile.read(int(self.headers["Content-Length"]))
+        form = parse_form(self.headers, body)
+        if self.path.startswith("/get-task/"):
+            answer = {"cmd": "selfplay", "network": NETWORK_HASH,
+                      "form": form}
+        elif self.path == "/submit":
+            answer = {"form": form}
+        else:
+            self.reply(404, b"Not found", "text/plain")
+            return
+        self.reply(200, json.dumps(answer).encode())
+
+
+if __name__ == "__main__":
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", int(sys.argv[1])),
+                                             Handler)
+    server.serve_forever()
@@ -30,6 +30,11 @@
 
 #include "config.h"
 
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+
 #ifdef __APPLE__
 #include <Accelerate/Accelerate.h>
 #endif
@@ -58,14 +63,325 @@ using ConstEigenMatrixMap =
     Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
 #endif
 
+#if defined(__GNUC__) && defined(__x86_64__) && !defined(_WIN32)
+#include <immintrin.h>
+#define HAVE_VNNI_KERNEL
+#endif
+
 void CPUPipe::initialize(int channels)
 {
     m_input_channels = channels;
 }
 
+#if WINOGRAD_TILE_M == 4
+// multiple vector [i0..i5] by Bt and produce [o0..o5]
+// const auto Bt = std::array<float, WINOGRAD_TILE>
+//           {1.0f,  0.0f,     -5.0f/2.0f,  0.0f,      1.0f, 0.0f,
+//            0.0f, -SQ2,      -2.0f,       SQ2/2.0f,  1.0f, 0.0f,
+//            0.0f,  SQ2,      -2.0f,      -SQ2/2.0f,  1.0f, 0.0f,
+//            0.0f, -SQ2/2.0f, -1.0f/2.0f,  SQ2,       1.0f, 0.0f,
+//            0.0f,  SQ2/2.0f, -1.0f/2.0f, -SQ2,       1.0f, 0.0f,
+//            0.0f,  1.0f,      0.0f,      -5.0f/2.0f, 0.0f, 1.0f};
+static inline void multiply_bt(
+    float & o0, float & o1, float & o2, float & o3, float & o4, float & o5,
+    float i0, float i1, float i2, float i3, float i4, float i5
+) {
+    auto i3m1 = i1 * -SQ2 + i3 * (SQ2 / 2.0f);
+    auto i4m2 = i2 * -2.0f + i4 * 1.0f;
+
+    o0 = i0 + i2 * (-5.0f/2.0f) + i4;
+    o1 = i3m1 + i4m2;
+    o2 = -i3m1 + i4m2;
+
+    auto i3m1_2 = i3 * (SQ2) + i1 * (-SQ2/2.0f);
+    auto i4m2_2 = i2 * (-1.0f/2.0f) + i4;
+
+    o3 = i3m1_2 + i4m2_2;
+    o4 = -i3m1_2 + i4m2_2;
+
+    o5 = i1 + i3 * (-5.0f/2.0f) + i5;
+}
+
+// multiple vector [i0..i5] by At and produce [o0..o3]
+// const auto At = std::array<float, WINOGRAD_ALPHA * WINOGRAD_M>
+//       {1.0f, 1.0f,      1.0f,       1.0f,      1.0f,     0.0f,
+//        0.0f, SQ2/2.0f, -SQ2/2.0f,   SQ2,      -SQ2,      0.0f,
+//        0.0f, 1.0f/2.0f, 1.0f/2.0f,  2.0f,      2.0f,     0.0f,
+//        0.0f, SQ2/4.0f, -SQ2/4.0f,   2.0f*SQ2, -2.0f*SQ2, 1.0f};
+static inline void multiply_at(
+    float & o0, float & o1, float & o2, float & o3,
+    float i0, float i1, float i2, float i3, float i4, float i5
+) {
+    auto t1p2 = (i1 + i2) * (1.0f / 2.0f);
+    auto t1m2 = (i1 - i2) * (SQ2/4.0f);
+    auto t3p4 = i3 + i4;
+    auto t3m4 = (i3 - i4) * (SQ2);
+
+    o0 = i0 + t1p2 + t1p2 + t3p4;
+    o1 = t1m2 + t1m2 + t3m4;
+    o2 = t1p2 + t3p4 + t3p4;
+    o3 = t1m2 + t3m4 + t3m4 + i5;
+}
+#else
+// The other tile sizes take their vectors as arrays, the loops over them
+// are unrolled so the tiles still vectorize.
+#if WINOGRAD_TILE_M == 2
+// multiple vector [i0..i3] by Bt and produce [o0..o3]
+// const auto Bt = std::array<float, WINOGRAD_TILE>
+//           {1.0f,  0.0f, -1.0f,  0.0f,
+//            0.0f,  1.0f,  1.0f,  0.0f,
+//            0.0f, -1.0f,  1.0f,  0.0f,
+//            0.0f,  1.0f,  0.0f, -1.0f};
+static inline void multiply_bt(float* o, const float* i) {
+    o[0] = i[0] - i[2];
+    o[1] = i[1] + i[2];
+    o[2] = i[2] - i[1];
+    o[3] = i[1] - i[3];
+}
+
+// multiple vector [i0..i3] by At and produce [o0..o1]
+// const auto At = std::array<float, WINOGRAD_ALPHA * WINOGRAD_M>
+//           {1.0f,  1.0f,  1.0f,  0.0f,
+//            0.0f,  1.0f, -1.0f, -1.0f};
+static inline void multiply_at(float* o, const float* i) {
+    o[0] = i[0] + i[1] + i[2];
+    o[1] = i[1] - i[2] - i[3];
+}
+#else
+// multiple vector [i0..i7] by Bt and produce [o0..o7]
+// const auto Bt = std::array<float, WINOGRAD_TILE>
+//   {1.0f,  0.0f,      -21.0f/4.0f,  0.0f,       21.0f/4.0f,  0.0f,      -1.0f, 0.0f,
+//    0.0f,  1.0f,        1.0f,      -17.0f/4.0f, -17.0f/4.0f,  1.0f,       1.0f, 0.0f,
+//    0.0f, -1.0f,        1.0f,       17.0f/4.0f, -17.0f/4.0f, -1.0f,       1.0f, 0.0f,
+//    0.0f,  1.0f/2.0f,   1.0f/4.0f,  -5.0f/2.0f,  -5.0f/4.0f,  2.0f,       1.0f, 0.0f,
+//    0.0f, -1.0f/2.0f,   1.0f/4.0f,   5.0f/2.0f,  -5.0f/4.0f, -2.0f,       1.0f, 0.0f,
+//    0.0f,  2.0f,        4.0f,       -5.0f/2.0f,  -5.0f,       1.0f/2.0f,  1.0f, 0.0f,
+//    0.0f, -2.0f,        4.0f,        5.0f/2.0f,  -5.0f,      -1.0f/2.0f,  1.0f, 0.0f,
+//    0.0f, -1.0f,        0.0f,       21.0f/4.0f,   0.0f,     -21.0f/4.0f,  0.0f, 1.0f};
+static inline void multiply_bt(float* o, const float* i) {
+    o[0] = i[0] - i[6] + (i[4] - i[2]) * (21.0f/4.0f);
+    o[7] = i[7] - i[1] + (i[3] - i[5]) * (21.0f/4.0f);
+
+    auto i26 = i[2] + i[6] - i[4] * (17.0f/4.0f);
+    auto i15 = i[1] + i[5] - i[3] * (17.0f/4.0f);
+    o[1] = i26 + i15;
+    o[2] = i26 - i15;
+
+    auto i26_2 = i[2] * (1.0f/4.0f) - i[4] * (5.0f/4.0f) + i[6];
+    auto i15_2 = i[1] * (1.0f/2.0f) - i[3] * (5.0f/2.0f) + i[5] * 2.0f;
+    o[3] = i26_2 + i15_2;
+    o[4] = i26_2 - i15_2;
+
+    auto i26_3 = i[2] * 4.0f - i[4] * 5.0f + i[6];
+    auto i15_3 = i[1] * 2.0f - i[3] * (5.0f/2.0f) + i[5] * (1.0f/2.0f);
+    o[5] = i26_3 + i15_3;
+    o[6] = i26_3 - i15_3;
+}
+
+// multiple vector [i0..i7] by At and produce [o0..o5]
+// const auto At = std::array<float, WINOGRAD_ALPHA * WINOGRAD_M>
+//   {1.0f, 1.0f,  1.0f,  1.0f,   1.0f,  1.0f,        1.0f,        0.0f,
+//    0.0f, 1.0f, -1.0f,  2.0f,  -2.0f,  1.0f/2.0f,  -1.0f/2.0f,   0.0f,
+//    0.0f, 1.0f,  1.0f,  4.0f,   4.0f,  1.0f/4.0f,   1.0f/4.0f,   0.0f,
+//    0.0f, 1.0f, -1.0f,  8.0f,  -8.0f,  1.0f/8.0f,  -1.0f/8.0f,   0.0f,
+//    0.0f, 1.0f,  1.0f, 16.0f,  16.0f,  1.0f/16.0f,  1.0f/16.0f,  0.0f,
+//    0.0f, 1.0f, -1.0f, 32.0f, -32.0f,  1.0f/32.0f, -1.0f/32.0f,  1.0f};
+static inline void multiply_at(float* o, const float* i) {
+    auto t1p2 = i[1] + i[2];
+    auto t1m2 = i[1] - i[2];
+    auto t3p4 = i[3] + i[4];
+    auto t3m4 = i[3] - i[4];
+    auto t5p6 = i[5] + i[6];
+    auto t5m6 = i[5] - i[6];
+
+    o[0] = i[0] + t1p2 + t3p4 + t5p6;
+    o[1] = t1m2 + t3m4 * 2.0f + t5m6 * (1.0f/2.0f);
+    o[2] = t1p2 + t3p4 * 4.0f + t5p6 * (1.0f/4.0f);
+    o[3] = t1m2 + t3m4 * 8.0f + t5m6 * (1.0f/8.0f);
+    o[4] = t1p2 + t3p4 * 16.0f + t5p6 * (1.0f/16.0f);
+    o[5] = t1m2 + t3m4 * 32.0f + t5m6 * (1.0f/32.0f) + i[7];
+}
+#endif
+#endif
+
+// The transforms below keep the tile index as the innermost dimension,
+// so every step is a loop over WINOGRAD_P independent tiles which the
+// compiler turns into full-width vector code.
+using TileVector = std::array<float, WINOGRAD_P>;
+
+// Transforms all the tiles of one zero padded input plane and stores them
+// in V[xi * CP + tile], with xi the position within the Winograd tile.
+CPU_KERNEL
+static void transform_in_plane(const float* in_pad, float* V, const size_t CP) {
+    constexpr auto WTILES = WINOGRAD_WTILES;
+    constexpr auto P = WINOGRAD_P;
+    constexpr auto Wpad = 2 + WINOGRAD_M * WTILES;
+
+    std::array<TileVector, WINOGRAD_TILE> x;
+    for (auto block_y = 0; block_y < WTILES; block_y++) {
+        // Tiles overlap by 2
+        const auto yin = WINOGRAD_M * block_y;
+        for (auto block_x = 0; block_x < WTILES; block_x++) {
+            const auto xin = WINOGRAD_M * block_x;
+            const auto b = block_y * WTILES + block_x;
+            for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
+                for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+                    x[i * WINOGRAD_ALPHA + j][b] =
+                        in_pad[(yin + i) * Wpad + xin + j];
+                }
+            }
+        }
+    }
+
+#if WINOGRAD_TILE_M == 4
+    // Calculates transpose(B).x.B
+    std::array<TileVector, WINOGRAD_TILE> T1;
+    for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+        for (auto b = 0; b < P; b++) {
+            multiply_bt(
+                T1[0 * WINOGRAD_ALPHA + j][b], T1[1 * WINOGRAD_ALPHA + j][b],
+                T1[2 * WINOGRAD_ALPHA + j][b], T1[3 * WINOGRAD_ALPHA + j][b],
+                T1[4 * WINOGRAD_ALPHA + j][b], T1[5 * WINOGRAD_ALPHA + j][b],
+                x[0 * WINOGRAD_ALPHA + j][b], x[1 * WINOGRAD_ALPHA + j][b],
+                x[2 * WINOGRAD_ALPHA + j][b], x[3 * WINOGRAD_ALPHA + j][b],
+                x[4 * WINOGRAD_ALPHA + j][b], x[5 * WINOGRAD_ALPHA + j][b]);
+        }
+    }
+    for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
+        const auto row = i * WINOGRAD_ALPHA;
+        float* out0 = V + (row + 0) * CP;
+        float* out1 = V + (row + 1) * CP;
+        float* out2 = V + (row + 2) * CP;
+        float* out3 = V + (row + 3) * CP;
+        float* out4 = V + (row + 4) * CP;
+        float* out5 = V + (row + 5) * CP;
+        for (auto b = 0; b < P; b++) {
+            multiply_bt(
+                out0[b], out1[b], out2[b], out3[b], out4[b], out5[b],
+                T1[row + 0][b], T1[row + 1][b], T1[row + 2][b],
+                T1[row + 3][b], T1[row + 4][b], T1[row + 5][b]);
+        }
+    }
+#else
+    // Calculates transpose(B).x.B
+    std::array<TileVector, WINOGRAD_TILE> T1;
+    for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+        for (auto b = 0; b < P; b++) {
+            float in[WINOGRAD_ALPHA], out[WINOGRAD_ALPHA];
+            for (auto k = 0; k < WINOGRAD_ALPHA; k++) {
+                in[k] = x[k * WINOGRAD_ALPHA + j][b];
+            }
+            multiply_bt(out, in);
+            for (auto k = 0; k < WINOGRAD_ALPHA; k++) {
+                T1[k * WINOGRAD_ALPHA + j][b] = out[k];
+            }
+        }
+    }
+    for (auto i = 0; i < WINOGRAD_ALPHA; i++) {
+        const auto row = i * WINOGRAD_ALPHA;
+        for (auto b = 0; b < P; b++) {
+            float in[WINOGRAD_ALPHA], out[WINOGRAD_ALPHA];
+            for (auto k = 0; k < WINOGRAD_ALPHA; k++) {
+                in[k] = T1[row + k][b];
+            }
+            multiply_bt(out, in);
+            for (auto k = 0; k < WINOGRAD_ALPHA; k++) {
+                V[(row + k) * CP + b] = out[k];
+            }
+        }
+    }
+#endif
+}
+
+// Inverse of the above for one output plane: M holds M[xi * KP + tile].
+CPU_KERNEL
+static void transform_out_plane(const float* M, float* Y, const size_t KP) {
+    constexpr auto W = BOARD_SIZE;
+    constexpr auto H = BOARD_SIZE;
+    constexpr auto WTILES = WINOGRAD_WTILES;
+    constexpr auto P = WINOGRAD_P;
+
+#if WINOGRAD_TILE_M == 4
+    // Calculates transpose(A).temp_m.A
+    std::array<TileVector, WINOGRAD_M * WINOGRAD_ALPHA> temp;
+    for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+        const float* in0 = M + (0 * WINOGRAD_ALPHA + j) * KP;
+        const float* in1 = M + (1 * WINOGRAD_ALPHA + j) * KP;
+        const float* in2 = M + (2 * WINOGRAD_ALPHA + j) * KP;
+        const float* in3 = M + (3 * WINOGRAD_ALPHA + j) * KP;
+        const float* in4 = M + (4 * WINOGRAD_ALPHA + j) * KP;
+        const float* in5 = M + (5 * WINOGRAD_ALPHA + j) * KP;
+        for (auto b = 0; b < P; b++) {
+            multiply_at(
+                temp[0 * WINOGRAD_ALPHA + j][b], temp[1 * WINOGRAD_ALPHA + j][b],
+                temp[2 * WINOGRAD_ALPHA + j][b], temp[3 * WINOGRAD_ALPHA + j][b],
+                in0[b], in1[b], in2[b], in3[b], in4[b], in5[b]);
+        }
+    }
+
+    std::array<TileVector, WINOGRAD_M * WINOGRAD_M> o;
+    for (auto i = 0; i < WINOGRAD_M; i++) {
+        const auto row = i * WINOGRAD_ALPHA;
+        for (auto b = 0; b < P; b++) {
+            multiply_at(
+                o[i * WINOGRAD_M + 0][b], o[i * WINOGRAD_M + 1][b],
+                o[i * WINOGRAD_M + 2][b], o[i * WINOGRAD_M + 3][b],
+                temp[row + 0][b], temp[row + 1][b], temp[row + 2][b],
+                temp[row + 3][b], temp[row + 4][b], temp[row + 5][b]);
+        }
+    }
+#else
+    // Calculates transpose(A).temp_m.A
+    std::array<TileVector, WINOGRAD_M * WINOGRAD_ALPHA> temp;
+    for (auto j = 0; j < WINOGRAD_ALPHA; j++) {
+        for (auto b = 0; b < P; b++) {
+            float in[WINOGRAD_ALPHA], out[WINOGRAD_M];
+            for (auto k = 0; k < WINOGRAD_ALPHA; k++) {
+                in[k] = M[(k * WINOGRAD_ALPHA + j) * KP + b];
+            }
+            multiply_at(out, in);
+            for (auto k = 0; k < WINOGRAD_M; k++) {
+                temp[k * WINOGRAD_ALPHA + j][b] = out[k];
+            }
+        }
+    }
+
+    std::array<TileVector, WINOGRAD_M * WINOGRAD_M> o;
+    for (auto i = 0; i < WINOGRAD_M; i++) {
+        const auto row = i * WINOGRAD_ALPHA;
+        for (auto b = 0; b < P; b++) {
+            float in[WINOGRAD_ALPHA], out[WINOGRAD_M];
+            for (auto k = 0; k < WINOGRAD_ALPHA; k++) {
+                in[k] = temp[row + k][b];
+            }
+            multiply_at(out, in);
+            for (auto k = 0; k < WINOGRAD_M; k++) {
+                o[i * WINOGRAD_M + k][b] = out[k];
+            }
+        }
+    }
+#endif
+
+    for (auto block_y = 0; block_y < WTILES; block_y++) {
+        const auto y = WINOGRAD_M * block_y;
+        for (auto block_x = 0; block_x < WTILES; block_x++) {
+            const auto x = WINOGRAD_M * block_x;
+            const auto b = block_y * WTILES + block_x;
+            for (auto i = 0; i < WINOGRAD_M; i++) {
+                for (auto j = 0; j < WINOGRAD_M; j++) {
+                    if (y + i < H && x + j < W) {
+                        Y[(y + i) * W + x + j] = o[i * WINOGRAD_M + j][b];
+                    }
+                }
+            }
+        }
+    }
+}
+
 void CPUPipe::winograd_transform_in(const std::vector<float> &in,
                                     std::vector<float> &V,
-                                    const int C)
+                                    const int C,
+                                    const int batch_size)
 {
     constexpr auto W = BOARD_SIZE;
     constexpr auto H = BOARD_SIZE;
@@ -74,119 +390,21 @@ void CPUPipe::winograd_transform_in(const std::vector<float> &in,
 
     constexpr auto Wpad = 2 + WINOGRAD_M * WTILES;
 
-    constexpr auto buffersize = 32;
-
     std::array<std::array<float, Wpad>, Wpad> in_pad{0.0f};
 
-    std::array<float, buffersize * WINOGRAD_ALPHA * WINOGRAD_ALPHA> buffer;
-    auto buffer_offset = 0;
-    auto buffer_entries = 0;
-
-
-    // multiple vector [i0..i5] by Bt and produce [o0..o5]
-    // const auto Bt = std::array<float, WINOGRAD_TILE>
-    //           {1.0f,  0.0f,     -5.0f/2.0f,  0.0f,      1.0f, 0.0f,
-    //            0.0f, -SQ2,      -2.0f,       SQ2/2.0f,  1.0f, 0.0f,
-    //            0.0f,  SQ2,      -2.0f,      -SQ2/2.0f,  1.0f, 0.0f,
-    //            0.0f, -SQ2/2.0f, -1.0f/2.0f,  SQ2,       1.0f, 0.0f,
-    //            0.0f,  SQ2/2.0f, -1.0f/2.0f, -SQ2,       1.0f, 0.0f,
-    //            0.0f,  1.0f,      0.0f,      -5.0f/2.0f, 0.0f, 1.0f};
-    auto multiply_bt = [](
-        float & o0, float & o1, float & o2, float & o3, float & o4, float & o5,
-        float i0, float i1, float i2, float i3, float i4, float i5
-    ) {
-        auto i3m1 = i1 * -SQ2 + i3 * (SQ2 / 2.0f);
-        auto i4m2 = i2 * -2.0f + i4 * 1.0f;
-
-        o0 = i0 + i2 * (-5.0f/2.0f) + i4;
-        o1 = i3m1 + i4m2;
-        o2 = -i3m1 + i4m2;
-
-        auto i3m1_2 = i3 * (SQ2) + i1 * (-SQ2/2.0f);
-        auto i4m2_2 = i2 * (-1.0f/2.0f) + i4;
-
-        o3 = i3m1_2 + i4m2_2;
-        o4 = -i3m1_2 + i4m2_2;
-
-        o5 = i1 + i3 * (-5.0f/2.0f) + i5;
-    };
-
-    for (auto ch = 0; ch < C; ch++) {
-        for (auto yin = 0; yin < H; yin++) {
-            for (auto xin = 0; xin < W; xin++) {
-                in_pad[yin + 1][xin + 1] = in[ch*(W*H) + yin*W + xin];
-            }
-        }
-        for (auto block_y = 0; block_y < WTILES; block_y++)
-        {
-            // Tiles overlap by 2
-            const auto yin = WINOGRAD_M * block_y;
-            for (auto block_x = 0; block_x < WTILES; block_x++)
-            {
-                const auto xin = WINOGRAD_M * block_x;
-#define DECL_T1(XX) \
-                float T1_##XX##_0, T1_##XX##_1, T1_##XX##_2, T1_##XX##_3, T1_##XX##_4, T1_##XX##_5;
-                DECL_T1(0)
-                DECL_T1(1)
-                DECL_T1(2)
-                DECL_T1(3)
-                DECL_T1(4)
-                DECL_T1(5)
-
-                // Calculates transpose(B).x.B
-#define MULTIPLY_BT(XX) \
-                multiply_bt( \
-                    T1_0_##XX, T1_1_##XX, T1_2_##XX, T1_3_##XX, T1_4_##XX, T1_5_##XX, \
-                    in_pad[yin + 0][xin + XX], \
-                    in_pad[yin + 1][xin + XX], \
-                    in_pad[yin + 2][xin + XX], \
-                    in_pad[yin + 3][xin + XX], \
-                    in_pad[yin + 4][xin + XX], \
-                    in_pad[yin + 5][xin + XX] \
-                );
-                MULTIPLY_BT(0)
-                MULTIPLY_BT(1)
-                MULTIPLY_BT(2)
-                MULTIPLY_BT(3)
-                MULTIPLY_BT(4)
-                MULTIPLY_BT(5)
-
-#define MULTIPLY_B(XX) \
-                multiply_bt( \
-                    buffer[buffersize * (XX * WINOGRAD_ALPHA + 0) + buffer_entries], \
-                    buffer[buffersize * (XX * WINOGRAD_ALPHA + 1) + buffer_entries], \
-                    buffer[buffersize * (XX * WINOGRAD_ALPHA + 2) + buffer_entries], \
-                    buffer[buffersize * (XX * WINOGRAD_ALPHA + 3) + buffer_entries], \
-                    buffer[buffersize * (XX * WINOGRAD_ALPHA + 4) + buffer_entries], \
-                    buffer[buffersize * (XX * WINOGRAD_ALPHA + 5) + buffer_entries], \
-                    T1_##XX##_0, T1_##XX##_1, T1_##XX##_2, T1_##XX##_3, T1_##XX##_4, T1_##XX##_5 \
-                );
-                MULTIPLY_B(0)
-                MULTIPLY_B(1)
-                MULTIPLY_B(2)
-                MULTIPLY_B(3)
-                MULTIPLY_B(4)
-                MULTIPLY_B(5)
-
-                if (buffer_entries == 0) {
-                    buffer_offset = ch * P + block_y * WTILES + block_x;
-                }
-                buffer_entries++;
-
-                if (buffer_entries >= buffersize ||
-                    (ch == C - 1 && block_x == WTILES - 1 && block_y == WTILES - 1))
-                {
-
-                    for (auto i = 0; i < WINOGRAD_ALPHA * WINOGRAD_ALPHA; i++)
-                    {
-                        for (auto entry = 0; entry < buffer_entries; entry++)
-                        {
-                            V[i * C * P + buffer_offset + entry] = buffer[i * buffersize + entry];
-                        }
-                    }
-                    buffer_entries = 0;
+    // Positions are stacked along the tile dimension of V,
+    // which is [36, C, batch_size * P].
+    const auto batch_P = batch_size * P;
+    for (auto batch = 0; batch < batch_size; batch++) {
+        for (auto ch = 0; ch < C; ch++) {
+            const auto plane = &in[(batch * C + ch) * W * H];
+            for (auto yin = 0; yin < H; yin++) {
+                for (auto xin = 0; xin < W; xin++) {
+                    in_pad[yin + 1][xin + 1] = plane[yin*W + xin];
                 }
             }
+            transform_in_plane(in_pad[0].data(),
+                               &V[ch * batch_P + batch * P], C * batch_P);
         }
     }
 }
@@ -194,9 +412,10 @@ void CPUPipe::winograd_transform_in(const std::vector<float> &in,
 void CPUPipe::winograd_sgemm(const std::vector<float> &U,
                              const std::vector<float> &V,
                              std::vector<float> &M,
-                             const int C, const int K)
+                             const int C, const int K,
+                             const int batch_size)
 {
-    constexpr auto P = WINOGRAD_P;
+    const auto P = batch_size * WINOGRAD_P;
 
     for (auto b = 0; b < WINOGRAD_TILE; b++)
     {
@@ -219,85 +438,217 @@ void CPUPipe::winograd_sgemm(const std::vector<float> &U,
     }
 }
 
-void CPUPipe::winograd_transform_out(const std::vector<float> &M,
-                                     std::vector<float> &Y,
-                                     const int K)
-{
-    constexpr auto W = BOARD_SIZE;
-    constexpr auto H = BOARD_SIZE;
-    constexpr auto WTILES = WINOGRAD_WTILES;
-    constexpr auto P = WINOGRAD_P;
+// Symmetric quantization of n values found every stride floats apart,
+// returns the scale to multiply the quantized values with.
+CPU_KERNEL
+static float quantize_int8(const float* in, const size_t n, const size_t stride,
+                           std::int8_t* out) {
+    auto maxabs = 0.0f;
+    for (auto i = size_t{0}; i < n; i++) {
+        maxabs = std::max(maxabs, std::abs(in[i * stride]));
+    }
+    if (maxabs == 0.0f) {
+        std::fill(out, out + n, std::int8_t{0});
+        return 0.0f;
+    }
+    const auto inv_scale = 127.0f / maxabs;
+    for (auto i = size_t{0}; i < n; i++) {
+        out[i] = static_cast<std::int8_t>(std::lrint(in[i * stride] * inv_scale));
+    }
+    return maxabs / 127.0f;
+}
 
-    // multiple vector [i0..i5] by At and produce [o0..o3]
-    // const auto At = std::array<float, WINOGRAD_ALPHA * WINOGRAD_M>
-    //       {1.0f, 1.0f,      1.0f,       1.0f,      1.0f,     0.0f,
-    //        0.0f, SQ2/2.0f, -SQ2/2.0f,   SQ2,      -SQ2,      0.0f,
-    //        0.0f, 1.0f/2.0f, 1.0f/2.0f,  2.0f,      2.0f,     0.0f,
-    //        0.0f, SQ2/4.0f, -SQ2/4.0f,   2.0f*SQ2, -2.0f*SQ2, 1.0f};
-    auto multiply_at = [](
-        float & o0, float & o1, float & o2, float & o3,
-        float i0, float i1, float i2, float i3, float i4, float i5
-    ) {
-        auto t1p2 = (i1 + i2) * (1.0f / 2.0f);
-        auto t1m2 = (i1 - i2) * (SQ2/4.0f);
-        auto t3p4 = i3 + i4;
-        auto t3m4 = (i3 - i4) * (SQ2);
-
-        o0 = i0 + t1p2 + t1p2 + t3p4;
-        o1 = t1m2 + t1m2 + t3m4;
-        o2 = t1p2 + t3p4 + t3p4;
-        o3 = t1m2 + t3m4 + t3m4 + i5;
-    };
+// Quantizes the [C][P] activation matrix V with one scale per column.
+CPU_KERNEL
+static void quantize_columns(const float* V, const int C, const int P,
+                             std::int8_t* Vq, float* sv) {
+    for (auto p = 0; p < P; p++) {
+        sv[p] = 0.0f;
+    }
+    for (auto c = 0; c < C; c++) {
+        for (auto p = 0; p < P; p++) {
+            sv[p] = std::max(sv[p], std::abs(V[c * P + p]));
+        }
+    }
+    auto inv_scale = std::vector<float>(P);
+    for (auto p = 0; p < P; p++) {
+        inv_scale[p] = sv[p] > 0.0f ? 127.0f / sv[p] : 0.0f;
+        sv[p] /= 127.0f;
+    }
+    for (auto c = 0; c < C; c++) {
+        for (auto p = 0; p < P; p++) {
+            Vq[c * P + p] = static_cast<std::int8_t>(
+                std::lrint(V[c * P + p] * inv_scale[p]));
+        }
+    }
+}
 
-    for (auto k = 0; k < K; k++) {
-        for (auto block_x = 0; block_x < WTILES; block_x++) {
-            const auto x = WINOGRAD_M * block_x;
-            for (auto block_y = 0; block_y < WTILES; block_y++)
-            {
-                const auto y = WINOGRAD_M * block_y;
-
-                const auto b = block_y * WTILES + block_x;
-                using WinogradTile =
-                    std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_ALPHA>;
-                WinogradTile temp_m;
-                for (auto xi = 0; xi < WINOGRAD_ALPHA; xi++)
-                {
-                    for (auto nu = 0; nu < WINOGRAD_ALPHA; nu++)
-                    {
-                        temp_m[xi][nu] =
-                            M[(xi * WINOGRAD_ALPHA + nu) * K * P + k * P + b];
-                    }
-                }
-                std::array<std::array<float, WINOGRAD_ALPHA>, WINOGRAD_M> temp;
-                std::array<std::array<float, WINOGRAD_M>, WINOGRAD_M> o;
-
-                // Calculates transpose(A).temp_m.A
-                for (auto j = 0; j < WINOGRAD_ALPHA; j++){
-                    multiply_at(
-                        temp[0][j], temp[1][j], temp[2][j], temp[3][j],
-                        temp_m[0][j], temp_m[1][j], temp_m[2][j], temp_m[3][j], temp_m[4][j], temp_m[5][j]
-                    );
+#ifdef HAVE_VNNI_KERNEL
+// Same product with AVX512-VNNI, 64 multiply-adds per instruction.
+// vpdpbusd multiplies unsigned by signed bytes, so the activations are
+// stored with a +128 offset and grouped by 4 channels, Vq[C/4][Ppad][4],
+// and ucomp[k] = 128 * sum_c Uq[k][c] removes the offset again.
+__attribute__((target("avx512f,avx512bw,avx512vnni")))
+static void int8_gemm_vnni(const std::int8_t* Uq, const std::int32_t* ucomp,
+                           const float* su,
+                           const std::uint8_t* Vq, const float* sv,
+                           float* M, const int C, const int K,
+                           const int P, const int Ppad) {
+    // Four output channels at a time share each load of Vq.
+    constexpr auto KB = 4;
+    for (auto p = 0; p < Ppad; p += 16) {
+        const auto lanes = std::min(16, P - p);
+        const auto mask = static_cast<__mmask16>((1u << lanes) - 1);
+        const auto scale_v = _mm512_loadu_ps(sv + p);
+        for (auto k0 = 0; k0 < K; k0 += KB) {
+            const auto kb = std::min(KB, K - k0);
+            __m512i acc[KB];
+            for (auto i = 0; i < KB; i++) {
+                acc[i] = _mm512_setzero_si512();
+            }
+            for (auto c = 0; c < C; c += 4) {
+                const auto v = _mm512_loadu_si512(Vq + (c * Ppad + p * 4));
+                for (auto i = 0; i < kb; i++) {
+                    auto u4 = std::int32_t{0};
+                    std::memcpy(&u4, Uq + (k0 + i) * C + c, sizeof(u4));
+                    acc[i] = _mm512_dpbusd_epi32(acc[i], v, _mm512_set1_epi32(u4));
                 }
+            }
+            for (auto i = 0; i < kb; i++) {
+                const auto k = k0 + i;
+                const auto dot = _mm512_sub_epi32(acc[i], _mm512_set1_epi32(ucomp[k]));
+                const auto out = _mm512_mul_ps(_mm512_cvtepi32_ps(dot),
+                    _mm512_mul_ps(_mm512_set1_ps(su[k]), scale_v));
+                _mm512_mask_storeu_ps(M + k * P + p, mask, out);
+            }
+        }
+    }
+}
 
-                for (auto i = 0; i < WINOGRAD_M; i++){
-                    multiply_at(
-                        o[i][0], o[i][1], o[i][2], o[i][3],
-                        temp[i][0], temp[i][1], temp[i][2], temp[i][3], temp[i][4], temp[i][5]
-                    );
-                }
+// Quantizes V like quantize_columns() into the layout int8_gemm_vnni()
+// expects.
+CPU_KERNEL
+static void quantize_columns_vnni(const float* V, const int C, const int P,
+                                  const int Ppad, std::uint8_t* Vq, float* sv) {
+    std::fill(sv, sv + Ppad, 0.0f);
+    for (auto c = 0; c < C; c++) {
+        for (auto p = 0; p < P; p++) {
+            sv[p] = std::max(sv[p], std::abs(V[c * P + p]));
+        }
+    }
+    auto inv_scale = std::vector<float>(P);
+    for (auto p = 0; p < P; p++) {
+        inv_scale[p] = sv[p] > 0.0f ? 127.0f / sv[p] : 0.0f;
+        sv[p] /= 127.0f;
+    }
+    for (auto c = 0; c < C; c++) {
+        const auto group = Vq + (c / 4) * 4 * Ppad + c % 4;
+        for (auto p = 0; p < P; p++) {
+            const auto x = V[c * P + p] * inv_scale[p];
+            // Round half away from zero, then shift into [1, 255].
+            const auto q = static_cast<std::int32_t>(x + (x >= 0.0f ? 0.5f : -0.5f));
+            group[p * 4] = static_cast<std::uint8_t>(q + 128);
+        }
+    }
+}
 
-                const auto y_ind = k * H * W + y * W + x;
-                for (auto i = 0; i < WINOGRAD_M; i++)
-                {
-                    for (auto j = 0; j < WINOGRAD_M; j++)
-                    {
-                        if (y + i < H && x + j < W)
-                        {
-                            Y[y_ind + i * W + j] = o[i][j];
-                        }
-                    }
-                }
+static bool cpu_has_vnni() {
+    static const auto has_vnni = bool(__builtin_cpu_supports("avx512vnni"));
+    return has_vnni;
+}
+#endif
+
+// M[k][p] = su[k] * sv[p] * sum_c Uq[k][c] * Vq[c][p], accumulated in
+// int32 across a whole row of tiles at a time.
+CPU_KERNEL
+static void int8_gemm(const std::int8_t* Uq, const float* su,
+                      const std::int8_t* Vq, const float* sv,
+                      float* M, const int C, const int K, const int P) {
+    auto acc = std::vector<std::int32_t>(P);
+    for (auto k = 0; k < K; k++) {
+        const auto u = Uq + k * C;
+        std::fill(begin(acc), end(acc), 0);
+        for (auto c = 0; c < C; c++) {
+            const auto uc = std::int16_t{u[c]};
+            const auto v = Vq + c * P;
+            for (auto p = 0; p < P; p++) {
+                acc[p] += std::int16_t(uc * std::int16_t{v[p]});
+            }
+        }
+        for (auto p = 0; p < P; p++) {
+            M[k * P + p] = acc[p] * su[k] * sv[p];
+        }
+    }
+}
+
+CPUPipe::Int8Filter CPUPipe::quantize_filter(const std::vector<float>& U,
+                                             const int C, const int K) {
+    auto filter = Int8Filter{};
+    filter.weights.resize(WINOGRAD_TILE * K * C);
+    filter.scales.resize(WINOGRAD_TILE * K);
+    filter.offsets.resize(WINOGRAD_TILE * K);
+    for (auto b = 0; b < WINOGRAD_TILE; b++) {
+        for (auto k = 0; k < K; k++) {
+            // U is [WINOGRAD_TILE][C][K]
+            const auto row = &filter.weights[(b * K + k) * C];
+            filter.scales[b * K + k] =
+                quantize_int8(&U[b * C * K + k], C, K, row);
+            auto sum = std::int32_t{0};
+            for (auto c = 0; c < C; c++) {
+                sum += row[c];
             }
+            filter.offsets[b * K + k] = 128 * sum;
+        }
+    }
+    return filter;
+}
+
+void CPUPipe::winograd_sgemm_int8(const Int8Filter& U,
+                                  const std::vector<float> &V,
+                                  std::vector<float> &M,
+                                  const int C, const int K,
+                                  const int batch_size)
+{
+    const auto P = batch_size * WINOGRAD_P;
+
+#ifdef HAVE_VNNI_KERNEL
+    if (cpu_has_vnni() && C % 4 == 0) {
+        const auto Ppad = (P + 15) / 16 * 16;
+        auto Vu = std::vector<std::uint8_t>(C * Ppad, 128);
+        auto sv = std::vector<float>(Ppad);
+        for (auto b = 0; b < WINOGRAD_TILE; b++) {
+            quantize_columns_vnni(&V[b * C * P], C, P, Ppad, Vu.data(), sv.data());
+            int8_gemm_vnni(&U.weights[b * K * C], &U.offsets[b * K],
+                           &U.scales[b * K], Vu.data(), sv.data(),
+                           &M[b * K * P], C, K, P, Ppad);
+        }
+        return;
+    }
+#endif
+
+    // Activations are quantized on the fly, one scale per tile column.
+    auto Vq = std::vector<std::int8_t>(C * P);
+    auto sv = std::vector<float>(P);
+    for (auto b = 0; b < WINOGRAD_TILE; b++) {
+        quantize_columns(&V[b * C * P], C, P, Vq.data(), sv.data());
+        int8_gemm(&U.weights[b * K * C], &U.scales[b * K],
+                  Vq.data(), sv.data(), &M[b * K * P], C, K, P);
+    }
+}
+
+void CPUPipe::winograd_transform_out(const std::vector<float> &M,
+                                     std::vector<float> &Y,
+                                     const int K,
+                                     const int batch_size)
+{
+    constexpr auto P = WINOGRAD_P;
+
+    const auto batch_P = batch_size * P;
+    for (auto batch = 0; batch < batch_size; batch++) {
+        for (auto k = 0; k < K; k++) {
+            transform_out_plane(&M[k * batch_P + batch * P],
+                                &Y[(batch * K + k) * NUM_INTERSECTIONS],
+                                K * batch_P);
         }
     }
 }
@@ -307,15 +658,43 @@ void CPUPipe::winograd_convolve3(const int outputs,
                                  const std::vector<float> &U,
                                  std::vector<float> &V,
                                  std::vector<float> &M,
-                                 std::vector<float> &output)
+                                 std::vector<float> &output,
+                                 const int batch_size,
+                                 const Int8Filter* quantized)
 {
 
     constexpr unsigned int filter_len = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
     const auto input_channels = U.size() / (outputs * filter_len);
 
-    winograd_transform_in(input, V, input_channels);
-    winograd_sgemm(U, V, M, input_channels, outputs);
-    winograd_transform_out(M, output, outputs);
+    winograd_transform_in(input, V, input_channels, batch_size);
+    if (quantized) {
+        winograd_sgemm_int8(*quantized, V, M, input_channels, outputs, batch_size);
+    } else {
+        winograd_sgemm(U, V, M, input_channels, outputs, batch_size);
+    }
+    winograd_transform_out(M, output, outputs, batch_size);
+}
+
+// output[o][b] = biases[o] + sum_c weights[o][c] * input[c][b] directly,
+// for the 1x1 head convolutions with few outputs. The planes are short
+// and their length is known, so the inner loop vectorizes fully.
+CPU_KERNEL
+static void convolve1_direct(const size_t outputs, const size_t channels,
+                             const float* input, const float* weights,
+                             const float* biases, float* output) {
+    for (auto o = size_t{0}; o < outputs; o++) {
+        const auto out = output + o * NUM_INTERSECTIONS;
+        for (auto b = 0; b < NUM_INTERSECTIONS; b++) {
+            out[b] = biases[o];
+        }
+        for (auto c = size_t{0}; c < channels; c++) {
+            const auto w = weights[o * channels + c];
+            const auto in = input + c * NUM_INTERSECTIONS;
+            for (auto b = 0; b < NUM_INTERSECTIONS; b++) {
+                out[b] += w * in[b];
+            }
+        }
+    }
 }
 
 template <unsigned int filter_size>
@@ -334,8 +713,20 @@ void convolve(const size_t outputs,
     const auto filter_dim = filter_len * input_channels;
     assert(outputs * num_intersections == output.size());
 
-    std::vector<float> col(filter_dim * width * height);
-    im2col<filter_size>(input_channels, input, col);
+    // A 1x1 convolution needs no column buffer: the input planes already
+    // are the matrix to multiply.
+    constexpr auto DIRECT_MAX_OUTPUTS = size_t{8};
+    if (filter_size == 1 && outputs <= DIRECT_MAX_OUTPUTS) {
+        convolve1_direct(outputs, input_channels, input.data(),
+                         weights.data(), biases.data(), output.data());
+        return;
+    }
+    thread_local auto col = std::vector<float>();
+    if (filter_size != 1) {
+        col.resize(filter_dim * width * height);
+        im2col<filter_size>(input_channels, input, col);
+    }
+    const auto& cols = filter_size == 1 ? input : col;
 
     // Weight shape (output, input, filter_size, filter_size)
     // 96 18 3 3
@@ -353,13 +744,13 @@ void convolve(const size_t outputs,
                 // M        N            K
                 outputs, num_intersections, filter_dim,
                 1.0f, &weights[0], filter_dim,
-                &col[0], num_intersections,
+                &cols[0], num_intersections,
                 0.0f, &output[0], num_intersections);
 #else
     auto C_mat = EigenMatrixMap<float>(output.data(),
                                        num_intersections, outputs);
     C_mat.noalias() =
-        ConstEigenMatrixMap<float>(col.data(), num_intersections, filter_dim) * ConstEigenMatrixMap<float>(weights.data(), filter_dim, outputs);
+        ConstEigenMatrixMap<float>(cols.data(), num_intersections, filter_dim) * ConstEigenMatrixMap<float>(weights.data(), filter_dim, outputs);
 #endif
 
     for (unsigned int o = 0; o < outputs; o++)
@@ -371,12 +762,13 @@ void convolve(const size_t outputs,
     }
 }
 
-template <size_t spatial_size>
-void batchnorm(const size_t channels,
-               std::vector<float> &data,
-               const float *const means,
-               const float *const stddevs,
-               const float *const eltwise = nullptr)
+CPU_KERNEL
+static void batchnorm_planes(const size_t channels,
+                             const size_t spatial_size,
+                             float* const data,
+                             const float *const means,
+                             const float *const stddevs,
+                             const float *const eltwise)
 {
     const auto lambda_ReLU = [](const auto val) { return (val > 0.0f) ? val : 0.0f; };
     for (auto c = size_t{0}; c < channels; ++c)
@@ -405,38 +797,91 @@ void batchnorm(const size_t channels,
     }
 }
 
+template <size_t spatial_size>
+void batchnorm(const size_t channels,
+               std::vector<float> &data,
+               const float *const means,
+               const float *const stddevs,
+               const float *const eltwise = nullptr)
+{
+    // data may hold several positions one after the other
+    const auto plane_size = channels * spatial_size;
+    for (auto offset = size_t{0}; offset < data.size(); offset += plane_size) {
+        batchnorm_planes(channels, spatial_size, &data[offset],
+                         means, stddevs,
+                         eltwise ? eltwise + offset : nullptr);
+    }
+}
+
+namespace {
+// Intermediate planes of a forward pass. Each thread keeps its own,
+// so after the first evaluation they are only resized within their
+// capacity and a forward pass makes no heap allocations.
+struct ForwardScratch {
+    std::vector<float> conv_out, conv_in, res, V, M;
+    // batch_size > 1: one position at a time through the heads
+    std::vector<float> tower_out, pol, val;
+    // forward_heads()
+    std::vector<float> pol_out, pol_in, pol_res, val_conv;
+};
+
+ForwardScratch& forward_scratch() {
+    thread_local auto scratch = ForwardScratch{};
+    return scratch;
+}
+}
+
 void CPUPipe::forward(const std::vector<float> &input,
                       std::vector<float> &output_pol,
                       std::vector<float> &output_val)
+{
+    forward_batch(input, output_pol, output_val, 1);
+}
+
+void CPUPipe::forward_batch(const std::vector<float> &input,
+                            std::vector<float> &output_pol,
+                            std::vector<float> &output_val,
+                            const size_t batch_size)
 {
     // Input convolution
     constexpr auto P = WINOGRAD_P;
+    const auto batch = static_cast<int>(batch_size);
     // Calculate output channels
     const auto output_channels = m_input_channels;
     // input_channels is the maximum number of input channels of any
     // convolution. Residual blocks are identical, but the first convolution
     // might be bigger when the network has very few filters
     const auto input_channels = std::max(static_cast<size_t>(output_channels),
-                                         static_cast<size_t>(input.size() / NUM_INTERSECTIONS));
-    auto conv_out = std::vector<float>(output_channels * NUM_INTERSECTIONS);
-
-    auto V = std::vector<float>(WINOGRAD_TILE * input_channels * P);
-    auto M = std::vector<float>(WINOGRAD_TILE * output_channels * P);
-
-    winograd_convolve3(output_channels, input, m_weights->m_conv_weights[0], V, M, conv_out);
+                                         static_cast<size_t>(input.size() / NUM_INTERSECTIONS / batch_size));
+    const auto planes_size = batch_size * output_channels * NUM_INTERSECTIONS;
+    auto& scratch = forward_scratch();
+    auto& conv_out = scratch.conv_out;
+    conv_out.resize(planes_size);
+
+    // The whole batch goes through the residual tower at once, with the
+    // positions stacked into the tile dimension of each SGEMM.
+    auto& V = scratch.V;
+    auto& M = scratch.M;
+    V.resize(WINOGRAD_TILE * input_channels * batch_size * P);
+    M.resize(WINOGRAD_TILE * output_channels * batch_size * P);
+
+    winograd_convolve3(output_channels, input, m_weights->m_conv_weights[0], V, M, conv_out, batch);
     batchnorm<NUM_INTERSECTIONS>(output_channels, conv_out,
                                  m_weights->m_batchnorm_means[0].data(),
                                  m_weights->m_batchnorm_stddevs[0].data());
 
     // Residual tower
-    auto conv_in = std::vector<float>(output_channels * NUM_INTERSECTIONS);
-    auto res = std::vector<float>(output_channels * NUM_INTERSECTIONS);
+    auto& conv_in = scratch.conv_in;
+    auto& res = scratch.res;
+    conv_in.resize(planes_size);
+    res.resize(planes_size);
     for (auto i = size_t{1}; i < m_weights->m_conv_weights.size(); i += 2)
     {
         auto output_channels = m_input_channels;
         std::swap(conv_out, conv_in);
         winograd_convolve3(output_channels, conv_in,
-                           m_weights->m_conv_weights[i], V, M, conv_out);
+                           m_weights->m_conv_weights[i], V, M, conv_out, batch,
+                           m_int8 ? &m_int8_weights[i] : nullptr);
         batchnorm<NUM_INTERSECTIONS>(output_channels, conv_out,
                                      m_weights->m_batchnorm_means[i].data(),
                                      m_weights->m_batchnorm_stddevs[i].data());
@@ -444,22 +889,58 @@ void CPUPipe::forward(const std::vector<float> &input,
         std::swap(conv_in, res);
         std::swap(conv_out, conv_in);
         winograd_convolve3(output_channels, conv_in,
-                           m_weights->m_conv_weights[i + 1], V, M, conv_out);
+                           m_weights->m_conv_weights[i + 1], V, M, conv_out, batch,
+                           m_int8 ? &m_int8_weights[i + 1] : nullptr);
         batchnorm<NUM_INTERSECTIONS>(output_channels, conv_out,
                                      m_weights->m_batchnorm_means[i + 1].data(),
                                      m_weights->m_batchnorm_stddevs[i + 1].data(),
                                      res.data());
     }
-    output_pol = conv_out;
+
+    if (batch_size == 1) {
+        forward_heads(conv_out, output_pol, output_val);
+        return;
+    }
+
+    // The heads are a few 1x1 convolutions, run them per position.
+    const auto tower_size = output_channels * NUM_INTERSECTIONS;
+    const auto pol_size = output_pol.size() / batch_size;
+    const auto val_size = output_val.size() / batch_size;
+    auto& tower_out = scratch.tower_out;
+    auto& pol = scratch.pol;
+    auto& val = scratch.val;
+    tower_out.resize(tower_size);
+    pol.resize(pol_size);
+    val.resize(val_size);
+    for (auto i = size_t{0}; i < batch_size; i++) {
+        std::copy(begin(conv_out) + i * tower_size,
+                  begin(conv_out) + (i + 1) * tower_size, begin(tower_out));
+        forward_heads(tower_out, pol, val);
+        std::copy(begin(pol), end(pol), begin(output_pol) + i * pol_size);
+        std::copy(begin(val), end(val), begin(output_val) + i * val_size);
+    }
+}
+
+void CPUPipe::forward_heads(const std::vector<float> &conv_out,
+                            std::vector<float> &output_pol,
+                            std::vector<float> &output_val)
+{
+    // The layers ping-pong between scratch planes, output_pol only
+    // receives the result: the caller's buffer is never swapped in.
+    auto& scratch = forward_scratch();
+    auto& pol_out = scratch.pol_out;
+    auto& conv_in = scratch.pol_in;
+    auto& res = scratch.pol_res;
+    pol_out.assign(begin(conv_out), end(conv_out));
     for (auto i = size_t{0}; i < m_weights->m_conv_pol_w.size(); i++)
     {
-        std::swap(output_pol, conv_in);
+        std::swap(pol_out, conv_in);
         auto input_channels = conv_in.size() / NUM_INTERSECTIONS;
         auto output_channels = m_weights->m_conv_pol_b[i].size();
-        output_pol.resize(output_channels * NUM_INTERSECTIONS);
+        pol_out.resize(output_channels * NUM_INTERSECTIONS);
         convolve<1>(output_channels, conv_in,
-                    m_weights->m_conv_pol_w[i], m_weights->m_conv_pol_b[i], output_pol);
-        batchnorm<NUM_INTERSECTIONS>(output_channels, output_pol,
+                    m_weights->m_conv_pol_w[i], m_weights->m_conv_pol_b[i], pol_out);
+        batchnorm<NUM_INTERSECTIONS>(output_channels, pol_out,
                                      m_weights->m_bn_pol_w1[i].data(),
                                      m_weights->m_bn_pol_w2[i].data());
         if (input_channels != output_channels || i+1 == m_weights->m_conv_pol_w.size() || !RESCONV_IN_POLICY_HEAD) {
@@ -469,16 +950,17 @@ void CPUPipe::forward(const std::vector<float> &input,
 
         ++i;
         std::swap(conv_in, res);
-        std::swap(output_pol, conv_in);
+        std::swap(pol_out, conv_in);
         output_channels = m_weights->m_conv_pol_b[i].size();
-        output_pol.resize(output_channels * NUM_INTERSECTIONS);
+        pol_out.resize(output_channels * NUM_INTERSECTIONS);
         convolve<1>(output_channels, conv_in,
-                    m_weights->m_conv_pol_w[i], m_weights->m_conv_pol_b[i], output_pol);
-        batchnorm<NUM_INTERSECTIONS>(output_channels, output_pol,
+                    m_weights->m_conv_pol_w[i], m_weights->m_conv_pol_b[i], pol_out);
+        batchnorm<NUM_INTERSECTIONS>(output_channels, pol_out,
                                      m_weights->m_bn_pol_w1[i].data(),
                                      m_weights->m_bn_pol_w2[i].data(),
                                      res.data());
     }
+    output_pol.assign(begin(pol_out), end(pol_out));
 
     if (0 == m_weights->m_conv_val_pool_b.size()) {
         convolve<1>(m_weights->m_conv_val_b.size(), conv_out,
@@ -488,7 +970,8 @@ void CPUPipe::forward(const std::vector<float> &input,
                                      m_weights->m_bn_val_w1.data(),
                                      m_weights->m_bn_val_w2.data());
     } else {
-        auto conv_val_out = std::vector<float>(m_weights->m_conv_val_b.size() * NUM_INTERSECTIONS);
+        auto& conv_val_out = scratch.val_conv;
+        conv_val_out.resize(m_weights->m_conv_val_b.size() * NUM_INTERSECTIONS);
         convolve<1>(m_weights->m_conv_val_b.size(), conv_out,
                     m_weights->m_conv_val_w, m_weights->m_conv_val_b,
                     conv_val_out);
@@ -510,4 +993,21 @@ void CPUPipe::push_weights(unsigned int /*filter_size*/,
                            std::shared_ptr<const ForwardPipeWeights> weights)
 {
     m_weights = weights;
+
+    if (m_int8) {
+#ifdef HAVE_VNNI_KERNEL
+        if (!cpu_has_vnni()) {
+            Utils::myprintf("No AVX512-VNNI support, int8 evaluation will be slow.\n");
+        }
+#endif
+        // The input convolution sees the raw input planes and is cheap,
+        // keep it in floating point.
+        m_int8_weights.clear();
+        m_int8_weights.resize(weights->m_conv_weights.size());
+        for (auto i = size_t{1}; i < weights->m_conv_weights.size(); i++) {
+            m_int8_weights[i] = quantize_filter(weights->m_conv_weights[i],
+                                                m_input_channels,
+                                                m_input_channels);
+        }
+    }
 }
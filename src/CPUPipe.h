@@ -32,47 +32,86 @@
 #define CPUPIPE_H_INCLUDED
 #include "config.h"
 
-#include <vector>
 #include <cassert>
+#include <cstdint>
+#include <vector>
 
 #include "ForwardPipe.h"
 
 class CPUPipe : public ForwardPipe {
 public:
+    // With int8 the residual tower convolutions run on 8-bit quantized
+    // Winograd weights and activations.
+    explicit CPUPipe(bool int8 = false) : m_int8(int8) {}
+
     virtual void initialize(const int channels);
     virtual void forward(const std::vector<float>& input,
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val);
+    virtual void forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               const size_t batch_size);
 
     virtual void push_weights(unsigned int filter_size,
                               unsigned int channels,
                               unsigned int outputs,
                               std::shared_ptr<const ForwardPipeWeights> weights);
 private:
+    // Winograd domain filter quantized per tile element and output
+    // channel, stored [WINOGRAD_TILE][outputs][channels].
+    struct Int8Filter {
+        std::vector<std::int8_t> weights;
+        std::vector<float> scales;
+        // 128 * sum of each row of weights, see int8_gemm_vnni()
+        std::vector<std::int32_t> offsets;
+    };
+
+    static Int8Filter quantize_filter(const std::vector<float>& U,
+                                      const int C, const int K);
+
+    void winograd_sgemm_int8(const Int8Filter& U,
+                             const std::vector<float>& V,
+                             std::vector<float>& M,
+                             const int C, const int K,
+                             const int batch_size);
+
     void winograd_transform_in(const std::vector<float>& in,
                                std::vector<float>& V,
-                               const int C);
+                               const int C,
+                               const int batch_size = 1);
 
     void winograd_sgemm(const std::vector<float>& U,
                         const std::vector<float>& V,
                         std::vector<float>& M,
-                        const int C, const int K);
+                        const int C, const int K,
+                        const int batch_size = 1);
 
     void winograd_transform_out(const std::vector<float>& M,
                                 std::vector<float>& Y,
-                                const int K);
+                                const int K,
+                                const int batch_size = 1);
 
     void winograd_convolve3(const int outputs,
                             const std::vector<float>& input,
                             const std::vector<float>& U,
                             std::vector<float>& V,
                             std::vector<float>& M,
-                            std::vector<float>& output);
+                            std::vector<float>& output,
+                            const int batch_size = 1,
+                            const Int8Filter* quantized = nullptr);
 
+    void forward_heads(const std::vector<float>& conv_out,
+                       std::vector<float>& output_pol,
+                       std::vector<float>& output_val);
 
     int m_input_channels;
 
     // Input + residual block tower
     std::shared_ptr<const ForwardPipeWeights> m_weights;
+
+    bool m_int8;
+    // Quantized m_conv_weights, empty for the input convolution
+    std::vector<Int8Filter> m_int8_weights;
 };
 #endif
@@ -0,0 +1,273 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+#include <sstream>
+
+#include "CPUScheduler.h"
+#include "GTP.h"
+#include "Network.h"
+#include "Utils.h"
+
+using Utils::myprintf;
+
+CPUScheduler::~CPUScheduler() {
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_running = false;
+    }
+    m_cv.notify_all();
+    for (auto& x : m_worker_threads) {
+        x.join();
+    }
+}
+
+void CPUScheduler::initialize(const int channels) {
+    m_pipe.initialize(channels);
+
+    // Each worker runs one batch at a time on one core, so with enough
+    // search threads to fill every batch there is one worker per
+    // cfg_batch_size threads.
+    const auto num_worker_threads =
+        std::max(1u, cfg_num_threads / cfg_batch_size);
+    myprintf("Using %d CPU evaluation thread(s) with batch size %d.\n",
+             num_worker_threads, cfg_batch_size);
+    for (auto i = size_t{0}; i < num_worker_threads; i++) {
+        m_worker_threads.emplace_back(&CPUScheduler::batch_worker, this);
+    }
+}
+
+void CPUScheduler::push_weights(unsigned int filter_size,
+                                unsigned int channels,
+                                unsigned int outputs,
+                                std::shared_ptr<const ForwardPipeWeights> weights) {
+    m_pipe.push_weights(filter_size, channels, outputs, weights);
+}
+
+void CPUScheduler::forward(const std::vector<float>& input,
+                           std::vector<float>& output_pol,
+                           std::vector<float>& output_val) {
+    if (m_single_eval_in_progress.load()) {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_waittime += 2;
+    }
+    forward_async(input, output_pol, output_val).get();
+
+    if (m_draining) {
+        throw NetworkHaltException();
+    }
+}
+
+std::future<void> CPUScheduler::forward_async(const std::vector<float>& input,
+                                              std::vector<float>& output_pol,
+                                              std::vector<float>& output_val) {
+    auto entry = std::make_shared<ForwardQueueEntry>(input, output_pol, output_val);
+    auto result = entry->done.get_future();
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_forward_queue.push_back(entry);
+    }
+    m_cv.notify_one();
+    return result;
+}
+
+void CPUScheduler::forward_batch(const std::vector<float>& input,
+                                 std::vector<float>& output_pol,
+                                 std::vector<float>& output_val,
+                                 const size_t batch_size) {
+    // Already a batch, no need to go through the queue.
+    if (m_draining) {
+        throw NetworkHaltException();
+    }
+    m_pipe.forward_batch(input, output_pol, output_val, batch_size);
+    m_batch_evals++;
+    m_evals += batch_size;
+}
+
+void CPUScheduler::batch_worker() {
+    // Same batching heuristic as OpenCLScheduler::batch_worker: wait up
+    // to m_waittime ms for a full batch, otherwise let one worker at a
+    // time run a single evaluation so that the search cannot stall on
+    // positions that will never come.
+    auto pickup_task = [this] () {
+        std::list<std::shared_ptr<ForwardQueueEntry>> inputs;
+        size_t count = 0;
+
+        std::unique_lock<std::mutex> lk(m_mutex);
+        while (true) {
+            if (!m_running) return inputs;
+
+            count = m_forward_queue.size();
+            if (count >= cfg_batch_size) {
+                count = cfg_batch_size;
+                break;
+            }
+
+            bool timeout = !m_cv.wait_for(
+                lk,
+                std::chrono::milliseconds(m_waittime),
+                [this] () {
+                    return !m_running || m_forward_queue.size() >= cfg_batch_size;
+                }
+            );
+
+            if (!m_forward_queue.empty()) {
+                if (timeout && m_single_eval_in_progress.exchange(true) == false) {
+                    if (m_waittime > 1) {
+                        m_waittime--;
+                    }
+                    count = 1;
+                    break;
+                }
+            }
+        }
+        auto end = begin(m_forward_queue);
+        std::advance(end, count);
+        std::move(begin(m_forward_queue), end, std::back_inserter(inputs));
+        m_forward_queue.erase(begin(m_forward_queue), end);
+
+        return inputs;
+    };
+
+    auto batch_input = std::vector<float>();
+    auto batch_output_pol = std::vector<float>();
+    auto batch_output_val = std::vector<float>();
+
+    while (true) {
+        auto inputs = pickup_task();
+        auto count = inputs.size();
+
+        if (!m_running) {
+            return;
+        }
+
+        if (count == 1) {
+            m_single_evals++;
+        } else {
+            m_batch_evals++;
+        }
+        m_evals += count;
+
+        const auto in_size = inputs.front()->in.size();
+        const auto out_pol_size = inputs.front()->out_p.size();
+        const auto out_val_size = inputs.front()->out_va.size();
+        batch_input.resize(in_size * count);
+        batch_output_pol.resize(out_pol_size * count);
+        batch_output_val.resize(out_val_size * count);
+
+        auto index = size_t{0};
+        for (auto& x : inputs) {
+            std::copy(begin(x->in), end(x->in), begin(batch_input) + in_size * index);
+            index++;
+        }
+
+        try {
+            m_pipe.forward_batch(batch_input, batch_output_pol,
+                                 batch_output_val, count);
+        } catch (...) {
+            for (auto& x : inputs) {
+                x->done.set_exception(std::current_exception());
+            }
+            if (count == 1) {
+                m_single_eval_in_progress = false;
+            }
+            continue;
+        }
+
+        index = 0;
+        for (auto& x : inputs) {
+            std::copy(begin(batch_output_pol) + out_pol_size * index,
+                      begin(batch_output_pol) + out_pol_size * (index + 1),
+                      begin(x->out_p));
+            std::copy(begin(batch_output_val) + out_val_size * index,
+                      begin(batch_output_val) + out_val_size * (index + 1),
+                      begin(x->out_va));
+            x->done.set_value();
+            index++;
+        }
+
+        if (count == 1) {
+            m_single_eval_in_progress = false;
+        }
+    }
+}
+
+std::string CPUScheduler::get_stats() {
+    auto out = std::ostringstream{};
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        out << "batch size " << cfg_batch_size
+            << ", wait time " << m_waittime << " ms\n";
+    }
+    const auto batches = m_single_evals.load() + m_batch_evals.load();
+    const auto evals = m_evals.load();
+    out << "CPU: " << batches << " batches, "
+        << m_single_evals.load() << " single, "
+        << "avg fill " << (batches ? float(evals) / batches : 0.0f) << "\n";
+    return out.str();
+}
+
+ForwardPipe::BatchCounters CPUScheduler::get_batch_counters() {
+    auto counters = BatchCounters{};
+    counters.batches = m_single_evals.load() + m_batch_evals.load();
+    std::unique_lock<std::mutex> lk(m_mutex);
+    counters.queued = m_forward_queue.size();
+    return counters;
+}
+
+void CPUScheduler::drain() {
+    // Wake up all pending requests, which then throw once they see
+    // m_draining.
+    m_draining = true;
+
+    std::list<std::shared_ptr<ForwardQueueEntry>> fq;
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        std::move(m_forward_queue.begin(),
+                  m_forward_queue.end(),
+                  std::back_inserter(fq));
+        m_forward_queue.clear();
+    }
+
+    for (auto& x : fq) {
+        x->done.set_exception(std::make_exception_ptr(NetworkHaltException()));
+    }
+}
+
+void CPUScheduler::resume() {
+    // UCTNode::think() should wait for all child threads to complete before resuming.
+    assert(m_forward_queue.empty());
+
+    m_draining = false;
+}
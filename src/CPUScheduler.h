@@ -0,0 +1,112 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#ifndef CPUSCHEDULER_H_INCLUDED
+#define CPUSCHEDULER_H_INCLUDED
+#include "config.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <future>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "CPUPipe.h"
+#include "ForwardPipe.h"
+
+// Collects the evaluations of the search threads into batches for
+// CPUPipe::forward_batch, the same way OpenCLScheduler does for GPUs.
+class CPUScheduler : public ForwardPipe {
+    class ForwardQueueEntry {
+    public:
+        const std::vector<float>& in;
+        std::vector<float>& out_p;
+        std::vector<float>& out_va;
+        std::promise<void> done;
+        ForwardQueueEntry(const std::vector<float>& input,
+                          std::vector<float>& output_pol,
+                          std::vector<float>& output_val)
+        : in(input), out_p(output_pol), out_va(output_val)
+          {}
+    };
+public:
+    explicit CPUScheduler(bool int8 = false) : m_pipe(int8) {}
+    virtual ~CPUScheduler();
+
+    virtual void initialize(const int channels);
+    virtual void forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val);
+    virtual std::future<void> forward_async(const std::vector<float>& input,
+                                            std::vector<float>& output_pol,
+                                            std::vector<float>& output_val);
+    virtual void forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               const size_t batch_size);
+    virtual std::string get_stats();
+    virtual BatchCounters get_batch_counters();
+    virtual void push_weights(unsigned int filter_size,
+                              unsigned int channels,
+                              unsigned int outputs,
+                              std::shared_ptr<const ForwardPipeWeights> weights);
+private:
+    bool m_running = true;
+    std::atomic<bool> m_draining{false};
+    CPUPipe m_pipe;
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+
+    // start with 2 milliseconds : lock protected
+    int m_waittime{2};
+
+    // set to true when single (non-batch) eval is in progress
+    std::atomic<bool> m_single_eval_in_progress{false};
+
+    std::atomic<size_t> m_single_evals{0};
+    std::atomic<size_t> m_batch_evals{0};
+    std::atomic<size_t> m_evals{0};
+
+    std::list<std::shared_ptr<ForwardQueueEntry>> m_forward_queue;
+    std::list<std::thread> m_worker_threads;
+
+    void batch_worker();
+
+    virtual void drain();
+    virtual void resume();
+};
+
+#endif
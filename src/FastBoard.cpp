@@ -101,6 +101,12 @@ void FastBoard::set_state(int vertex, FastBoard::vertex_t content) {
     assert(vertex >= 0 && vertex < m_numvertices);
     assert(content >= BLACK && content <= INVAL);
 
+    if (m_state[vertex] == BLACK || m_state[vertex] == WHITE) {
+        m_stone_cnt[m_state[vertex]]--;
+    }
+    if (content == BLACK || content == WHITE) {
+        m_stone_cnt[content]++;
+    }
     m_state[vertex] = content;
 }
 
@@ -120,6 +126,8 @@ void FastBoard::reset_board(int size) {
     m_prisoners[BLACK] = 0;
     m_prisoners[WHITE] = 0;
     m_empty_cnt = 0;
+    m_stone_cnt[BLACK] = 0;
+    m_stone_cnt[WHITE] = 0;
 
     m_dirs[0] = -m_sidevertices;
     m_dirs[1] = +1;
@@ -194,6 +202,18 @@ bool FastBoard::is_suicide(int i, int color) const {
     return true;
 }
 
+std::bitset<NUM_INTERSECTIONS> FastBoard::get_nonsuicide_moves(int color) const {
+    auto moves = std::bitset<NUM_INTERSECTIONS>{};
+    for (auto n = 0; n < m_empty_cnt; n++) {
+        const auto vertex = m_empty[n];
+        // Most empty points have an empty neighbour: skip is_suicide().
+        if (count_pliberties(vertex) || !is_suicide(vertex, color)) {
+            moves.set(get_index(vertex));
+        }
+    }
+    return moves;
+}
+
 int FastBoard::count_pliberties(const int i) const {
     return count_neighbours(EMPTY, i);
 }
@@ -276,16 +296,41 @@ void FastBoard::remove_neighbour(const int vtx, const int color) {
     }
 }
 
-int FastBoard::calc_reach_color(int color) const {
-    auto bd = std::vector<bool>(m_numvertices, false);
+#ifdef USE_BITBOARD
+int FastBoard::calc_reach_color(int color,
+                                int spread_color,
+                                reach_t & bd,
+                                bool territory) const {
+    auto spread = reach_t{};
+    bd.reset();
+    for (auto vertex = 0; vertex < m_numvertices; vertex++) {
+        const auto peek = territory ?
+            int(m_territory[vertex]) : int(m_state[vertex]);
+        if (peek == color) {
+            bd.set(vertex);
+        } else if (peek == spread_color) {
+            spread.set(vertex);
+        }
+    }
 
-    return calc_reach_color(color, EMPTY, bd, false);
+    // Grow into the neighbouring spread vertices until nothing changes.
+    // Vertices off the board are never in spread, so the shifts wrapping
+    // around the end of a row or past the border cannot leak.
+    while (true) {
+        auto grown = (bd << 1) | (bd >> 1)
+            | (bd << m_sidevertices) | (bd >> m_sidevertices);
+        grown = bd | (grown & spread);
+        if (grown == bd) {
+            break;
+        }
+        bd = grown;
+    }
+    return bd.count();
 }
-
-
+#else
 int FastBoard::calc_reach_color(int color,
                                 int spread_color,
-                                std::vector<bool> & bd,
+                                reach_t & bd,
                                 bool territory) const {
     auto reachable = 0;
     bd.resize(m_numvertices);
@@ -322,12 +367,54 @@ int FastBoard::calc_reach_color(int color,
     }
     return reachable;
 }
+#endif
+
+// Calls f(vertices, count, reaches_black, reaches_white) for every
+// connected group of empty intersections. Only the empty intersections
+// are visited, so this gets cheaper as the game goes on.
+template <typename F>
+void FastBoard::for_each_empty_region(F&& f) const {
+    auto seen = std::bitset<NUM_VERTICES>{};
+    auto region = std::array<unsigned short, NUM_VERTICES>{};
+    for (auto e = 0; e < m_empty_cnt; e++) {
+        const auto start = m_empty[e];
+        if (seen[start]) {
+            continue;
+        }
+        seen.set(start);
+        region[0] = start;
+        auto count = 1;
+        auto reaches = std::array<bool, 2>{false, false};
+        // The region doubles as the stack of vertices to expand.
+        for (auto next = 0; next < count; next++) {
+            const auto vertex = region[next];
+            for (auto k = 0; k < 4; k++) {
+                const auto neighbor = vertex + m_dirs[k];
+                const auto peek = m_state[neighbor];
+                if (peek == EMPTY) {
+                    if (!seen[neighbor]) {
+                        seen.set(neighbor);
+                        region[count++] = neighbor;
+                    }
+                } else if (peek != INVAL) {
+                    reaches[peek] = true;
+                }
+            }
+        }
+        f(region.data(), count, reaches[BLACK], reaches[WHITE]);
+    }
+}
 
 // Needed for scoring passed out games not in MC playouts
 float FastBoard::area_score(float komi) const {
-    auto white = calc_reach_color(WHITE);
-    auto black = calc_reach_color(BLACK);
-    return black - white - komi;
+    // Stones are counted as they are played and captured, empty
+    // intersections count for the colors their region reaches.
+    auto score = m_stone_cnt[BLACK] - m_stone_cnt[WHITE];
+    for_each_empty_region([&score](const unsigned short*, int count,
+                                   bool black, bool white) {
+        score += (black ? count : 0) - (white ? count : 0);
+    });
+    return score - komi;
 }
 
 
@@ -690,16 +777,22 @@ void FastBoard::find_dame() {
 
 void FastBoard::find_dame(std::vector<int>& all_dames) {
     all_dames.clear();
-    auto black = std::vector<bool>(m_numvertices, false);
-    auto white = std::vector<bool>(m_numvertices, false);
-
-    calc_reach_color(BLACK, EMPTY, black, false);
-    calc_reach_color(WHITE, EMPTY, white, false);
+    auto dame = std::bitset<NUM_VERTICES>{};
+
+    // Dame are the empty intersections both colors reach.
+    for_each_empty_region([&dame](const unsigned short* vertices, int count,
+                                  bool black, bool white) {
+        if (black && white) {
+            for (auto i = 0; i < count; i++) {
+                dame.set(vertices[i]);
+            }
+        }
+    });
 
     for (int i = 0; i < m_boardsize; i++) {
         for (int j = 0; j < m_boardsize; j++) {
             int vertex = get_vertex(i, j);
-            if (black[vertex] && white[vertex]) {
+            if (dame[vertex]) {
                 m_territory[vertex] = DAME;
                 all_dames.push_back(vertex);
             }
@@ -709,8 +802,8 @@ void FastBoard::find_dame(std::vector<int>& all_dames) {
 
 
 void FastBoard::find_seki() {
-    auto black_seki = std::vector<bool>(m_numvertices, false);
-    auto white_seki = std::vector<bool>(m_numvertices, false);
+    auto black_seki = reach_t{};
+    auto white_seki = reach_t{};
 
     calc_reach_color(DAME, B_STONE, black_seki, true);
     calc_reach_color(DAME, W_STONE, white_seki, true);
@@ -731,9 +824,9 @@ std::pair<int,int> FastBoard::find_territory() {
     auto b_terr_count = 0;
     auto w_terr_count = 0;
 
-    auto seki_eye = std::vector<bool>(m_numvertices, false);
-    auto b_territory = std::vector<bool>(m_numvertices, false);
-    auto w_territory = std::vector<bool>(m_numvertices, false);
+    auto seki_eye = reach_t{};
+    auto b_territory = reach_t{};
+    auto w_territory = reach_t{};
 
     calc_reach_color(SEKI, EMPTY_I, seki_eye, true);
     calc_reach_color(B_STONE, EMPTY_I, b_territory, true);
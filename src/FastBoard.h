@@ -34,6 +34,7 @@
 #include "config.h"
 
 #include <array>
+#include <bitset>
 #include <queue>
 #include <string>
 #include <utility>
@@ -95,6 +96,10 @@ public:
     std::pair<int, int> get_xy(int vertex) const;
 
     bool is_suicide(int i, int color) const;
+    // The empty intersections, by index, where color can play without
+    // suicide, in one pass over the list of empty vertices. Ko is not
+    // checked.
+    std::bitset<NUM_INTERSECTIONS> get_nonsuicide_moves(int color) const;
     int count_pliberties(const int i) const;
     bool is_eye(const int color, const int vtx) const;
 
@@ -148,6 +153,7 @@ protected:
     std::array<unsigned short, NUM_VERTICES>   m_empty;      /* empty intersections */
     std::array<unsigned short, NUM_VERTICES>   m_empty_idx;  /* intersection indices */
     int m_empty_cnt;                                         /* count of empties */
+    std::array<int, 2>                         m_stone_cnt;  /* stones per color */
 
     int m_tomove;
     int m_numvertices;
@@ -157,9 +163,19 @@ protected:
 
     std::array<territory_t, NUM_VERTICES> m_territory;
 
+    /*
+        vertices reached by a flood fill, indexed by vertex
+    */
+#ifdef USE_BITBOARD
+    using reach_t = std::bitset<NUM_VERTICES>;
+#else
+    using reach_t = std::vector<bool>;
+#endif
+
     int calc_reach_color(int color, int color_spread,
-                         std::vector<bool> & bd, bool territory) const;
-    int calc_reach_color(int color) const;
+                         reach_t & bd, bool territory) const;
+    template <typename F>
+    void for_each_empty_region(F&& f) const;
     void find_dame();
     void find_seki();
     std::pair<int,int> find_territory();
@@ -103,35 +103,52 @@ bool FastState::is_move_legal(int color, int vertex) const {
                       !board.is_suicide(vertex, color)));
 }
 
+std::bitset<NUM_INTERSECTIONS> FastState::get_legal_moves(int color) const {
+    auto moves = board.get_nonsuicide_moves(color);
+    if (m_komove != FastBoard::NO_VERTEX) {
+        moves.reset(board.get_index(m_komove));
+    }
+    if (cfg_analyze_tags.has_move_restrictions()) {
+        for (auto i = 0; i < NUM_INTERSECTIONS; i++) {
+            if (moves[i]
+                && cfg_analyze_tags.is_to_avoid(color, board.get_vertex(i),
+                                                m_movenum)) {
+                moves.reset(i);
+            }
+        }
+    }
+    return moves;
+}
+
 void FastState::play_move(int vertex) {
     play_move(get_to_move(), vertex);
 }
 
 void FastState::play_move(int color, int vertex) {
-    board.m_hash ^= Zobrist::zobrist_ko[m_komove];
+    board.hash_ko_move(m_komove);
     if (vertex == FastBoard::PASS) {
         // No Ko move
         m_komove = FastBoard::NO_VERTEX;
     } else {
         m_komove = board.update_board(color, vertex);
     }
-    board.m_hash ^= Zobrist::zobrist_ko[m_komove];
+    board.hash_ko_move(m_komove);
 
     m_lastmove = vertex;
     m_movenum++;
 
     if (board.m_tomove == color) {
-        board.m_hash ^= Zobrist::zobrist_blacktomove;
+        board.hash_invariant(Zobrist::zobrist_blacktomove);
     }
     board.m_tomove = !color;
 
-    board.m_hash ^= Zobrist::zobrist_pass[get_passes()];
+    board.hash_invariant(Zobrist::zobrist_pass[get_passes()]);
     if (vertex == FastBoard::PASS) {
         increment_passes();
     } else {
         set_passes(0);
     }
-    board.m_hash ^= Zobrist::zobrist_pass[get_passes()];
+    board.hash_invariant(Zobrist::zobrist_pass[get_passes()]);
 }
 
 size_t FastState::get_movenum() const {
@@ -260,7 +277,7 @@ int FastState::get_handicap() const {
 }
 
 std::uint64_t FastState::get_symmetry_hash(int symmetry) const {
-    return board.calc_symmetry_hash(m_komove, symmetry);
+    return board.get_symmetry_hash(symmetry);
 }
 
 
@@ -293,19 +310,19 @@ int FastState::get_allowed_blunders() const {
 }
 
 bool FastState::is_symmetry_invariant(const int symmetry) const {
-    for (auto y = 0; y < BOARD_SIZE; y++) {
-        for (auto x = 0; x < BOARD_SIZE; x++) {
-            const auto sym_vertex =
-                board.get_vertex(symmetry_nn_idx_table[symmetry][y * BOARD_SIZE + x]);
-            if (board.get_state(x, y) != board.get_state(sym_vertex))
-                return false;
-        }
-    }
+    // The symmetry hashes include the stones and the ko move, and the
+    // rest of the hash does not depend on the symmetry.
+    return board.get_symmetry_hash(symmetry) == board.get_hash();
+}
 
-    if(m_komove != 0) {
-        if (m_komove != board.get_sym_move(m_komove, symmetry))
-            return false;
+std::vector<int> FastState::get_stabilizer_subgroup() const {
+    auto subgroup = std::vector<int>{0};
+    if (cfg_exploit_symmetries) {
+        for (auto i = 1; i < 8; i++) {
+            if (is_symmetry_invariant(i)) {
+                subgroup.emplace_back(i);
+            }
+        }
     }
-
-    return true;
+    return subgroup;
 }
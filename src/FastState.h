@@ -58,6 +58,8 @@ public:
     void reset_board();
 
     bool is_move_legal(int color, int vertex) const;
+    // The intersections, by index, where is_move_legal() is true.
+    std::bitset<NUM_INTERSECTIONS> get_legal_moves(int color) const;
 
     void set_komi(float komi);
     void add_komi(float delta);
@@ -95,6 +97,9 @@ public:
     int get_allowed_blunders() const;
 
     bool is_symmetry_invariant(const int symmetry) const;
+    // The symmetries leaving the position unchanged, identity first.
+    // Only the identity when cfg_exploit_symmetries is off.
+    std::vector<int> get_stabilizer_subgroup() const;
 
     void play_move(int vertex);
     void play_move(int color, int vertex);
@@ -31,7 +31,10 @@
 #ifndef FORWARDPIPE_H_INCLUDED
 #define FORWARDPIPE_H_INCLUDED
 
+#include <algorithm>
+#include <future>
 #include <memory>
+#include <string>
 #include <vector>
 
 #include "config.h"
@@ -71,11 +74,63 @@ public:
     virtual void forward(const std::vector<float>& input,
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val) = 0;
+
+    // Queue an evaluation and return without waiting for it. The
+    // buffers must stay alive until the future is ready. The default
+    // evaluates immediately.
+    virtual std::future<void> forward_async(const std::vector<float>& input,
+                                            std::vector<float>& output_pol,
+                                            std::vector<float>& output_val) {
+        auto done = std::promise<void>();
+        try {
+            forward(input, output_pol, output_val);
+            done.set_value();
+        } catch (...) {
+            done.set_exception(std::current_exception());
+        }
+        return done.get_future();
+    }
+
+    // Evaluate batch_size positions stored one after the other in input.
+    // The default just runs them one at a time.
+    virtual void forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               const size_t batch_size) {
+        const auto in_size = input.size() / batch_size;
+        const auto pol_size = output_pol.size() / batch_size;
+        const auto val_size = output_val.size() / batch_size;
+        auto in = std::vector<float>(in_size);
+        auto pol = std::vector<float>(pol_size);
+        auto val = std::vector<float>(val_size);
+        for (auto i = size_t{0}; i < batch_size; i++) {
+            std::copy(begin(input) + i * in_size,
+                      begin(input) + (i + 1) * in_size, begin(in));
+            forward(in, pol, val);
+            std::copy(begin(pol), end(pol), begin(output_pol) + i * pol_size);
+            std::copy(begin(val), end(val), begin(output_val) + i * val_size);
+        }
+    }
     virtual void push_weights(unsigned int filter_size,
                               unsigned int channels,
                               unsigned int outputs,
                               std::shared_ptr<const ForwardPipeWeights> weights) = 0;
 
+    // Whether push_weights can be called again, with no evaluations
+    // running, to swap in the weights of a network of the same shape.
+    virtual bool can_replace_weights() const { return true; }
+
+    // Human readable report on batching and throughput, if any.
+    virtual std::string get_stats() { return ""; }
+
+    // Batches run so far and positions waiting for one, for pipes
+    // that batch.
+    struct BatchCounters {
+        size_t batches{0};
+        size_t queued{0};
+    };
+    virtual BatchCounters get_batch_counters() { return {}; }
+
     virtual void drain() {}
     virtual void resume() {}
 };
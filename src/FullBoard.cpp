@@ -32,6 +32,7 @@
 
 #include <array>
 #include <cassert>
+#include <vector>
 
 #include "FullBoard.h"
 #include "Network.h"
@@ -46,20 +47,19 @@ int FullBoard::remove_string(int i) {
     int color = m_state[i];
 
     do {
-        m_hash    ^= Zobrist::zobrist[m_state[pos]][pos];
-        m_ko_hash ^= Zobrist::zobrist[m_state[pos]][pos];
+        hash_vertex(pos);
 
         m_state[pos] = EMPTY;
         m_parent[pos] = NUM_VERTICES;
 
         remove_neighbour(pos, color);
+        m_stone_cnt[color]--;
 
         m_empty_idx[pos]      = m_empty_cnt;
         m_empty[m_empty_cnt]  = pos;
         m_empty_cnt++;
 
-        m_hash    ^= Zobrist::zobrist[m_state[pos]][pos];
-        m_ko_hash ^= Zobrist::zobrist[m_state[pos]][pos];
+        hash_vertex(pos);
 
         removed++;
         pos = m_next[pos];
@@ -109,27 +109,99 @@ std::uint64_t FullBoard::calc_hash(int komove) const {
 }
 
 std::uint64_t FullBoard::calc_symmetry_hash(int komove, int symmetry) const {
-    return calc_hash(komove, [this, symmetry](const auto vertex) {
-        if (vertex == NO_VERTEX) {
-            return NO_VERTEX;
-        } else {
-            const auto newvtx = Network::get_symmetry(get_xy(vertex), symmetry, m_boardsize);
-            return get_vertex(newvtx.first, newvtx.second);
-        }
+    const auto& image = (*m_symmetries)[symmetry];
+    return calc_hash(komove, [&image](const auto vertex) {
+        return int{image[vertex]};
     });
 }
 
+const FullBoard::SymmetryTable& FullBoard::symmetry_table(int size) {
+    static_assert(NUM_SYMMETRIES == Network::NUM_SYMMETRIES,
+                  "FullBoard and Network disagree on the symmetries");
+    static const auto tables = [] {
+        auto tables = std::vector<SymmetryTable>(BOARD_SIZE + 1);
+        for (auto size = 1; size <= BOARD_SIZE; size++) {
+            const auto side = size + 2;
+            for (auto sym = 0; sym < NUM_SYMMETRIES; sym++) {
+                auto& image = tables[size][sym];
+                for (auto vertex = 0; vertex < NUM_VERTICES; vertex++) {
+                    image[vertex] = static_cast<std::uint16_t>(vertex);
+                }
+                for (auto y = 0; y < size; y++) {
+                    for (auto x = 0; x < size; x++) {
+                        const auto newvtx =
+                            Network::get_symmetry({x, y}, sym, size);
+                        image[(y + 1) * side + x + 1] =
+                            static_cast<std::uint16_t>(
+                                (newvtx.second + 1) * side + newvtx.first + 1);
+                    }
+                }
+            }
+        }
+        return tables;
+    }();
+    assert(size >= 1 && size <= BOARD_SIZE);
+    return tables[size];
+}
+
 std::uint64_t FullBoard::get_hash() const {
     return m_hash;
 }
 
+std::uint64_t FullBoard::get_symmetry_hash(int symmetry) const {
+    assert(m_sym_hash[Network::IDENTITY_SYMMETRY] == m_hash);
+    return m_sym_hash[symmetry];
+}
+
+void FullBoard::hash_vertex(int vertex) {
+    const auto& zobrist = Zobrist::zobrist[m_state[vertex]];
+    m_hash ^= zobrist[vertex];
+    m_ko_hash ^= zobrist[vertex];
+    for (auto sym = 0; sym < NUM_SYMMETRIES; sym++) {
+        m_sym_hash[sym] ^= zobrist[(*m_symmetries)[sym][vertex]];
+    }
+}
+
+void FullBoard::hash_ko_move(int komove) {
+    m_hash ^= Zobrist::zobrist_ko[komove];
+    for (auto sym = 0; sym < NUM_SYMMETRIES; sym++) {
+        m_sym_hash[sym] ^= Zobrist::zobrist_ko[(*m_symmetries)[sym][komove]];
+    }
+}
+
+void FullBoard::hash_invariant(std::uint64_t key) {
+    m_hash ^= key;
+    for (auto& hash : m_sym_hash) {
+        hash ^= key;
+    }
+}
+
+bool FullBoard::quiet_move_ko_hash(int color, int vertex,
+                                   std::uint64_t& hash) const {
+    if (m_state[vertex] != EMPTY) {
+        return false;
+    }
+    for (auto k = 0; k < 4; k++) {
+        const auto ai = vertex + m_dirs[k];
+        if (m_state[ai] == !color && m_libs[m_parent[ai]] <= 1) {
+            return false;
+        }
+    }
+    if (is_suicide(vertex, color)) {
+        return false;
+    }
+    hash = m_ko_hash ^ Zobrist::zobrist[EMPTY][vertex]
+                     ^ Zobrist::zobrist[color][vertex];
+    return true;
+}
+
 std::uint64_t FullBoard::get_ko_hash() const {
     return m_ko_hash;
 }
 
 void FullBoard::set_to_move(int tomove) {
     if (m_tomove != tomove) {
-        m_hash ^= Zobrist::zobrist_blacktomove;
+        hash_invariant(Zobrist::zobrist_blacktomove);
     }
     FastBoard::set_to_move(tomove);
 }
@@ -138,17 +210,16 @@ int FullBoard::update_board(const int color, const int i) {
     assert(i != FastBoard::PASS);
     assert(m_state[i] == EMPTY);
 
-    m_hash ^= Zobrist::zobrist[m_state[i]][i];
-    m_ko_hash ^= Zobrist::zobrist[m_state[i]][i];
+    hash_vertex(i);
 
     m_state[i] = vertex_t(color);
+    m_stone_cnt[color]++;
     m_next[i] = i;
     m_parent[i] = i;
     m_libs[i] = count_pliberties(i);
     m_stones[i] = 1;
 
-    m_hash ^= Zobrist::zobrist[m_state[i]][i];
-    m_ko_hash ^= Zobrist::zobrist[m_state[i]][i];
+    hash_vertex(i);
 
     /* update neighbor liberties (they all lose 1) */
     add_neighbour(i, color);
@@ -195,9 +266,9 @@ int FullBoard::update_board(const int color, const int i) {
         }
     }
 
-    m_hash ^= Zobrist::zobrist_pris[color][m_prisoners[color]];
+    hash_invariant(Zobrist::zobrist_pris[color][m_prisoners[color]]);
     m_prisoners[color] += captured_stones;
-    m_hash ^= Zobrist::zobrist_pris[color][m_prisoners[color]];
+    hash_invariant(Zobrist::zobrist_pris[color][m_prisoners[color]]);
 
     /* move last vertex in list to our position */
     auto lastvertex = m_empty[--m_empty_cnt];
@@ -230,8 +301,12 @@ void FullBoard::display_board(int lastmove) const {
 void FullBoard::reset_board(int size) {
     FastBoard::reset_board(size);
 
+    m_symmetries = &symmetry_table(size);
     m_hash = calc_hash();
     m_ko_hash = calc_ko_hash();
+    for (auto sym = 0; sym < NUM_SYMMETRIES; sym++) {
+        m_sym_hash[sym] = calc_symmetry_hash(NO_VERTEX, sym);
+    }
 }
 
 bool FullBoard::remove_dead_stones(const FullBoard & tt_endboard) {
@@ -32,11 +32,15 @@
 #define FULLBOARD_H_INCLUDED
 
 #include "config.h"
+#include <array>
 #include <cstdint>
 #include "FastBoard.h"
 
 class FullBoard : public FastBoard {
 public:
+    // Same as Network::NUM_SYMMETRIES.
+    static constexpr auto NUM_SYMMETRIES = 8;
+
     int remove_string(int i);
     int update_board(const int color, const int i);
 
@@ -53,13 +57,40 @@ public:
     std::uint64_t calc_hash(int komove = NO_VERTEX) const;
     std::uint64_t calc_symmetry_hash(int komove, int symmetry) const;
     std::uint64_t calc_ko_hash() const;
+    // The ko hash after color plays vertex, if the move neither
+    // captures nor is a suicide, which leaves the other vertices alone.
+    // False for the other moves.
+    bool quiet_move_ko_hash(int color, int vertex, std::uint64_t& hash) const;
+
+    // The hash of the position transformed by a symmetry, see
+    // Network::get_symmetry(). Kept up to date along with m_hash, so
+    // that it equals calc_symmetry_hash() and, for the identity, m_hash.
+    std::uint64_t get_symmetry_hash(int symmetry) const;
+
+    // Update m_hash and the symmetry hashes for a change of the ko
+    // move, or of a key that no symmetry changes (side to move,
+    // passes, prisoners).
+    void hash_ko_move(int komove);
+    void hash_invariant(std::uint64_t key);
 
     std::uint64_t m_hash;
     std::uint64_t m_ko_hash;
 
 private:
+    // The image of each vertex by each symmetry, for a board size.
+    // Vertices off the board, and NO_VERTEX, are their own image.
+    using SymmetryTable =
+        std::array<std::array<std::uint16_t, NUM_VERTICES>, NUM_SYMMETRIES>;
+    static const SymmetryTable& symmetry_table(int size);
+
     template<class Function>
     std::uint64_t calc_hash(int komove, Function transform) const;
+    // Update the hashes for the stone (or emptiness) of a vertex being
+    // added or removed.
+    void hash_vertex(int vertex);
+
+    std::array<std::uint64_t, NUM_SYMMETRIES> m_sym_hash;
+    const SymmetryTable* m_symmetries{nullptr};
     bool m_lastforced{false};
 };
 
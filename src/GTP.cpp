@@ -31,6 +31,7 @@
 #include "config.h"
 
 #include <algorithm>
+#include <atomic>
 #include <cctype>
 #include <chrono>
 #include <cmath>
@@ -44,15 +45,20 @@
 #include <sstream>
 #include <string>
 #include <vector>
+#include <boost/format.hpp>
 
 #include "GTP.h"
 #include "FastBoard.h"
 #include "FullBoard.h"
 #include "GameState.h"
+#include "MemoryTracker.h"
+#include "Metrics.h"
 #include "Network.h"
+#include "Numa.h"
 #include "SGFTree.h"
 #include "SHA256.h"
 #include "SMP.h"
+#include "SearchProfiler.h"
 #include "Training.h"
 #include "UCTSearch.h"
 #include "Utils.h"
@@ -66,9 +72,15 @@ using namespace Utils;
 bool cfg_gtp_mode;
 bool cfg_japanese_mode;
 bool cfg_use_nncache;
+bool cfg_compact_nncache;
+bool cfg_canonical_nncache;
+std::string cfg_shared_cache_file;
+size_t cfg_shared_cache_mib;
+std::string cfg_opening_book;
 bool cfg_allow_pondering;
 unsigned int cfg_num_threads;
 unsigned int cfg_batch_size;
+int cfg_batch_latency;
 int cfg_max_playouts;
 int cfg_max_visits;
 size_t cfg_max_memory;
@@ -76,6 +88,7 @@ size_t cfg_max_tree_size;
 int cfg_max_cache_ratio_percent;
 TimeManagement::enabled_t cfg_timemanage;
 int cfg_lagbuffer_cs;
+float cfg_time_extension;
 float cfg_resignpct;
 float cfg_resign_threshold;
 int cfg_noise;
@@ -89,6 +102,18 @@ bool cfg_chainsize_features;
 bool cfg_exploit_symmetries;
 bool cfg_symm_nonrandom;
 bool cfg_laddercode;
+bool cfg_transpositions;
+bool cfg_prune_tree;
+bool cfg_expand_wait;
+bool cfg_deterministic;
+int cfg_virtual_loss;
+bool cfg_adaptive_vl;
+bool cfg_lcb_stop;
+float cfg_score_stop;
+unsigned int cfg_root_split;
+size_t cfg_widening;
+size_t cfg_ponder_replies;
+int cfg_policy_rollouts;
 bool cfg_pass_agree;
 float cfg_noise_value;
 float cfg_noise_weight;
@@ -101,16 +126,26 @@ float cfg_komi;
 int cfg_random_cnt;
 int cfg_random_min_visits;
 float cfg_random_temp;
+int cfg_fast_visits;
+float cfg_full_search_prob;
 std::uint64_t cfg_rng_seed;
 bool cfg_dumbpass;
 bool cfg_restrict_tt;
 bool cfg_recordvisits;
+size_t cfg_max_training_steps;
+bool cfg_binary_chunks;
+int cfg_chunk_compression;
 #ifdef USE_OPENCL
 std::vector<int> cfg_gpus;
 bool cfg_sgemm_exhaustive;
 bool cfg_tune_only;
+int cfg_tune_time;
+std::string cfg_tuner_file;
+std::string cfg_tuner_export;
 #ifdef USE_HALF
 precision_t cfg_precision;
+bool cfg_recheck_precision;
+bool cfg_half_no_selfcheck;
 #endif
 #endif
 float cfg_puct;
@@ -128,11 +163,22 @@ FILE* cfg_logfile_handle;
 bool cfg_quiet;
 std::string cfg_options_str;
 bool cfg_benchmark;
+bool cfg_profile_search;
+bool cfg_numa;
+int cfg_metrics_interval;
+int cfg_server_port;
+std::string cfg_server_address;
+std::vector<std::string> cfg_remote_workers;
+std::vector<std::string> cfg_analyze_sgf;
+int cfg_analyze_parallel;
+std::string cfg_nn_server_file;
+std::string cfg_nn_client_file;
 bool cfg_cpu_only;
+bool cfg_int8;
 float cfg_blunder_thr;
 float cfg_losing_thr;
 float cfg_blunder_rndmax_avg;
-AnalyzeTags cfg_analyze_tags;
+thread_local AnalyzeTags cfg_analyze_tags;
 
 /* Parses tags for the lz-analyze GTP command and friends */
 AnalyzeTags::AnalyzeTags(std::istringstream& cmdstream, const GameState& game) {
@@ -271,6 +317,11 @@ AnalyzeTags::AnalyzeTags(std::istringstream& cmdstream, const GameState& game) {
             if (cmdstream.fail()) {
                 return;
             }
+        } else if (tag == "maxmoves") {
+            cmdstream >> m_max_moves;
+            if (cmdstream.fail()) {
+                return;
+            }
         } else {
             return;
         }
@@ -301,6 +352,11 @@ size_t AnalyzeTags::post_move_count() const {
     return m_min_moves;
 }
 
+// 0 means all of them.
+size_t AnalyzeTags::max_move_count() const {
+    return m_max_moves;
+}
+
 bool AnalyzeTags::is_to_avoid(int color, int vertex, size_t movenum) const {
     for (auto& move : m_moves_to_avoid) {
         if (color == move.color && vertex == move.vertex && movenum <= move.until_move) {
@@ -329,6 +385,8 @@ bool AnalyzeTags::has_move_restrictions() const {
 }
 
 std::unique_ptr<Network> GTP::s_network;
+std::vector<std::unique_ptr<Network>> GTP::s_networks(1);
+size_t GTP::s_current_network = 0;
 
 void GTP::initialize(std::unique_ptr<Network>&& net) {
     s_network = std::move(net);
@@ -351,12 +409,18 @@ void GTP::setup_default_parameters() {
     cfg_gtp_mode = false;
     cfg_japanese_mode = false;
     cfg_use_nncache = true;
+    cfg_compact_nncache = false;
+    cfg_canonical_nncache = false;
+    cfg_shared_cache_file = "";
+    cfg_shared_cache_mib = NNSharedCache::DEFAULT_SIZE_MIB;
+    cfg_opening_book = "";
     cfg_allow_pondering = true;
 
     // we will re-calculate this on Leela.cpp
     cfg_num_threads = 1;
     // we will re-calculate this on Leela.cpp
     cfg_batch_size = 1;
+    cfg_batch_latency = 0;
 
     cfg_max_memory = UCTSearch::DEFAULT_MAX_MEMORY;
     cfg_max_playouts = UCTSearch::UNLIMITED_PLAYOUTS;
@@ -383,14 +447,20 @@ void GTP::setup_default_parameters() {
     cfg_max_cache_ratio_percent = 10;
     cfg_timemanage = TimeManagement::AUTO;
     cfg_lagbuffer_cs = 100;
+    cfg_time_extension = 1.0f;
     cfg_weightsfile = leelaz_file("best-network");
 #ifdef USE_OPENCL
     cfg_gpus = { };
     cfg_sgemm_exhaustive = false;
     cfg_tune_only = false;
+    cfg_tune_time = 0;
+    cfg_tuner_file = "";
+    cfg_tuner_export = "";
 
 #ifdef USE_HALF
     cfg_precision = precision_t::AUTO;
+    cfg_recheck_precision = false;
+    cfg_half_no_selfcheck = false;
 #endif
 #endif
     cfg_policy_temp = 1.0f;
@@ -400,6 +470,18 @@ void GTP::setup_default_parameters() {
     cfg_exploit_symmetries = true;
     cfg_symm_nonrandom = true;
     cfg_laddercode = true;
+    cfg_transpositions = false;
+    cfg_prune_tree = false;
+    cfg_expand_wait = true;
+    cfg_deterministic = false;
+    cfg_virtual_loss = UCTNode::VIRTUAL_LOSS_COUNT;
+    cfg_adaptive_vl = false;
+    cfg_lcb_stop = false;
+    cfg_score_stop = 0.0f;
+    cfg_root_split = 1;
+    cfg_widening = 0;
+    cfg_ponder_replies = 0;
+    cfg_policy_rollouts = 0;
     cfg_pass_agree = false;
     cfg_fpuzero = false;
     cfg_fpuavg = true;
@@ -408,6 +490,9 @@ void GTP::setup_default_parameters() {
     cfg_noise_value = 0.03;
     cfg_noise_weight = 0.25;
     cfg_recordvisits = true;
+    cfg_max_training_steps = 0;
+    cfg_binary_chunks = false;
+    cfg_chunk_compression = 9;
     cfg_blunder_thr = 1.0f;
     cfg_losing_thr = 0.05f;
     // nu = ln(4) => P(X=0) = 0.25
@@ -428,16 +513,29 @@ void GTP::setup_default_parameters() {
     cfg_random_cnt = 0;
     cfg_random_min_visits = 1;
     cfg_random_temp = 1.0f;
+    cfg_fast_visits = 0;
+    cfg_full_search_prob = 0.25f;
     cfg_restrict_tt = false;
     cfg_dumbpass = false;
     cfg_logfile_handle = nullptr;
     cfg_quiet = false;
     cfg_benchmark = false;
+    cfg_profile_search = false;
+    cfg_numa = false;
+    cfg_metrics_interval = 0;
+    cfg_server_port = 0;
+    cfg_server_address = "127.0.0.1";
+    cfg_remote_workers = { };
+    cfg_analyze_sgf.clear();
+    cfg_analyze_parallel = 4;
+    cfg_nn_server_file = "";
+    cfg_nn_client_file = "";
 #ifdef USE_CPU_ONLY
     cfg_cpu_only = true;
 #else
     cfg_cpu_only = false;
 #endif
+    cfg_int8 = false;
 
     cfg_analyze_tags = AnalyzeTags{};
 
@@ -489,6 +587,18 @@ const std::string GTP::s_commands[] = {
     "lz-memory_report",
     "lz-setoption",
     "lz-search_reset",
+    "sai-batchstats",
+    "sai-network_hash",
+    "sai-profile",
+    "sai-loadnet",
+    "sai-makebook",
+    "sai-savetree",
+    "sai-loadtree",
+    "sai-selfplay",
+    "sai-addnet",
+    "sai-usenet",
+    "sai-match",
+    "sai-komi_curve",
     "gomill-explain_last_move",
     ""
 };
@@ -537,12 +647,12 @@ std::string GTP::get_life_list(const GameState & game, bool live) {
 }
 
 void GTP::execute(GameState & game, const std::string& xinput) {
-    std::string input;
     static auto search = std::make_unique<UCTSearch>(game, *s_network);
+    execute(game, xinput, search);
+}
 
-    // Maybe something changed resignpct, so recompute threshold
-    cfg_resign_threshold =
-        0.01f * (cfg_resignpct < -0.5f ? 10.0f : cfg_resignpct);
+std::pair<int, std::string> GTP::parse_input(const std::string& xinput) {
+    std::string input;
 
     bool transform_lowercase = true;
 
@@ -579,12 +689,8 @@ void GTP::execute(GameState & game, const std::string& xinput) {
     std::string command;
     int id = -1;
 
-    if (input == "") {
-        return;
-    } else if (input == "exit") {
-        exit(EXIT_SUCCESS);
-    } else if (input.find("#") == 0) {
-        return;
+    if (input == "" || input.find("#") == 0) {
+        return {id, command};
     } else if (std::isdigit(input[0])) {
         std::istringstream strm(input);
         char spacer;
@@ -594,6 +700,24 @@ void GTP::execute(GameState & game, const std::string& xinput) {
     } else {
         command = input;
     }
+    return {id, command};
+}
+
+void GTP::execute(GameState & game, const std::string& xinput,
+                  std::unique_ptr<UCTSearch>& search) {
+    // Maybe something changed resignpct, so recompute threshold
+    cfg_resign_threshold =
+        0.01f * (cfg_resignpct < -0.5f ? 10.0f : cfg_resignpct);
+
+    const auto parsed = parse_input(xinput);
+    const auto id = parsed.first;
+    const auto& command = parsed.second;
+
+    if (id == -1 && command == "") {
+        return;
+    } else if (id == -1 && command == "exit") {
+        exit(EXIT_SUCCESS);
+    }
 
     /* process commands */
     if (command == "protocol_version") {
@@ -756,7 +880,7 @@ void GTP::execute(GameState & game, const std::string& xinput) {
             // now start pondering
             if (!game.has_resigned()) {
                 // Outputs winrate and pvs through gtp for lz-genmove_analyze
-                search->ponder();
+                search->ponder(true);
             }
         }
         if (analysis_output) {
@@ -819,7 +943,7 @@ void GTP::execute(GameState & game, const std::string& xinput) {
             if (cfg_allow_pondering) {
                 // now start pondering
                 if (!game.has_resigned()) {
-                    search->ponder();
+                    search->ponder(true);
                 }
             }
         } else {
@@ -858,18 +982,11 @@ void GTP::execute(GameState & game, const std::string& xinput) {
         game.board.display_chainsize();
         return;
     } else if (command.find("final_score") == 0) {
-        float ftmp;
-        if (cfg_japanese_mode) {
-            ftmp = search->final_japscore();
-            if (ftmp > NUM_INTERSECTIONS * 10.0) {
-                gtp_fail_printf(id, "japanese scoring failed "
-                                "while trying to remove dead groups");
-                return;
-            }
-        } else if (cfg_pass_agree && game.score_agreed()) {
-            ftmp = game.get_final_accepted_score();
-        } else {
-            ftmp = game.final_score();
+        const auto ftmp = get_final_score(game, *search);
+        if (ftmp > NUM_INTERSECTIONS * 10.0) {
+            gtp_fail_printf(id, "japanese scoring failed "
+                            "while trying to remove dead groups");
+            return;
         }
         /* white wins */
         if (ftmp < -0.0001f) {
@@ -934,7 +1051,7 @@ void GTP::execute(GameState & game, const std::string& xinput) {
                 // KGS sends this after our move
                 // now start pondering
                 if (!game.has_resigned()) {
-                    search->ponder();
+                    search->ponder(true);
                 }
             }
         } else {
@@ -1390,14 +1507,26 @@ void GTP::execute(GameState & game, const std::string& xinput) {
 
         // tmp will eat dump_supervised
         cmdstream >> tmp >> sgfname >> outname;
+        if (cmdstream.fail()) {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
 
-        Training::dump_supervised(sgfname, outname);
-
-        if (!cmdstream.fail()) {
-            gtp_printf(id, "");
+        // Optionally the number of threads, and "ordered" to write
+        // the same chunks as with a single thread.
+        auto threads = size_t{1};
+        auto ordered = false;
+        std::string order;
+        cmdstream >> threads;
+        if (cmdstream.fail()) {
+            threads = 1;
         } else {
-            gtp_fail_printf(id, "syntax not understood");
+            cmdstream >> order;
+            ordered = (order == "ordered");
         }
+
+        Training::dump_supervised(sgfname, outname, threads, ordered);
+        gtp_printf(id, "");
         return;
     } else if (command.find("lz-memory_report") == 0) {
         auto base_memory = get_base_memory();
@@ -1405,13 +1534,317 @@ void GTP::execute(GameState & game, const std::string& xinput) {
         auto cache_size = add_overhead(s_network->get_estimated_cache_size());
 
         auto total = base_memory + tree_size + cache_size;
+        s_network->nncache_dump_stats();
         gtp_printf(id,
             "Estimated total memory consumption: %d MiB.\n"
-            "Network with overhead: %d MiB / Search tree: %d MiB / Network cache: %d\n",
-            total / MiB, base_memory / MiB, tree_size / MiB, cache_size / MiB);
+            "Network with overhead: %d MiB / Search tree: %d MiB / Network cache: %d\n"
+            "Tracked allocations:\n%s",
+            total / MiB, base_memory / MiB, tree_size / MiB, cache_size / MiB,
+            MemoryTracker::report().c_str());
         return;
     } else if (command.find("lz-setoption") == 0) {
         return execute_setoption(*search.get(), id, command);
+    } else if (command.find("sai-batchstats") == 0) {
+        const auto stats = s_network->get_forward_stats();
+        if (stats.empty()) {
+            gtp_fail_printf(id, "no batching statistics for this backend");
+        } else {
+            gtp_printf(id, "%s", stats.c_str());
+        }
+        return;
+    } else if (command.find("sai-network_hash") == 0) {
+        gtp_printf(id, "%016llx",
+                   static_cast<unsigned long long>(s_network->get_network_hash()));
+        return;
+    } else if (command.find("sai-profile") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, mode;
+
+        cmdstream >> tmp >> mode;
+        if (mode.empty()) {
+            // The profile of the last search.
+            gtp_printf(id, "%s", SearchProfiler::report().c_str());
+            return;
+        }
+        // on and off take effect with the next search.
+        if (mode == "on") {
+            cfg_profile_search = true;
+        } else if (mode == "off") {
+            cfg_profile_search = false;
+        } else if (mode == "reset") {
+            SearchProfiler::reset();
+        } else {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
+        gtp_printf(id, "");
+        return;
+    } else if (command.find("sai-loadnet") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, filename;
+
+        cmdstream >> tmp;
+        std::getline(cmdstream >> std::ws, filename);
+        if (filename.empty()) {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
+
+        // The tree holds evaluations of the old network.
+        search.reset();
+        auto playouts = std::min(cfg_max_playouts, cfg_max_visits);
+        auto network = s_network->load_replacement(playouts, filename);
+        if (network == nullptr) {
+            search = std::make_unique<UCTSearch>(game, *s_network);
+            gtp_fail_printf(id, "cannot load weights file");
+            return;
+        }
+        const auto was_sai = s_network->m_value_head_sai;
+        {
+            std::lock_guard<std::mutex> lock(MetricsReporter::network_mutex());
+            s_network = std::move(network);
+        }
+        cfg_weightsfile = filename;
+        set_max_memory(cfg_max_memory, cfg_max_cache_ratio_percent);
+        if (s_network->m_value_head_sai != was_sai) {
+            game.init_game(game.board.get_boardsize(), game.get_komi(),
+                           s_network->m_value_head_sai);
+        }
+        search = std::make_unique<UCTSearch>(game, *s_network);
+        gtp_printf(id, "");
+        return;
+    } else if (command.find("sai-addnet") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, filename;
+
+        cmdstream >> tmp;
+        std::getline(cmdstream >> std::ws, filename);
+        if (filename.empty()) {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
+        const auto playouts = std::min(cfg_max_playouts, cfg_max_visits);
+        auto network = Network::load_additional(playouts, filename);
+        if (network == nullptr) {
+            gtp_fail_printf(id, "cannot load weights file");
+            return;
+        }
+        if (network->m_value_head_sai != s_network->m_value_head_sai) {
+            gtp_fail_printf(id, "value head differs from the current network");
+            return;
+        }
+        s_networks.emplace_back(std::move(network));
+        gtp_printf(id, "%zu", s_networks.size() - 1);
+        return;
+    } else if (command.find("sai-usenet") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp;
+        size_t index;
+
+        cmdstream >> tmp >> index;
+        if (cmdstream.fail() || index >= s_networks.size()) {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
+        if (index != s_current_network) {
+            // The tree holds evaluations of the other network.
+            search.reset();
+            {
+                std::lock_guard<std::mutex> lock(MetricsReporter::network_mutex());
+                s_networks[s_current_network] = std::move(s_network);
+                s_network = std::move(s_networks[index]);
+            }
+            s_current_network = index;
+            search = std::make_unique<UCTSearch>(game, *s_network);
+        }
+        gtp_printf(id, "");
+        return;
+    } else if (command.find("sai-match") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, prefix;
+        size_t index;
+        int count, parallel;
+
+        cmdstream >> tmp >> index >> count >> parallel >> prefix;
+        if (cmdstream.fail() || index >= s_networks.size()
+            || index == s_current_network || count < 1 || parallel < 1) {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
+        auto& opponent = *s_networks[index];
+
+        search.reset();
+        parallel = std::min(parallel, count);
+        const auto threads = size_t(parallel) * (cfg_num_threads + 1);
+        while (thread_pool.size() < threads) {
+            const auto thread = thread_pool.size();
+            thread_pool.add_thread([thread]() { Numa::bind_thread(thread); });
+        }
+
+        // Both networks evaluate the positions of all the games, so
+        // that the batches of each fill up from the games where it is
+        // to move.
+        auto results = std::vector<std::pair<std::string, int>>(count);
+        std::atomic<int> next{0};
+        ThreadGroup tg(thread_pool);
+        for (auto i = 0; i < parallel; i++) {
+            tg.add_task([&results, &next, &opponent, count, &prefix]() {
+                for (auto n = next++; n < count; n = next++) {
+                    results[n] = play_match_game(
+                        *s_network, opponent, n % 2 == 0,
+                        prefix + "-" + std::to_string(n));
+                }
+            });
+        }
+        tg.wait_all();
+        search = std::make_unique<UCTSearch>(game, *s_network);
+
+        auto wins = 0;
+        auto losses = 0;
+        auto out = std::string{};
+        for (auto n = 0; n < count; n++) {
+            out += prefix + "-" + std::to_string(n) + " "
+                + results[n].first + "\n";
+            wins += results[n].second > 0;
+            losses += results[n].second < 0;
+        }
+        out += str(boost::format("%d wins, %d losses, %d other")
+                   % wins % losses % (count - wins - losses));
+        gtp_printf(id, "%s", out.c_str());
+        return;
+    } else if (command.find("sai-makebook") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, filename;
+        int depth = 6;
+        int width = 3;
+
+        cmdstream >> tmp >> filename;
+        if (cmdstream >> depth) {
+            cmdstream >> width;
+        }
+        if (filename.empty() || depth < 0 || width < 1) {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
+
+        const auto positions = NNOpeningBook::generate(*s_network, game,
+                                                       depth, width, filename);
+        if (positions == 0) {
+            gtp_fail_printf(id, "cannot write opening book");
+            return;
+        }
+        gtp_printf(id, "%zu positions", positions);
+        return;
+    } else if (command.find("sai-savetree") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, filename;
+        float min_policy = 0.0f;
+
+        // The file name is the rest of the line, as for sai-loadtree,
+        // but for a last word that is the minimum policy.
+        cmdstream >> tmp;
+        std::getline(cmdstream >> std::ws, filename);
+        const auto last = filename.find_last_of(" \t");
+        if (last != std::string::npos) {
+            std::istringstream policystream(filename.substr(last + 1));
+            auto policy = 0.0f;
+            if (policystream >> policy && policystream.eof()) {
+                min_policy = policy;
+                filename.erase(filename.find_last_not_of(" \t", last) + 1);
+            }
+        }
+        if (filename.empty() || min_policy < 0.0f) {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
+
+        const auto nodes = search->save_tree(filename, min_policy);
+        if (nodes == 0) {
+            gtp_fail_printf(id, "cannot save search tree");
+            return;
+        }
+        gtp_printf(id, "%zu nodes", nodes);
+        return;
+    } else if (command.find("sai-loadtree") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, filename;
+
+        cmdstream >> tmp;
+        std::getline(cmdstream >> std::ws, filename);
+        if (filename.empty()) {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
+
+        const auto nodes = search->load_tree(filename);
+        if (nodes == 0) {
+            gtp_fail_printf(id, "cannot load search tree");
+            return;
+        }
+        gtp_printf(id, "%zu nodes", nodes);
+        return;
+    } else if (command.find("sai-selfplay") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp, prefix;
+        int count, parallel;
+
+        cmdstream >> tmp >> count >> parallel >> prefix;
+        if (cmdstream.fail() || count < 1 || parallel < 1) {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
+
+        // Drop the tree of the current game, as the self-play trees
+        // need the memory.
+        search.reset();
+        UCTSearch::reset_move_cost();
+        const auto results = play_selfplay_games(count, parallel, prefix);
+        myprintf("Self-play: %s.\n", UCTSearch::move_cost_report().c_str());
+        search = std::make_unique<UCTSearch>(game, *s_network);
+
+        auto out = std::string{};
+        for (auto i = size_t{0}; i < results.size(); i++) {
+            if (i > 0) {
+                out += "\n";
+            }
+            out += results[i];
+        }
+        gtp_printf(id, "%s", out.c_str());
+        return;
+    } else if (command.find("sai-komi_curve") == 0) {
+        std::istringstream cmdstream(command);
+        std::string tmp;
+        auto komi = std::vector<float>{};
+        auto k = 0.0f;
+
+        cmdstream >> tmp;   // eat sai-komi_curve
+        while (cmdstream >> k) {
+            komi.emplace_back(k);
+        }
+        if (komi.empty() || !cmdstream.eof()) {
+            gtp_fail_printf(id, "syntax not understood");
+            return;
+        }
+        if (!s_network->m_value_head_sai) {
+            gtp_fail_printf(id, "komi curve needs a network with SAI value head");
+            return;
+        }
+
+        // One search at the komi of the game, rescored at every komi,
+        // without playing the move.
+        search->set_komi_curve(komi);
+        search->think(game.get_to_move(), UCTSearch::NORESIGN);
+        const auto curve = search->get_komi_curve();
+        search->set_komi_curve({});
+
+        auto out = std::string{};
+        for (const auto& point : curve) {
+            out += str(boost::format("%s%.1f %.4f")
+                       % (out.empty() ? "" : "\n")
+                       % point.first % point.second);
+        }
+        gtp_printf(id, "%s", out.c_str());
+        return;
     } else if (command.find("lz-search_reset") == 0) {
         search = std::make_unique<UCTSearch>(game, *s_network);
         return;
@@ -1423,6 +1856,230 @@ void GTP::execute(GameState & game, const std::string& xinput) {
     return;
 }
 
+float GTP::get_final_score(GameState& game, UCTSearch& search) {
+    if (cfg_japanese_mode) {
+        return search.final_japscore();
+    } else if (cfg_pass_agree && game.score_agreed()) {
+        return game.get_final_accepted_score();
+    }
+    return game.final_score();
+}
+
+std::string GTP::play_selfplay_game(const std::string& filename) {
+    GameState game;
+    game.init_game(BOARD_SIZE, cfg_komi, s_network->m_value_head_sai);
+    game.set_timecontrol(0, 1, 0, 0);  // Set infinite time.
+    auto search = std::make_unique<UCTSearch>(game, *s_network);
+    Training::clear_training();
+
+    // Same end of game as autogtp.
+    while (!game.has_resigned() && game.get_passes() < 2
+           && game.get_movenum() <= 2 * NUM_INTERSECTIONS) {
+        const auto who = game.get_to_move();
+        game.set_cpu_color(FastBoard::THIS_COLOR);
+        game.play_move(search->think(who));
+    }
+
+    int who_won = FullBoard::EMPTY;
+    auto result = std::string{"0"};
+    if (game.has_resigned()) {
+        who_won = !game.who_resigned();
+        result = who_won == FastBoard::BLACK ? "B+Resign" : "W+Resign";
+    } else {
+        const auto score = get_final_score(game, *search);
+        if (score > NUM_INTERSECTIONS * 10.0) {
+            result = "?";
+        } else if (score < -0.0001f) {
+            who_won = FullBoard::WHITE;
+            result = str(boost::format("W+%3.1f") % -score);
+        } else if (score > 0.0001f) {
+            who_won = FullBoard::BLACK;
+            result = str(boost::format("B+%3.1f") % score);
+        }
+    }
+
+    auto sgf = std::ofstream{filename + ".sgf"};
+    sgf << SGFTree::state_to_string(game, 0);
+    sgf.close();
+    const auto sgfhash = SHA256::sha256(SGFTree::state_to_string(game, 0, true));
+    Training::dump_training(who_won, filename, sgfhash);
+    Training::clear_training();
+
+    return filename + " " + result;
+}
+
+std::pair<std::string, int> GTP::play_match_game(
+    Network& first, Network& second, const bool first_black,
+    const std::string& filename) {
+    GameState game;
+    game.init_game(BOARD_SIZE, cfg_komi, first.m_value_head_sai);
+    game.set_timecontrol(0, 1, 0, 0);  // Set infinite time.
+    // A tree for each network, both on the game.
+    auto first_search = std::make_unique<UCTSearch>(game, first);
+    auto second_search = std::make_unique<UCTSearch>(game, second);
+    const auto first_color = first_black ? FastBoard::BLACK : FastBoard::WHITE;
+
+    while (!game.has_resigned() && game.get_passes() < 2
+           && game.get_movenum() <= 2 * NUM_INTERSECTIONS) {
+        const auto who = game.get_to_move();
+        auto& search = who == first_color ? first_search : second_search;
+        game.set_cpu_color(FastBoard::THIS_COLOR);
+        game.play_move(search->think(who));
+        Training::clear_training();
+    }
+
+    int who_won = FullBoard::EMPTY;
+    auto result = std::string{"0"};
+    if (game.has_resigned()) {
+        who_won = !game.who_resigned();
+        result = who_won == FastBoard::BLACK ? "B+Resign" : "W+Resign";
+    } else {
+        const auto score = get_final_score(game, *first_search);
+        if (score > NUM_INTERSECTIONS * 10.0) {
+            result = "?";
+        } else if (score < -0.0001f) {
+            who_won = FullBoard::WHITE;
+            result = str(boost::format("W+%3.1f") % -score);
+        } else if (score > 0.0001f) {
+            who_won = FullBoard::BLACK;
+            result = str(boost::format("B+%3.1f") % score);
+        }
+    }
+
+    auto sgf = std::ofstream{filename + ".sgf"};
+    sgf << SGFTree::state_to_string(game, 0);
+
+    auto winner = 0;
+    if (who_won == first_color) {
+        winner = 1;
+    } else if (who_won != FullBoard::EMPTY) {
+        winner = -1;
+    }
+    return {result, winner};
+}
+
+std::vector<std::string> GTP::play_selfplay_games(int count, int parallel,
+                                                  const std::string& prefix) {
+    parallel = std::min(parallel, count);
+
+    // Every game searches with cfg_num_threads threads of its own, and
+    // all of them share the network, so that its batches fill up with
+    // positions from all the games.
+    const auto threads = size_t(parallel) * (cfg_num_threads + 1);
+    while (thread_pool.size() < threads) {
+        const auto index = thread_pool.size();
+        thread_pool.add_thread([index]() { Numa::bind_thread(index); });
+    }
+
+    auto results = std::vector<std::string>(count);
+    std::atomic<int> next{0};
+    ThreadGroup tg(thread_pool);
+    for (auto i = 0; i < parallel; i++) {
+        tg.add_task([&results, &next, count, &prefix]() {
+            for (auto n = next++; n < count; n = next++) {
+                results[n] = play_selfplay_game(prefix + "-" + std::to_string(n));
+            }
+        });
+    }
+    tg.wait_all();
+    return results;
+}
+
+void GTP::analyze_sgf_file(const std::string& filename,
+                           std::mutex& output_mutex) {
+    auto quoted = std::string{"\""};
+    for (const auto c : filename) {
+        if (c == '"' || c == '\\') {
+            quoted.push_back('\\');
+        }
+        quoted.push_back(c);
+    }
+    quoted.push_back('"');
+
+    auto sgftree = SGFTree{};
+    try {
+        sgftree.load_from_file(filename);
+    } catch (const std::exception&) {
+        std::lock_guard<std::mutex> lock(output_mutex);
+        std::cout << "{\"file\": " << quoted
+                  << ", \"error\": \"cannot load file\"}" << std::endl;
+        return;
+    }
+
+    auto game = sgftree.follow_mainline_state(0);
+    game.set_timecontrol(0, 1, 0, 0);  // Set infinite time.
+    // One search for the whole game, so that the tree of each position
+    // carries over to the next one.
+    auto search = std::make_unique<UCTSearch>(game, *s_network);
+    search->set_record_training(false);
+    const auto is_sai = s_network->m_value_head_sai;
+
+    for (auto link = sgftree.get_child(0); link != nullptr;
+         link = link->get_child(0)) {
+        const auto colored_move = link->get_colored_move();
+        if (colored_move.first == FastBoard::INVAL) {
+            continue;
+        }
+        const auto color = colored_move.first;
+        const auto played = colored_move.second;
+
+        game.set_to_move(color);
+        const auto best = search->think(color, UCTSearch::NORESIGN);
+        const auto summary = search->get_root_summary();
+
+        auto line = str(boost::format("{\"file\": %s, \"move\": %d, "
+                                      "\"color\": \"%c\", \"played\": \"%s\", "
+                                      "\"best\": \"%s\", \"visits\": %d, "
+                                      "\"winrate\": %.4f")
+                        % quoted % (game.get_movenum() + 1)
+                        % (color == FastBoard::BLACK ? 'b' : 'w')
+                        % game.move_to_text(played)
+                        % game.move_to_text(best)
+                        % summary.visits % summary.winrate);
+        if (is_sai) {
+            line += str(boost::format(", \"alpkt\": %.2f, \"beta\": %.4f, "
+                                      "\"score\": %.2f")
+                        % summary.alpkt % summary.beta % summary.score);
+        }
+        line += str(boost::format(", \"pv\": \"%s\"}") % summary.pv);
+        {
+            std::lock_guard<std::mutex> lock(output_mutex);
+            std::cout << line << std::endl;
+        }
+
+        // Stop at an illegal move: occupied point, ko or suicide.
+        if (!game.is_move_legal(color, played)) {
+            break;
+        }
+        game.play_move(color, played);
+    }
+}
+
+void GTP::analyze_sgf_files(const std::vector<std::string>& files,
+                            int parallel) {
+    parallel = std::max(1, std::min(parallel, int(files.size())));
+
+    // As in play_selfplay_games(), every game searches with threads of
+    // its own and the batches of the network fill up from all of them.
+    const auto threads = size_t(parallel) * (cfg_num_threads + 1);
+    while (thread_pool.size() < threads) {
+        const auto index = thread_pool.size();
+        thread_pool.add_thread([index]() { Numa::bind_thread(index); });
+    }
+
+    std::mutex output_mutex;
+    std::atomic<size_t> next{0};
+    ThreadGroup tg(thread_pool);
+    for (auto i = 0; i < parallel; i++) {
+        tg.add_task([&files, &next, &output_mutex]() {
+            for (auto n = next++; n < files.size(); n = next++) {
+                analyze_sgf_file(files[n], output_mutex);
+            }
+        });
+    }
+    tg.wait_all();
+}
+
 std::pair<std::string, std::string> GTP::parse_option(std::istringstream& is) {
     std::string token, name, value;
 
@@ -1470,7 +2127,7 @@ std::pair<bool, std::string> GTP::set_max_memory(size_t max_memory,
     auto max_cache_size = (max_memory_for_search / 100) * cache_size_ratio_percent;
 
     auto max_cache_count =
-        (int)(remove_overhead(max_cache_size) / NNCache::ENTRY_SIZE);
+        (int)(remove_overhead(max_cache_size) / s_network->get_nncache_entry_size());
 
     // Verify if the setting would not result in too little cache.
     if (max_cache_count < NNCache::MIN_CACHE_COUNT) {
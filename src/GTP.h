@@ -34,7 +34,9 @@
 #include "config.h"
 
 #include <cstdio>
+#include <mutex>
 #include <string>
+#include <utility>
 #include <vector>
 
 #include "Network.h"
@@ -69,6 +71,7 @@ public:
     int invalid() const;
     int who() const;
     size_t post_move_count() const;
+    size_t max_move_count() const;
     bool is_to_avoid(int color, int vertex, size_t movenum) const;
     bool has_move_restrictions() const;
 
@@ -78,14 +81,21 @@ private:
     int m_interval_centis{0};
     int m_who{FastBoard::INVAL};
     size_t m_min_moves{0};
+    size_t m_max_moves{0};
 };
 
 extern bool cfg_gtp_mode;
 extern bool cfg_japanese_mode;
 extern bool cfg_use_nncache;
+extern bool cfg_compact_nncache;
+extern bool cfg_canonical_nncache;
+extern std::string cfg_shared_cache_file;
+extern size_t cfg_shared_cache_mib;
+extern std::string cfg_opening_book;
 extern bool cfg_allow_pondering;
 extern unsigned int cfg_num_threads;
 extern unsigned int cfg_batch_size;
+extern int cfg_batch_latency;
 extern int cfg_max_playouts;
 extern int cfg_max_visits;
 extern size_t cfg_max_memory;
@@ -93,6 +103,7 @@ extern size_t cfg_max_tree_size;
 extern int cfg_max_cache_ratio_percent;
 extern TimeManagement::enabled_t cfg_timemanage;
 extern int cfg_lagbuffer_cs;
+extern float cfg_time_extension;
 extern float cfg_resignpct;
 extern float cfg_resign_threshold;
 extern int cfg_noise;
@@ -106,6 +117,18 @@ extern bool cfg_chainsize_features;
 extern bool cfg_exploit_symmetries;
 extern bool cfg_symm_nonrandom;
 extern bool cfg_laddercode;
+extern bool cfg_transpositions;
+extern bool cfg_prune_tree;
+extern bool cfg_expand_wait;
+extern bool cfg_deterministic;
+extern int cfg_virtual_loss;
+extern bool cfg_adaptive_vl;
+extern bool cfg_lcb_stop;
+extern float cfg_score_stop;
+extern unsigned int cfg_root_split;
+extern size_t cfg_widening;
+extern size_t cfg_ponder_replies;
+extern int cfg_policy_rollouts;
 extern bool cfg_pass_agree;
 extern float cfg_noise_value;
 extern float cfg_noise_weight;
@@ -118,19 +141,31 @@ extern float cfg_betatune;
 extern int cfg_random_cnt;
 extern int cfg_random_min_visits;
 extern float cfg_random_temp;
+extern int cfg_fast_visits;
+extern float cfg_full_search_prob;
 extern std::uint64_t cfg_rng_seed;
 extern bool cfg_dumbpass;
 extern bool cfg_restrict_tt;
 extern bool cfg_recordvisits;
+extern size_t cfg_max_training_steps;
+extern bool cfg_binary_chunks;
+extern int cfg_chunk_compression;
 #ifdef USE_OPENCL
 extern std::vector<int> cfg_gpus;
 extern bool cfg_sgemm_exhaustive;
 extern bool cfg_tune_only;
+extern int cfg_tune_time;
+extern std::string cfg_tuner_file;
+extern std::string cfg_tuner_export;
 #ifdef USE_HALF
 enum class precision_t {
     AUTO, SINGLE, HALF
 };
 extern precision_t cfg_precision;
+extern bool cfg_recheck_precision;
+// Free the single precision reference of the self-check once half
+// precision is selected, which turns the self-check off.
+extern bool cfg_half_no_selfcheck;
 #endif
 #endif
 extern float cfg_puct;
@@ -148,11 +183,23 @@ extern FILE* cfg_logfile_handle;
 extern bool cfg_quiet;
 extern std::string cfg_options_str;
 extern bool cfg_benchmark;
+extern bool cfg_profile_search;
+extern bool cfg_numa;
+extern int cfg_metrics_interval;
+extern int cfg_server_port;
+extern std::string cfg_server_address;
+extern std::vector<std::string> cfg_remote_workers;
+extern std::vector<std::string> cfg_analyze_sgf;
+extern int cfg_analyze_parallel;
+extern std::string cfg_nn_server_file;
+extern std::string cfg_nn_client_file;
 extern bool cfg_cpu_only;
+extern bool cfg_int8;
 extern float cfg_blunder_thr;
 extern float cfg_losing_thr;
 extern float cfg_blunder_rndmax_avg;
-extern AnalyzeTags cfg_analyze_tags;
+// Set by the GTP thread of each session and handed to its search workers.
+extern thread_local AnalyzeTags cfg_analyze_tags;
 
 static constexpr size_t MiB = 1024LL * 1024LL;
 
@@ -164,14 +211,41 @@ static constexpr size_t MiB = 1024LL * 1024LL;
 class GTP {
 public:
     static std::unique_ptr<Network> s_network;
+    // The networks loaded with sai-addnet. The slot of the network in
+    // use, s_current_network, is empty: that one is s_network.
+    static std::vector<std::unique_ptr<Network>> s_networks;
+    static size_t s_current_network;
     static void initialize(std::unique_ptr<Network>&& network);
     static void execute(GameState & game, const std::string& xinput);
+    // Same, for a session that keeps a search of its own.
+    static void execute(GameState & game, const std::string& xinput,
+                        std::unique_ptr<UCTSearch>& search);
+    // The id, or -1, and the command of a GTP line, cleaned up the way
+    // execute() does before dispatching on it. The command is empty for
+    // an empty line or a comment.
+    static std::pair<int, std::string> parse_input(const std::string& xinput);
     static void setup_default_parameters();
     static void adjust_komi(GameState & game);
+    // Search every position of the main line of these SGF files, up to
+    // parallel games at a time sharing the network, and print one JSON
+    // line per position to stdout as soon as it is searched.
+    static void analyze_sgf_files(const std::vector<std::string>& files,
+                                  int parallel);
 private:
     static constexpr int GTP_VERSION = 2;
 
     static std::string get_life_list(const GameState & game, bool live);
+    static float get_final_score(GameState & game, UCTSearch & search);
+    static std::string play_selfplay_game(const std::string& filename);
+    static std::vector<std::string> play_selfplay_games(
+        int count, int parallel, const std::string& prefix);
+    // Game of first against second, first playing black if first_black.
+    // Returns the result and +1 if first won, -1 if second did, or 0.
+    static std::pair<std::string, int> play_match_game(
+        Network& first, Network& second, bool first_black,
+        const std::string& filename);
+    static void analyze_sgf_file(const std::string& filename,
+                                 std::mutex& output_mutex);
     static const std::string s_commands[];
     static const std::string s_options[];
     static std::pair<std::string, std::string> parse_option(
@@ -0,0 +1,221 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#include "config.h"
+#include "GTPServer.h"
+
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#include <csignal>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include "GTP.h"
+#include "GameState.h"
+#include "Numa.h"
+#include "ThreadPool.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+std::atomic<int> GTPServer::s_sessions{0};
+
+#ifndef _WIN32
+// Longer than any command a client needs to send.
+static constexpr auto MAX_LINE_LENGTH = size_t{64 * 1024};
+
+static bool is_quit(const std::string& command) {
+    auto name = std::string{};
+    std::istringstream{command} >> name;
+    return name == "quit" || name == "exit";
+}
+#endif
+
+// Commands that replace the network or take over the thread pool, and
+// the ones that write files, which anyone reaching the port could point
+// anywhere the server can write. GTP::execute() dispatches on the start
+// of the command, so it is matched here the same way. printsgf without
+// a file name only prints.
+bool GTPServer::is_refused(const std::string& command) {
+    static const auto refused = std::vector<std::string>{
+        "sai-loadnet", "sai-addnet", "sai-usenet", "sai-selfplay", "sai-match", "sai-makebook",
+        "sai-savetree", "eval", "save_training", "dump_training",
+        "dump_debug", "dump_supervised"
+    };
+    if (command.find("printsgf") == 0) {
+        auto is = std::istringstream{command};
+        auto word = std::string{};
+        auto words = 0;
+        while (is >> word) {
+            words++;
+        }
+        return words > 1;
+    }
+    for (const auto& prefix : refused) {
+        if (command.find(prefix) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+void GTPServer::session(int fd) {
+#ifndef _WIN32
+    ++s_sessions;
+    auto in = fdopen(fd, "r");
+    auto out = fdopen(dup(fd), "w");
+    setvbuf(out, nullptr, _IOLBF, 0);
+
+    // The reader stops after quit, so that it can be joined.
+    Utils::InputQueue input;
+    auto quit = false;
+    input.start([in, &quit](std::string& line) {
+        if (quit) {
+            return false;
+        }
+        if (!read_line(in, line, MAX_LINE_LENGTH)) {
+            if (line.size() > MAX_LINE_LENGTH) {
+                myprintf_error("Dropping a session sending a line over "
+                               "%zu bytes.\n", MAX_LINE_LENGTH);
+            }
+            return false;
+        }
+        quit = is_quit(GTP::parse_input(line).second);
+        return true;
+    });
+
+    Utils::set_session_io(&input, out);
+    {
+        GameState game;
+        game.init_game(BOARD_SIZE, cfg_komi,
+                       GTP::s_network->m_value_head_sai);
+        auto search = std::make_unique<UCTSearch>(game, *GTP::s_network);
+
+        auto line = std::string{};
+        while (input.pop(line)) {
+            Utils::log_input(line);
+            const auto command = GTP::parse_input(line);
+            if (is_quit(command.second)) {
+                gtp_printf(command.first, "");
+                break;
+            }
+            if (is_refused(command.second)) {
+                gtp_fail_printf(command.first, "not available in server mode");
+                continue;
+            }
+            GTP::execute(game, line, search);
+        }
+    }
+    Utils::set_session_io(nullptr, nullptr);
+
+    input.join();
+    fclose(in);
+    fclose(out);
+    --s_sessions;
+#else
+    (void)fd;
+#endif
+}
+
+bool GTPServer::run(const std::string& address, int port) {
+#ifndef _WIN32
+    // A client going away must not kill the other sessions.
+    signal(SIGPIPE, SIG_IGN);
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    if (inet_pton(AF_INET, address.c_str(), &addr.sin_addr) != 1) {
+        myprintf_error("Cannot listen on %s, not an IPv4 address.\n",
+                       address.c_str());
+        return false;
+    }
+    const auto fd = socket(AF_INET, SOCK_STREAM, 0);
+    auto one = 1;
+    if (fd < 0
+        || setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one)) < 0
+        || bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) < 0
+        || listen(fd, 16) < 0) {
+        myprintf_error("Cannot listen on %s port %d.\n",
+                       address.c_str(), port);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return false;
+    }
+
+    UCTSearch::set_share_threads(true);
+    myprintf("Serving GTP sessions on %s port %d.\n", address.c_str(), port);
+    for (;;) {
+        const auto client = accept(fd, nullptr, nullptr);
+        if (client < 0) {
+            if (errno == EINTR || errno == ECONNABORTED) {
+                continue;
+            }
+            // Out of descriptors or memory: wait for sessions to end
+            // rather than spin.
+            if (errno == EMFILE || errno == ENFILE
+                || errno == ENOBUFS || errno == ENOMEM) {
+                std::this_thread::sleep_for(std::chrono::milliseconds(100));
+                continue;
+            }
+            myprintf_error("Cannot accept sessions: %s.\n", strerror(errno));
+            close(fd);
+            return false;
+        }
+        // Each session searching keeps at least one worker thread, so
+        // grow the pool with the sessions, as sai-selfplay does.
+        const auto threads = size_t{cfg_num_threads} + s_sessions + 1;
+        while (thread_pool.size() < threads) {
+            const auto index = thread_pool.size();
+            thread_pool.add_thread([index]() { Numa::bind_thread(index); });
+        }
+        std::thread(session, client).detach();
+    }
+#else
+    myprintf_error("Server mode is not supported on Windows.\n");
+    (void)address;
+    (void)port;
+    return false;
+#endif
+}
@@ -0,0 +1,66 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#ifndef GTPSERVER_H_INCLUDED
+#define GTPSERVER_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <string>
+
+// Serves GTP over TCP: every connection is a session with a game and a
+// search of its own, speaking the same protocol as standard input,
+// lz-analyze included. All the sessions share GTP::s_network, and so its
+// batches, its NNCache and its GPU context, and the search threads are
+// split between the sessions that are searching at the same time.
+//
+// Options changed by a session (lz-setoption, the cfg_* of the command
+// line) are still process-wide, and commands that replace the network or
+// take over the thread pool are refused. Sessions are not authenticated,
+// so the port is only bound to the loopback interface unless asked
+// otherwise, and the commands that write files are refused too.
+class GTPServer {
+public:
+    // Accept sessions on the port of the IPv4 address until the process
+    // exits. Returns false if the port cannot be listened on.
+    static bool run(const std::string& address, int port);
+
+    // Whether a command, as returned by GTP::parse_input(), is refused
+    // to the sessions.
+    static bool is_refused(const std::string& command);
+
+private:
+    static void session(int fd);
+
+    static std::atomic<int> s_sessions;
+};
+
+#endif
@@ -49,9 +49,18 @@
 #include "FullBoard.h"
 #include "GTP.h"
 #include "KoState.h"
+#include "MemoryTracker.h"
 #include "UCTSearch.h"
 #include "Utils.h"
 
+namespace {
+    // The copy of state kept in the game history.
+    std::shared_ptr<const KoState> history_entry(const KoState& state) {
+        return std::allocate_shared<KoState>(
+            TrackedAllocator<KoState, MemoryTracker::HISTORY>{}, state);
+    }
+}
+
 StateEval GameState::get_state_eval() const {
     return KoState::get_state_eval();
 }
@@ -70,7 +79,7 @@ void GameState::init_game(int size, float komi, bool value_head_sai) {
     KoState::init_game(size, komi);
 
     game_history.clear();
-    game_history.emplace_back(std::make_shared<KoState>(*this));
+    game_history.push_back(history_entry(*this));
 
     m_timecontrol.reset_clocks();
 
@@ -88,7 +97,7 @@ void GameState::reset_game() {
     KoState::reset_game();
 
     game_history.clear();
-    game_history.emplace_back(std::make_shared<KoState>(*this));
+    game_history.push_back(history_entry(*this));
 
     m_timecontrol.reset_clocks();
 
@@ -151,7 +160,7 @@ void GameState::play_move(int color, int vertex) {
 
     // cut off any leftover moves from navigating
     game_history.resize(get_movenum());
-    game_history.emplace_back(std::make_shared<KoState>(*this));
+    game_history.push_back(history_entry(*this));
 
     // this is the place to reset state info for comments
     reset_comment_data();
@@ -226,7 +235,7 @@ void GameState::anchor_game_history() {
     // handicap moves don't count in game history
     set_movenum(0);
     game_history.clear();
-    game_history.emplace_back(std::make_shared<KoState>(*this));
+    game_history.push_back(history_entry(*this));
 }
 
 bool GameState::set_fixed_handicap(int handicap) {
@@ -393,8 +402,8 @@ std::string GameState::eval_comment(bool print_header) const {
     return comstr.str();
 }
 
-const std::vector<std::shared_ptr<const KoState>>& GameState::get_game_history() const {
-    return game_history;
+std::vector<std::shared_ptr<const KoState>> GameState::get_game_history() const {
+    return game_history.to_vector();
 }
 
 
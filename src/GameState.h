@@ -39,6 +39,7 @@
 #include "FastState.h"
 #include "FullBoard.h"
 #include "KoState.h"
+#include "SharedHistory.h"
 #include "TimeControl.h"
 
 class Network;
@@ -63,7 +64,7 @@ public:
     bool forward_move();
     std::shared_ptr<const KoState> get_past_state(int moves_ago) const;
     const FullBoard& get_past_board(int moves_ago) const;
-    const std::vector<std::shared_ptr<const KoState>>& get_game_history() const;
+    std::vector<std::shared_ptr<const KoState>> get_game_history() const;
 
     void play_move(int vertex);
     void play_move(int color, int vertex);
@@ -101,7 +102,9 @@ public:
 private:
     bool valid_handicap(int stones);
 
-    std::vector<std::shared_ptr<const KoState>> game_history;
+    // Copies made for each search simulation share all but the most
+    // recent positions with the root state.
+    SharedHistory<std::shared_ptr<const KoState>> game_history;
     TimeControl m_timecontrol;
     int m_resigned{FastBoard::EMPTY};
     std::pair<int, int> m_acceptedscore = {-1 * NUM_INTERSECTIONS, NUM_INTERSECTIONS};
@@ -46,16 +46,23 @@ void KoState::init_game(int size, float komi) {
     FastState::init_game(size, komi);
 
     m_ko_hash_history.clear();
-    m_ko_hash_history.emplace_back(board.get_ko_hash());
+    m_ko_hash_history.push_back(board.get_ko_hash());
 }
 
 bool KoState::superko() const {
-    auto first = crbegin(m_ko_hash_history);
-    auto last = crend(m_ko_hash_history);
-
-    auto res = std::find(++first, last, board.get_ko_hash());
+    // The last entry is the current position.
+    return m_ko_hash_history.contains(board.get_ko_hash(),
+                                      m_ko_hash_history.size() - 1);
+}
 
-    return (res != last);
+bool KoState::superko_move(int vertex) const {
+    auto hash = std::uint64_t{};
+    if (board.quiet_move_ko_hash(get_to_move(), vertex, hash)) {
+        return m_ko_hash_history.contains(hash, m_ko_hash_history.size());
+    }
+    auto state = *this;
+    state.play_move(vertex);
+    return state.superko();
 }
 
 void KoState::reset_game() {
@@ -85,3 +92,11 @@ StateEval KoState::get_state_eval() const {
 void KoState::set_state_eval(const StateEval& ev) {
     m_ev = ev;
 }
+
+std::shared_ptr<const PositionPlanes> KoState::get_planes() const {
+    return std::atomic_load(&m_planes.planes);
+}
+
+void KoState::set_planes(std::shared_ptr<const PositionPlanes> planes) const {
+    std::atomic_store(&m_planes.planes, std::move(planes));
+}
@@ -33,11 +33,14 @@
 
 #include "config.h"
 
+#include <bitset>
+#include <memory>
 #include <vector>
 #include <tuple>
 
 #include "FastState.h"
 #include "FullBoard.h"
+#include "SharedHistory.h"
 
 struct StateEval {
     size_t visits = 0;
@@ -62,10 +65,32 @@ struct StateEval {
     StateEval() {}
 };
 
+// Network input features of one position, before applying a symmetry.
+// See Network::gather_features().
+struct PositionPlanes {
+    using Plane = std::bitset<NUM_INTERSECTIONS>;
+    static constexpr unsigned int STONES = 1;
+    static constexpr unsigned int ADV_FEATURES = 2;
+    static constexpr unsigned int CHAIN_LIBERTIES = 4;
+    static constexpr unsigned int CHAIN_SIZE = 8;
+
+    // Which of the groups above are filled in.
+    unsigned int groups{0};
+    Plane black;
+    Plane white;
+    Plane illegal;
+    Plane atari;
+    std::vector<Plane> chainlibs;
+    std::vector<Plane> chainsize;
+};
+
 class KoState : public FastState {
 public:
     void init_game(int size, float komi);
     bool superko() const;
+    // Whether playing vertex would repeat a position, as play_move()
+    // followed by superko() would tell, mostly without a copy.
+    bool superko_move(int vertex) const;
     void reset_game();
 
     StateEval get_state_eval() const;
@@ -74,9 +99,29 @@ public:
     void play_move(int vertex);
     void play_move(int color, int vertex);
 
+    // Input planes computed for this position, if any. Only positions
+    // in the game history, which never change, keep them, and several
+    // search threads may look at the same one.
+    std::shared_ptr<const PositionPlanes> get_planes() const;
+    void set_planes(std::shared_ptr<const PositionPlanes> planes) const;
+
 private:
-    std::vector<std::uint64_t> m_ko_hash_history;
+    // Copies start empty, as they are usually played on.
+    class PlanesCache {
+    public:
+        PlanesCache() = default;
+        PlanesCache(const PlanesCache&) {}
+        PlanesCache& operator=(const PlanesCache&) {
+            planes.reset();
+            return *this;
+        }
+        std::shared_ptr<const PositionPlanes> planes;
+    };
+
+    // Filtered, so the superko check rarely scans the whole game.
+    SharedHistory<std::uint64_t, 8192> m_ko_hash_history;
     StateEval m_ev;
+    mutable PlanesCache m_planes;
 };
 
 #endif
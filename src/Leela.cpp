@@ -43,9 +43,13 @@
 #include <vector>
 
 #include "GTP.h"
+#include "GTPServer.h"
 #include "GameState.h"
+#include "Metrics.h"
 #include "Network.h"
 #include "NNCache.h"
+#include "NNServer.h"
+#include "Numa.h"
 #include "Random.h"
 #include "ThreadPool.h"
 #include "Utils.h"
@@ -68,6 +72,12 @@ static void calculate_thread_count_cpu(boost::program_options::variables_map & v
     // If we are CPU-based, there is no point using more than the number of CPUs/
     auto cfg_max_threads = std::min(SMP::get_num_cpus(), size_t{MAX_CPUS});
 
+    // When batching, search threads mostly wait for their batch to be
+    // evaluated, so allow batchsize threads per CPU.
+    cfg_batch_size = std::max(1u, vm["batchsize"].as<unsigned int>());
+    cfg_max_threads = std::min(cfg_max_threads * cfg_batch_size,
+                               size_t{MAX_CPUS});
+
 #ifndef NDEBUG
     cfg_max_threads = 1;
 #endif
@@ -164,13 +174,56 @@ static void parse_commandline(int argc, char *argv[]) {
         ("nosymm", "Do not exploit symmetries.")
         ("symm", "Exploit symmetries, but choose move randomly.")
         ("noladdercode", "Don't use heuristics for deeper ladders exploration.")
+        ("transpositions", "When the search reaches an already expanded "
+                           "position through another move order, go on in "
+                           "the subtree of that position, sharing its "
+                           "statistics.")
+        ("prunetree", "When pondering or analyzing fills the tree, free "
+                      "its least visited subtrees and go on searching, "
+                      "instead of stopping.")
+        ("noexpandwait", "Give up a playout that reaches a node being "
+                         "expanded by another thread, instead of waiting.")
+        ("deterministic", "Run the search threads in rounds of fixed order, so "
+                          "that with --seed and a playout or visit limit the "
+                          "search is the same in every run.")
+        ("virtualloss", po::value<int>()->default_value(cfg_virtual_loss),
+         "Virtual losses for each playout in flight through a node.")
+        ("adaptivevl", "Scale virtual losses with the square root of the "
+                       "playouts in flight through a node, and count those "
+                       "as visits. For many threads or large batches.")
+        ("lcbstop", "Stop searching once the lower confidence bound of "
+                    "the best move is above the upper bounds of all the "
+                    "other moves tried.")
+        ("scorestop", po::value<float>()->default_value(cfg_score_stop),
+         "Stop searching once the score estimates of all the moves tried "
+         "are within this many points. 0 disables.")
+        ("rootsplit", po::value<unsigned int>()->default_value(cfg_root_split),
+         "Split the threads into this many groups, each searching its own "
+         "share of the root moves. Reduces contention with many threads.")
+        ("widening", po::value<size_t>()->default_value(cfg_widening),
+         "Below the root, only consider this many of the most likely moves "
+         "of a node, twice as many each time its visits quadruple. "
+         "0 considers all of them.")
+        ("ponderreplies", po::value<size_t>()->default_value(cfg_ponder_replies),
+         "When pondering after our move, only search this many of the "
+         "opponent's most likely replies. 0 searches all of them. "
+         "lz-analyze always searches all of them.")
+        ("policyrollouts", po::value<int>()->default_value(cfg_policy_rollouts),
+         "Find the dead stones at the end of the game by playing this many "
+         "games out with the policy alone, instead of with a search.")
         ("lagbuffer,b", po::value<int>()->default_value(cfg_lagbuffer_cs),
                         "Safety margin for time usage in centiseconds.")
+        ("timeextension", po::value<float>()->default_value(cfg_time_extension),
+         "Contested moves may think up to this fraction of their planned "
+         "time longer, paid for by the moves that stop early. 0 disables.")
         ("resignpct,r", po::value<float>()->default_value(cfg_resignpct),
                         "Resign when winrate is less than x%.\n"
                         "-1 uses 10% but scales for handicap.")
         ("weights,w", po::value<std::string>()->default_value(cfg_weightsfile),
          "File with network weights.")
+        ("convertweights", po::value<std::string>(),
+         "Write the weights file as a binary weights file with this name, "
+         "which loads much faster, and exit.")
         ("logfile,l", po::value<std::string>(), "File to log input/output to.")
         ("quiet,q", "Disable all diagnostic output.")
         ("timemanage", po::value<std::string>()->default_value("auto"),
@@ -183,10 +236,62 @@ static void parse_commandline(int argc, char *argv[]) {
         ("noponder", "Disable thinking on opponent's time.")
         ("benchmark", "Test network and exit. Default args:\n-v3200 --noponder "
                       "-m0 -t1 -s1.")
+        ("profile-search", "Time the phases of every playout and show "
+                           "them after each search.")
+        ("numa", "Pin the search and GPU threads to the NUMA nodes, so "
+                 "that the memory they allocate stays local. Linux only.")
+        ("server", po::value<int>(),
+                   "Serve GTP sessions on this TCP port instead of "
+                   "standard input, sharing the network between them.")
+        ("server-address", po::value<std::string>(),
+                           "Address the --server port is bound to, "
+                           "0.0.0.0 for all the interfaces. Sessions are "
+                           "not authenticated. Default: 127.0.0.1.")
+        ("remote", po::value<std::vector<std::string> >(),
+                   "host:port of a sai --server that searches each position "
+                   "too, its root statistics added to the local ones. "
+                   "Can be given multiple times.")
+        ("metrics", po::value<int>(),
+                    "Every so many seconds, write a JSON line with the "
+                    "search and network throughput to the log file.")
+        ("analyze-sgf", po::value<std::vector<std::string>>()->multitoken(),
+                        "Search every position of the main line of these "
+                        "SGF files and print a JSON line per move, with "
+                        "the evaluations for Black, then exit.")
+        ("analyze-parallel",
+            po::value<int>()->default_value(cfg_analyze_parallel),
+            "Number of files searched at once with analyze-sgf. The "
+            "positions of each file are searched one after the other.")
         ("nocache", "Disable neural network cache.")
+        ("compact-cache", "Store the policy in the neural network cache "
+                          "as fp16 to fit about twice as many positions.")
+        ("canonical-cache", "Store the neural network cache entries for "
+                            "one symmetry of each position only, shared "
+                            "by its symmetric positions.")
+        ("shared-cache", po::value<std::string>(),
+                         "File with a neural network cache shared by all "
+                         "processes using the same network.")
+        ("shared-cache-size", po::value<size_t>()->default_value(cfg_shared_cache_mib),
+                              "Size in MiB of the shared cache file, "
+                              "when it has to be created.")
+        ("nn-server", po::value<std::string>(),
+                      "Evaluate positions for the nn-client processes "
+                      "through this file instead of playing.")
+        ("nn-client", po::value<std::string>(),
+                      "Have the nn-server serving this file evaluate "
+                      "the positions.")
+        ("opening-book", po::value<std::string>(),
+                         "File with network evaluations of opening "
+                         "positions, made with sai-makebook.")
 #ifndef USE_CPU_ONLY
         ("cpu-only", "Use CPU-only implementation and do not use OpenCL device(s).")
 #endif
+#ifndef USE_OPENCL
+        ("batchsize", po::value<unsigned int>()->default_value(1),
+         "Max batch size for CPU evaluation.")
+#endif
+        ("int8", "Run the residual tower of the CPU evaluation "
+                 "in 8-bit integer arithmetic.")
         ;
 #ifdef USE_OPENCL
     po::options_description gpu_desc("OpenCL device options");
@@ -195,12 +300,31 @@ static void parse_commandline(int argc, char *argv[]) {
                 "ID of the OpenCL device(s) to use (disables autodetection).")
         ("full-tuner", "Try harder to find an optimal OpenCL tuning.")
         ("tune-only", "Tune OpenCL only and then exit.")
+        ("tune-time", po::value<int>()->default_value(cfg_tune_time),
+         "Stop OpenCL tuning after this many seconds per GPU and go on "
+         "from there on the next start. Select 0 for no limit.")
+        ("tuner-file", po::value<std::string>(),
+         "File with the OpenCL tunings, can be shared between machines.")
+        ("tuner-import", po::value<std::string>(),
+         "Merge the OpenCL tunings from this file into the tuner file.")
+        ("tuner-export", po::value<std::string>(),
+         "Copy the OpenCL tunings to this file after tuning.")
         ("batchsize", po::value<unsigned int>()->default_value(0),
          "Max batch size.  Select 0 to let SAI pick a reasonable default.")
+        ("batch-latency", po::value<int>()->default_value(cfg_batch_latency),
+         "Average time in milliseconds an evaluation may wait for a batch "
+         "to fill. Select 0 to only use the built-in heuristic.")
 #ifdef USE_HALF
         ("precision", po::value<std::string>(),
             "Floating-point precision (single/half/auto).\n"
             "Default is to auto which automatically determines which one to use.")
+        ("recheck-precision",
+            "Benchmark both precisions again instead of using the choice "
+            "saved by an earlier autodetection.")
+        ("half-no-selfcheck",
+            "With half precision, free the single precision copy of the "
+            "network kept to self-check the OpenCL results, and stop "
+            "self-checking.")
 #endif
         ;
 #endif
@@ -225,6 +349,13 @@ static void parse_commandline(int argc, char *argv[]) {
         ("randomtemp",
             po::value<float>()->default_value(cfg_random_temp),
             "Temperature to use for random move selection.")
+        ("fastvisits",
+            po::value<int>()->default_value(cfg_fast_visits),
+            "Search most moves after the random ones with at most this "
+            "many visits, and leave them out of the training data.")
+        ("fullsearch",
+            po::value<float>()->default_value(cfg_full_search_prob),
+            "With fastvisits, share of the moves searched in full.")
         ("blunderthr",
             po::value<float>()->default_value(cfg_blunder_thr),
             "Moves with winrate drop higher than this, are blunders. "
@@ -233,6 +364,13 @@ static void parse_commandline(int argc, char *argv[]) {
             po::value<float>()->default_value(cfg_blunder_rndmax_avg),
             "Blunders number is bounded by a Poisson r.v. with this mean.")
         ("norecordvisits", "Normalize visits to probabilities when writing training info.")
+        ("maxtrainingsteps", po::value<size_t>(),
+         "Keep at most this many positions of a game in memory, moving "
+         "the older ones to a temporary file.")
+        ("binarychunks", "Write training data as fixed size binary records "
+         "instead of text.")
+        ("chunkcompression", po::value<int>()->default_value(cfg_chunk_compression),
+         "gzip level of the training data, 1 (fastest) to 9 (smallest).")
         ("adv_features", "Include advanced features (legal moves, "
          "last liberty intersections) when saving training data. Shorten "
          "history from 8 past moves to last 4.")
@@ -261,10 +399,6 @@ static void parse_commandline(int argc, char *argv[]) {
     // These won't be shown, we use them to catch incorrect usage of the
     // command line.
     po::options_description ignore("Ignored options");
-#ifndef USE_OPENCL
-    ignore.add_options()
-        ("batchsize", po::value<unsigned int>()->default_value(1), "Max batch size.");
-#endif
     po::options_description h_desc("Hidden options");
     h_desc.add_options()
         // Same as --symm, but the move is chosen to be in the general
@@ -391,6 +525,12 @@ static void parse_commandline(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    if (vm.count("convertweights")) {
+        const auto outfile = vm["convertweights"].as<std::string>();
+        exit(Network::convert_weights_file(cfg_weightsfile, outfile)
+             ? EXIT_FAILURE : EXIT_SUCCESS);
+    }
+
     if (vm.count("gtp")) {
         cfg_gtp_mode = true;
     }
@@ -404,6 +544,10 @@ static void parse_commandline(int argc, char *argv[]) {
         cfg_gpus = vm["gpu"].as<std::vector<int> >();
     }
 
+    if (vm.count("batch-latency")) {
+        cfg_batch_latency = vm["batch-latency"].as<int>();
+    }
+
     if (vm.count("full-tuner")) {
         cfg_sgemm_exhaustive = true;
 
@@ -416,6 +560,24 @@ static void parse_commandline(int argc, char *argv[]) {
     if (vm.count("tune-only")) {
         cfg_tune_only = true;
     }
+
+    if (vm.count("tune-time")) {
+        cfg_tune_time = vm["tune-time"].as<int>();
+    }
+
+    if (vm.count("tuner-file")) {
+        cfg_tuner_file = vm["tuner-file"].as<std::string>();
+    }
+
+    if (vm.count("tuner-import")) {
+        if (!tuner_import(vm["tuner-import"].as<std::string>())) {
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (vm.count("tuner-export")) {
+        cfg_tuner_export = vm["tuner-export"].as<std::string>();
+    }
 #ifdef USE_HALF
     if (vm.count("precision")) {
         auto precision = vm["precision"].as<std::string>();
@@ -430,6 +592,12 @@ static void parse_commandline(int argc, char *argv[]) {
             exit(EXIT_FAILURE);
         }
     }
+    if (vm.count("recheck-precision")) {
+        cfg_recheck_precision = true;
+    }
+    if (vm.count("half-no-selfcheck")) {
+        cfg_half_no_selfcheck = true;
+    }
     if (cfg_precision == precision_t::AUTO) {
         // Auto precision is not supported for full tuner cases.
         if (cfg_sgemm_exhaustive) {
@@ -456,9 +624,12 @@ static void parse_commandline(int argc, char *argv[]) {
     }
     myprintf("Using %d thread(s).\n", cfg_num_threads);
 
+    if (vm.count("deterministic")) {
+        cfg_deterministic = true;
+    }
     if (vm.count("seed")) {
         cfg_rng_seed = vm["seed"].as<std::uint64_t>();
-        if (cfg_num_threads > 1) {
+        if (cfg_num_threads > 1 && !cfg_deterministic) {
             myprintf("Seed specified but multiple threads enabled.\n");
             myprintf("Games will likely not be reproducible.\n");
         }
@@ -479,6 +650,35 @@ static void parse_commandline(int argc, char *argv[]) {
         cfg_max_cache_ratio_percent = 1;
     }
 
+    if (vm.count("compact-cache")) {
+        cfg_compact_nncache = true;
+    }
+
+    if (vm.count("canonical-cache")) {
+        cfg_canonical_nncache = true;
+    }
+
+    if (vm.count("int8")) {
+        cfg_int8 = true;
+    }
+
+    if (vm.count("shared-cache")) {
+        cfg_shared_cache_file = vm["shared-cache"].as<std::string>();
+        cfg_shared_cache_mib = vm["shared-cache-size"].as<size_t>();
+    }
+
+    if (vm.count("nn-server")) {
+        cfg_nn_server_file = vm["nn-server"].as<std::string>();
+    }
+
+    if (vm.count("nn-client")) {
+        cfg_nn_client_file = vm["nn-client"].as<std::string>();
+    }
+
+    if (vm.count("opening-book")) {
+        cfg_opening_book = vm["opening-book"].as<std::string>();
+    }
+
     if (vm.count("dumbpass")) {
         cfg_dumbpass = true;
     }
@@ -495,6 +695,19 @@ static void parse_commandline(int argc, char *argv[]) {
         cfg_recordvisits = false;
     }
 
+    if (vm.count("maxtrainingsteps")) {
+        cfg_max_training_steps = vm["maxtrainingsteps"].as<size_t>();
+    }
+
+    if (vm.count("binarychunks")) {
+        cfg_binary_chunks = true;
+    }
+
+    if (vm.count("chunkcompression")) {
+        cfg_chunk_compression =
+            std::min(9, std::max(1, vm["chunkcompression"].as<int>()));
+    }
+
     if (vm.count("adv_features")) {
         cfg_adv_features  = true;
     }
@@ -563,6 +776,14 @@ static void parse_commandline(int argc, char *argv[]) {
         cfg_random_temp = vm["randomtemp"].as<float>();
     }
 
+    if (vm.count("fastvisits")) {
+        cfg_fast_visits = vm["fastvisits"].as<int>();
+    }
+
+    if (vm.count("fullsearch")) {
+        cfg_full_search_prob = vm["fullsearch"].as<float>();
+    }
+
     if (vm.count("blunderthr")) {
         cfg_blunder_thr = vm["blunderthr"].as<float>();
     }
@@ -580,6 +801,27 @@ static void parse_commandline(int argc, char *argv[]) {
     if (vm.count("noladdercode")) {
         cfg_laddercode = false;
     }
+    if (vm.count("transpositions")) {
+        cfg_transpositions = true;
+    }
+    if (vm.count("prunetree")) {
+        cfg_prune_tree = true;
+    }
+    if (vm.count("noexpandwait")) {
+        cfg_expand_wait = false;
+    }
+    cfg_virtual_loss = std::max(0, vm["virtualloss"].as<int>());
+    if (vm.count("adaptivevl")) {
+        cfg_adaptive_vl = true;
+    }
+    if (vm.count("lcbstop")) {
+        cfg_lcb_stop = true;
+    }
+    cfg_score_stop = vm["scorestop"].as<float>();
+    cfg_root_split = std::max(1u, vm["rootsplit"].as<unsigned int>());
+    cfg_widening = vm["widening"].as<size_t>();
+    cfg_ponder_replies = vm["ponderreplies"].as<size_t>();
+    cfg_policy_rollouts = std::max(0, vm["policyrollouts"].as<int>());
     if (vm.count("timemanage")) {
         auto tm = vm["timemanage"].as<std::string>();
         if (tm == "auto") {
@@ -610,6 +852,36 @@ static void parse_commandline(int argc, char *argv[]) {
             cfg_lagbuffer_cs = lagbuffer;
         }
     }
+    cfg_time_extension = std::max(0.0f, vm["timeextension"].as<float>());
+
+    if (vm.count("profile-search")) {
+        cfg_profile_search = true;
+    }
+
+    if (vm.count("numa")) {
+        cfg_numa = true;
+    }
+
+    if (vm.count("server")) {
+        cfg_server_port = vm["server"].as<int>();
+    }
+    if (vm.count("server-address")) {
+        cfg_server_address = vm["server-address"].as<std::string>();
+    }
+
+    if (vm.count("remote")) {
+        cfg_remote_workers = vm["remote"].as<std::vector<std::string> >();
+    }
+
+    if (vm.count("analyze-sgf")) {
+        cfg_analyze_sgf = vm["analyze-sgf"].as<std::vector<std::string>>();
+        cfg_analyze_parallel = std::max(1, vm["analyze-parallel"].as<int>());
+    }
+
+    if (vm.count("metrics")) {
+        cfg_metrics_interval = std::max(1, vm["metrics"].as<int>());
+    }
+
     if (vm.count("benchmark")) {
         // These must be set later to override default arguments.
         cfg_allow_pondering = false;
@@ -624,6 +896,18 @@ static void parse_commandline(int argc, char *argv[]) {
         }
     }
 
+    if (!cfg_analyze_sgf.empty()) {
+        // Same search for every position, whatever the game clock says.
+        cfg_allow_pondering = false;
+        cfg_noise = false;
+        cfg_random_cnt = 0;
+        cfg_timemanage = TimeManagement::OFF;
+
+        if (!vm.count("playouts") && !vm.count("visits")) {
+            cfg_max_visits = 3200;
+        }
+    }
+
     // Do not lower the expected eval for root moves that are likely not
     // the best if we have introduced noise there exactly to explore more.
     cfg_fpu_root_reduction = cfg_noise ? 0.0f : cfg_fpu_reduction;
@@ -648,6 +932,7 @@ static void initialize_network() {
 
 // Setup global objects after command line has been parsed
 void init_global_objects() {
+    Numa::initialize(cfg_numa);
     thread_pool.initialize(cfg_num_threads);
 
     // Use deterministic random numbers for hashing
@@ -662,6 +947,10 @@ void init_global_objects() {
     Utils::create_z_table();
 
     initialize_network();
+
+    if (cfg_metrics_interval > 0) {
+        MetricsReporter::start(cfg_metrics_interval);
+    }
 }
 
 void benchmark(GameState& game) {
@@ -672,7 +961,9 @@ void benchmark(GameState& game) {
 
     auto search = std::make_unique<UCTSearch>(game, *GTP::s_network);
     game.set_to_move(FastBoard::WHITE);
+    UCTSearch::reset_move_cost();
     search->think(FastBoard::WHITE);
+    myprintf("Benchmark: %s.\n", UCTSearch::move_cost_report().c_str());
 }
 
 int main(int argc, char *argv[]) {
@@ -691,7 +982,8 @@ int main(int argc, char *argv[]) {
     setbuf(stdin, nullptr);
 #endif
 
-    if (!cfg_gtp_mode && !cfg_benchmark) {
+    // stdout is for the JSON lines of analyze-sgf only.
+    if (!cfg_gtp_mode && !cfg_benchmark && cfg_analyze_sgf.empty()) {
         license_blurb();
     }
 
@@ -710,6 +1002,21 @@ int main(int argc, char *argv[]) {
         return 0;
     }
 
+    if (!cfg_analyze_sgf.empty()) {
+        GTP::analyze_sgf_files(cfg_analyze_sgf, cfg_analyze_parallel);
+        return 0;
+    }
+
+    if (!cfg_nn_server_file.empty()) {
+        return NNServer::run(*GTP::s_network, cfg_nn_server_file)
+            ? 0 : EXIT_FAILURE;
+    }
+
+    if (cfg_server_port > 0) {
+        return GTPServer::run(cfg_server_address, cfg_server_port) ? 0 : EXIT_FAILURE;
+    }
+
+    Utils::start_input_thread();
     for (;;) {
         if (!cfg_gtp_mode) {
             maingame->display_state();
@@ -717,7 +1024,7 @@ int main(int argc, char *argv[]) {
         }
 
         auto input = std::string{};
-        if (std::getline(std::cin, input)) {
+        if (Utils::read_input_line(input)) {
             Utils::log_input(input);
             GTP::execute(*maingame, input);
         } else {
@@ -727,10 +1034,7 @@ int main(int argc, char *argv[]) {
         }
 
         // Force a flush of the logfile
-        if (cfg_logfile_handle) {
-            fclose(cfg_logfile_handle);
-            cfg_logfile_handle = fopen(cfg_logfile.c_str(), "a");
-        }
+        Utils::flush_log();
     }
 
     return 0;
@@ -0,0 +1,129 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include "Lockstep.h"
+#include "Random.h"
+
+namespace {
+    enum class Phase {
+        IDLE, DESCENT, EVALUATION, BACKUP
+    };
+
+    struct ThreadState {
+        Lockstep* lockstep{nullptr};
+        size_t index{0};
+        Phase phase{Phase::IDLE};
+    };
+
+    thread_local ThreadState s_thread;
+}
+
+void Lockstep::enter(const size_t index) {
+    s_thread = ThreadState{this, index, Phase::IDLE};
+    // Stream 0 is the thread that prepares the root.
+    Random::seed_thread(1 + index);
+}
+
+void Lockstep::leave() {
+    if (s_thread.lockstep) {
+        s_thread.lockstep->stop();
+    }
+    s_thread = ThreadState{};
+}
+
+void Lockstep::stop() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_stopped = true;
+    m_cv.notify_all();
+}
+
+bool Lockstep::active() {
+    return s_thread.lockstep != nullptr;
+}
+
+bool Lockstep::begin_simulation(const std::function<bool()>& should_run) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    const auto index = s_thread.index;
+    m_cv.wait(lock, [this, index]() {
+        return m_stopped || m_descent_turn == index;
+    });
+    if (!m_stopped && index == 0 && !should_run()) {
+        m_stopped = true;
+        m_cv.notify_all();
+    }
+    if (m_stopped) {
+        return false;
+    }
+    s_thread.phase = Phase::DESCENT;
+    return true;
+}
+
+void Lockstep::end_descent() {
+    if (s_thread.phase != Phase::DESCENT) {
+        return;
+    }
+    auto& lockstep = *s_thread.lockstep;
+    std::lock_guard<std::mutex> lock(lockstep.m_mutex);
+    lockstep.m_descent_turn++;
+    s_thread.phase = Phase::EVALUATION;
+    lockstep.m_cv.notify_all();
+}
+
+void Lockstep::begin_backup() {
+    end_descent();
+    if (s_thread.phase != Phase::EVALUATION) {
+        return;
+    }
+    auto& lockstep = *s_thread.lockstep;
+    std::unique_lock<std::mutex> lock(lockstep.m_mutex);
+    const auto index = s_thread.index;
+    lockstep.m_cv.wait(lock, [&lockstep, index]() {
+        return lockstep.m_stopped
+            || (lockstep.m_descent_turn == lockstep.m_threads
+                && lockstep.m_backup_turn == index);
+    });
+    s_thread.phase = Phase::BACKUP;
+}
+
+void Lockstep::end_simulation() {
+    begin_backup();
+    if (s_thread.phase != Phase::BACKUP) {
+        return;
+    }
+    auto& lockstep = *s_thread.lockstep;
+    std::lock_guard<std::mutex> lock(lockstep.m_mutex);
+    if (++lockstep.m_backup_turn == lockstep.m_threads) {
+        lockstep.m_descent_turn = 0;
+        lockstep.m_backup_turn = 0;
+    }
+    s_thread.phase = Phase::IDLE;
+    lockstep.m_cv.notify_all();
+}
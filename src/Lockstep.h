@@ -0,0 +1,89 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef LOCKSTEP_H_INCLUDED
+#define LOCKSTEP_H_INCLUDED
+
+#include "config.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+
+// Runs the simulations of the search threads in rounds with a fixed order,
+// for cfg_deterministic. In each round the threads descend the tree one
+// after the other, evaluate their leaves at the same time and back up one
+// after the other, each after all the descents of the round. So every
+// thread sees the tree, the virtual losses and the NN cache in the same
+// state in every run, and the search only depends on the seed and on the
+// number of threads, while the evaluations still overlap.
+//
+// A search thread enter()s before its first simulation. The hooks are
+// static and find the Lockstep of the calling thread, they do nothing on
+// the threads that didn't enter one.
+class Lockstep {
+public:
+    explicit Lockstep(size_t threads) : m_threads(threads) {}
+
+    // Bind the calling thread as search thread index, and seed its
+    // random number generator from cfg_rng_seed and index.
+    void enter(size_t index);
+    // Unbind the calling thread. The rounds stop: the other threads
+    // would wait for its turns.
+    static void leave();
+
+    // Wait for the turn of the calling thread to descend. The first
+    // thread of a round calls should_run(), when it returns false no
+    // more rounds start and every thread gets false.
+    bool begin_simulation(const std::function<bool()>& should_run);
+    // The calling thread reached its leaf, let the next one descend.
+    static void end_descent();
+    // Wait for the turn of the calling thread to back up, ending its
+    // descent if it didn't yet.
+    static void begin_backup();
+    // The backup of the calling thread is done.
+    static void end_simulation();
+
+    // True on the threads of a lockstep search.
+    static bool active();
+
+private:
+    void stop();
+
+    size_t m_threads;
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    // The next thread to descend and to back up in this round.
+    size_t m_descent_turn{0};
+    size_t m_backup_turn{0};
+    bool m_stopped{false};
+};
+
+#endif
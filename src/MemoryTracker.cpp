@@ -0,0 +1,95 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <boost/format.hpp>
+
+#include "MemoryTracker.h"
+
+std::mutex MemoryTracker::s_registry_mutex;
+std::vector<std::shared_ptr<MemoryTracker::Counters>> MemoryTracker::s_registry;
+
+namespace {
+    const char* const s_subsystem_names[MemoryTracker::NUM_SUBSYSTEMS] = {
+        "tree_nodes", "tree_children", "nncache", "history", "training",
+        "opencl_host"
+    };
+}
+
+MemoryTracker::Counters& MemoryTracker::local_counters() {
+    thread_local auto counters = [] {
+        auto ptr = std::make_shared<Counters>();
+        for (auto& counter : *ptr) {
+            counter = 0;
+        }
+        std::lock_guard<std::mutex> lock(s_registry_mutex);
+        s_registry.push_back(ptr);
+        return ptr;
+    }();
+    return *counters;
+}
+
+std::int64_t MemoryTracker::get(const Subsystem subsystem) {
+    auto bytes = std::int64_t{0};
+    std::lock_guard<std::mutex> lock(s_registry_mutex);
+    for (const auto& counters : s_registry) {
+        bytes += (*counters)[subsystem].load(std::memory_order_relaxed);
+    }
+    return bytes;
+}
+
+std::int64_t MemoryTracker::total() {
+    auto bytes = std::int64_t{0};
+    for (auto s = 0; s < NUM_SUBSYSTEMS; s++) {
+        bytes += get(Subsystem(s));
+    }
+    return bytes;
+}
+
+std::string MemoryTracker::report() {
+    auto out = std::string{};
+    for (auto s = 0; s < NUM_SUBSYSTEMS; s++) {
+        out += str(boost::format("%-14s %9.1f MiB\n")
+                   % s_subsystem_names[s] % (get(Subsystem(s)) / 1048576.0));
+    }
+    out += str(boost::format("%-14s %9.1f MiB\n")
+               % "total" % (total() / 1048576.0));
+    return out;
+}
+
+std::string MemoryTracker::json() {
+    auto out = std::string{"{"};
+    for (auto s = 0; s < NUM_SUBSYSTEMS; s++) {
+        out += str(boost::format("%s\"%s\": %d")
+                   % (s ? ", " : "") % s_subsystem_names[s]
+                   % get(Subsystem(s)));
+    }
+    return out + "}";
+}
@@ -0,0 +1,127 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef MEMORYTRACKER_H_INCLUDED
+#define MEMORYTRACKER_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Bytes actually allocated by each part of the engine, as counted by the
+// containers that hold them, where lz-memory_report and the cfg_max_memory
+// limits only have estimates. The containers take a TrackedAllocator, the
+// few buffers allocated otherwise call add() themselves.
+//
+// Every thread counts in counters of its own, so that allocating does not
+// contend on a shared cache line. A block freed by another thread than
+// the one that allocated it leaves one counter negative, only the sums
+// over the threads are meaningful.
+class MemoryTracker {
+public:
+    enum Subsystem {
+        TREE_NODES,     // NodePool slabs holding the UCTNodes
+        TREE_CHILDREN,  // the child lists of the nodes
+        NNCACHE,        // NNCache tables
+        HISTORY,        // KoState game histories and their ko hashes
+        TRAINING,       // the positions recorded by Training
+        OPENCL_HOST,    // pinned host buffers of the OpenCL contexts
+        NUM_SUBSYSTEMS
+    };
+
+    static void add(Subsystem subsystem, std::int64_t bytes) {
+        local_counters()[subsystem].fetch_add(bytes,
+                                              std::memory_order_relaxed);
+    }
+
+    // Bytes allocated by subsystem now.
+    static std::int64_t get(Subsystem subsystem);
+    static std::int64_t total();
+
+    // One line per subsystem and the total, in MiB.
+    static std::string report();
+    // {"tree_nodes": bytes, ...} for the metrics.
+    static std::string json();
+
+private:
+    using Counters = std::array<std::atomic<std::int64_t>, NUM_SUBSYSTEMS>;
+
+    static Counters& local_counters();
+
+    // The counters of every thread that ever allocated, kept after the
+    // thread exits since its blocks can outlive it.
+    static std::mutex s_registry_mutex;
+    static std::vector<std::shared_ptr<Counters>> s_registry;
+};
+
+// std::allocator counting its blocks in MemoryTracker under subsystem S.
+template <typename T, MemoryTracker::Subsystem S>
+class TrackedAllocator {
+public:
+    using value_type = T;
+
+    template <typename U>
+    struct rebind {
+        using other = TrackedAllocator<U, S>;
+    };
+
+    TrackedAllocator() = default;
+    template <typename U>
+    TrackedAllocator(const TrackedAllocator<U, S>&) {}
+
+    T* allocate(size_t n) {
+        MemoryTracker::add(S, n * sizeof(T));
+        return std::allocator<T>{}.allocate(n);
+    }
+    void deallocate(T* ptr, size_t n) {
+        MemoryTracker::add(S, -std::int64_t(n * sizeof(T)));
+        std::allocator<T>{}.deallocate(ptr, n);
+    }
+
+    template <typename U>
+    bool operator==(const TrackedAllocator<U, S>&) const {
+        return true;
+    }
+    template <typename U>
+    bool operator!=(const TrackedAllocator<U, S>&) const {
+        return false;
+    }
+};
+
+template <typename T, MemoryTracker::Subsystem S>
+using TrackedVector = std::vector<T, TrackedAllocator<T, S>>;
+
+#endif
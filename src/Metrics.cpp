@@ -0,0 +1,148 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+#include <cstdint>
+#include <iomanip>
+#include <sstream>
+
+#include "Metrics.h"
+#include "GTP.h"
+#include "MemoryTracker.h"
+#include "UCTNodePointer.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+std::thread MetricsReporter::s_thread;
+std::mutex MetricsReporter::s_mutex;
+std::condition_variable MetricsReporter::s_cv;
+bool MetricsReporter::s_stopping{false};
+
+namespace {
+    struct Sample {
+        std::chrono::steady_clock::time_point time{std::chrono::steady_clock::now()};
+        std::uint64_t playouts{0};
+        size_t evals{0};
+        size_t batches{0};
+        std::uint32_t cache_hits{0};
+        std::uint32_t cache_lookups{0};
+    };
+    // The previous sample, only used by the reporter thread.
+    Sample s_last;
+
+    // Counters restart from zero when the network is replaced.
+    template <typename T>
+    T delta(const T now, const T before) {
+        return now >= before ? now - before : now;
+    }
+}
+
+std::mutex& MetricsReporter::network_mutex() {
+    static std::mutex mutex;
+    return mutex;
+}
+
+void MetricsReporter::start(int interval_seconds) {
+    assert(!s_thread.joinable());
+    s_last = Sample{};
+    s_stopping = false;
+    s_thread = std::thread(&MetricsReporter::run, interval_seconds);
+    // Before exit() destroys the network.
+    std::atexit(&MetricsReporter::stop);
+}
+
+void MetricsReporter::stop() {
+    {
+        std::lock_guard<std::mutex> lock(s_mutex);
+        s_stopping = true;
+    }
+    s_cv.notify_all();
+    if (s_thread.joinable()) {
+        s_thread.join();
+    }
+}
+
+void MetricsReporter::run(int interval_seconds) {
+    std::unique_lock<std::mutex> lock(s_mutex);
+    while (!s_cv.wait_for(lock, std::chrono::seconds(interval_seconds),
+                          [] { return s_stopping; })) {
+        lock.unlock();
+        log_line(sample());
+        lock.lock();
+    }
+}
+
+std::string MetricsReporter::sample() {
+    auto now = Sample{};
+    auto queued = size_t{0};
+    auto cache_size = size_t{0};
+    now.playouts = UCTSearch::get_total_playouts();
+    {
+        std::lock_guard<std::mutex> lock(network_mutex());
+        if (GTP::s_network) {
+            const auto counters = GTP::s_network->get_counters();
+            now.evals = counters.evals;
+            now.batches = counters.batches;
+            now.cache_hits = counters.cache_hit_rate.first;
+            now.cache_lookups = counters.cache_hit_rate.second;
+            queued = counters.queued;
+            cache_size = counters.cache_size;
+        }
+    }
+
+    const auto seconds = std::chrono::duration<double>(now.time - s_last.time).count();
+    const auto evals = delta(now.evals, s_last.evals);
+    const auto batches = delta(now.batches, s_last.batches);
+    const auto lookups = delta(now.cache_lookups, s_last.cache_lookups);
+    const auto hits = std::min(delta(now.cache_hits, s_last.cache_hits), lookups);
+
+    auto out = std::ostringstream{};
+    out << std::fixed << std::setprecision(1)
+        << "{\"metrics\": {"
+        << "\"playouts_per_s\": " << delta(now.playouts, s_last.playouts) / seconds
+        << ", \"nn_evals_per_s\": " << evals / seconds
+        << std::setprecision(2)
+        << ", \"avg_batch_size\": " << (batches ? double(evals) / batches : 0.0)
+        << ", \"cache_hit_rate\": " << (lookups ? double(hits) / lookups : 0.0)
+        << ", \"cache_mib\": " << double(cache_size) / MiB
+        << ", \"tree_mib\": " << double(UCTNodePointer::get_tree_size()) / MiB
+        << ", \"nn_queue_depth\": " << queued
+        << ", \"memory\": " << MemoryTracker::json()
+        << "}}";
+    s_last = now;
+    return out.str();
+}
@@ -0,0 +1,68 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#ifndef METRICS_H_INCLUDED
+#define METRICS_H_INCLUDED
+
+#include "config.h"
+
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
+
+// Periodically writes one JSON line with the throughput of the engine to
+// the log file (stderr without one): playouts and network evaluations
+// per second, average batch size, cache hit rate, cache and tree memory,
+// the positions queued for the network and the bytes allocated by each
+// subsystem, see MemoryTracker.
+//
+// It only samples counters the engine keeps anyway, from a thread of its
+// own, so the search is not slowed down.
+class MetricsReporter {
+public:
+    static void start(int interval_seconds);
+    static void stop();
+
+    // Held while GTP::s_network is replaced.
+    static std::mutex& network_mutex();
+
+private:
+    // The JSON line for the interval since the last call.
+    static std::string sample();
+    static void run(int interval_seconds);
+
+    static std::thread s_thread;
+    static std::mutex s_mutex;
+    static std::condition_variable s_cv;
+    static bool s_stopping;
+};
+
+#endif
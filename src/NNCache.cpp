@@ -28,67 +28,216 @@
 */
 
 #include "config.h"
+#include <algorithm>
+#include <cmath>
 #include <functional>
 #include <memory>
+#include <thread>
+#include <vector>
 
 #include "NNCache.h"
+#include "Numa.h"
 #include "Utils.h"
 #include "UCTSearch.h"
 #include "GTP.h"
 
+const int NNCache::NUM_SHARDS;
 const int NNCache::MAX_CACHE_COUNT;
 const int NNCache::MIN_CACHE_COUNT;
 const size_t NNCache::ENTRY_SIZE;
+const size_t NNCache::COMPACT_ENTRY_SIZE;
+const float NNCache::COMPACT_MAX_ERROR;
+const int NNCache::BUCKET_WAYS;
 
-NNCache::NNCache(int size) : m_size(size) {}
+void NNCache::CompactEntry::store(const Netresult& r) {
+    for (auto i = size_t{0}; i < policy.size(); i++) {
+        policy[i] = half_float::half_cast<half_float::half,
+                                          std::round_to_nearest>(r.policy[i]);
+    }
+    policy_pass = r.policy_pass;
+    value = r.value;
+    alpha = r.alpha;
+    beta = r.beta;
+    beta2 = r.beta2;
+    is_sai = r.is_sai;
+}
 
-bool NNCache::lookup(std::uint64_t hash, Netresult & result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
-    ++m_lookups;
+void NNCache::CompactEntry::load(Netresult& r) const {
+    for (auto i = size_t{0}; i < policy.size(); i++) {
+        r.policy[i] = policy[i];
+    }
+    r.policy_pass = policy_pass;
+    r.value = value;
+    r.alpha = alpha;
+    r.beta = beta;
+    r.beta2 = beta2;
+    r.is_sai = is_sai;
+}
 
-    auto iter = m_cache.find(hash);
-    if (iter == m_cache.end()) {
-        return false;  // Not found.
+NNCache::NNCache(int size) {
+    resize(size);
+}
+
+template <typename T>
+bool NNCache::lookup_table(Shard& shard, Table<T>& table,
+                           std::uint64_t hash, Netresult& result) {
+    auto bucket = &table[((hash & 0xFFFFFFFF) % shard.buckets) * BUCKET_WAYS];
+    for (auto way = 0; way < BUCKET_WAYS; way++) {
+        const auto& entry = bucket[way];
+        if (entry.stamp != 0 && entry.hash == hash) {
+            entry.load(result);
+            return true;
+        }
     }
+    return false;
+}
 
-    const auto& entry = iter->second;
+template <typename T>
+T* NNCache::insert_table(Shard& shard, Table<T>& table,
+                         std::uint64_t hash, const Netresult& result) {
+    auto bucket = &table[((hash & 0xFFFFFFFF) % shard.buckets) * BUCKET_WAYS];
+    auto victim = bucket;
+    for (auto way = 0; way < BUCKET_WAYS; way++) {
+        auto& entry = bucket[way];
+        if (entry.stamp != 0 && entry.hash == hash) {
+            return nullptr;  // Already in the cache.
+        }
+        // Prefer an empty slot, otherwise take the oldest one.
+        if (entry.stamp < victim->stamp) {
+            victim = &entry;
+        }
+    }
+
+    if (victim->stamp == 0) {
+        ++shard.count;
+    }
+    victim->hash = hash;
+    victim->stamp = ++shard.stamp;
+    victim->store(result);
+    return victim;
+}
+
+bool NNCache::lookup(std::uint64_t hash, Netresult & result,
+                     bool count_lookup) {
+    if (count_lookup) {
+        ++m_lookups;
+    }
+
+    auto& shard = get_shard(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto found = m_compact
+        ? lookup_table(shard, shard.compact_table, hash, result)
+        : lookup_table(shard, shard.table, hash, result);
+    if (!found) {
+        return false;  // Not found.
+    }
 
     // Found it.
     ++m_hits;
-    result = entry->result;
     return true;
 }
 
 void NNCache::insert(std::uint64_t hash,
                      const Netresult& result) {
-    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& shard = get_shard(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
 
-    if (m_cache.find(hash) != m_cache.end()) {
-        return;  // Already in the cache.
+    if (!m_compact) {
+        if (insert_table(shard, shard.table, hash, result)) {
+            ++m_inserts;
+        }
+        return;
     }
 
-    m_cache.emplace(hash, std::make_unique<Entry>(result));
-    m_order.push_back(hash);
-    ++m_inserts;
+    auto entry = insert_table(shard, shard.compact_table, hash, result);
+    if (entry) {
+        ++m_inserts;
+        // Keep track of the quantization error actually incurred.
+        for (auto i = size_t{0}; i < result.policy.size(); i++) {
+            auto error = std::abs(float(entry->policy[i]) - result.policy[i]);
+            shard.max_error = std::max(shard.max_error, error);
+        }
+    }
+}
 
-    // If the cache is too large, remove the oldest entry.
-    if (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+void NNCache::reset_shard(Shard& shard, size_t buckets) {
+    // Only the table in use gets memory, the other one is released.
+    if (m_compact) {
+        shard.table = Table<Entry>();
+        shard.compact_table = Table<CompactEntry>(buckets * BUCKET_WAYS);
+    } else {
+        shard.compact_table = Table<CompactEntry>();
+        shard.table = Table<Entry>(buckets * BUCKET_WAYS);
+    }
+    shard.buckets = buckets;
+    shard.count = 0;
+    shard.stamp = 0;
+    shard.max_error = 0.0f;
+}
+
+template <typename F>
+void NNCache::for_each_shard(F f) {
+    const auto nodes = Numa::num_nodes();
+    const auto run = [this, nodes, &f](size_t node) {
+        for (auto i = node; i < m_shards.size(); i += nodes) {
+            std::lock_guard<std::mutex> lock(m_shards[i].mutex);
+            f(m_shards[i]);
+        }
+    };
+    if (nodes == 1) {
+        run(0);
+        return;
+    }
+    auto threads = std::vector<std::thread>{};
+    for (auto node = size_t{0}; node < nodes; node++) {
+        threads.emplace_back([&run, node]() {
+            Numa::bind_to_node(node);
+            run(node);
+        });
+    }
+    for (auto& t : threads) {
+        t.join();
     }
 }
 
 void NNCache::resize(int size) {
     m_size = size;
-    while (m_order.size() > m_size) {
-        m_cache.erase(m_order.front());
-        m_order.pop_front();
+    // Round up so that tiny caches still keep something in every shard.
+    const auto buckets = std::max(size_t{1},
+        (m_size + NUM_SHARDS * BUCKET_WAYS - 1) / (NUM_SHARDS * BUCKET_WAYS));
+    for_each_shard([this, buckets](Shard& shard) {
+        if (shard.buckets == buckets) {
+            return;
+        }
+        // Entries can't be rehashed into the new geometry cheaply,
+        // so resizing starts from an empty table.
+        reset_shard(shard, buckets);
+    });
+}
+
+void NNCache::set_compact(bool compact) {
+    if (compact == m_compact) {
+        return;
     }
+    m_compact = compact;
+    for_each_shard([this](Shard& shard) {
+        reset_shard(shard, shard.buckets);
+    });
 }
 
 void NNCache::clear() {
-    m_cache.clear();
-    m_order.clear();
+    for (auto& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        for (auto& entry : shard.table) {
+            entry.stamp = 0;
+        }
+        for (auto& entry : shard.compact_table) {
+            entry.stamp = 0;
+        }
+        shard.count = 0;
+        shard.stamp = 0;
+    }
 }
 
 void NNCache::set_size_from_playouts(int max_playouts) {
@@ -104,13 +253,38 @@ void NNCache::set_size_from_playouts(int max_playouts) {
     resize(max_size);
 }
 
+size_t NNCache::get_count() {
+    auto count = size_t{0};
+    for (auto& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        count += shard.count;
+    }
+    return count;
+}
+
 void NNCache::dump_stats() {
     Utils::myprintf(
-        "NNCache: %d/%d hits/lookups = %.1f%% hitrate, %d inserts, %u size\n",
-        m_hits, m_lookups, 100. * m_hits / (m_lookups + 1),
-        m_inserts, m_cache.size());
+        "NNCache: %d/%d hits/lookups = %.1f%% hitrate, %d inserts, %zu size\n",
+        m_hits.load(), m_lookups.load(), 100. * m_hits / (m_lookups + 1),
+        m_inserts.load(), get_count());
+
+    if (m_compact) {
+        auto max_error = 0.0f;
+        for (auto& shard : m_shards) {
+            std::lock_guard<std::mutex> lock(shard.mutex);
+            max_error = std::max(max_error, shard.max_error);
+        }
+        Utils::myprintf(
+            "NNCache: compact policy, max error %.2e (bound %.2e)\n",
+            max_error, COMPACT_MAX_ERROR);
+    }
 }
 
 size_t NNCache::get_estimated_size() {
-    return m_order.size() * NNCache::ENTRY_SIZE;
+    auto slots = size_t{0};
+    for (auto& shard : m_shards) {
+        std::lock_guard<std::mutex> lock(shard.mutex);
+        slots += m_compact ? shard.compact_table.size() : shard.table.size();
+    }
+    return slots * get_entry_size();
 }
@@ -33,14 +33,20 @@
 #include "config.h"
 
 #include <array>
-#include <deque>
-#include <memory>
+#include <atomic>
+#include <cstdint>
 #include <mutex>
-#include <unordered_map>
+#include <vector>
+
+#include "half/half.hpp"
+#include "MemoryTracker.h"
 
 class NNCache {
 public:
 
+    // Number of independently locked shards. Must be a power of 2.
+    static constexpr int NUM_SHARDS = 32;
+
     // Maximum size of the cache in number of items.
     static constexpr int MAX_CACHE_COUNT = 150'000;
 
@@ -74,12 +80,50 @@ public:
         }
     };
 
-    static constexpr size_t ENTRY_SIZE =
-          sizeof(Netresult)
-        + sizeof(std::uint64_t)
-        + sizeof(std::unique_ptr<Netresult>);
+    // One slot of the preallocated table. A stamp of 0 marks
+    // an empty slot, otherwise it records the insertion order.
+    struct Entry {
+        std::uint64_t hash{0};
+        std::uint64_t stamp{0};
+        Netresult result;  // ~ 1.4KiB
+
+        void store(const Netresult& r) { result = r; }
+        void load(Netresult& r) const { r = result; }
+    };
+
+    // Slot of the compact table: the policy is kept as fp16, which
+    // roughly halves the entry size. The scalars stay in full precision
+    // as the SAI winrate is very sensitive to alpha and beta.
+    struct CompactEntry {
+        std::uint64_t hash{0};
+        std::uint64_t stamp{0};
+        std::array<half_float::half, NUM_INTERSECTIONS> policy;
+        float policy_pass;
+        float value;
+        float alpha;
+        float beta;
+        float beta2;
+        bool is_sai;
 
-    NNCache(int size = MAX_CACHE_COUNT);  // ~ 208MiB
+        void store(const Netresult& r);
+        void load(Netresult& r) const;
+    };
+
+    // Exact memory used per cache item, as the table is preallocated.
+    static constexpr size_t ENTRY_SIZE = sizeof(Entry);
+    static constexpr size_t COMPACT_ENTRY_SIZE = sizeof(CompactEntry);
+
+    // Worst case absolute error of a policy value in [0, 1] after
+    // rounding to nearest fp16: half an ulp in [0.5, 1).
+    static constexpr float COMPACT_MAX_ERROR = 1.0f / 4096.0f;
+
+    // Number of slots per bucket. A new entry replaces the oldest
+    // entry in its bucket.
+    static constexpr int BUCKET_WAYS = 2;
+
+    // The table is allocated up front, so start small: Network sizes the
+    // cache with resize() once the playouts and the memory are known.
+    NNCache(int size = MIN_CACHE_COUNT);  // ~ 8MiB
 
     // Set a reasonable size gives max number of playouts
     void set_size_from_playouts(int max_playouts);
@@ -88,8 +132,21 @@ public:
     void resize(int size);
     void clear();
 
-    // Try and find an existing entry.
-    bool lookup(std::uint64_t hash, Netresult & result);
+    // Switch between full and compact (fp16 policy) storage.
+    // This empties the cache.
+    void set_compact(bool compact);
+    bool is_compact() const { return m_compact; }
+
+    // Memory used by a single item with the current storage.
+    size_t get_entry_size() const {
+        return m_compact ? COMPACT_ENTRY_SIZE : ENTRY_SIZE;
+    }
+
+    // Try and find an existing entry. With count_lookup false, only a
+    // hit is counted in hit_rate(), for the further lookups of a
+    // position already missed once.
+    bool lookup(std::uint64_t hash, Netresult & result,
+                bool count_lookup = true);
 
     // Insert a new entry.
     void insert(std::uint64_t hash,
@@ -97,7 +154,7 @@ public:
 
     // Return the hit rate ratio.
     std::pair<int, int> hit_rate() const {
-        return {m_hits, m_lookups};
+        return {m_hits.load(), m_lookups.load()};
     }
 
     void dump_stats();
@@ -105,26 +162,58 @@ public:
     // Return the estimated memory consumption of the cache.
     size_t get_estimated_size();
 private:
+    template <typename T>
+    using Table = TrackedVector<T, MemoryTracker::NNCACHE>;
+
+    // Each shard owns a slice of the key space and its own lock, so
+    // that search threads probing different positions rarely contend.
+    // Its table is allocated once in resize() and never grows. Only
+    // one of the two tables is in use, depending on m_compact.
+    struct Shard {
+        std::mutex mutex;
+        std::uint64_t stamp{0};
+        size_t buckets{0};
+        size_t count{0};
+        Table<Entry> table;
+        Table<CompactEntry> compact_table;
+        // Largest policy error measured on insert into compact_table.
+        float max_error{0.0f};
+    };
 
-    std::mutex m_mutex;
+    // Number of entries currently stored.
+    size_t get_count();
+
+    // Empty and (re)allocate the table of a shard. Shard lock must be held.
+    void reset_shard(Shard& shard, size_t buckets);
+
+    // Call f on every shard, with its lock held. With NUMA placement
+    // shard i is handled by a thread on node i % nodes, so its table is
+    // allocated there and the cache traffic spreads over all sockets.
+    template <typename F>
+    void for_each_shard(F f);
+
+    template <typename T>
+    bool lookup_table(Shard& shard, Table<T>& table,
+                      std::uint64_t hash, Netresult& result);
+    template <typename T>
+    T* insert_table(Shard& shard, Table<T>& table,
+                    std::uint64_t hash, const Netresult& result);
+
+    Shard& get_shard(std::uint64_t hash) {
+        // The low bits are used for the bucket index,
+        // take the shard index from the high bits instead.
+        return m_shards[(hash >> 32) & (NUM_SHARDS - 1)];
+    }
 
     size_t m_size;
+    bool m_compact{false};
 
     // Statistics
-    int m_hits{0};
-    int m_lookups{0};
-    int m_inserts{0};
-
-    struct Entry {
-        Entry(const Netresult& r)
-            : result(r) {}
-        Netresult result;  // ~ 1.4KiB
-    };
+    std::atomic<int> m_hits{0};
+    std::atomic<int> m_lookups{0};
+    std::atomic<int> m_inserts{0};
 
-    // Map from hash to {features, result}
-    std::unordered_map<std::uint64_t, std::unique_ptr<const Entry>> m_cache;
-    // Order entries were added to the map.
-    std::deque<size_t> m_order;
+    std::array<Shard, NUM_SHARDS> m_shards;
 };
 
 #endif
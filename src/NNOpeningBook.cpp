@@ -0,0 +1,180 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#include "config.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <type_traits>
+#include <unordered_set>
+
+#include "NNOpeningBook.h"
+#include "GameState.h"
+#include "Network.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+const std::uint32_t NNOpeningBook::VERSION;
+
+static_assert(std::is_trivially_copyable<NNCache::Netresult>::value,
+              "Netresult is written raw into the book file");
+
+static constexpr char OPENING_BOOK_MAGIC[8] = "SAIBOOK";
+
+NNOpeningBook::~NNOpeningBook() {
+    if (m_loader.joinable()) {
+        m_loader.join();
+    }
+}
+
+void NNOpeningBook::load_async(const std::string& filename,
+                               std::uint64_t network_hash) {
+    assert(!m_loader.joinable());
+    m_loader = std::thread(&NNOpeningBook::load, this, filename, network_hash);
+}
+
+void NNOpeningBook::load(const std::string& filename,
+                         std::uint64_t network_hash) {
+    std::ifstream file(filename, std::ifstream::binary);
+    auto header = Header{};
+    file.read(reinterpret_cast<char*>(&header), sizeof(Header));
+    if (!file
+        || std::memcmp(header.magic, OPENING_BOOK_MAGIC, sizeof(header.magic)) != 0
+        || header.version != VERSION
+        || header.board_size != BOARD_SIZE
+        || header.entry_size != sizeof(Entry)) {
+        myprintf("Opening book %s is invalid.\n", filename.c_str());
+        return;
+    }
+    if (header.network_hash != network_hash) {
+        myprintf("Opening book %s belongs to another network.\n",
+                 filename.c_str());
+        return;
+    }
+
+    auto entries = std::vector<Entry>(header.entries);
+    file.read(reinterpret_cast<char*>(entries.data()),
+              entries.size() * sizeof(Entry));
+    if (!file) {
+        myprintf("Opening book %s is truncated.\n", filename.c_str());
+        return;
+    }
+    std::sort(begin(entries), end(entries),
+              [](const Entry& a, const Entry& b) { return a.hash < b.hash; });
+
+    myprintf("Loaded opening book %s with %zu positions.\n",
+             filename.c_str(), entries.size());
+    m_entries = std::move(entries);
+    m_ready.store(true, std::memory_order_release);
+}
+
+bool NNOpeningBook::lookup(std::uint64_t hash, Netresult& result,
+                           bool count_lookup) {
+    if (!m_ready.load(std::memory_order_acquire)) {
+        return false;
+    }
+    if (count_lookup) {
+        ++m_lookups;
+    }
+    const auto it = std::lower_bound(
+        begin(m_entries), end(m_entries), hash,
+        [](const Entry& entry, std::uint64_t h) { return entry.hash < h; });
+    if (it == end(m_entries) || it->hash != hash) {
+        return false;
+    }
+    ++m_hits;
+    result = it->result;
+    return true;
+}
+
+size_t NNOpeningBook::generate(Network& network, const GameState& root,
+                               int depth, int width,
+                               const std::string& filename) {
+    auto entries = std::vector<Entry>{};
+    auto seen = std::unordered_set<std::uint64_t>{};
+    auto level = std::vector<GameState>{root};
+
+    for (auto d = 0; d <= depth && !level.empty(); d++) {
+        auto next_level = std::vector<GameState>{};
+        for (const auto& state : level) {
+            if (!seen.insert(state.board.get_hash()).second) {
+                continue;
+            }
+            // All the symmetries, as the book is made once.
+            const auto result = network.get_output(
+                &state, Network::Ensemble::AVERAGE, -1, false, false);
+            entries.push_back({state.board.get_hash(), result});
+            if (d == depth) {
+                continue;
+            }
+
+            auto moves = std::vector<std::pair<float, int>>{};
+            const auto to_move = state.get_to_move();
+            for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
+                const auto x = idx % BOARD_SIZE;
+                const auto y = idx / BOARD_SIZE;
+                const auto vertex = state.board.get_vertex(x, y);
+                if (state.is_move_legal(to_move, vertex)) {
+                    moves.emplace_back(result.policy[idx], vertex);
+                }
+            }
+            const auto count = std::min(moves.size(), size_t(width));
+            std::partial_sort(begin(moves), begin(moves) + count, end(moves),
+                              std::greater<std::pair<float, int>>());
+            for (auto i = size_t{0}; i < count; i++) {
+                next_level.push_back(state);
+                next_level.back().play_move(moves[i].second);
+            }
+        }
+        myprintf("Opening book: %zu positions up to move %d.\n",
+                 entries.size(), d);
+        level = std::move(next_level);
+    }
+
+    auto header = Header{};
+    std::memcpy(header.magic, OPENING_BOOK_MAGIC, sizeof(header.magic));
+    header.version = VERSION;
+    header.board_size = BOARD_SIZE;
+    header.network_hash = network.get_network_hash();
+    header.entries = entries.size();
+    header.entry_size = sizeof(Entry);
+
+    std::ofstream file(filename, std::ofstream::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(Header));
+    file.write(reinterpret_cast<const char*>(entries.data()),
+               entries.size() * sizeof(Entry));
+    if (!file) {
+        myprintf("Could not write opening book %s.\n", filename.c_str());
+        return 0;
+    }
+    return entries.size();
+}
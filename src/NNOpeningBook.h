@@ -0,0 +1,107 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#ifndef NNOPENINGBOOK_H_INCLUDED
+#define NNOPENINGBOOK_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "NNCache.h"
+
+class GameState;
+class Network;
+
+// Read-only table of network evaluations of opening positions, made
+// offline for one network with sai-makebook. The file is read by a
+// background thread, and lookups miss until it is done, so that the
+// engine does not wait for it at startup.
+class NNOpeningBook {
+public:
+    using Netresult = NNCache::Netresult;
+
+    NNOpeningBook() = default;
+    ~NNOpeningBook();
+
+    // Start reading the file. Positions of another network or board
+    // size are not used.
+    void load_async(const std::string& filename, std::uint64_t network_hash);
+
+    // Try and find an entry, see NNCache::lookup().
+    bool lookup(std::uint64_t hash, Netresult& result,
+                bool count_lookup = true);
+
+    std::pair<int, int> hit_rate() const {
+        return {m_hits.load(), m_lookups.load()};
+    }
+
+    // Evaluate the positions reached from root by following the width
+    // moves with the highest policy, up to depth moves, and write them
+    // to filename. Returns the number of positions, 0 on failure.
+    static size_t generate(Network& network, const GameState& root,
+                           int depth, int width,
+                           const std::string& filename);
+
+private:
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t board_size;
+        std::uint64_t network_hash;
+        std::uint64_t entries;
+        std::uint64_t entry_size;
+    };
+
+    struct Entry {
+        std::uint64_t hash;
+        Netresult result;
+    };
+
+    static constexpr std::uint32_t VERSION = 1;
+
+    void load(const std::string& filename, std::uint64_t network_hash);
+
+    // Sorted by hash, only read once m_ready is set.
+    std::vector<Entry> m_entries;
+    std::atomic<bool> m_ready{false};
+    std::thread m_loader;
+
+    // Statistics
+    std::atomic<int> m_hits{0};
+    std::atomic<int> m_lookups{0};
+};
+
+#endif
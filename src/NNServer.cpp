@@ -0,0 +1,488 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2018-2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#include <cerrno>
+#include <csignal>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#ifdef __linux__
+#include <ctime>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#endif
+
+#include "NNServer.h"
+#include "GTP.h"
+#include "Network.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+const size_t NNServer::SLOTS;
+constexpr int NNServer::HEARTBEAT_MS;
+constexpr std::uint64_t NNServer::SERVER_TIMEOUT_MS;
+
+namespace {
+constexpr char NN_SERVER_MAGIC[8] = "SAINNS";
+constexpr std::uint32_t NN_SERVER_VERSION = 3;
+
+// The slots start on a cache line of their own.
+const auto SLOTS_OFFSET = ceilMultiple(sizeof(NNServer::Header), 64);
+
+// Evaluations take a fraction of a millisecond: spin a little before
+// sleeping.
+void backoff(int& spins) {
+    if (++spins < 100) {
+        std::this_thread::yield();
+    } else {
+        std::this_thread::sleep_for(std::chrono::microseconds(20));
+    }
+}
+
+std::atomic<std::uint64_t>& state_at(char* slot) {
+    return *reinterpret_cast<std::atomic<std::uint64_t>*>(slot);
+}
+
+template <typename T>
+std::atomic<T>& atomic_at(T& word) {
+    return *reinterpret_cast<std::atomic<T>*>(&word);
+}
+
+// Sleep until word is no longer value, for at most 100 ms. The mapping is
+// shared between processes, so on Linux this is a shared futex; elsewhere
+// it is a plain sleep, still long enough not to keep a core busy.
+void wait_change(std::atomic<std::uint32_t>& word, std::uint32_t value) {
+#ifdef __linux__
+    auto timeout = timespec{0, 100 * 1000 * 1000};
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAIT,
+            value, &timeout, nullptr, 0);
+#else
+    (void)word;
+    (void)value;
+    std::this_thread::sleep_for(std::chrono::milliseconds(1));
+#endif
+}
+
+void wake_one(std::atomic<std::uint32_t>& word) {
+#ifdef __linux__
+    syscall(SYS_futex, reinterpret_cast<std::uint32_t*>(&word), FUTEX_WAKE,
+            1, nullptr, nullptr, 0);
+#else
+    (void)word;
+#endif
+}
+}
+
+std::uint64_t NNServer::now_ms() {
+    // The steady clock is the same for all the processes of the host.
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+NNServer::Layout::Layout(size_t input_size, size_t policy_size,
+                         size_t value_size)
+    : input_size(input_size), policy_size(policy_size),
+      value_size(value_size) {
+    static_assert(sizeof(std::atomic<std::uint64_t>) <= 8,
+                  "The slot state fits before the input");
+    input_offset = 8;
+    policy_offset = ceilMultiple(input_offset + input_size, 8);
+    value_offset = policy_offset + policy_size * sizeof(float);
+    slot_size = ceilMultiple(value_offset + value_size * sizeof(float), 64);
+}
+
+#ifdef _WIN32
+
+bool NNServer::run(Network&, const std::string&) {
+    myprintf("The NN server is not supported on this platform.\n");
+    return false;
+}
+
+NNClientPipe::~NNClientPipe() {}
+
+bool NNClientPipe::connect(const std::string&, std::uint64_t,
+                           size_t, size_t, size_t) {
+    myprintf("The NN server is not supported on this platform.\n");
+    return false;
+}
+
+#else
+
+bool NNServer::run(Network& network, const std::string& filename) {
+    const auto layout = Layout(network.get_input_size(),
+                               network.get_policy_size(),
+                               network.get_value_size());
+    const auto size = SLOTS_OFFSET + SLOTS * layout.slot_size;
+
+    auto fd = ::open(filename.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0 || ftruncate(fd, size) != 0) {
+        myprintf("Could not create NN server file %s.\n", filename.c_str());
+        if (fd >= 0) {
+            ::close(fd);
+        }
+        return false;
+    }
+    auto mapping = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED,
+                        fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        myprintf("Could not map NN server file %s.\n", filename.c_str());
+        return false;
+    }
+
+    // The new file reads as zeros: all slots are FREE. Clients check the
+    // magic, which goes in last.
+    auto header = Header{};
+    header.version = NN_SERVER_VERSION;
+    header.board_size = BOARD_SIZE;
+    header.network_hash = network.get_network_hash();
+    header.input_size = layout.input_size;
+    header.policy_size = layout.policy_size;
+    header.value_size = layout.value_size;
+    header.slots = SLOTS;
+    header.slot_size = layout.slot_size;
+    header.heartbeat = now_ms();
+    std::memcpy(mapping, &header, sizeof(Header));
+    std::atomic_thread_fence(std::memory_order_release);
+    std::memcpy(mapping, NN_SERVER_MAGIC, sizeof(header.magic));
+
+    const auto threads = std::max(1u, cfg_num_threads);
+    myprintf("Serving network evaluations on %s, %zu slots, %u threads.\n",
+             filename.c_str(), SLOTS, threads);
+
+    auto shared_header = static_cast<Header*>(mapping);
+    auto slots = static_cast<char*>(mapping) + SLOTS_OFFSET;
+    auto servers = std::vector<std::thread>{};
+    servers.emplace_back([shared_header, slots, &layout]() {
+        heartbeat(shared_header, slots, layout);
+    });
+    for (auto i = 0u; i < threads; i++) {
+        servers.emplace_back([&network, shared_header, slots, &layout]() {
+            serve(network, shared_header, slots, layout);
+        });
+    }
+    for (auto& server : servers) {
+        server.join();
+    }
+    return true;
+}
+
+void NNServer::heartbeat(Header* header, char* slots, const Layout& layout) {
+    auto& stamp = atomic_at(header->heartbeat);
+    for (;;) {
+        stamp.store(now_ms(), std::memory_order_relaxed);
+        // A client that died leaves its CLAIMED slots, and the slots the
+        // server evaluated for it since, to nobody. The pid goes in with
+        // the state, so a slot claimed again since it was read is left
+        // alone.
+        for (auto i = size_t{0}; i < SLOTS; i++) {
+            auto& state = state_at(slots + i * layout.slot_size);
+            auto word = state.load(std::memory_order_relaxed);
+            const auto slot_state = state_of(word);
+            if ((slot_state == CLAIMED || slot_state == DONE)
+                && kill(pid_of(word), 0) != 0 && errno == ESRCH) {
+                state.compare_exchange_strong(word, slot_word(FREE, 0));
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(HEARTBEAT_MS));
+    }
+}
+
+void NNServer::serve(Network& network, Header* header, char* slots,
+                     const Layout& layout) {
+    auto& ready_count = atomic_at(header->ready_count);
+    auto& sleepers = atomic_at(header->sleepers);
+    const auto max_batch = std::max(1u, cfg_batch_size);
+    auto batch = std::vector<size_t>{};
+    auto input = std::vector<float>{};
+    auto output_pol = std::vector<float>{};
+    auto output_val = std::vector<float>{};
+
+    for (;;) {
+        // Take the READY slots, waiting for a full batch at most
+        // cfg_batch_latency milliseconds.
+        batch.clear();
+        auto spins = 0;
+        auto first_ready = std::chrono::steady_clock::time_point{};
+        const auto take_ready = [&]() {
+            for (auto i = size_t{0}; i < SLOTS && batch.size() < max_batch; i++) {
+                auto& state = state_at(slots + i * layout.slot_size);
+                auto word = state.load(std::memory_order_relaxed);
+                if (state_of(word) == READY
+                    && state.compare_exchange_strong(
+                        word, slot_word(BUSY, pid_of(word)),
+                        std::memory_order_acquire)) {
+                    batch.emplace_back(i);
+                }
+            }
+        };
+        for (;;) {
+            take_ready();
+            if (batch.size() == max_batch) {
+                break;
+            }
+            if (batch.empty()) {
+                if (++spins < 100) {
+                    std::this_thread::yield();
+                    continue;
+                }
+                // Idle: announce the sleep before the last look at the
+                // slots, so that a client either sees the sleeper and
+                // wakes it or made its slot READY before the look.
+                sleepers.fetch_add(1);
+                const auto count = ready_count.load();
+                take_ready();
+                if (batch.empty()) {
+                    wait_change(ready_count, count);
+                }
+                sleepers.fetch_sub(1);
+                if (batch.empty()) {
+                    continue;
+                }
+            }
+            const auto now = std::chrono::steady_clock::now();
+            if (first_ready == std::chrono::steady_clock::time_point{}) {
+                first_ready = now;
+            }
+            if (now - first_ready
+                >= std::chrono::milliseconds(cfg_batch_latency)) {
+                break;
+            }
+            std::this_thread::yield();
+        }
+
+        input.resize(batch.size() * layout.input_size);
+        output_pol.resize(batch.size() * layout.policy_size);
+        output_val.resize(batch.size() * layout.value_size);
+        for (auto b = size_t{0}; b < batch.size(); b++) {
+            const auto in = reinterpret_cast<const std::uint8_t*>(
+                slots + batch[b] * layout.slot_size + layout.input_offset);
+            std::copy(in, in + layout.input_size,
+                      begin(input) + b * layout.input_size);
+        }
+
+        network.forward_batch(input, output_pol, output_val, batch.size());
+
+        for (auto b = size_t{0}; b < batch.size(); b++) {
+            const auto slot = slots + batch[b] * layout.slot_size;
+            std::memcpy(slot + layout.policy_offset,
+                        output_pol.data() + b * layout.policy_size,
+                        layout.policy_size * sizeof(float));
+            std::memcpy(slot + layout.value_offset,
+                        output_val.data() + b * layout.value_size,
+                        layout.value_size * sizeof(float));
+            auto& state = state_at(slot);
+            const auto pid = pid_of(state.load(std::memory_order_relaxed));
+            state.store(slot_word(DONE, pid), std::memory_order_release);
+        }
+    }
+}
+
+NNClientPipe::~NNClientPipe() {
+    if (m_mapping) {
+        munmap(m_mapping, m_mapping_size);
+    }
+}
+
+bool NNClientPipe::connect(const std::string& filename,
+                           std::uint64_t network_hash, size_t input_size,
+                           size_t policy_size, size_t value_size) {
+    auto fd = ::open(filename.c_str(), O_RDWR);
+    if (fd < 0) {
+        myprintf("Could not open NN server file %s.\n", filename.c_str());
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < SLOTS_OFFSET) {
+        myprintf("NN server file %s is invalid.\n", filename.c_str());
+        ::close(fd);
+        return false;
+    }
+    auto mapping = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        myprintf("Could not map NN server file %s.\n", filename.c_str());
+        return false;
+    }
+    m_mapping = mapping;
+    m_mapping_size = st.st_size;
+
+    auto header = NNServer::Header{};
+    std::memcpy(&header, mapping, sizeof(header));
+    auto layout = std::make_unique<NNServer::Layout>(input_size, policy_size,
+                                                     value_size);
+    if (std::memcmp(header.magic, NN_SERVER_MAGIC, sizeof(header.magic)) != 0
+        || header.version != NN_SERVER_VERSION
+        || header.board_size != BOARD_SIZE
+        || header.slot_size != layout->slot_size
+        || m_mapping_size < SLOTS_OFFSET + header.slots * header.slot_size) {
+        myprintf("NN server file %s is invalid.\n", filename.c_str());
+        return false;
+    }
+    if (header.network_hash != network_hash
+        || header.input_size != input_size
+        || header.policy_size != policy_size
+        || header.value_size != value_size) {
+        myprintf("NN server %s serves another network.\n", filename.c_str());
+        return false;
+    }
+    if (NNServer::now_ms() - header.heartbeat > NNServer::SERVER_TIMEOUT_MS) {
+        myprintf("NN server %s is not running.\n", filename.c_str());
+        return false;
+    }
+
+    m_header = static_cast<NNServer::Header*>(mapping);
+    m_slots = static_cast<char*>(mapping) + SLOTS_OFFSET;
+    m_num_slots = header.slots;
+    m_layout = std::move(layout);
+    m_pid = getpid();
+    return true;
+}
+
+#endif
+
+std::atomic<std::uint64_t>& NNClientPipe::slot_state(size_t slot) {
+    return state_at(m_slots + slot * m_layout->slot_size);
+}
+
+void NNClientPipe::check_server() const {
+    const auto heartbeat =
+        atomic_at(m_header->heartbeat).load(std::memory_order_relaxed);
+    if (m_server_lost
+        || NNServer::now_ms() - heartbeat > NNServer::SERVER_TIMEOUT_MS) {
+        if (!m_server_lost.exchange(true)) {
+            myprintf_error("The NN server stopped answering.\n");
+        }
+        throw std::runtime_error("NN server not responding.");
+    }
+}
+
+size_t NNClientPipe::submit(const std::vector<float>& input, size_t i) {
+    if (m_server_lost) {
+        check_server();
+    }
+    auto spins = 0;
+    for (auto tries = size_t{1};; tries++) {
+        const auto slot = m_next_slot++ % m_num_slots;
+        auto& state = slot_state(slot);
+        auto expected = NNServer::slot_word(NNServer::FREE, 0);
+        if (state.load(std::memory_order_relaxed) == expected
+            && state.compare_exchange_strong(
+                expected, NNServer::slot_word(NNServer::CLAIMED, m_pid),
+                std::memory_order_acquire)) {
+            const auto in_size = m_layout->input_size;
+            auto in = reinterpret_cast<std::uint8_t*>(
+                m_slots + slot * m_layout->slot_size + m_layout->input_offset);
+            // The input planes are all 0 or 1.
+            std::transform(begin(input) + i * in_size,
+                           begin(input) + (i + 1) * in_size, in,
+                           [](float x) {
+                               assert(x == 0.0f || x == 1.0f);
+                               return static_cast<std::uint8_t>(x);
+                           });
+            state.store(NNServer::slot_word(NNServer::READY, m_pid),
+                        std::memory_order_release);
+            auto& ready_count = atomic_at(m_header->ready_count);
+            ready_count.fetch_add(1);
+            if (atomic_at(m_header->sleepers).load() > 0) {
+                wake_one(ready_count);
+            }
+            return slot;
+        }
+        if (tries % m_num_slots == 0) {
+            backoff(spins);
+            if (spins % 1024 == 0) {
+                check_server();
+            }
+        }
+    }
+}
+
+void NNClientPipe::collect(size_t slot, std::vector<float>& output_pol,
+                           std::vector<float>& output_val, size_t i) {
+    auto& state = slot_state(slot);
+    auto spins = 0;
+    while (NNServer::state_of(state.load(std::memory_order_acquire))
+           != NNServer::DONE) {
+        backoff(spins);
+        if (spins % 1024 == 0) {
+            check_server();
+        }
+    }
+    const auto data = m_slots + slot * m_layout->slot_size;
+    std::memcpy(output_pol.data() + i * m_layout->policy_size,
+                data + m_layout->policy_offset,
+                m_layout->policy_size * sizeof(float));
+    std::memcpy(output_val.data() + i * m_layout->value_size,
+                data + m_layout->value_offset,
+                m_layout->value_size * sizeof(float));
+    state.store(NNServer::slot_word(NNServer::FREE, 0),
+                std::memory_order_release);
+}
+
+void NNClientPipe::forward(const std::vector<float>& input,
+                           std::vector<float>& output_pol,
+                           std::vector<float>& output_val) {
+    collect(submit(input, 0), output_pol, output_val, 0);
+}
+
+void NNClientPipe::forward_batch(const std::vector<float>& input,
+                                 std::vector<float>& output_pol,
+                                 std::vector<float>& output_val,
+                                 const size_t batch_size) {
+    // Never hold more than a share of the slots, so that the other
+    // clients always get some.
+    const auto chunk = std::max(size_t{1}, m_num_slots / 8);
+    auto slots = std::vector<size_t>{};
+    for (auto start = size_t{0}; start < batch_size; start += chunk) {
+        const auto end = std::min(batch_size, start + chunk);
+        slots.clear();
+        for (auto i = start; i < end; i++) {
+            slots.emplace_back(submit(input, i));
+        }
+        for (auto i = start; i < end; i++) {
+            collect(slots[i - start], output_pol, output_val, i);
+        }
+    }
+}
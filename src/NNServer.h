@@ -0,0 +1,174 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2017-2019 Gian-Carlo Pascutto and contributors
+    Copyright (C) 2018-2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef NNSERVER_H_INCLUDED
+#define NNSERVER_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ForwardPipe.h"
+
+class Network;
+
+// Network evaluations for the engine processes of a host, through a
+// memory-mapped file of request slots. The server owns the network and
+// its GPUs, and evaluates the slots its clients fill in batches, which
+// fill up from all the processes. A client passes the input planes of
+// each position as bytes and waits for the outputs in the same slot.
+//
+// Each slot goes FREE -> CLAIMED (the client writes the input) -> READY
+// -> BUSY (the server evaluates it) -> DONE -> FREE (the client has read
+// the outputs), with the transitions on an atomic in the mapping, which
+// also holds the pid of the client. Idle server threads sleep on the
+// ready counter of the header, which the clients bump and wake after
+// each READY.
+//
+// The server stamps the header every HEARTBEAT_MS, and frees the slots
+// left CLAIMED or DONE by clients that died. A client whose server has
+// not stamped the header for SERVER_TIMEOUT_MS fails its evaluations
+// instead of waiting for it.
+class NNServer {
+public:
+    static constexpr size_t SLOTS = 256;
+    static constexpr auto HEARTBEAT_MS = 100;
+    static constexpr auto SERVER_TIMEOUT_MS = std::uint64_t{5000};
+
+    // Create filename and serve its clients with network, from
+    // cfg_num_threads threads, until the process exits. Returns false
+    // if the file cannot be created.
+    static bool run(Network& network, const std::string& filename);
+
+    enum SlotState : std::uint32_t {
+        FREE = 0, CLAIMED, READY, BUSY, DONE
+    };
+
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t board_size;
+        std::uint64_t network_hash;
+        std::uint64_t input_size;
+        std::uint64_t policy_size;
+        std::uint64_t value_size;
+        std::uint64_t slots;
+        std::uint64_t slot_size;
+        // Bumped after each READY, and the server threads waiting for it.
+        std::uint32_t ready_count;
+        std::uint32_t sleepers;
+        // Last stamp of the server, in steady clock milliseconds.
+        std::uint64_t heartbeat;
+    };
+
+    // The layout of a slot in the mapping, after the Header.
+    struct Layout {
+        Layout(size_t input_size, size_t policy_size, size_t value_size);
+
+        size_t input_size;
+        size_t policy_size;
+        size_t value_size;
+        size_t input_offset;
+        size_t policy_offset;
+        size_t value_offset;
+        size_t slot_size;
+    };
+
+    // The state of a slot and the pid of the client that claimed it.
+    static std::uint64_t slot_word(SlotState state, std::uint32_t pid) {
+        return std::uint64_t{pid} << 32 | state;
+    }
+    static SlotState state_of(std::uint64_t word) {
+        return static_cast<SlotState>(word & 0xffffffff);
+    }
+    static std::uint32_t pid_of(std::uint64_t word) {
+        return static_cast<std::uint32_t>(word >> 32);
+    }
+
+    static std::uint64_t now_ms();
+
+private:
+    static void serve(Network& network, Header* header, char* slots,
+                      const Layout& layout);
+    // Stamp the header and free the slots of dead clients, forever.
+    static void heartbeat(Header* header, char* slots, const Layout& layout);
+};
+
+// ForwardPipe that has an NNServer evaluate the positions.
+class NNClientPipe : public ForwardPipe {
+public:
+    NNClientPipe() = default;
+    ~NNClientPipe();
+
+    // Map filename, served for the network with this hash and these
+    // sizes of one position in floats. False if there is no such server.
+    bool connect(const std::string& filename, std::uint64_t network_hash,
+                 size_t input_size, size_t policy_size, size_t value_size);
+
+    virtual void initialize(const int) {}
+    virtual void forward(const std::vector<float>& input,
+                         std::vector<float>& output_pol,
+                         std::vector<float>& output_val);
+    virtual void forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               const size_t batch_size);
+    // The weights are on the server.
+    virtual void push_weights(unsigned int, unsigned int, unsigned int,
+                              std::shared_ptr<const ForwardPipeWeights>) {}
+    virtual bool can_replace_weights() const { return false; }
+
+private:
+    std::atomic<std::uint64_t>& slot_state(size_t slot);
+    // Throw if the server stopped stamping the header.
+    void check_server() const;
+    // Claim a free slot and copy the input of position i of input into it.
+    size_t submit(const std::vector<float>& input, size_t i);
+    // Wait for the outputs of slot, copy them to position i and free it.
+    void collect(size_t slot, std::vector<float>& output_pol,
+                 std::vector<float>& output_val, size_t i);
+
+    void* m_mapping{nullptr};
+    size_t m_mapping_size{0};
+    NNServer::Header* m_header{nullptr};
+    char* m_slots{nullptr};
+    std::unique_ptr<NNServer::Layout> m_layout;
+    size_t m_num_slots{0};
+    std::atomic<size_t> m_next_slot{0};
+    std::uint32_t m_pid{0};
+    // Once the server is gone, every evaluation fails at once.
+    mutable std::atomic<bool> m_server_lost{false};
+};
+
+#endif
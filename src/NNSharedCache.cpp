@@ -0,0 +1,241 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#include "config.h"
+
+#include <cstring>
+#include <type_traits>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "NNSharedCache.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+const size_t NNSharedCache::DEFAULT_SIZE_MIB;
+const std::uint32_t NNSharedCache::VERSION;
+const size_t NNSharedCache::MAX_PENDING;
+
+static_assert(std::is_trivially_copyable<NNCache::Netresult>::value,
+              "Netresult is copied raw into the shared mapping");
+
+static constexpr char SHARED_CACHE_MAGIC[8] = "SAINNC";
+
+NNSharedCache::~NNSharedCache() {
+    close();
+}
+
+#ifdef _WIN32
+
+bool NNSharedCache::open(const std::string&, std::uint64_t, size_t) {
+    myprintf("Shared NN cache files are not supported on this platform.\n");
+    return false;
+}
+
+void NNSharedCache::close() {}
+
+#else
+
+bool NNSharedCache::open(const std::string& filename,
+                         std::uint64_t network_hash,
+                         size_t size_mib) {
+    close();
+
+    auto fd = ::open(filename.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+        myprintf("Could not open shared NN cache %s.\n", filename.c_str());
+        return false;
+    }
+
+    // Serialize creation against the other processes.
+    flock(fd, LOCK_EX);
+
+    auto header = Header{};
+    struct stat st;
+    fstat(fd, &st);
+    auto ok = true;
+    if (st.st_size == 0) {
+        std::memcpy(header.magic, SHARED_CACHE_MAGIC, sizeof(header.magic));
+        header.version = VERSION;
+        header.board_size = BOARD_SIZE;
+        header.network_hash = network_hash;
+        header.slot_size = sizeof(Slot);
+        header.slots = (size_mib * 1024 * 1024 - sizeof(Header)) / sizeof(Slot);
+        // The new file reads as zeros: all slots are empty.
+        ok = ftruncate(fd, sizeof(Header) + header.slots * sizeof(Slot)) == 0
+            && pwrite(fd, &header, sizeof(Header), 0) == sizeof(Header);
+    } else {
+        ok = pread(fd, &header, sizeof(Header), 0) == sizeof(Header)
+            && std::memcmp(header.magic, SHARED_CACHE_MAGIC, sizeof(header.magic)) == 0
+            && header.version == VERSION
+            && header.board_size == BOARD_SIZE
+            && header.slot_size == sizeof(Slot)
+            && size_t(st.st_size) >= sizeof(Header) + header.slots * sizeof(Slot);
+        if (ok && header.network_hash != network_hash) {
+            myprintf("Shared NN cache %s belongs to another network.\n",
+                     filename.c_str());
+            flock(fd, LOCK_UN);
+            ::close(fd);
+            return false;
+        }
+    }
+    flock(fd, LOCK_UN);
+
+    if (!ok || header.slots == 0) {
+        myprintf("Shared NN cache %s is invalid.\n", filename.c_str());
+        ::close(fd);
+        return false;
+    }
+
+    m_mapping_size = sizeof(Header) + header.slots * sizeof(Slot);
+    auto mapping = mmap(nullptr, m_mapping_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED, fd, 0);
+    // The mapping stays valid after the descriptor is closed.
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        myprintf("Could not map shared NN cache %s.\n", filename.c_str());
+        m_mapping_size = 0;
+        return false;
+    }
+
+    m_mapping = mapping;
+    m_slots = reinterpret_cast<Slot*>(static_cast<char*>(mapping) + sizeof(Header));
+    m_num_slots = header.slots;
+
+    m_pending.reserve(MAX_PENDING);
+    m_running = true;
+    m_writer = std::thread(&NNSharedCache::writer_loop, this);
+
+    myprintf("Using shared NN cache %s with %zu entries.\n",
+             filename.c_str(), m_num_slots);
+    return true;
+}
+
+void NNSharedCache::close() {
+    if (m_writer.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_running = false;
+        }
+        m_cv.notify_one();
+        m_writer.join();
+    }
+    if (m_mapping != nullptr) {
+        munmap(m_mapping, m_mapping_size);
+        m_mapping = nullptr;
+        m_slots = nullptr;
+        m_num_slots = 0;
+    }
+}
+
+#endif
+
+bool NNSharedCache::lookup(std::uint64_t hash, Netresult& result) {
+    if (m_slots == nullptr) {
+        return false;
+    }
+    ++m_lookups;
+
+    auto slot = get_slot(hash);
+    const auto before = slot->sequence.load(std::memory_order_acquire);
+    if (before & 1) {
+        return false;  // Being written.
+    }
+    if (slot->hash != hash) {
+        return false;  // Not found (or empty).
+    }
+    auto copy = Netresult{};
+    std::memcpy(&copy, &slot->result, sizeof(Netresult));
+    std::atomic_thread_fence(std::memory_order_acquire);
+    const auto after = slot->sequence.load(std::memory_order_relaxed);
+    if (before != after || slot->hash != hash) {
+        return false;  // Overwritten while we were reading it.
+    }
+
+    ++m_hits;
+    result = copy;
+    return true;
+}
+
+void NNSharedCache::insert(std::uint64_t hash, const Netresult& result) {
+    if (m_slots == nullptr) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_pending.size() >= MAX_PENDING) {
+            return;
+        }
+        m_pending.emplace_back(hash, result);
+    }
+    m_cv.notify_one();
+}
+
+void NNSharedCache::write_slot(std::uint64_t hash, const Netresult& result) {
+    auto slot = get_slot(hash);
+    auto sequence = slot->sequence.load(std::memory_order_relaxed);
+    // Claim the slot by making the sequence odd. If another
+    // process holds it, give up: the entry is only a cache.
+    if ((sequence & 1)
+        || !slot->sequence.compare_exchange_strong(sequence, sequence + 1,
+                                                   std::memory_order_acquire)) {
+        return;
+    }
+    slot->hash = hash;
+    std::memcpy(&slot->result, &result, sizeof(Netresult));
+    slot->sequence.store(sequence + 2, std::memory_order_release);
+}
+
+void NNSharedCache::writer_loop() {
+    auto batch = std::vector<std::pair<std::uint64_t, Netresult>>{};
+    batch.reserve(MAX_PENDING);
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cv.wait(lock, [this] { return !m_running || !m_pending.empty(); });
+            if (m_pending.empty()) {
+                // Not running and nothing left to write.
+                return;
+            }
+            std::swap(batch, m_pending);
+        }
+        for (const auto& entry : batch) {
+            write_slot(entry.first, entry.second);
+        }
+        batch.clear();
+    }
+}
@@ -0,0 +1,123 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#ifndef NNSHAREDCACHE_H_INCLUDED
+#define NNSHAREDCACHE_H_INCLUDED
+
+#include "config.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "NNCache.h"
+
+// Memory-mapped evaluation cache backed by a file, which can be
+// shared by all the engine processes running on one host. It is a
+// direct-mapped table where every slot is guarded by a sequence
+// counter, so readers never block and a writer that loses a race
+// simply drops its entry.
+class NNSharedCache {
+public:
+    using Netresult = NNCache::Netresult;
+
+    // Size of the file created when none exists yet.
+    static constexpr size_t DEFAULT_SIZE_MIB = 1024;
+
+    NNSharedCache() = default;
+    ~NNSharedCache();
+
+    // Map the file, creating it if needed. Returns false if the file
+    // can't be used, e.g. because it was built for another network.
+    bool open(const std::string& filename, std::uint64_t network_hash,
+              size_t size_mib = DEFAULT_SIZE_MIB);
+
+    // Try and find an existing entry.
+    bool lookup(std::uint64_t hash, Netresult& result);
+
+    // Queue an entry to be written by the background thread.
+    void insert(std::uint64_t hash, const Netresult& result);
+
+    std::pair<int, int> hit_rate() const {
+        return {m_hits.load(), m_lookups.load()};
+    }
+
+private:
+    struct Header {
+        char magic[8];
+        std::uint32_t version;
+        std::uint32_t board_size;
+        std::uint64_t network_hash;
+        std::uint64_t slots;
+        std::uint64_t slot_size;
+    };
+
+    struct Slot {
+        // Odd while a writer is updating the slot.
+        std::atomic<std::uint32_t> sequence;
+        std::uint32_t padding;
+        std::uint64_t hash;
+        Netresult result;
+    };
+
+    static constexpr std::uint32_t VERSION = 1;
+    // Pending writes beyond this are dropped.
+    static constexpr size_t MAX_PENDING = 1024;
+
+    void close();
+    void write_slot(std::uint64_t hash, const Netresult& result);
+    void writer_loop();
+
+    Slot* get_slot(std::uint64_t hash) {
+        return &m_slots[hash % m_num_slots];
+    }
+
+    void* m_mapping{nullptr};
+    size_t m_mapping_size{0};
+    Slot* m_slots{nullptr};
+    size_t m_num_slots{0};
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::vector<std::pair<std::uint64_t, Netresult>> m_pending;
+    bool m_running{false};
+    std::thread m_writer;
+
+    // Statistics
+    std::atomic<int> m_hits{0};
+    std::atomic<int> m_lookups{0};
+};
+
+#endif
@@ -32,15 +32,25 @@
 
 #include <algorithm>
 #include <array>
+#include <atomic>
 #include <cassert>
 #include <cmath>
+#include <cstring>
+#include <fstream>
 #include <iterator>
 #include <memory>
+#include <numeric>
 #include <sstream>
 #include <string>
 #include <boost/utility.hpp>
 #include <boost/format.hpp>
 #include <boost/spirit/home/x3.hpp>
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
 #ifndef USE_BLAS
 #include <Eigen/Dense>
 #endif
@@ -58,6 +68,7 @@
 
 #include "Network.h"
 #include "CPUPipe.h"
+#include "CPUScheduler.h"
 #ifdef USE_OPENCL
 #include "OpenCLScheduler.h"
 #include "UCTNode.h"
@@ -68,7 +79,10 @@
 #include "GameState.h"
 #include "GTP.h"
 #include "NNCache.h"
+#include "NNServer.h"
+#include "NNSharedCache.h"
 #include "Random.h"
+#include "SearchProfiler.h"
 #include "ThreadPool.h"
 #include "Timing.h"
 #include "Utils.h"
@@ -85,6 +99,9 @@ template <typename T>
 using ConstEigenVectorMap =
     Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, 1>>;
 template <typename T>
+using EigenMatrixMap =
+    Eigen::Map<Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
+template <typename T>
 using ConstEigenMatrixMap =
     Eigen::Map<const Eigen::Matrix<T, Eigen::Dynamic, Eigen::Dynamic>>;
 #endif
@@ -135,11 +152,14 @@ void Network::benchmark(const GameState* const state, const int iterations) {
     ThreadGroup tg(thread_pool);
     std::atomic<int> runcount{0};
 
+    // Each thread submits whole batches, so that the device is
+    // saturated even with few threads.
+    const auto batch = std::vector<const GameState*>(cfg_batch_size, state);
     for (auto i = size_t{0}; i < cpus; i++) {
-        tg.add_task([this, &runcount, iterations, state]() {
+        tg.add_task([this, &runcount, iterations, &batch]() {
             while (runcount < iterations) {
-                runcount++;
-                get_output(state, Ensemble::RANDOM_SYMMETRY, -1, false);
+                runcount += batch.size();
+                get_output_batch(batch, Ensemble::RANDOM_SYMMETRY, -1, false);
             }
         });
     }
@@ -162,10 +182,17 @@ void process_bn_var(container& weights) {
 std::vector<float> Network::winograd_transform_f(const std::vector<float>& f,
                                                  const int outputs,
                                                  const int channels) {
-    // F(4x4, 3x3) Winograd filter transformation
+    // F(MxM, 3x3) Winograd filter transformation
     // transpose(G.dot(f).dot(G.transpose()))
     // U matrix is transposed for better memory layout in SGEMM
     auto U = std::vector<float>(WINOGRAD_TILE * outputs * channels);
+#if WINOGRAD_TILE_M == 2
+    const auto G = std::array<float, 3 * WINOGRAD_ALPHA>
+                    { 1.0f,       0.0f,      0.0f,
+                      1.0f/2.0f,  1.0f/2.0f, 1.0f/2.0f,
+                      1.0f/2.0f, -1.0f/2.0f, 1.0f/2.0f,
+                      0.0f,       0.0f,      1.0f};
+#elif WINOGRAD_TILE_M == 4
     const auto G = std::array<float, 3 * WINOGRAD_ALPHA>
                     { 1.0f,        0.0f,      0.0f,
                       -2.0f/3.0f, -SQ2/3.0f, -1.0f/3.0f,
@@ -173,6 +200,17 @@ std::vector<float> Network::winograd_transform_f(const std::vector<float>& f,
                       1.0f/6.0f,   SQ2/6.0f,  1.0f/3.0f,
                       1.0f/6.0f,  -SQ2/6.0f,  1.0f/3.0f,
                       0.0f,        0.0f,      1.0f};
+#else
+    const auto G = std::array<float, 3 * WINOGRAD_ALPHA>
+                    { 1.0f,         0.0f,         0.0f,
+                      -2.0f/9.0f,   -2.0f/9.0f,   -2.0f/9.0f,
+                      -2.0f/9.0f,    2.0f/9.0f,   -2.0f/9.0f,
+                      1.0f/90.0f,    1.0f/45.0f,   2.0f/45.0f,
+                      1.0f/90.0f,   -1.0f/45.0f,   2.0f/45.0f,
+                      32.0f/45.0f,  16.0f/45.0f,   8.0f/45.0f,
+                      32.0f/45.0f, -16.0f/45.0f,   8.0f/45.0f,
+                      0.0f,         0.0f,          1.0f};
+#endif
 
     auto temp = std::array<float, 3 * WINOGRAD_ALPHA>{};
 
@@ -250,24 +288,37 @@ void Network::add_zero_channels() {
 }
 
 
-bool Network::read_weights_line(std::istream& wtfile,
-                                std::vector<float>& weights) {
-    auto line = std::string{};
+bool Network::parse_weights_line(const char* begin, const char* end,
+                                 std::vector<float>& weights) {
     weights.clear();
+    const auto ok = phrase_parse(begin, end, *x3::float_, x3::space, weights);
+    return ok && begin == end;
+}
 
-    if (std::getline(wtfile, line)) {
-        auto it_line = line.cbegin();
-        const auto ok = phrase_parse(it_line, line.cend(),
-                                     *x3::float_, x3::space, weights);
-        if (ok && it_line == line.cend()) {
-            return true;
+// Runs f(0), ..., f(count - 1) on the thread pool, or right here if the
+// pool has no threads yet.
+static void parallel_for(size_t count, const std::function<void(size_t)>& f) {
+    const auto tasks = std::min(thread_pool.size(), count);
+    if (tasks < 2) {
+        for (auto i = size_t{0}; i < count; i++) {
+            f(i);
         }
+        return;
     }
-
-    return false;
+    // Items can differ a lot in cost, so the tasks take them one at a time.
+    std::atomic<size_t> next{0};
+    ThreadGroup tg(thread_pool);
+    for (auto t = size_t{0}; t < tasks; t++) {
+        tg.add_task([&next, count, &f]() {
+            for (auto i = next++; i < count; i = next++) {
+                f(i);
+            }
+        });
+    }
+    tg.wait_all();
 }
 
-bool Network::read_weights_block(std::istream& wtfile,
+bool Network::read_weights_block(const WeightsLineReader& read_line,
                                  std::array<std::vector<float>, 4> &layer,
                                  WeightsFileIndex &id) {
     // Reads up to 4 lines of the weights file.  Returns false if
@@ -284,7 +335,7 @@ bool Network::read_weights_block(std::istream& wtfile,
         if (i < id.excess) {
             // there are leftovers from previous read of 4 lines
             layer[i] = std::move(layer[4 - id.excess + i]);
-        } else if (read_weights_line(wtfile, layer[i])) {
+        } else if (read_line(layer[i])) {
             ++id.line;
         } else {
             layer[i].clear();
@@ -683,14 +734,15 @@ void Network::store_layer(std::array<std::vector<float>, 4> &layer, WeightsFileI
 }
 
 
-int Network::load_v1_network(std::istream& wtfile, int format_version) {
+int Network::load_v1_network(const WeightsLineReader& read_line,
+                             int format_version) {
     // Count size of the network
     myprintf("Detecting residual layers... v%d\n", format_version);
 
     std::array<std::vector<float>, 4> layer;
     WeightsFileIndex id;
 
-    while(read_weights_block(wtfile, layer, id));
+    while(read_weights_block(read_line, layer, id));
 
     if (id.complete) {
         print_network_details();
@@ -702,7 +754,65 @@ int Network::load_v1_network(std::istream& wtfile, int format_version) {
     return 0;
 }
 
+bool Network::set_format_version(int format_version) {
+    m_format_version = format_version;
+    m_adv_features = bool(format_version & 16);
+    //        m_komi_policy = bool(format_version & 32);
+    m_chainlibs_features = bool(format_version & 64);
+    m_chainsize_features = bool(format_version & 128);
+    m_quartile_encoding = bool(format_version & 256);
+    auto extra_bits = format_version - (format_version & 511);
+    auto lz_or_elf = format_version & 3;
+    if ((lz_or_elf != 1 && lz_or_elf != 2) || extra_bits != 0) {
+        myprintf("Weights file is the wrong version.\n");
+        return false;
+    }
+    myprintf("Version %d weights file", format_version);
+    auto open_parenthesis = false;
+    const auto plusconj = " + ";
+    auto conj = "";
+    // Version 2 networks are identical to v1, except
+    // that they return the value for black instead of
+    // the player to move. This is used by ELF Open Go.
+    if (lz_or_elf == 2) {
+        myprintf(" (ELF");
+        m_value_head_not_stm = true;
+        open_parenthesis = true;
+        conj = plusconj;
+    } else {
+        m_value_head_not_stm = false;
+    }
+    if (format_version != lz_or_elf && !open_parenthesis) {
+        myprintf(" (");
+        open_parenthesis = true;
+    }
+    if (m_adv_features) {
+        myprintf("%sadvanced board features", conj);
+        conj = plusconj;
+    }
+    if (m_chainlibs_features) {
+        myprintf("%schain liberties", conj);
+        conj = plusconj;
+    }
+    if (m_chainsize_features) {
+        myprintf("%schain size", conj);
+        conj = plusconj;
+    }
+    if (m_quartile_encoding) {
+        myprintf("%squartile encoding", conj);
+    }
+    if (open_parenthesis) {
+        myprintf(")");
+    }
+    myprintf(".\n");
+    return true;
+}
+
 int Network::load_network_file(const std::string& filename) {
+    if (is_binary_weights_file(filename)) {
+        return load_binary_network_file(filename);
+    }
+
     // gzopen supports both gz and non-gz files, will decompress
     // or just read directly as needed.
     auto gzhandle = gzopen(filename.c_str(), "rb");
@@ -710,10 +820,12 @@ int Network::load_network_file(const std::string& filename) {
         myprintf("Could not open weights file: %s\n", filename.c_str());
         return 1;
     }
-    // Stream the gz file in to a memory buffer stream.
-    auto buffer = std::stringstream{};
+    // Read the gz file in to a memory buffer.
+    auto buffer = std::string{};
     constexpr auto chunkBufferSize = 64 * 1024;
     std::vector<char> chunkBuffer(chunkBufferSize);
+    // FNV-1a of the weights, identifies the network in shared caches.
+    m_network_hash = 0xcbf29ce484222325ULL;
     while (true) {
         auto bytesRead = gzread(gzhandle, chunkBuffer.data(), chunkBufferSize);
         if (bytesRead == 0) break;
@@ -723,70 +835,238 @@ int Network::load_network_file(const std::string& filename) {
             return 1;
         }
         assert(bytesRead <= chunkBufferSize);
-        buffer.write(chunkBuffer.data(), bytesRead);
+        buffer.append(chunkBuffer.data(), bytesRead);
+        for (auto i = 0; i < bytesRead; i++) {
+            m_network_hash ^= static_cast<unsigned char>(chunkBuffer[i]);
+            m_network_hash *= 0x100000001b3ULL;
+        }
     }
     gzclose(gzhandle);
 
+    // Split the buffer in lines, without copying them.
+    auto lines = std::vector<std::pair<const char*, const char*>>{};
+    for (auto pos = buffer.data(), end = pos + buffer.size(); pos < end;) {
+        auto eol = static_cast<const char*>(std::memchr(pos, '\n', end - pos));
+        if (eol == nullptr) {
+            eol = end;
+        }
+        lines.emplace_back(pos, eol);
+        pos = eol + 1;
+    }
+    if (lines.empty()) {
+        return 1;
+    }
+
     // Read format version
-    auto line = std::string{};
-    auto format_version = -1;
-    if (std::getline(buffer, line)) {
-        auto iss = std::stringstream{line};
+    {
+        auto iss = std::stringstream{std::string(lines[0].first, lines[0].second)};
         // First line is the file format version id
+        auto format_version = -1;
         iss >> format_version;
-        m_adv_features = bool(format_version & 16);
-        //        m_komi_policy = bool(format_version & 32);
-        m_chainlibs_features = bool(format_version & 64);
-        m_chainsize_features = bool(format_version & 128);
-        m_quartile_encoding = bool(format_version & 256);
-        auto extra_bits = format_version - (format_version & 511);
-        auto lz_or_elf = format_version & 3;
-        if (iss.fail() || (lz_or_elf != 1 && lz_or_elf != 2) || extra_bits != 0) {
+        if (iss.fail()) {
             myprintf("Weights file is the wrong version.\n");
             return 1;
-        } else {
-            myprintf("Version %d weights file", format_version);
-            auto open_parenthesis = false;
-            const auto plusconj = " + ";
-            auto conj = "";
-            // Version 2 networks are identical to v1, except
-            // that they return the value for black instead of
-            // the player to move. This is used by ELF Open Go.
-            if (lz_or_elf == 2) {
-                myprintf(" (ELF");
-                m_value_head_not_stm = true;
-                open_parenthesis = true;
-                conj = plusconj;
-            } else {
-                m_value_head_not_stm = false;
-            }
-            if (format_version != lz_or_elf && !open_parenthesis) {
-                    myprintf(" (");
-                    open_parenthesis = true;
-                }
-            if (m_adv_features) {
-                myprintf("%sadvanced board features", conj);
-                conj = plusconj;
-            }
-            if (m_chainlibs_features) {
-                myprintf("%schain liberties", conj);
-                conj = plusconj;
-            }
-            if (m_chainsize_features) {
-                myprintf("%schain size", conj);
-                conj = plusconj;
-            }
-            if (m_quartile_encoding) {
-                myprintf("%squartile encoding", conj);
-            }
-            if (open_parenthesis) {
-                    myprintf(")");
-            }
-            myprintf(".\n");
-            return load_v1_network(buffer, format_version);
         }
+        if (!set_format_version(format_version)) {
+            return 1;
+        }
+    }
+
+    // The lines are independent, so they are all parsed up front in
+    // parallel, and the layers are then put together from them in order.
+    auto parsed = std::vector<std::vector<float>>(lines.size() - 1);
+    auto parsed_ok = std::vector<char>(lines.size() - 1);
+    parallel_for(parsed.size(), [&](size_t i) {
+        parsed_ok[i] = parse_weights_line(lines[i + 1].first,
+                                          lines[i + 1].second, parsed[i]);
+    });
+
+    auto next_line = size_t{0};
+    const auto read_line = [&](std::vector<float>& weights) {
+        // Stop at the first line that does not parse, like the end
+        // of the file.
+        if (next_line == parsed.size() || !parsed_ok[next_line]) {
+            weights.clear();
+            next_line = parsed.size();
+            return false;
+        }
+        weights = std::move(parsed[next_line++]);
+        if (m_recorded_lines) {
+            m_recorded_lines->emplace_back(weights);
+        }
+        return true;
+    };
+    return load_v1_network(read_line, m_format_version);
+}
+
+// Binary weights files start with this header, followed by one record per
+// line of the text file and then one record per Winograd transformed
+// convolution. A record is a 64-bit count and that many floats, so the
+// floats stay 4-byte aligned in a mapping of the file.
+struct BinaryWeightsHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::int32_t format_version;
+    std::uint64_t network_hash;
+    std::uint32_t lines;
+    std::uint32_t winograd_convs;
+};
+
+static_assert(sizeof(BinaryWeightsHeader) == 32,
+              "BinaryWeightsHeader is read raw from the file");
+
+static constexpr char BINARY_WEIGHTS_MAGIC[8] = "SAIWBIN";
+static constexpr std::uint32_t BINARY_WEIGHTS_VERSION = 1;
+
+bool Network::is_binary_weights_file(const std::string& filename) {
+    auto file = std::ifstream{filename, std::ios::binary};
+    char magic[sizeof(BINARY_WEIGHTS_MAGIC)];
+    return file.read(magic, sizeof(magic))
+        && std::memcmp(magic, BINARY_WEIGHTS_MAGIC, sizeof(magic)) == 0;
+}
+
+int Network::load_binary_network_file(const std::string& filename) {
+#ifndef _WIN32
+    auto fd = ::open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        myprintf("Could not open weights file: %s\n", filename.c_str());
+        if (fd >= 0) ::close(fd);
+        return 1;
+    }
+    const auto size = size_t(st.st_size);
+    auto mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if (mapping == MAP_FAILED) {
+        myprintf("Could not map weights file: %s\n", filename.c_str());
+        return 1;
+    }
+    const auto ret = load_binary_network(static_cast<const char*>(mapping), size);
+    munmap(mapping, size);
+    return ret;
+#else
+    auto file = std::ifstream{filename, std::ios::binary};
+    auto data = std::vector<char>(std::istreambuf_iterator<char>(file),
+                                  std::istreambuf_iterator<char>());
+    if (!file.eof()) {
+        myprintf("Could not read weights file: %s\n", filename.c_str());
+        return 1;
+    }
+    return load_binary_network(data.data(), data.size());
+#endif
+}
+
+int Network::load_binary_network(const char* data, size_t size) {
+    auto header = BinaryWeightsHeader{};
+    if (size < sizeof(header)) {
+        myprintf("Binary weights file is truncated.\n");
+        return 1;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (header.version != BINARY_WEIGHTS_VERSION) {
+        myprintf("Binary weights file is version %u, expected %u.\n",
+                 header.version, BINARY_WEIGHTS_VERSION);
+        return 1;
     }
-    return 1;
+    // The hash of the text file it was converted from, so that both
+    // share the same caches.
+    m_network_hash = header.network_hash;
+    if (!set_format_version(header.format_version)) {
+        return 1;
+    }
+
+    auto pos = data + sizeof(header);
+    const auto end = data + size;
+    const auto read_record = [&pos, end](std::vector<float>& weights) {
+        weights.clear();
+        auto count = std::uint64_t{0};
+        if (size_t(end - pos) < sizeof(count)) {
+            return false;
+        }
+        std::memcpy(&count, pos, sizeof(count));
+        if (count > (size_t(end - pos) - sizeof(count)) / sizeof(float)) {
+            return false;
+        }
+        pos += sizeof(count);
+        weights.resize(count);
+        std::memcpy(weights.data(), pos, count * sizeof(float));
+        pos += count * sizeof(float);
+        return true;
+    };
+
+    auto lines_left = header.lines;
+    const auto read_line = [&](std::vector<float>& weights) {
+        if (lines_left == 0) {
+            weights.clear();
+            return false;
+        }
+        --lines_left;
+        return read_record(weights);
+    };
+    if (load_v1_network(read_line, header.format_version)) {
+        return 1;
+    }
+
+    m_winograd_U.resize(header.winograd_convs);
+    for (auto& U : m_winograd_U) {
+        if (!read_record(U)) {
+            myprintf("Binary weights file is truncated.\n");
+            return 1;
+        }
+    }
+    return 0;
+}
+
+int Network::convert_weights_file(const std::string& infile,
+                                  const std::string& outfile) {
+    Network net;
+    auto lines = std::vector<std::vector<float>>{};
+    net.m_fwd_weights = std::make_shared<ForwardPipeWeights>();
+    net.m_recorded_lines = &lines;
+    if (is_binary_weights_file(infile)) {
+        myprintf("%s is already a binary weights file.\n", infile.c_str());
+        return 1;
+    }
+    if (net.load_network_file(infile)) {
+        return 1;
+    }
+
+    auto convs = std::vector<std::vector<float>>(1 + net.m_residual_blocks * 2);
+    parallel_for(convs.size(), [&net, &convs](size_t i) {
+        convs[i] = winograd_transform_f(net.m_fwd_weights->m_conv_weights[i],
+                                        net.m_channels,
+                                        i == 0 ? net.m_input_planes : net.m_channels);
+    });
+
+    auto header = BinaryWeightsHeader{};
+    std::memcpy(header.magic, BINARY_WEIGHTS_MAGIC, sizeof(header.magic));
+    header.version = BINARY_WEIGHTS_VERSION;
+    header.format_version = net.m_format_version;
+    header.network_hash = net.m_network_hash;
+    header.lines = lines.size();
+    header.winograd_convs = convs.size();
+
+    auto out = std::ofstream{outfile, std::ios::binary | std::ios::trunc};
+    out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    const auto write_record = [&out](const std::vector<float>& weights) {
+        const auto count = std::uint64_t{weights.size()};
+        out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+        out.write(reinterpret_cast<const char*>(weights.data()),
+                  count * sizeof(float));
+    };
+    for (const auto& line : lines) {
+        write_record(line);
+    }
+    for (const auto& U : convs) {
+        write_record(U);
+    }
+    out.close();
+    if (!out) {
+        myprintf("Could not write binary weights file: %s\n", outfile.c_str());
+        return 1;
+    }
+    myprintf("Wrote binary weights file %s.\n", outfile.c_str());
+    return 0;
 }
 
 std::unique_ptr<ForwardPipe>&& Network::init_net(int channels,
@@ -798,6 +1078,20 @@ std::unique_ptr<ForwardPipe>&& Network::init_net(int channels,
     return std::move(pipe);
 }
 
+std::unique_ptr<ForwardPipe> Network::init_cpu_net(int channels) {
+    if (cfg_int8) {
+        myprintf("Using 8-bit integer residual tower.\n");
+#ifdef USE_OPENCL_SELFCHECK
+        // Keep checking against full precision now and then.
+        m_forward_cpu = init_net(channels, std::make_unique<CPUPipe>());
+#endif
+    }
+    if (cfg_batch_size > 1) {
+        return init_net(channels, std::make_unique<CPUScheduler>(cfg_int8));
+    }
+    return init_net(channels, std::make_unique<CPUPipe>(cfg_int8));
+}
+
 #ifdef USE_HALF
 void Network::select_precision(int channels) {
     if (cfg_precision == precision_t::AUTO) {
@@ -814,6 +1108,7 @@ void Network::select_precision(int channels) {
                 myprintf("OpenCL: using fp16/half or tensor core compute support.\n");
                 m_forward = init_net(channels, std::move(fp16_net));
                 benchmark_time(1); // a sanity check run
+                release_cpu_reference();
             } catch (...) {
                 myprintf("OpenCL: fp16/half or tensor core failed despite driver claiming support.\n");
                 myprintf("Falling back to single precision\n");
@@ -824,6 +1119,36 @@ void Network::select_precision(int channels) {
             return;
         }
 
+        const auto devices = fp16_net->get_device_names();
+        const auto drivers = fp16_net->get_driver_versions();
+        auto choice = PrecisionChoice{};
+        if (!cfg_recheck_precision
+            && load_precision_choice(devices, drivers, channels,
+                                     m_residual_blocks, choice)) {
+            myprintf("Using OpenCL %s precision, autodetected before "
+                     "(%.0f n/s single, %.0f n/s half).\n",
+                     choice.half ? "half" : "single",
+                     choice.single_speed, choice.half_speed);
+            if (choice.half) {
+                try {
+                    m_forward = init_net(channels, std::move(fp16_net));
+                    benchmark_time(1); // a sanity check run
+                    release_cpu_reference();
+                    return;
+                } catch (...) {
+                    myprintf("OpenCL: half precision failed, "
+                             "autodetecting again.\n");
+                    m_forward.reset();
+                    fp16_net = std::make_unique<OpenCLScheduler<half_float::half>>();
+                }
+            } else {
+                fp16_net.reset();
+                m_forward = init_net(channels,
+                    std::make_unique<OpenCLScheduler<float>>());
+                return;
+            }
+        }
+
         // Start by setting up fp32.
         try {
             m_forward.reset();
@@ -846,13 +1171,23 @@ void Network::select_precision(int channels) {
         if (score_fp16 < 0.0f && score_fp32 < 0.0f) {
             myprintf("Both single precision and half precision failed to run.\n");
             throw std::runtime_error("Failed to initialize net.");
-        } else if (score_fp16 < 0.0f) {
+        }
+        // Later runs on these devices can skip the benchmarks.
+        choice.single_speed = score_fp32;
+        choice.half_speed = score_fp16;
+        choice.half = score_fp32 < 0.0f
+            || (score_fp16 >= 0.0f && score_fp32 * 1.05f <= score_fp16);
+        store_precision_choice(devices, drivers, channels, m_residual_blocks,
+                               choice);
+
+        if (score_fp16 < 0.0f) {
             myprintf("Using OpenCL single precision (half precision failed to run).\n");
             m_forward.reset();
             m_forward = init_net(channels,
                 std::make_unique<OpenCLScheduler<float>>());
         } else if (score_fp32 < 0.0f) {
             myprintf("Using OpenCL half precision (single precision failed to run).\n");
+            release_cpu_reference();
         } else if (score_fp32 * 1.05f > score_fp16) {
             myprintf("Using OpenCL single precision (less than 5%% slower than half).\n");
             m_forward.reset();
@@ -860,6 +1195,7 @@ void Network::select_precision(int channels) {
                 std::make_unique<OpenCLScheduler<float>>());
         } else {
             myprintf("Using OpenCL half precision (at least 5%% faster than single).\n");
+            release_cpu_reference();
         }
         return;
     } else if (cfg_precision == precision_t::SINGLE) {
@@ -871,9 +1207,30 @@ void Network::select_precision(int channels) {
         myprintf("Initializing OpenCL (half precision).\n");
         m_forward = init_net(channels,
             std::make_unique<OpenCLScheduler<half_float::half>>());
+        benchmark_time(1); // a sanity check run
+        release_cpu_reference();
         return;
     }
 }
+
+// The CPU reference of the self-check keeps the whole residual tower in
+// single precision on the host, several times what a half precision
+// device needs. With --half-no-selfcheck, once the half precision pipe
+// passed its sanity check against it, give that memory back: later
+// evaluations skip the check.
+void Network::release_cpu_reference() {
+#ifdef USE_OPENCL_SELFCHECK
+    if (!cfg_half_no_selfcheck) {
+        return;
+    }
+    stop_selfcheck();
+    if (m_forward_cpu) {
+        m_forward_cpu.reset();
+        myprintf("Released the single precision reference weights, "
+                 "self-checks are off.\n");
+    }
+#endif
+}
 #endif
 
 void Network::initialize(int playouts, const std::string & weightsfile) {
@@ -896,15 +1253,7 @@ void Network::initialize(int playouts, const std::string & weightsfile) {
              EIGEN_WORLD_VERSION, EIGEN_MAJOR_VERSION, EIGEN_MINOR_VERSION);
 #endif
 
-    m_fwd_weights = std::make_shared<ForwardPipeWeights>();
-
-    // Make a guess at a good size as long as the user doesn't
-    // explicitly set a maximum memory usage.
-    if (cfg_use_nncache) {
-        m_nncache.set_size_from_playouts(playouts);
-    } else {
-        m_nncache.resize(10);
-    }
+    init_nncache(playouts);
 
     // Prepare symmetry table
     for (auto s = 0; s < NUM_SYMMETRIES; ++s) {
@@ -918,27 +1267,69 @@ void Network::initialize(int playouts, const std::string & weightsfile) {
         }
     }
 
+    if (!load_weights(weightsfile)) {
+        exit(EXIT_FAILURE);
+    }
+    init_forward_pipe();
+
+    // Need to estimate size before clearing up the pipe.
+    get_estimated_size();
+    m_fwd_weights.reset();
+}
+
+void Network::init_nncache(int playouts) {
+    // Make a guess at a good size as long as the user doesn't
+    // explicitly set a maximum memory usage.
+    m_nncache.set_compact(cfg_compact_nncache);
+    if (cfg_use_nncache) {
+        m_nncache.set_size_from_playouts(playouts);
+    } else {
+        m_nncache.resize(10);
+    }
+}
+
+bool Network::load_weights(const std::string& weightsfile) {
+    m_fwd_weights = std::make_shared<ForwardPipeWeights>();
+
     // Load network from file
     if (load_network_file(weightsfile)) {
-        exit(EXIT_FAILURE);
+        return false;
     }
     m_value_head_sai = (m_value_head_type != SINGLE);
 
-    auto weight_index = size_t{0};
-    // Input convolution
-    // Winograd transform convolution weights
-    m_fwd_weights->m_conv_weights[weight_index] =
-        winograd_transform_f(m_fwd_weights->m_conv_weights[weight_index],
-                             m_channels, m_input_planes);
-    weight_index++;
+    if (cfg_use_nncache && !cfg_shared_cache_file.empty()) {
+        auto shared_cache = std::make_unique<NNSharedCache>();
+        if (shared_cache->open(cfg_shared_cache_file, m_network_hash,
+                               cfg_shared_cache_mib)) {
+            m_shared_cache = std::move(shared_cache);
+        }
+    }
+    if (cfg_use_nncache && !cfg_opening_book.empty()) {
+        m_opening_book = std::make_unique<NNOpeningBook>();
+        m_opening_book->load_async(cfg_opening_book, m_network_hash);
+    }
 
-    // Residual block convolutions
-    for (auto i = size_t{0}; i < m_residual_blocks * 2; i++) {
-        m_fwd_weights->m_conv_weights[weight_index] =
-            winograd_transform_f(m_fwd_weights->m_conv_weights[weight_index],
-                                 m_channels, m_channels);
-        weight_index++;
+    // Binary weights files already hold the transformed convolutions.
+    auto pretransformed = m_winograd_U.size() == 1 + m_residual_blocks * 2
+        && m_winograd_U[0].size() == WINOGRAD_TILE * m_channels * m_input_planes;
+    for (auto i = size_t{1}; pretransformed && i < m_winograd_U.size(); i++) {
+        pretransformed =
+            m_winograd_U[i].size() == WINOGRAD_TILE * m_channels * m_channels;
+    }
+    if (pretransformed) {
+        for (auto i = size_t{0}; i < m_winograd_U.size(); i++) {
+            m_fwd_weights->m_conv_weights[i] = std::move(m_winograd_U[i]);
+        }
+    } else {
+        // Winograd transform convolution weights: the input convolution
+        // and then the residual block convolutions.
+        parallel_for(1 + m_residual_blocks * 2, [this](size_t i) {
+            auto& conv = m_fwd_weights->m_conv_weights[i];
+            conv = winograd_transform_f(conv, m_channels,
+                                        i == 0 ? m_input_planes : m_channels);
+        });
     }
+    m_winograd_U.clear();
 
     // Biases are not calculated and are typically zero but some networks might
     // still have non-zero biases.
@@ -981,12 +1372,26 @@ void Network::initialize(int playouts, const std::string & weightsfile) {
         }
         process_bn_var(m_vh_dense_bn_vars[i]);
     }
+    return true;
+}
 
- 
+void Network::init_forward_pipe() {
+    if (!cfg_nn_client_file.empty()) {
+        auto client = std::make_unique<NNClientPipe>();
+        if (client->connect(cfg_nn_client_file, m_network_hash,
+                            get_input_size(), get_policy_size(),
+                            get_value_size())) {
+            myprintf("Evaluating through the NN server %s.\n",
+                     cfg_nn_client_file.c_str());
+            m_forward = init_net(m_channels, std::move(client));
+            return;
+        }
+        myprintf("Falling back to a network of this process.\n");
+    }
 #ifdef USE_OPENCL
     if (cfg_cpu_only) {
         myprintf("Initializing CPU-only evaluation.\n");
-        m_forward = init_net(m_channels, std::make_unique<CPUPipe>());
+        m_forward = init_cpu_net(m_channels);
     } else {
 #ifdef USE_OPENCL_SELFCHECK
         // initialize CPU reference first, so that we can self-check
@@ -1006,21 +1411,111 @@ void Network::initialize(int playouts, const std::string & weightsfile) {
 
 #else //!USE_OPENCL
     myprintf("Initializing CPU-only evaluation.\n");
-    m_forward = init_net(m_channels, std::make_unique<CPUPipe>());
+    m_forward = init_cpu_net(m_channels);
 #endif
+}
 
-    // Need to estimate size before clearing up the pipe.
-    get_estimated_size();
-    m_fwd_weights.reset();
+size_t Network::get_input_size() const {
+    return m_input_planes * NUM_INTERSECTIONS;
+}
+
+size_t Network::get_policy_size() const {
+    return m_policy_outputs * NUM_INTERSECTIONS;
+}
+
+size_t Network::get_value_size() const {
+    const auto value_outputs = (m_val_pool_outputs > 0) ? m_val_pool_outputs : m_val_outputs;
+    return value_outputs * NUM_INTERSECTIONS;
+}
+
+void Network::forward_batch(const std::vector<float>& input,
+                            std::vector<float>& output_pol,
+                            std::vector<float>& output_val,
+                            const size_t batch_size) {
+    m_evals += batch_size;
+    m_forward->forward_batch(input, output_pol, output_val, batch_size);
+}
+
+bool Network::same_shape(const Network& other) const {
+    return m_channels == other.m_channels
+        && m_residual_blocks == other.m_residual_blocks
+        && m_input_planes == other.m_input_planes
+        && m_policy_conv_layers == other.m_policy_conv_layers
+        && m_policy_channels == other.m_policy_channels
+        && m_policy_outputs == other.m_policy_outputs
+        && m_val_outputs == other.m_val_outputs
+        && m_val_pool_outputs == other.m_val_pool_outputs;
+}
+
+std::unique_ptr<Network> Network::load_replacement(int playouts,
+                                                   const std::string& weightsfile) {
+    auto net = std::make_unique<Network>();
+    net->init_nncache(playouts);
+    if (!net->load_weights(weightsfile)) {
+        return nullptr;
+    }
+
+    if (same_shape(*net) && m_forward->can_replace_weights()) {
+        // Keep the devices, the compiled kernels and the tuning,
+        // only the weights change.
+        myprintf("Replacing the network weights.\n");
+        drain_evals();
+#ifdef USE_OPENCL_SELFCHECK
+        stop_selfcheck();
+#endif
+        net->m_forward = std::move(m_forward);
+        net->m_forward->push_weights(WINOGRAD_ALPHA, net->m_input_planes,
+                                     net->m_channels, net->m_fwd_weights);
+        net->m_forward->resume();
+#ifdef USE_OPENCL_SELFCHECK
+        net->m_forward_cpu = std::move(m_forward_cpu);
+        if (net->m_forward_cpu) {
+            net->m_forward_cpu->push_weights(WINOGRAD_ALPHA, net->m_input_planes,
+                                             net->m_channels, net->m_fwd_weights);
+        }
+#endif
+    } else {
+        // Free the old devices before setting them up again.
+        drain_evals();
+#ifdef USE_OPENCL_SELFCHECK
+        stop_selfcheck();
+#endif
+        m_forward.reset();
+#ifdef USE_OPENCL_SELFCHECK
+        m_forward_cpu.reset();
+#endif
+        net->init_forward_pipe();
+    }
+
+    net->get_estimated_size();
+    net->m_fwd_weights.reset();
+    return net;
 }
 
+std::unique_ptr<Network> Network::load_additional(
+    int playouts, const std::string& weightsfile) {
+    auto net = std::make_unique<Network>();
+    net->init_nncache(playouts);
+    if (!net->load_weights(weightsfile)) {
+        return nullptr;
+    }
+    net->init_forward_pipe();
+    net->get_estimated_size();
+    net->m_fwd_weights.reset();
+    return net;
+}
+
+// The output buffers of the layers below are resized in place, so
+// reusing them between evaluations avoids any heap allocation.
 template<bool ReLU>
-std::vector<float> innerproduct(const std::vector<float>& input,
-                                const std::vector<float>& weights,
-                                const std::vector<float>& biases) {
+void innerproduct(const std::vector<float>& input,
+                  const std::vector<float>& weights,
+                  const std::vector<float>& biases,
+                  std::vector<float>& output) {
+    assert(&input != &output);
     const auto inputs = input.size();
     const auto outputs = biases.size();
-    std::vector<float> output(outputs);
+    output.resize(outputs);
     //    myprintf("***ip: %d * %d == %d\n", inputs, outputs, weights.size());
     assert(inputs*outputs == weights.size());
 #ifdef USE_BLAS
@@ -1047,7 +1542,38 @@ std::vector<float> innerproduct(const std::vector<float>& input,
         }
         output[o] = val;
     }
-    return output;
+}
+
+// innerproduct<false>() of batch_size inputs stored one after the other,
+// as a single matrix product.
+void innerproduct_batch(const std::vector<float>& input,
+                        const std::vector<float>& weights,
+                        const std::vector<float>& biases,
+                        const size_t batch_size,
+                        std::vector<float>& output) {
+    const auto inputs = input.size() / batch_size;
+    const auto outputs = biases.size();
+    output.resize(outputs * batch_size);
+    assert(inputs * batch_size == input.size());
+    assert(inputs*outputs == weights.size());
+#ifdef USE_BLAS
+    cblas_sgemm(CblasRowMajor, CblasNoTrans, CblasTrans,
+                // M          N        K
+                batch_size, outputs, inputs,
+                1.0f, &input[0], inputs,
+                &weights[0], inputs,
+                0.0f, &output[0], outputs);
+#else
+    auto C_mat = EigenMatrixMap<float>(output.data(), outputs, batch_size);
+    C_mat.noalias() =
+        ConstEigenMatrixMap<float>(weights.data(), inputs, outputs).transpose()
+        * ConstEigenMatrixMap<float>(input.data(), inputs, batch_size);
+#endif
+    for (auto b = size_t{0}; b < batch_size; b++) {
+        for (auto o = size_t{0}; o < outputs; o++) {
+            output[b * outputs + o] += biases[o];
+        }
+    }
 }
 
 template <size_t spatial_size>
@@ -1098,17 +1624,79 @@ void Network::compare_net_outputs(const Netresult& data,
     error = std::sqrt(error);
 
     if (error > max_error || std::isnan(error)) {
+        // With cfg_cpu_only the self-check is only on for --int8.
+        if (cfg_cpu_only) {
+            printf("Error in 8-bit integer calculation: this network loses "
+                   "too much precision when quantized, run without --int8.\n");
+            throw std::runtime_error("int8 self-check mismatch.");
+        }
         printf("Error in OpenCL calculation: Update your device's OpenCL drivers "
                "or reduce the amount of games played simultaneously.\n");
         throw std::runtime_error("OpenCL self-check mismatch.");
     }
 }
+
+Network::~Network() {
+    stop_selfcheck();
+}
+
+void Network::queue_selfcheck(const GameState* const state,
+                              const int symmetry, const Netresult& result) {
+    // A check takes a full CPU evaluation. If they come faster than that,
+    // drop the new ones instead of piling them up.
+    constexpr auto MAX_QUEUED = size_t{4};
+
+    std::lock_guard<std::mutex> lock(m_selfcheck_mutex);
+    if (m_selfcheck_exit || m_selfcheck_queue.size() >= MAX_QUEUED) {
+        return;
+    }
+    m_selfcheck_queue.push_back({*state, symmetry, result});
+    if (!m_selfcheck_thread.joinable()) {
+        m_selfcheck_thread = std::thread(&Network::selfcheck_worker, this);
+    }
+    m_selfcheck_cv.notify_one();
+}
+
+void Network::selfcheck_worker() {
+    while (true) {
+        std::unique_lock<std::mutex> lock(m_selfcheck_mutex);
+        m_selfcheck_cv.wait(lock, [this] {
+            return m_selfcheck_exit || !m_selfcheck_queue.empty();
+        });
+        if (m_selfcheck_queue.empty()) {
+            return;
+        }
+        const auto sample = std::move(m_selfcheck_queue.front());
+        m_selfcheck_queue.pop_front();
+        lock.unlock();
+
+        const auto ref = get_output_internal(&sample.state, sample.symmetry,
+                                             true);
+        try {
+            compare_net_outputs(sample.result, ref);
+        } catch (const std::runtime_error&) {
+            m_selfcheck_failed = true;
+        }
+    }
+}
+
+void Network::stop_selfcheck() {
+    {
+        std::lock_guard<std::mutex> lock(m_selfcheck_mutex);
+        m_selfcheck_exit = true;
+    }
+    m_selfcheck_cv.notify_one();
+    if (m_selfcheck_thread.joinable()) {
+        m_selfcheck_thread.join();
+    }
+    std::lock_guard<std::mutex> lock(m_selfcheck_mutex);
+    m_selfcheck_exit = false;
+}
 #endif
 
-std::vector<float> softmax(const std::vector<float>& input,
-                           const float temperature = 1.0f) {
-    auto output = std::vector<float>{};
-    output.reserve(input.size());
+void softmax(const std::vector<float>& input, std::vector<float>& output,
+             const float temperature = 1.0f) {
+    output.clear();
 
     const auto alpha = *std::max_element(cbegin(input), cend(input));
     auto denom = 0.0f;
@@ -1122,8 +1710,6 @@ std::vector<float> softmax(const std::vector<float>& input,
     for (auto& out : output) {
         out /= denom;
     }
-
-    return output;
 }
 
 std::pair<float,float> sigmoid(float alpha, float beta, float bonus, float beta2) {
@@ -1141,27 +1727,109 @@ std::pair<float,float> sigmoid(float alpha, float beta, float bonus, float beta2
         std::make_pair(float(1.0 - ret), float(ret));
 }
 
+template <typename Iterator>
+static Network::Netresult average_results(Iterator first, Iterator last) {
+    Network::Netresult result;
+    // Start from zero, the default beta2 is -1.
+    result.beta2 = 0.0f;
+    const auto count = static_cast<float>(std::distance(first, last));
+    for (auto it = first; it != last; ++it) {
+        const auto& tmpresult = *it;
+        result.policy_pass += tmpresult.policy_pass / count;
+        result.value += tmpresult.value / count;
+        result.alpha += tmpresult.alpha / count;
+        result.beta += tmpresult.beta / count;
+        result.beta2 += tmpresult.beta2 / count;
+        result.is_sai = tmpresult.is_sai;
+
+        for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
+            result.policy[idx] += tmpresult.policy[idx] / count;
+        }
+    }
+    return result;
+}
+
+std::pair<std::uint64_t, int> Network::nncache_key(
+    const GameState* const state) const {
+    auto key = std::make_pair(state->board.get_hash(), int{IDENTITY_SYMMETRY});
+    if (cfg_canonical_nncache) {
+        for (auto sym = 0; sym < NUM_SYMMETRIES; ++sym) {
+            const auto hash = state->get_symmetry_hash(sym);
+            if (hash < key.first) {
+                key = {hash, sym};
+            }
+        }
+    }
+    return key;
+}
+
+void Network::remap_policy(Netresult& result, const int symmetry,
+                           const bool to_symmetry) {
+    if (symmetry == IDENTITY_SYMMETRY) {
+        return;
+    }
+    decltype(result.policy) corrected_policy;
+    for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; ++idx) {
+        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
+        if (to_symmetry) {
+            corrected_policy[sym_idx] = result.policy[idx];
+        } else {
+            corrected_policy[idx] = result.policy[sym_idx];
+        }
+    }
+    result.policy = std::move(corrected_policy);
+}
+
+void Network::nncache_insert(const GameState* const state,
+                             const Netresult& result) {
+    const auto key = nncache_key(state);
+    if (key.second == IDENTITY_SYMMETRY) {
+        m_nncache.insert(key.first, result);
+    } else {
+        auto stored = result;
+        remap_policy(stored, key.second, true);
+        m_nncache.insert(key.first, stored);
+    }
+}
+
 bool Network::probe_cache(const GameState* const state,
                           Network::Netresult& result) {
-    auto cache_success = m_nncache.lookup(state->board.get_hash(), result);
+    const auto key = nncache_key(state);
+    auto cache_success = m_nncache.lookup(key.first, result);
+    if (cache_success) {
+        remap_policy(result, key.second);
+    }
+
+    // Second level: the cache shared with the other processes.
+    if (!cache_success && m_shared_cache
+        && m_shared_cache->lookup(state->board.get_hash(), result)) {
+        nncache_insert(state, result);
+        cache_success = true;
+    }
+
+    // Third level: the opening book, once it has been read.
+    if (!cache_success && m_opening_book
+        && m_opening_book->lookup(state->board.get_hash(), result)) {
+        nncache_insert(state, result);
+        cache_success = true;
+    }
 
     // If we are not generating a self-play game, try to find
-    // symmetries if we are in the early opening.
+    // symmetries. The board keeps their hashes up to date, so this
+    // costs a lookup each and is not limited to the opening. With
+    // canonical keys, m_nncache already had all of them.
     if (!cache_success && !cfg_noise && !cfg_random_cnt
-        && state->get_movenum()
-           < (state->get_timecontrol().opening_moves(BOARD_SIZE) / 2)) {
+        && (!cfg_canonical_nncache || m_opening_book)) {
         for (auto sym = 0; sym < Network::NUM_SYMMETRIES; ++sym) {
             if (sym == Network::IDENTITY_SYMMETRY) {
                 continue;
             }
             const auto hash = state->get_symmetry_hash(sym);
-            if (m_nncache.lookup(hash, result)) {
-                decltype(result.policy) corrected_policy;
-                for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; ++idx) {
-                    const auto sym_idx = symmetry_nn_idx_table[sym][idx];
-                    corrected_policy[idx] = result.policy[sym_idx];
-                }
-                result.policy = std::move(corrected_policy);
+            if ((!cfg_canonical_nncache
+                 && m_nncache.lookup(hash, result, false))
+                || (m_opening_book
+                    && m_opening_book->lookup(hash, result, false))) {
+                remap_policy(result, sym);
                 cache_success = true;
                 break;
             }
@@ -1195,9 +1863,16 @@ Network::Netresult Network::get_output(const GameState* const state,
     if (state->board.get_boardsize() != BOARD_SIZE) {
         return result;
     }
+#ifdef USE_OPENCL_SELFCHECK
+    if (m_selfcheck_failed) {
+        throw std::runtime_error(cfg_cpu_only ? "int8 self-check mismatch."
+                                              : "OpenCL self-check mismatch.");
+    }
+#endif
 
     if (read_cache && ensemble != AVERAGE) {
         // See if we already have this in the cache.
+        SearchProfiler::Scope scope{SearchProfiler::CACHE_PROBE};
         if (probe_cache(state, result)) {
             return result;
         }
@@ -1208,21 +1883,13 @@ Network::Netresult Network::get_output(const GameState* const state,
         result = get_output_internal(state, symmetry);
     } else if (ensemble == AVERAGE) {
         assert(symmetry == -1);
-        for (auto sym = 0; sym < NUM_SYMMETRIES; ++sym) {
-            auto tmpresult = get_output_internal(state, sym);
-            result.policy_pass +=
-                tmpresult.policy_pass / static_cast<float>(NUM_SYMMETRIES);
-            result.value += tmpresult.value / static_cast<float>(NUM_SYMMETRIES);;
-            result.alpha += tmpresult.alpha / static_cast<float>(NUM_SYMMETRIES);;
-            result.beta += tmpresult.beta / static_cast<float>(NUM_SYMMETRIES);;
-            result.beta2 += tmpresult.beta2 / static_cast<float>(NUM_SYMMETRIES);;
-            result.is_sai = tmpresult.is_sai;
-
-            for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
-                result.policy[idx] +=
-                    tmpresult.policy[idx] / static_cast<float>(NUM_SYMMETRIES);
-            }
-        }
+        // Submit all the symmetries as one batch.
+        const auto states =
+            std::vector<const GameState*>(NUM_SYMMETRIES, state);
+        auto symmetries = std::vector<int>(NUM_SYMMETRIES);
+        std::iota(begin(symmetries), end(symmetries), 0);
+        const auto symresults = get_output_internal_batch(states, symmetries);
+        result = average_results(cbegin(symresults), cend(symresults));
     } else {
         assert(ensemble == RANDOM_SYMMETRY);
         assert(symmetry == -1);
@@ -1233,17 +1900,27 @@ Network::Netresult Network::get_output(const GameState* const state,
         // running both with a probability of 1/2000.
         // selfcheck is done here because this is the only place NN
         // evaluation is done on actual gameplay.
-        if (m_forward_cpu != nullptr
-            && (force_selfcheck || Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0)
-        ) {
+        // The forced checks of the sanity runs are waited for, the
+        // sampled ones are left to the self-check thread.
+        if (m_forward_cpu != nullptr && force_selfcheck) {
             auto result_ref = get_output_internal(state, rand_sym, true);
             compare_net_outputs(result, result_ref);
+        } else if (m_forward_cpu != nullptr
+                   && Random::get_Rng().randfix<SELFCHECK_PROBABILITY>() == 0) {
+            queue_selfcheck(state, rand_sym, result);
         }
 #else
         (void)force_selfcheck;
 #endif
     }
 
+    finish_output(state, result, write_cache);
+
+    return result;
+}
+
+void Network::finish_output(const GameState* const state, Netresult& result,
+                            const bool write_cache) {
     // v2 format (ELF Open Go) returns black value, not stm
     if (m_value_head_not_stm) {
         if (state->board.get_to_move() == FastBoard::WHITE) {
@@ -1257,10 +1934,74 @@ Network::Netresult Network::get_output(const GameState* const state,
         // updated with the average result, unless of course it
         // already contained that board state. Don't know if this is
         // wanted.
-        m_nncache.insert(state->board.get_hash(), result);
+        store_cache(state, result);
     }
+}
 
-    return result;
+void Network::store_cache(const GameState* const state,
+                          const Netresult& result) {
+    nncache_insert(state, result);
+    if (m_shared_cache) {
+        m_shared_cache->insert(state->board.get_hash(), result);
+    }
+}
+
+std::vector<Network::Netresult> Network::get_output_batch(
+    const std::vector<const GameState*>& states,
+    const Ensemble ensemble,
+    const int symmetry,
+    const bool read_cache,
+    const bool write_cache) {
+    auto results = std::vector<Netresult>(states.size());
+
+    // Positions that need an evaluation, and the ForwardPipe jobs
+    // for them: one per position, or NUM_SYMMETRIES for AVERAGE.
+    auto pending = std::vector<size_t>();
+    auto job_states = std::vector<const GameState*>();
+    auto job_symmetries = std::vector<int>();
+    for (auto i = size_t{0}; i < states.size(); i++) {
+        const auto state = states[i];
+        if (state->board.get_boardsize() != BOARD_SIZE) {
+            continue;
+        }
+        if (read_cache && ensemble != AVERAGE && probe_cache(state, results[i])) {
+            continue;
+        }
+        pending.emplace_back(i);
+        if (ensemble == DIRECT) {
+            assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
+            job_states.emplace_back(state);
+            job_symmetries.emplace_back(symmetry);
+        } else if (ensemble == AVERAGE) {
+            assert(symmetry == -1);
+            for (auto sym = 0; sym < NUM_SYMMETRIES; ++sym) {
+                job_states.emplace_back(state);
+                job_symmetries.emplace_back(sym);
+            }
+        } else {
+            assert(ensemble == RANDOM_SYMMETRY);
+            assert(symmetry == -1);
+            job_states.emplace_back(state);
+            job_symmetries.emplace_back(
+                Random::get_Rng().randfix<NUM_SYMMETRIES>());
+        }
+    }
+
+    const auto outputs = get_output_internal_batch(job_states, job_symmetries);
+
+    auto job = begin(outputs);
+    for (const auto i : pending) {
+        auto& result = results[i];
+        if (ensemble == AVERAGE) {
+            result = average_results(job, job + NUM_SYMMETRIES);
+            job += NUM_SYMMETRIES;
+        } else {
+            result = *job++;
+        }
+        finish_output(states[i], result, write_cache);
+    }
+
+    return results;
 }
 
 // void Network::dump_array(std::string name, std::vector<float> &array) {
@@ -1282,18 +2023,38 @@ void Network::reduce_mean(std::vector<float> &layer, size_t area) {
     const auto channels = layer.size() / area;
     assert (area * channels == layer.size());
 
-    std::vector<float> output(channels);
+    // In place: the mean of channel c only overwrites values of the
+    // channels before it, which are already reduced.
     for (auto c = size_t{0} ; c < channels ; c++) {
-        output[c] = 0.0f;
+        auto sum = 0.0f;
         for (auto i = size_t{0} ; i < area ; i++) {
-            output[c] += layer[area*c + i];
+            sum += layer[area*c + i];
         }
-        output[c] /= area;
+        layer[c] = sum / area;
     }
-    layer = std::move(output);
+    layer.resize(channels);
 }
 
 
+namespace {
+// Buffers of an evaluation, from the input planes to the outputs of
+// the heads. Each thread keeps its own: they are resized within their
+// capacity, so past the first evaluation there is no heap allocation.
+struct EvalScratch {
+    std::vector<float> input, policy, value;
+    // get_output_internal_batch()
+    std::vector<float> batch_input, batch_policy, batch_value, batch_logits;
+    // process_output() and process_policy_logits()
+    std::vector<float> logits, probs, val, res, dense;
+    std::vector<float> val_channels, val_output, vbe_channels, vbe_output;
+};
+
+EvalScratch& eval_scratch() {
+    thread_local auto scratch = EvalScratch{};
+    return scratch;
+}
+}
+
 Network::Netresult Network::get_output_internal(
     const GameState* const state, const int symmetry, bool selfcheck) {
     assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
@@ -1304,64 +2065,152 @@ Network::Netresult Network::get_output_internal(
     // color of the current player is encoded in the last two planes
     const auto include_color = (0 == m_input_planes % 2);
 
-    const auto input_data = gather_features(state, symmetry, m_input_moves,
-                                            m_adv_features, m_chainlibs_features,
-                                            m_chainsize_features, include_color);
-    std::vector<float> policy_data(m_policy_outputs * width * height);
+    auto& scratch = eval_scratch();
+    auto& input_data = scratch.input;
+    gather_features(state, symmetry, m_input_moves,
+                    m_adv_features, m_chainlibs_features,
+                    m_chainsize_features, include_color, input_data);
+    auto& policy_data = scratch.policy;
+    policy_data.resize(m_policy_outputs * width * height);
     const auto value_outputs = (m_val_pool_outputs > 0) ? m_val_pool_outputs : m_val_outputs;
-    std::vector<float> val_data(value_outputs * width * height);
+    auto& val_data = scratch.value;
+    val_data.resize(value_outputs * width * height);
 
+    m_evals++;
+    {
+        SearchProfiler::Scope scope{SearchProfiler::NN_WAIT};
 #ifdef USE_OPENCL_SELFCHECK
-    if (selfcheck) {
-        m_forward_cpu->forward(input_data, policy_data, val_data);
-    } else {
-        m_forward->forward(input_data, policy_data, val_data);
-    }
+        if (selfcheck) {
+            m_forward_cpu->forward(input_data, policy_data, val_data);
+        } else {
+            m_forward->forward(input_data, policy_data, val_data);
+        }
 #else
-    m_forward->forward(input_data, policy_data, val_data);
-    (void) selfcheck;
+        m_forward->forward(input_data, policy_data, val_data);
+        (void) selfcheck;
 #endif
+    }
 
-    // Get the moves
-    const auto policy_out =
-        innerproduct<false>(
-            policy_data, m_ip_pol_w, m_ip_pol_b);
-    const auto outputs = softmax(policy_out, cfg_softmax_temp);
+    return process_output(state, symmetry, policy_data, val_data);
+}
+
+std::vector<Network::Netresult> Network::get_output_internal_batch(
+    const std::vector<const GameState*>& states,
+    const std::vector<int>& symmetries) {
+    assert(states.size() == symmetries.size());
+    const auto batch_size = states.size();
+    if (batch_size == 0) {
+        return {};
+    }
+
+    const auto include_color = (0 == m_input_planes % 2);
+    const auto in_size = m_input_planes * NUM_INTERSECTIONS;
+    const auto pol_size = m_policy_outputs * NUM_INTERSECTIONS;
+    const auto value_outputs = (m_val_pool_outputs > 0) ? m_val_pool_outputs : m_val_outputs;
+    const auto val_size = value_outputs * NUM_INTERSECTIONS;
+
+    auto& scratch = eval_scratch();
+    auto& features = scratch.input;
+    auto& input_data = scratch.batch_input;
+    input_data.resize(in_size * batch_size);
+    for (auto i = size_t{0}; i < batch_size; i++) {
+        gather_features(states[i], symmetries[i], m_input_moves,
+                        m_adv_features, m_chainlibs_features,
+                        m_chainsize_features, include_color, features);
+        assert(features.size() == in_size);
+        std::copy(begin(features), end(features), begin(input_data) + i * in_size);
+    }
+    auto& policy_data = scratch.batch_policy;
+    auto& val_data = scratch.batch_value;
+    policy_data.resize(pol_size * batch_size);
+    val_data.resize(val_size * batch_size);
+
+    m_evals += batch_size;
+    {
+        SearchProfiler::Scope scope{SearchProfiler::NN_WAIT};
+        m_forward->forward_batch(input_data, policy_data, val_data, batch_size);
+    }
+
+    // The policy inner product is the biggest layer of the heads, run it
+    // on the whole batch at once.
+    auto& logits = scratch.batch_logits;
+    innerproduct_batch(policy_data, m_ip_pol_w, m_ip_pol_b, batch_size, logits);
+    const auto logits_size = m_ip_pol_b.size();
+
+    auto results = std::vector<Netresult>();
+    results.reserve(batch_size);
+    auto& policy = scratch.logits;
+    auto& value = scratch.value;
+    for (auto i = size_t{0}; i < batch_size; i++) {
+        policy.assign(begin(logits) + i * logits_size,
+                      begin(logits) + (i + 1) * logits_size);
+        value.assign(begin(val_data) + i * val_size,
+                     begin(val_data) + (i + 1) * val_size);
+        results.emplace_back(
+            process_policy_logits(states[i], symmetries[i], policy, value));
+    }
+    return results;
+}
 
-    // Now get the value
+Network::Netresult Network::process_output(const GameState* const state,
+                                           const int symmetry,
+                                           const std::vector<float>& policy_data,
+                                           const std::vector<float>& val_data) {
+    auto& policy_out = eval_scratch().logits;
+    innerproduct<false>(policy_data, m_ip_pol_w, m_ip_pol_b, policy_out);
+    return process_policy_logits(state, symmetry, policy_out, val_data);
+}
+
+Network::Netresult Network::process_policy_logits(
+    const GameState* const state, const int symmetry,
+    const std::vector<float>& policy_out, const std::vector<float>& val_data) {
+    constexpr auto width = BOARD_SIZE;
+    constexpr auto height = BOARD_SIZE;
+    auto& scratch = eval_scratch();
+
+    // Get the moves
+    auto& outputs = scratch.probs;
+    softmax(policy_out, outputs, cfg_softmax_temp);
+
+    // Now get the value. The dense layers swap between three scratch
+    // buffers: the current activations, the residual and the output.
+    auto& val = scratch.val;
+    auto& res = scratch.res;
+    auto& dense = scratch.dense;
+    val.assign(begin(val_data), end(val_data));
     if (m_val_pool_outputs) {
-        reduce_mean(val_data, width * height);
+        reduce_mean(val, width * height);
     }
-    std::vector<float> res(val_data.size());
     unsigned int parity = 0;
     for (auto i = size_t{0} ; i<m_vh_dense_weights.size() ; i++) {
-        if (i == 0 && val_data.size() != m_vh_dense_biases[0].size()) {
-            val_data = innerproduct<false>(val_data, m_vh_dense_weights[i],
-                                           m_vh_dense_biases[i]);
-            batchnorm<1>(m_vh_dense_biases[i].size(), val_data,
+        if (i == 0 && val.size() != m_vh_dense_biases[0].size()) {
+            innerproduct<false>(val, m_vh_dense_weights[i],
+                                m_vh_dense_biases[i], dense);
+            std::swap(val, dense);
+            batchnorm<1>(m_vh_dense_biases[i].size(), val,
                          m_vh_dense_bn_means[i].data(), m_vh_dense_bn_vars[i].data());
             parity = 1;
         } else if (!RESDENSE_IN_VALUE_HEAD || i % 2 == parity) {
-            std::swap(val_data, res);
-            val_data = innerproduct<false>(res, m_vh_dense_weights[i],
-                                           m_vh_dense_biases[i]);
-            batchnorm<1>(m_vh_dense_biases[i].size(), val_data,
+            std::swap(val, res);
+            innerproduct<false>(res, m_vh_dense_weights[i],
+                                m_vh_dense_biases[i], val);
+            batchnorm<1>(m_vh_dense_biases[i].size(), val,
                          m_vh_dense_bn_means[i].data(), m_vh_dense_bn_vars[i].data());
         } else {
-            val_data = innerproduct<false>(val_data, m_vh_dense_weights[i],
-                                           m_vh_dense_biases[i]);
-            batchnorm<1>(m_vh_dense_biases[i].size(), val_data,
+            innerproduct<false>(val, m_vh_dense_weights[i],
+                                m_vh_dense_biases[i], dense);
+            std::swap(val, dense);
+            batchnorm<1>(m_vh_dense_biases[i].size(), val,
                          m_vh_dense_bn_means[i].data(), m_vh_dense_bn_vars[i].data(),
                          res.data());
         }
         
     }
 
-    const auto val_channels =
-        innerproduct<true>(
-            val_data, m_ip1_val_w, m_ip1_val_b);
-    const auto val_output =
-        innerproduct<false>(val_channels, m_ip2_val_w, m_ip2_val_b);
+    auto& val_channels = scratch.val_channels;
+    innerproduct<true>(val, m_ip1_val_w, m_ip1_val_b, val_channels);
+    auto& val_output = scratch.val_output;
+    innerproduct<false>(val_channels, m_ip2_val_w, m_ip2_val_b, val_output);
 
     Netresult result;
 
@@ -1372,18 +2221,18 @@ Network::Netresult Network::get_output_internal(
         result.is_sai = false;
     } else {
         if (m_value_head_type==DOUBLE_Y) {
-            const auto vbe_channels =
-                innerproduct<true>(val_data, m_ip1_vbe_w, m_ip1_vbe_b);
-            const auto vbe_output =
-                innerproduct<false>(vbe_channels, m_ip2_vbe_w, m_ip2_vbe_b);
+            auto& vbe_channels = scratch.vbe_channels;
+            innerproduct<true>(val, m_ip1_vbe_w, m_ip1_vbe_b, vbe_channels);
+            auto& vbe_output = scratch.vbe_output;
+            innerproduct<false>(vbe_channels, m_ip2_vbe_w, m_ip2_vbe_b, vbe_output);
 
             result.beta = vbe_output[0];
             if (m_vbe_head_rets == 2) {
                 result.beta2 = vbe_output[1];
             }
         } else if (m_value_head_type==DOUBLE_T) {
-            const auto vbe_output =
-                innerproduct<false>(val_channels, m_ip2_vbe_w, m_ip2_vbe_b);
+            auto& vbe_output = scratch.vbe_output;
+            innerproduct<false>(val_channels, m_ip2_vbe_w, m_ip2_vbe_b, vbe_output);
             result.beta = vbe_output[0];
             if (m_vbe_head_rets == 2) {
                 result.beta2 = vbe_output[1];
@@ -1526,82 +2375,104 @@ void Network::show_heatmap(const FastState* const state,
 }
 
 void Network::fill_input_plane_pair(const FullBoard& board,
-                                    std::vector<float>::iterator black,
-                                    std::vector<float>::iterator white,
-                                    const int symmetry) {
+                                    PositionPlanes& planes) {
     for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
-        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
-        const auto x = sym_idx % BOARD_SIZE;
-        const auto y = sym_idx / BOARD_SIZE;
+        const auto x = idx % BOARD_SIZE;
+        const auto y = idx / BOARD_SIZE;
         const auto color = board.get_state(x, y);
-        if (color == FastBoard::BLACK) {
-            black[idx] = float(true);
-        } else if (color == FastBoard::WHITE) {
-            white[idx] = float(true);
-        }
+        planes.black[idx] = (color == FastBoard::BLACK);
+        planes.white[idx] = (color == FastBoard::WHITE);
     }
 }
 
-void Network::fill_input_plane_advfeat(std::shared_ptr<const KoState> const state,
-                                       std::vector<float>::iterator legal,
-                                       std::vector<float>::iterator atari,
-                                       const int symmetry) {
+void Network::fill_input_plane_advfeat(const KoState& state,
+                                       PositionPlanes& planes) {
+    const auto tomove = state.get_to_move();
+    const auto legal_moves = state.get_legal_moves(tomove);
     for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
-        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
-        const auto x = sym_idx % BOARD_SIZE;
-        const auto y = sym_idx / BOARD_SIZE;
-        const auto vertex = state->board.get_vertex(x,y);
-        const auto tomove = state->get_to_move();
-        const auto is_legal = state->is_move_legal(tomove, vertex);
-        legal[idx] = !is_legal;
-        atari[idx] = is_legal && (1 == state->board.liberties_to_capture(vertex));
+        const auto x = idx % BOARD_SIZE;
+        const auto y = idx / BOARD_SIZE;
+        const auto vertex = state.board.get_vertex(x,y);
+        const auto is_legal = legal_moves[idx];
+        planes.illegal[idx] = !is_legal;
+        planes.atari[idx] = is_legal && (1 == state.board.liberties_to_capture(vertex));
     }
 }
 
-void Network::fill_input_plane_chainlibsfeat(std::shared_ptr<const KoState> const state,
-                                             std::vector<float>::iterator chainlibs,
-                                             const int symmetry) {
+void Network::fill_input_plane_chainlibsfeat(const KoState& state,
+                                             PositionPlanes& planes) {
+    planes.chainlibs.assign(CHAIN_LIBERTIES_PLANES, PositionPlanes::Plane{});
     for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
-        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
-        const auto x = sym_idx % BOARD_SIZE;
-        const auto y = sym_idx / BOARD_SIZE;
-        const auto peek = state->board.get_state(x,y);
+        const auto x = idx % BOARD_SIZE;
+        const auto y = idx / BOARD_SIZE;
+        const auto peek = state.board.get_state(x,y);
         const auto is_stone = (peek == FastBoard::BLACK || peek == FastBoard::WHITE);
-        const auto vtx = state->board.get_vertex(x,y);
+        if (!is_stone) {
+            continue;
+        }
+        const auto vtx = state.board.get_vertex(x,y);
         // if there is no stone, then put 0 in all planes
         // if there is a stone, then put 1 if its chain has only 1 liberty,
         //                               1 if its chain has <= 2 liberies,
         //                               1 if its chain has <= 3 liberies,
         //                               1 if its chain has <= 4 liberies
+        const auto libs = state.board.chain_liberties(vtx);
         for (auto plane = size_t{0} ; plane < CHAIN_LIBERTIES_PLANES ; plane++) {
-            chainlibs[idx + plane * NUM_INTERSECTIONS] = is_stone &&
-                (state->board.chain_liberties(vtx) <= plane + 1);
+            planes.chainlibs[plane][idx] = (libs <= plane + 1);
         }
     }
 }
 
-void Network::fill_input_plane_chainsizefeat(std::shared_ptr<const KoState> const state,
-                                             std::vector<float>::iterator chainsize,
-                                             const int symmetry) {
+void Network::fill_input_plane_chainsizefeat(const KoState& state,
+                                             PositionPlanes& planes) {
+    planes.chainsize.assign(CHAIN_SIZE_PLANES, PositionPlanes::Plane{});
     for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
-        const auto sym_idx = symmetry_nn_idx_table[symmetry][idx];
-        const auto x = sym_idx % BOARD_SIZE;
-        const auto y = sym_idx / BOARD_SIZE;
-        const auto peek = state->board.get_state(x,y);
+        const auto x = idx % BOARD_SIZE;
+        const auto y = idx / BOARD_SIZE;
+        const auto peek = state.board.get_state(x,y);
         const auto is_stone = (peek == FastBoard::BLACK || peek == FastBoard::WHITE);
-        const auto vtx = state->board.get_vertex(x,y);
+        if (!is_stone) {
+            continue;
+        }
+        const auto vtx = state.board.get_vertex(x,y);
         // if there is no stone, then put 0 in all planes
         // if there is a stone, then put 1 if its chain has >= 2 stones,
         //                               1 if its chain has >= 4 stones,
         //                               1 if its chain has >= 6 stones,
         //                               1 if its chain has >= 8 stones
+        const auto stones = state.board.chain_stones(vtx);
         for (auto plane = size_t{0} ; plane < CHAIN_SIZE_PLANES ; plane++) {
-            chainsize[idx + plane * NUM_INTERSECTIONS] = is_stone &&
-                (state->board.chain_stones(vtx) >= 2 * plane + 2);
+            planes.chainsize[plane][idx] = (stones >= 2 * plane + 2);
         }
     }
 }
 
+std::shared_ptr<const PositionPlanes> Network::get_position_planes(
+    const KoState& state, const unsigned int groups) {
+
+    auto planes = state.get_planes();
+    if (planes && (planes->groups & groups) == groups) {
+        return planes;
+    }
+
+    // Not computed yet, or for a network using fewer features. If two
+    // threads get here at the same time both results are the same.
+    auto fresh = std::make_shared<PositionPlanes>();
+    fresh->groups = groups | (planes ? planes->groups : 0);
+    fill_input_plane_pair(state.board, *fresh);
+    if (fresh->groups & PositionPlanes::ADV_FEATURES) {
+        fill_input_plane_advfeat(state, *fresh);
+    }
+    if (fresh->groups & PositionPlanes::CHAIN_LIBERTIES) {
+        fill_input_plane_chainlibsfeat(state, *fresh);
+    }
+    if (fresh->groups & PositionPlanes::CHAIN_SIZE) {
+        fill_input_plane_chainsizefeat(state, *fresh);
+    }
+    state.set_planes(fresh);
+    return fresh;
+}
+
 std::vector<float> Network::gather_features(const GameState* const state,
                                             const int symmetry,
                                             const int input_moves,
@@ -1609,6 +2480,21 @@ std::vector<float> Network::gather_features(const GameState* const state,
                                             const bool chainlibs_features,
                                             const bool chainsize_features,
                                             const bool include_color) {
+    auto input_data = std::vector<float>();
+    gather_features(state, symmetry, input_moves, adv_features,
+                    chainlibs_features, chainsize_features, include_color,
+                    input_data);
+    return input_data;
+}
+
+void Network::gather_features(const GameState* const state,
+                              const int symmetry,
+                              const int input_moves,
+                              const bool adv_features,
+                              const bool chainlibs_features,
+                              const bool chainsize_features,
+                              const bool include_color,
+                              std::vector<float>& input_data) {
     assert(symmetry >= 0 && symmetry < NUM_SYMMETRIES);
 
     // if advanced board features are included, for every input move
@@ -1632,7 +2518,7 @@ std::vector<float> Network::gather_features(const GameState* const state,
     // will provide information on the border of the board for the CNN
     const auto input_planes = moves_planes + (include_color ? 2 : 1);
 
-    auto input_data = std::vector<float>(input_planes * NUM_INTERSECTIONS);
+    input_data.assign(input_planes * NUM_INTERSECTIONS, 0.0f);
 
     const auto current_it = begin(input_data);
     const auto opponent_it = current_it + plane_block;
@@ -1655,33 +2541,50 @@ std::vector<float> Network::gather_features(const GameState* const state,
         begin(input_data) + (moves_planes + 1) * NUM_INTERSECTIONS;
     std::fill(onesfilled_it, onesfilled_it + NUM_INTERSECTIONS, float(true));
 
+    const auto groups = PositionPlanes::STONES
+        | (adv_features ? PositionPlanes::ADV_FEATURES : 0)
+        | (chainlibs_features ? PositionPlanes::CHAIN_LIBERTIES : 0)
+        | (chainsize_features ? PositionPlanes::CHAIN_SIZE : 0);
+    const auto& sym_table = symmetry_nn_idx_table[symmetry];
+
+    // Writes a plane with the symmetry applied, only setting ones if
+    // the destination is known to be zero.
+    const auto fill_plane = [&sym_table](const PositionPlanes::Plane& plane,
+                                         std::vector<float>::iterator out,
+                                         const bool overwrite) {
+        for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
+            const auto bit = plane[sym_table[idx]];
+            if (overwrite || bit) {
+                out[idx] = float(bit);
+            }
+        }
+    };
+
     const auto moves = std::min<size_t>(state->get_movenum() + 1, input_moves);
-    // Go back in time, fill history boards
+    // Go back in time, fill history boards. Positions in the history
+    // keep their planes, so usually only the most recent ones are new.
     for (auto h = size_t{0}; h < moves; h++) {
+        const auto planes = get_position_planes(*state->get_past_state(h), groups);
         // collect white, black occupation planes
-        fill_input_plane_pair(state->get_past_state(h)->board,
-                              black_it + h * NUM_INTERSECTIONS,
-                              white_it + h * NUM_INTERSECTIONS,
-                              symmetry);
+        fill_plane(planes->black, black_it + h * NUM_INTERSECTIONS, false);
+        fill_plane(planes->white, white_it + h * NUM_INTERSECTIONS, false);
         if (adv_features) {
-            fill_input_plane_advfeat(state->get_past_state(h),
-                                     legal_it + h * NUM_INTERSECTIONS,
-                                     atari_it + h * NUM_INTERSECTIONS,
-                                     symmetry);
+            fill_plane(planes->illegal, legal_it + h * NUM_INTERSECTIONS, true);
+            fill_plane(planes->atari, atari_it + h * NUM_INTERSECTIONS, true);
         }
         if (chainlibs_features) {
-            fill_input_plane_chainlibsfeat(state->get_past_state(h),
-                                           chainlibs_it + h * NUM_INTERSECTIONS,
-                                           symmetry);
+            for (auto plane = size_t{0}; plane < CHAIN_LIBERTIES_PLANES; plane++) {
+                fill_plane(planes->chainlibs[plane],
+                           chainlibs_it + (h + plane) * NUM_INTERSECTIONS, true);
+            }
         }
         if (chainsize_features) {
-            fill_input_plane_chainsizefeat(state->get_past_state(h),
-                                           chainsize_it + h * NUM_INTERSECTIONS,
-                                           symmetry);
+            for (auto plane = size_t{0}; plane < CHAIN_SIZE_PLANES; plane++) {
+                fill_plane(planes->chainsize[plane],
+                           chainsize_it + (h + plane) * NUM_INTERSECTIONS, true);
+            }
         }
     }
-
-    return input_data;
 }
 
 std::pair<int, int> Network::get_symmetry(const std::pair<int, int>& vertex,
@@ -1761,6 +2664,18 @@ size_t Network::get_estimated_cache_size() {
     return m_nncache.get_estimated_size();
 }
 
+Network::Counters Network::get_counters() {
+    const auto batch = m_forward->get_batch_counters();
+    auto counters = Counters{};
+    counters.evals = m_evals.load();
+    // Pipes that do not batch evaluate one position at a time.
+    counters.batches = batch.batches ? batch.batches : counters.evals;
+    counters.queued = batch.queued;
+    counters.cache_hit_rate = m_nncache.hit_rate();
+    counters.cache_size = m_nncache.get_estimated_size();
+    return counters;
+}
+
 void Network::nncache_resize(int max_count) {
     return m_nncache.resize(max_count);
 }
@@ -1769,6 +2684,30 @@ void Network::nncache_clear() {
     m_nncache.clear();
 }
 
+size_t Network::get_nncache_entry_size() const {
+    return m_nncache.get_entry_size();
+}
+
+std::string Network::get_forward_stats() {
+    return m_forward->get_stats();
+}
+
+void Network::nncache_dump_stats() {
+    m_nncache.dump_stats();
+    if (m_shared_cache) {
+        const auto stats = m_shared_cache->hit_rate();
+        myprintf("Shared NNCache: %d/%d hits/lookups = %.1f%% hitrate\n",
+                 stats.first, stats.second,
+                 100. * stats.first / (stats.second + 1));
+    }
+    if (m_opening_book) {
+        const auto stats = m_opening_book->hit_rate();
+        myprintf("Opening book: %d/%d hits/lookups = %.1f%% hitrate\n",
+                 stats.first, stats.second,
+                 100. * stats.first / (stats.second + 1));
+    }
+}
+
 void Network::drain_evals() {
     m_forward->drain();
 }
@@ -35,14 +35,19 @@
 
 #include <deque>
 #include <array>
+#include <atomic>
+#include <cmath>
 #include <memory>
 #include <string>
 #include <utility>
 #include <vector>
 #include <fstream>
+#include <functional>
 #include <tuple>
 
 #include "NNCache.h"
+#include "NNOpeningBook.h"
+#include "NNSharedCache.h"
 #include "FastState.h"
 #ifdef USE_OPENCL
 #include "OpenCLScheduler.h"
@@ -53,11 +58,14 @@
 #include "OpenCLScheduler.h"
 #endif
 #ifdef USE_OPENCL_SELFCHECK
+#include <condition_variable>
+#include <mutex>
+#include <thread>
 #include "SMP.h"
 #endif
 
 // Winograd filter transformation changes 3x3 filters to M + 3 - 1
-constexpr auto WINOGRAD_M = 4;
+constexpr auto WINOGRAD_M = WINOGRAD_TILE_M;
 constexpr auto WINOGRAD_ALPHA = WINOGRAD_M + 3 - 1;
 constexpr auto WINOGRAD_WTILES = BOARD_SIZE / WINOGRAD_M + (BOARD_SIZE % WINOGRAD_M != 0);
 constexpr auto WINOGRAD_TILE = WINOGRAD_ALPHA * WINOGRAD_ALPHA;
@@ -66,6 +74,22 @@ constexpr auto SQ2 = 1.4142135623730951f; // Square root of 2
 
 std::pair<float, float> sigmoid(float alpha, float beta, float bonus, float beta2=-1.0f);
 
+// Same as sigmoid(), in single precision and with one exponential, for
+// the search backup. The results agree to a few units in the last place.
+inline std::pair<float, float> sigmoid_fast(float alpha, float beta,
+                                            float bonus, float beta2=-1.0f) {
+    if (beta2 < 0) {
+        beta2 = beta;
+    }
+    const auto arg = (alpha + bonus > 0 ? beta2 : beta) * (alpha + bonus);
+    const auto e = std::exp(-std::abs(arg));
+    const auto ret = e / (1.0f + e);
+
+    return (arg < 0) ?
+        std::make_pair(ret, 1.0f - ret) :
+        std::make_pair(1.0f - ret, ret);
+}
+
 extern std::array<std::array<int, NUM_INTERSECTIONS>, 8>
     symmetry_nn_idx_table;
 
@@ -84,6 +108,9 @@ class Network {
     using ForwardPipeWeights = ForwardPipe::ForwardPipeWeights;
 
   public:
+#ifdef USE_OPENCL_SELFCHECK
+    ~Network();
+#endif
     static constexpr auto NUM_SYMMETRIES = 8;
     static constexpr auto IDENTITY_SYMMETRY = 0;
     enum Ensemble
@@ -125,6 +152,14 @@ class Network {
                          const bool write_cache = true,
                          const bool force_selfcheck = false);
 
+    // Evaluate several positions with as few ForwardPipe calls as
+    // possible. Results are in the same order as states.
+    std::vector<Netresult> get_output_batch(const std::vector<const GameState*>& states,
+                                            const Ensemble ensemble,
+                                            const int symmetry = -1,
+                                            const bool read_cache = true,
+                                            const bool write_cache = true);
+
     static constexpr unsigned short int SINGLE = 1;
     static constexpr unsigned short int DOUBLE_V = 2;
     static constexpr unsigned short int DOUBLE_Y = 3;
@@ -140,6 +175,23 @@ class Network {
 
     void initialize(int playouts, const std::string &weightsfile);
 
+    // Loads another weights file for a running engine. The forward pipe
+    // moves to the returned network, taking the new weights if both
+    // networks have the same shape, so this network must not be used
+    // afterwards. The NN cache starts empty. Returns nullptr, leaving
+    // this network untouched, if the file cannot be loaded.
+    std::unique_ptr<Network> load_replacement(int playouts,
+                                              const std::string &weightsfile);
+    // Loads a network with devices of its own, next to the running one,
+    // or returns nullptr if the file cannot be loaded.
+    static std::unique_ptr<Network> load_additional(
+        int playouts, const std::string &weightsfile);
+
+    // Writes the text weights file infile as a binary weights file,
+    // which loads without parsing. Returns 0 on success.
+    static int convert_weights_file(const std::string &infile,
+                                    const std::string &outfile);
+
     float benchmark_time(int centiseconds);
     void benchmark(const GameState *const state,
                    const int iterations = 1600);
@@ -153,6 +205,15 @@ class Network {
                                               const bool chainlibs_features = false,
                                               const bool chainsize_features = false,
                                               const bool include_color = false);
+    // Same, into a buffer reused between calls.
+    static void gather_features(const GameState *const state,
+                                const int symmetry,
+                                const int input_moves,
+                                const bool adv_features,
+                                const bool chainlibs_features,
+                                const bool chainsize_features,
+                                const bool include_color,
+                                std::vector<float>& input_data);
     static std::pair<int, int> get_symmetry(const std::pair<int, int> &vertex,
                                             const int symmetry,
                                             const int board_size = BOARD_SIZE);
@@ -161,6 +222,36 @@ class Network {
     size_t get_estimated_cache_size();
     void nncache_resize(int max_count);
     void nncache_clear();
+    void nncache_dump_stats();
+    std::string get_forward_stats();
+    size_t get_nncache_entry_size() const;
+    // The cache levels of get_output(), for callers that look up and
+    // store the results themselves: a result of get_output() with
+    // write_cache false can be stored later with store_cache().
+    bool probe_cache(const GameState *const state, Network::Netresult &result);
+    void store_cache(const GameState *const state, const Netresult& result);
+    std::uint64_t get_network_hash() const { return m_network_hash; }
+
+    // Sizes in floats of the input and of the outputs of the residual
+    // tower for one position, and a forward pass on a batch of them,
+    // for the NN server.
+    size_t get_input_size() const;
+    size_t get_policy_size() const;
+    size_t get_value_size() const;
+    void forward_batch(const std::vector<float>& input,
+                       std::vector<float>& output_pol,
+                       std::vector<float>& output_val,
+                       const size_t batch_size);
+
+    // Running totals, sampled by the metrics reporter.
+    struct Counters {
+        size_t evals;
+        size_t batches;
+        size_t queued;
+        std::pair<int, int> cache_hit_rate;
+        size_t cache_size;
+    };
+    Counters get_counters();
 
     int m_value_head_type = 0;
     bool m_value_head_sai = false;
@@ -197,15 +288,26 @@ class Network {
     
   private:
     void add_zero_channels();
-    bool read_weights_line(std::istream& wtfile, std::vector<float>& weights);
-    bool read_weights_block(std::istream& wtfile, std::array<std::vector<float>, 4> &layer,
+    using WeightsLineReader = std::function<bool(std::vector<float>&)>;
+    static bool parse_weights_line(const char* begin, const char* end,
+                                   std::vector<float>& weights);
+    bool read_weights_block(const WeightsLineReader& read_line,
+                            std::array<std::vector<float>, 4> &layer,
                             WeightsFileIndex &id);
     void identify_layer(std::array<std::vector<float>, 4> &layer, WeightsFileIndex &id);
     void set_network_parameters(std::array<std::vector<float>, 4> &layer, WeightsFileIndex &id);
     void print_network_details();
     void store_layer(std::array<std::vector<float>, 4> &layer, WeightsFileIndex &id);
-    int load_v1_network(std::istream &wtfile, int format_version);
+    int load_v1_network(const WeightsLineReader& read_line, int format_version);
+    bool set_format_version(int format_version);
     int load_network_file(const std::string &filename);
+    void init_nncache(int playouts);
+    bool load_weights(const std::string &weightsfile);
+    void init_forward_pipe();
+    bool same_shape(const Network &other) const;
+    static bool is_binary_weights_file(const std::string &filename);
+    int load_binary_network_file(const std::string &filename);
+    int load_binary_network(const char* data, size_t size);
 
     static std::vector<float> winograd_transform_f(const std::vector<float> &f,
                                                    const int outputs, const int channels);
@@ -230,36 +332,90 @@ class Network {
     void reduce_mean(std::vector<float> &layer, size_t area);
     Netresult get_output_internal(const GameState *const state,
                                   const int symmetry, bool selfcheck = false);
+    std::vector<Netresult> get_output_internal_batch(
+        const std::vector<const GameState*>& states,
+        const std::vector<int>& symmetries);
+    Netresult process_output(const GameState *const state, const int symmetry,
+                             const std::vector<float>& policy_data,
+                             const std::vector<float>& val_data);
+    // Same as above, with the policy inner product already applied.
+    Netresult process_policy_logits(const GameState *const state,
+                                    const int symmetry,
+                                    const std::vector<float>& policy_out,
+                                    const std::vector<float>& val_data);
+    void finish_output(const GameState *const state, Netresult& result,
+                       const bool write_cache);
+    static std::shared_ptr<const PositionPlanes> get_position_planes(
+        const KoState& state, const unsigned int groups);
     static void fill_input_plane_pair(const FullBoard &board,
-                                      std::vector<float>::iterator black,
-                                      std::vector<float>::iterator white,
-                                      const int symmetry);
-    static void fill_input_plane_advfeat(std::shared_ptr<const KoState> const state,
-                                         std::vector<float>::iterator legal,
-                                         std::vector<float>::iterator atari,
-                                         const int symmetry);
-    static void fill_input_plane_chainlibsfeat(std::shared_ptr<const KoState> const state,
-                                               std::vector<float>::iterator chainlibs,
-                                               const int symmetry);
-    static void fill_input_plane_chainsizefeat(std::shared_ptr<const KoState> const state,
-                                               std::vector<float>::iterator chainsize,
-                                               const int symmetry);
-
-    bool probe_cache(const GameState *const state, Network::Netresult &result);
+                                      PositionPlanes& planes);
+    static void fill_input_plane_advfeat(const KoState& state,
+                                         PositionPlanes& planes);
+    static void fill_input_plane_chainlibsfeat(const KoState& state,
+                                               PositionPlanes& planes);
+    static void fill_input_plane_chainsizefeat(const KoState& state,
+                                               PositionPlanes& planes);
+
+    // The key of a position in m_nncache, and the symmetry taking it to
+    // the position its entry is stored for: the symmetry of smallest
+    // hash with cfg_canonical_nncache, else the identity.
+    std::pair<std::uint64_t, int> nncache_key(const GameState* state) const;
+    void nncache_insert(const GameState* state, const Netresult& result);
+    // Reorder the policy of the position transformed by symmetry into
+    // that of the position, or back with to_symmetry.
+    static void remap_policy(Netresult& result, int symmetry,
+                             bool to_symmetry = false);
     float get_sai_winrate(Network::Netresult& result, const GameState* const state);
     std::unique_ptr<ForwardPipe> &&init_net(int channels,
                                             std::unique_ptr<ForwardPipe> &&pipe);
+    std::unique_ptr<ForwardPipe> init_cpu_net(int channels);
     void dump_array(std::string name, std::vector<float> &array);
 #ifdef USE_HALF
     void select_precision(int channels);
+    void release_cpu_reference();
 #endif
     std::unique_ptr<ForwardPipe> m_forward;
 #ifdef USE_OPENCL_SELFCHECK
     void compare_net_outputs(const Netresult &data, const Netresult &ref);
     std::unique_ptr<ForwardPipe> m_forward_cpu;
+
+    // Sampled evaluations are checked against m_forward_cpu by a thread
+    // of their own, so that the search does not wait for the CPU. A
+    // mismatch is thrown by the next get_output().
+    struct SelfCheckSample {
+        GameState state;
+        int symmetry;
+        Netresult result;
+    };
+    void queue_selfcheck(const GameState* const state, const int symmetry,
+                         const Netresult& result);
+    void selfcheck_worker();
+    // Wait for the queued checks and end the thread, before
+    // m_forward_cpu changes.
+    void stop_selfcheck();
+    std::mutex m_selfcheck_mutex;
+    std::condition_variable m_selfcheck_cv;
+    std::deque<SelfCheckSample> m_selfcheck_queue;
+    std::thread m_selfcheck_thread;
+    bool m_selfcheck_exit{false};
+    std::atomic<bool> m_selfcheck_failed{false};
 #endif
 
     NNCache m_nncache;
+    std::unique_ptr<NNSharedCache> m_shared_cache;
+    std::unique_ptr<NNOpeningBook> m_opening_book;
+
+    // Positions evaluated by the network.
+    std::atomic<size_t> m_evals{0};
+
+    // Hash of the weights file contents.
+    std::uint64_t m_network_hash{0};
+    int m_format_version{-1};
+
+    // Winograd transformed convolutions read from a binary weights file.
+    std::vector<std::vector<float>> m_winograd_U;
+    // When set, the text loader keeps a copy of every line here.
+    std::vector<std::vector<float>>* m_recorded_lines{nullptr};
 
     size_t estimated_size{0};
 
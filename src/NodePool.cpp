@@ -0,0 +1,226 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#include "config.h"
+#include "NodePool.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+#include "MemoryTracker.h"
+#include "Numa.h"
+#include "UCTNode.h"
+
+namespace {
+
+constexpr size_t CACHE_LINE = 64;
+constexpr size_t BATCH_SIZE = NodePool<UCTNode>::BATCH_SIZE;
+constexpr size_t SLAB_SIZE = NodePool<UCTNode>::SLAB_SIZE;
+
+struct FreeBlock {
+    FreeBlock* next;
+};
+
+template <typename T>
+constexpr size_t block_size() {
+    return (std::max(sizeof(T), sizeof(FreeBlock)) + CACHE_LINE / 2 - 1)
+        / (CACHE_LINE / 2) * (CACHE_LINE / 2);
+}
+
+// A singly linked list of free blocks.
+struct FreeList {
+    FreeBlock* head{nullptr};
+    size_t count{0};
+
+    void push(void* ptr) {
+        auto block = static_cast<FreeBlock*>(ptr);
+        block->next = head;
+        head = block;
+        count++;
+    }
+
+    void* pop() {
+        auto block = head;
+        head = block->next;
+        count--;
+        return block;
+    }
+
+    // Detaches the first n blocks as a list of their own.
+    FreeList split(size_t n) {
+        assert(n > 0 && n <= count);
+        auto result = FreeList{head, n};
+        auto last = head;
+        for (auto i = size_t{1}; i < n; i++) {
+            last = last->next;
+        }
+        head = last->next;
+        last->next = nullptr;
+        count -= n;
+        return result;
+    }
+};
+
+template <size_t BlockSize>
+class SharedPool {
+public:
+    FreeList take_batch() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_batches.empty()) {
+            add_slab();
+        }
+        auto batch = m_batches.back();
+        m_batches.pop_back();
+        return batch;
+    }
+
+    // Like take_batch(), but never allocates a new slab.
+    bool try_take_batch(FreeList& batch) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_batches.empty()) {
+            return false;
+        }
+        batch = m_batches.back();
+        m_batches.pop_back();
+        return true;
+    }
+
+    void give_batch(const FreeList& batch) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_batches.push_back(batch);
+    }
+
+private:
+    void add_slab() {
+        auto slab = std::make_unique<char[]>(SLAB_SIZE * BlockSize + CACHE_LINE);
+        MemoryTracker::add(MemoryTracker::TREE_NODES,
+                           SLAB_SIZE * BlockSize + CACHE_LINE);
+        auto first = reinterpret_cast<std::uintptr_t>(slab.get());
+        first = (first + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+        auto base = reinterpret_cast<char*>(first);
+        for (auto b = size_t{0}; b < SLAB_SIZE; b += BATCH_SIZE) {
+            auto batch = FreeList{};
+            for (auto i = b; i < b + BATCH_SIZE; i++) {
+                batch.push(base + i * BlockSize);
+            }
+            m_batches.push_back(batch);
+        }
+        m_slabs.emplace_back(std::move(slab));
+    }
+
+    std::mutex m_mutex;
+    std::vector<std::unique_ptr<char[]>> m_slabs;
+    std::vector<FreeList> m_batches;
+};
+
+// One shared pool per NUMA node, the slabs of each being first
+// touched by a thread of that node in add_slab(). Never destroyed:
+// threads of the global thread pool give their blocks back when
+// they exit, which can be after static destruction.
+template <size_t BlockSize>
+std::vector<SharedPool<BlockSize>>& shared_pools() {
+    static auto pools = new std::vector<SharedPool<BlockSize>>(Numa::num_nodes());
+    return *pools;
+}
+
+template <size_t BlockSize>
+SharedPool<BlockSize>& shared_pool() {
+    auto& pools = shared_pools<BlockSize>();
+    return pools[Numa::current_node() % pools.size()];
+}
+
+// Blocks freed by a thread of another node (typically the one deleting
+// the old tree) are taken before growing the pool: locality is only
+// preferred, the pool still stays as big as the largest tree.
+template <size_t BlockSize>
+FreeList take_batch() {
+    auto& pools = shared_pools<BlockSize>();
+    const auto node = Numa::current_node() % pools.size();
+    auto batch = FreeList{};
+    for (auto i = size_t{0}; i < pools.size(); i++) {
+        if (pools[(node + i) % pools.size()].try_take_batch(batch)) {
+            return batch;
+        }
+    }
+    return pools[node].take_batch();
+}
+
+template <size_t BlockSize>
+class LocalPool {
+public:
+    ~LocalPool() {
+        while (m_free.count > 0) {
+            shared_pool<BlockSize>().give_batch(
+                m_free.split(std::min(m_free.count, BATCH_SIZE)));
+        }
+    }
+
+    void* allocate() {
+        if (m_free.count == 0) {
+            m_free = take_batch<BlockSize>();
+        }
+        return m_free.pop();
+    }
+
+    void deallocate(void* ptr) {
+        m_free.push(ptr);
+        if (m_free.count >= 2 * BATCH_SIZE) {
+            shared_pool<BlockSize>().give_batch(m_free.split(BATCH_SIZE));
+        }
+    }
+
+private:
+    FreeList m_free;
+};
+
+template <size_t BlockSize>
+LocalPool<BlockSize>& local_pool() {
+    thread_local LocalPool<BlockSize> pool;
+    return pool;
+}
+
+}
+
+template <typename T>
+void* NodePool<T>::allocate() {
+    return local_pool<block_size<T>()>().allocate();
+}
+
+template <typename T>
+void NodePool<T>::deallocate(void* ptr) {
+    local_pool<block_size<T>()>().deallocate(ptr);
+}
+
+template class NodePool<UCTNode>;
+template class NodePool<UCTNodeQuantiles>;
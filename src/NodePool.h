@@ -0,0 +1,61 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#ifndef NODEPOOL_H_INCLUDED
+#define NODEPOOL_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+
+// Allocator for the search tree objects, see UCTNode::operator new.
+//
+// Objects are carved out of large slabs and recycled through free lists
+// instead of going through malloc for each one. Every thread keeps a
+// small list of its own and exchanges whole batches with a shared one,
+// so the thread that deletes an old tree after the root advances hands
+// the nodes over to the search threads a batch at a time. Slabs are
+// never released, the pool stays as big as the largest tree.
+//
+// Slabs start on a cache line and blocks are a multiple of half a line,
+// so the first 32 bytes of an object never straddle two lines.
+//
+// Only instantiated for the types in NodePool.cpp.
+template <typename T>
+class NodePool {
+public:
+    static void* allocate();
+    static void deallocate(void* ptr);
+
+    static constexpr size_t BATCH_SIZE = 256;
+    static constexpr size_t SLAB_SIZE = 16 * BATCH_SIZE;
+};
+
+#endif
@@ -0,0 +1,150 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#include "config.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+#include "Numa.h"
+#include "Utils.h"
+
+using Utils::myprintf;
+
+std::vector<std::vector<int>> Numa::s_node_cpus;
+std::vector<int> Numa::s_node_ids;
+thread_local size_t Numa::s_current_node{0};
+
+#ifdef __linux__
+// Parse a sysfs CPU list such as "0-15,32-47".
+static std::vector<int> parse_cpulist(const std::string& list) {
+    auto cpus = std::vector<int>{};
+    auto ranges = std::istringstream{list};
+    auto range = std::string{};
+    while (std::getline(ranges, range, ',')) {
+        if (range.empty()) {
+            continue;
+        }
+        const auto dash = range.find('-');
+        const auto first = std::stoi(range.substr(0, dash));
+        const auto last = dash == std::string::npos ?
+            first : std::stoi(range.substr(dash + 1));
+        for (auto cpu = first; cpu <= last; cpu++) {
+            cpus.emplace_back(cpu);
+        }
+    }
+    return cpus;
+}
+#endif
+
+void Numa::initialize(bool enabled) {
+    s_node_cpus.clear();
+    s_node_ids.clear();
+#ifdef __linux__
+    if (!enabled) {
+        return;
+    }
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+        return;
+    }
+    for (auto node = 0; ; node++) {
+        auto file = std::ifstream{"/sys/devices/system/node/node"
+                                  + std::to_string(node) + "/cpulist"};
+        auto list = std::string{};
+        if (!file || !std::getline(file, list)) {
+            break;
+        }
+        auto cpus = std::vector<int>{};
+        for (const auto cpu : parse_cpulist(list)) {
+            if (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed)) {
+                cpus.emplace_back(cpu);
+            }
+        }
+        if (!cpus.empty()) {
+            s_node_cpus.emplace_back(std::move(cpus));
+            s_node_ids.emplace_back(node);
+        }
+    }
+    if (s_node_cpus.size() < 2) {
+        s_node_cpus.clear();
+        s_node_ids.clear();
+        myprintf("NUMA: single node, threads are not pinned.\n");
+        return;
+    }
+    myprintf("NUMA: spreading threads over %zu nodes.\n", s_node_cpus.size());
+#else
+    if (enabled) {
+        myprintf("NUMA: thread placement is only supported on Linux.\n");
+    }
+#endif
+}
+
+size_t Numa::num_nodes() {
+    return std::max(size_t{1}, s_node_cpus.size());
+}
+
+void Numa::bind_to_node(size_t node) {
+#ifdef __linux__
+    if (s_node_cpus.empty()) {
+        return;
+    }
+    node %= s_node_cpus.size();
+    s_current_node = node;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (const auto cpu : s_node_cpus[node]) {
+        CPU_SET(cpu, &set);
+    }
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)node;
+#endif
+}
+
+int Numa::pci_device_node(const std::string& address) {
+    auto file = std::ifstream{"/sys/bus/pci/devices/" + address + "/numa_node"};
+    auto node = -1;
+    if (!(file >> node)) {
+        return -1;
+    }
+    const auto it = std::find(begin(s_node_ids), end(s_node_ids), node);
+    if (it == end(s_node_ids)) {
+        return -1;
+    }
+    return static_cast<int>(std::distance(begin(s_node_ids), it));
+}
@@ -0,0 +1,82 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#ifndef NUMA_H_INCLUDED
+#define NUMA_H_INCLUDED
+
+#include "config.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+// Optional placement of threads on the NUMA nodes (sockets) of the host.
+//
+// Memory is not placed explicitly: Linux allocates a page on the node of
+// the thread touching it first, so once the search threads are pinned the
+// slabs NodePool carves the tree nodes from are local to them, as it keeps
+// one shared pool per node. The NN cache spreads its shards over the nodes
+// in the same way, see NNCache::for_each_shard().
+//
+// Everything is a no-op unless enabled on a Linux host with more than one
+// node.
+class Numa {
+public:
+    // Read the node layout from sysfs. Only the CPUs this process
+    // may run on are considered.
+    static void initialize(bool enabled);
+
+    // Number of nodes threads are spread over, 1 when disabled.
+    static size_t num_nodes();
+
+    // Pin the calling thread to the CPUs of a node.
+    static void bind_to_node(size_t node);
+
+    // Node the calling thread was bound to, 0 if it never was.
+    static size_t current_node() { return s_current_node; }
+
+    // Pin the n-th thread of a group: consecutive threads
+    // alternate between the nodes.
+    static void bind_thread(size_t index) {
+        bind_to_node(index % num_nodes());
+    }
+
+    // Node (as passed to bind_to_node()) of a PCI device given as
+    // "domain:bus:device.function", or -1 if unknown.
+    static int pci_device_node(const std::string& address);
+
+private:
+    static std::vector<std::vector<int>> s_node_cpus;
+    // sysfs number of each node in s_node_cpus.
+    static std::vector<int> s_node_ids;
+    static thread_local size_t s_current_node;
+};
+
+#endif
@@ -39,21 +39,25 @@
 #include <limits>
 #include <stdexcept>
 
+#include <cstdint>
 #include <cstdio>
+#include <fstream>
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <sstream>
 #include <string>
+#include <thread>
 
 #include "OpenCL.h"
 #include "Network.h"
 #include "GTP.h"
+#include "MemoryTracker.h"
 #include "Utils.h"
 #include "Tuner.h"
 
 using namespace Utils;
 
-static constexpr auto LOG2_NUM_ITEMS_PER_WG   = 8;
 static constexpr auto LOG2_NUM_CHANS_PER_WG   = 4;
 static constexpr auto LOG2_NUM_OUTPUTS_PER_WG = 4;
 static constexpr auto LOG2_NUM_MULTS_PER_ITEM = 4;
@@ -81,7 +85,7 @@ static const std::string sourceCode_tensorcore_test =
     #include "kernels/tensorcore_test.opencl"
 ;
 
-static const std::string sourceCode_config = R"(
+const std::string sourceCode_config = R"(
 #define BOARD_SIZE )" + std::to_string(BOARD_SIZE) +
 "\n#define NUM_INTERSECTIONS " + std::to_string(NUM_INTERSECTIONS) +
 "\n#define WINOGRAD_M " + std::to_string(WINOGRAD_M) +
@@ -89,11 +93,11 @@ static const std::string sourceCode_config = R"(
 "\n#define WTILES " + std::to_string(WINOGRAD_WTILES) +
 "\n#define LOG2_NUM_MULTS_PER_ITEM " + std::to_string(LOG2_NUM_MULTS_PER_ITEM);
 
-static const std::string sourceCode_convolve1 =
+const std::string sourceCode_convolve1 =
     #include "kernels/convolve1.opencl"
 ;
 
-static const std::string sourceCode_convolve3 =
+const std::string sourceCode_convolve3 =
     #include "kernels/convolve3.opencl"
 ;
 
@@ -108,6 +112,11 @@ const std::string sourceCode_sgemm =
     "\n#endif\n"
 ;
 
+OpenCLContext::~OpenCLContext() {
+    MemoryTracker::add(MemoryTracker::OPENCL_HOST,
+                       -std::int64_t(m_host_bytes));
+}
+
 template <typename net_t>
 void OpenCL<net_t>::ensure_context_initialized(OpenCLContext &opencl_context) {
     if (!opencl_context.m_is_initialized) {
@@ -220,6 +229,14 @@ void OpenCL_Network<net_t>::forward(const std::vector<float>& input,
             m_opencl.m_context,
             CL_MEM_READ_WRITE | CL_MEM_HOST_NO_ACCESS, alloc_vm_size);
 
+        // Host-side staging area for the input planes, so the upload to
+        // the device is a DMA from pinned memory.
+        const auto alloc_pinnedInSize =
+            getOpenCL().m_batch_size * input_planes * one_plane;
+        opencl_context.m_pinnedInBuffer = cl::Buffer(
+            m_opencl.m_context,
+            CL_MEM_READ_ONLY | CL_MEM_ALLOC_HOST_PTR, alloc_pinnedInSize);
+
         opencl_context.m_pinnedOutBuffer_pol = cl::Buffer(
             m_opencl.m_context,
             CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, getOpenCL().m_batch_size * finalSize_pol);
@@ -227,6 +244,10 @@ void OpenCL_Network<net_t>::forward(const std::vector<float>& input,
             m_opencl.m_context,
             CL_MEM_WRITE_ONLY | CL_MEM_ALLOC_HOST_PTR, getOpenCL().m_batch_size * finalSize_val);
 
+        opencl_context.m_host_bytes = alloc_pinnedInSize
+            + getOpenCL().m_batch_size * (finalSize_pol + finalSize_val);
+        MemoryTracker::add(MemoryTracker::OPENCL_HOST,
+                           opencl_context.m_host_bytes);
         opencl_context.m_buffers_allocated = true;
     }
 
@@ -236,11 +257,19 @@ void OpenCL_Network<net_t>::forward(const std::vector<float>& input,
     cl::Buffer & MBuffer = opencl_context.m_MBuffer;
     cl::CommandQueue & queue = opencl_context.m_commandqueue;
 
-    std::vector<net_t> net_t_input(input.size());
-    std::copy(begin(input), end(input), begin(net_t_input));
-
+    // Convert straight into the pinned staging buffer. Each worker thread
+    // has its own context and queue, so this copy and the transfer overlap
+    // with the kernels another worker has in flight on the same device.
     const auto inSize = sizeof(net_t) * input.size();
-    queue.enqueueWriteBuffer(inBuffer, CL_FALSE, 0, inSize, net_t_input.data());
+    auto pinnedInBufferHost = queue.enqueueMapBuffer(
+        opencl_context.m_pinnedInBuffer, CL_TRUE,
+        CL_MAP_WRITE_INVALIDATE_REGION, 0, inSize);
+    std::copy(begin(input), end(input),
+              static_cast<net_t*>(pinnedInBufferHost));
+    queue.enqueueUnmapMemObject(opencl_context.m_pinnedInBuffer,
+                                pinnedInBufferHost);
+    queue.enqueueCopyBuffer(opencl_context.m_pinnedInBuffer, inBuffer,
+                            0, 0, inSize);
 
     // Fused in_out transformation kernel is slower with big batch_sizes than
     // calling out and in transformations separately.
@@ -469,8 +498,17 @@ void OpenCL_Network<net_t>::convolve3(OpenCLContext & opencl_context,
             in_transform_kernel.setArg(4, n_ceil);
             in_transform_kernel.setArg(5, batch_size);
 
-            queue.enqueueNDRangeKernel(in_transform_kernel, cl::NullRange,
-                                       cl::NDRange(wgs, channels));
+            const auto in_wgs = m_opencl.m_conv_tuners.in_wgs;
+            if (in_wgs) {
+                queue.enqueueNDRangeKernel(
+                    in_transform_kernel, cl::NullRange,
+                    cl::NDRange(ceilMultiple(batch_size * tiles, in_wgs),
+                                channels),
+                    cl::NDRange(in_wgs, 1));
+            } else {
+                queue.enqueueNDRangeKernel(in_transform_kernel, cl::NullRange,
+                                           cl::NDRange(wgs, channels));
+            }
         } catch (const cl::Error &e) {
             std::cerr << "Error in convolve3/in: " << e.what() << ": "
                 << e.err() << std::endl;
@@ -553,8 +591,8 @@ void OpenCL_Network<net_t>::convolve3(OpenCLContext & opencl_context,
             out_transform_bn_kernel.setArg(8, bn_weights[1]);
 
             // Needs to match OUT_KWG, OUT_BWG in the kernel.
-            // This could be tuned.
-            cl::NDRange local_out = {32, 2};
+            cl::NDRange local_out = {m_opencl.m_conv_tuners.out_kwg,
+                                     m_opencl.m_conv_tuners.out_bwg};
 
             cl::NDRange global_out = {ceilMultiple(outputs, local_out[0]),
                                       ceilMultiple(tiles * batch_size, local_out[1])};
@@ -586,6 +624,31 @@ namespace
     }
 }
 
+Conv1Workgroup convolve1_workgroup(const int channels, const int outputs,
+                                   const int log2_items) {
+    const int num_items_wg   = 1 << log2_items;              // m - number of items per workgroup
+    constexpr int num_chans_wg   = 1 << LOG2_NUM_CHANS_PER_WG;   //   - number of channels handled per workgroup
+    constexpr int num_outputs_wg = 1 << LOG2_NUM_OUTPUTS_PER_WG;
+    constexpr int num_mults_item = 1 << LOG2_NUM_MULTS_PER_ITEM; // d - number of multiplications per item
+
+    const int num_items_a_c      = std::max(1, channels / num_mults_item); // number of items along channels
+
+    // if a loc_outputs of 8 would result in a waste of items of 25%, use 2
+    const bool is_wasting_items  = outputs <= 4 * (num_outputs_wg - 1 - ((outputs - 1) % num_outputs_wg));
+
+    auto wg = Conv1Workgroup{};
+    wg.items = num_items_wg;
+    wg.outputs = num_outputs_wg / (is_wasting_items ? 4 : 1); // beta
+    // gamma = min(32 * eccent, ceil_pow2(num_items_a_c) * 8) - in any case a power of 2!
+    wg.channels = std::min(num_chans_wg * (is_wasting_items ? 2 : 1),
+                           ceil_pow2(num_items_a_c) * num_mults_item);
+    // local number of items along channels
+    wg.channel_items = wg.channels / num_mults_item;
+    // alpha - this is always an exact division, when there are enough items
+    wg.sites = std::max(1, num_items_wg / wg.channel_items / wg.outputs);
+    return wg;
+}
+
 template <typename net_t>
 void OpenCL_Network<net_t>::convolve1(OpenCLContext & opencl_context,
                                       const int channels,
@@ -597,29 +660,16 @@ void OpenCL_Network<net_t>::convolve1(OpenCLContext & opencl_context,
                                       weight_slice_t bn_weights,
                                       const int batch_size,
                                       const bool add_origin) {
-    // The size of the board is defined at compile time
-    constexpr int num_items_wg   = 1 << LOG2_NUM_ITEMS_PER_WG;   // m - number of items per workgroup
-    constexpr int num_chans_wg   = 1 << LOG2_NUM_CHANS_PER_WG;   //   - number of channels handled per workgroup
-    constexpr int num_outputs_wg = 1 << LOG2_NUM_OUTPUTS_PER_WG;
-    constexpr int num_mults_item = 1 << LOG2_NUM_MULTS_PER_ITEM; // d - number of multiplications per item
+    const auto wg = convolve1_workgroup(channels, outputs,
+                                        m_opencl.m_conv_tuners.conv1_items);
+    const int num_items_wg       = wg.items;
+    const int loc_outputs        = wg.outputs;
+    const int loc_channels       = wg.channels;
+    const int loc_num_items_a_c  = wg.channel_items;
+    const int loc_sites          = wg.sites;
 
     const int sites              = NUM_INTERSECTIONS * batch_size;  // n - number of sites
 
-    const int num_items_a_c      = std::max(1, channels / num_mults_item); // number of items along channels
-    
-    // if a loc_outputs of 8 would result in a waste of items of 25%, use 2
-    const bool is_wasting_items  = outputs <= 4 * (num_outputs_wg - 1 - ((outputs - 1) % num_outputs_wg));
-    const int loc_outputs        = num_outputs_wg / (is_wasting_items ? 4 : 1); // beta
-
-    // gamma = min(32 * eccent, ceil_pow2(num_items_a_c) * 8) - in any case a power of 2!
-    const int loc_channels       = std::min(num_chans_wg * (is_wasting_items ? 2 : 1),
-                                            ceil_pow2(num_items_a_c) * num_mults_item);
-
-    // local number of items along channels
-    const int loc_num_items_a_c  = loc_channels / num_mults_item;
-    // alpha - this is always an exact division
-    const int loc_sites          = num_items_wg / loc_num_items_a_c / loc_outputs;
-
     // const int merge_size_a_c     = ceilMultiple(channels, loc_channels) / loc_channels;
 
     const cl_int4 conv1_sizes{sites, outputs, channels, 0};
@@ -780,6 +830,19 @@ void OpenCL<net_t>::process_tuners(std::string tuners) {
             m_sgemm_tuners.tce = value;
             tce = true;
         }
+        // Optional, the tuner files of older versions do not have them.
+        if (name == "-DIN_WGS") {
+            m_conv_tuners.in_wgs = value;
+        }
+        if (name == "-DOUT_KWG") {
+            m_conv_tuners.out_kwg = value;
+        }
+        if (name == "-DOUT_BWG") {
+            m_conv_tuners.out_bwg = value;
+        }
+        if (name == "-DCONV1_ITEMS") {
+            m_conv_tuners.conv1_items = value;
+        }
     }
     if (!mwg || !nwg || !kwg || !mdimc || !ndimc || !vwm || !vwn || !mdima || !ndimb) {
         std::cerr << "Missing tuner parameters";
@@ -982,17 +1045,88 @@ OpenCL<net_t>::OpenCL(int gpu, bool silent) {
     }
 }
 
+// Compiled programs are cached next to the tuning file, under a name
+// hashed from everything that goes into the build. Building from source
+// takes several seconds with some drivers, at every start.
+static std::string program_cache_file(const cl::Device& device,
+                                      const std::string& source,
+                                      const std::string& args) {
+    const auto key = device.getInfo<CL_DEVICE_NAME>() + '\n'
+        + device.getInfo<CL_DEVICE_VENDOR>() + '\n'
+        + device.getInfo<CL_DEVICE_VERSION>() + '\n'
+        + device.getInfo<CL_DRIVER_VERSION>() + '\n'
+        + args + '\n' + source;
+    // FNV-1a
+    auto hash = std::uint64_t{0xcbf29ce484222325ULL};
+    for (const auto c : key) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 0x100000001b3ULL;
+    }
+    return leelaz_file(str(boost::format("sai_opencl_%016x.bin") % hash));
+}
+
+template <typename net_t>
+bool OpenCL<net_t>::load_program_binary(const std::string& filename,
+                                        const std::string& args) {
+    std::ifstream file(filename, std::ifstream::binary);
+    if (!file) {
+        return false;
+    }
+    auto binary = std::vector<unsigned char>(
+        std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    if (binary.empty()) {
+        return false;
+    }
+    try {
+        auto program = cl::Program(m_context, {m_device},
+                                   cl::Program::Binaries{binary});
+        program.build(args.c_str());
+        m_program = program;
+    } catch (const cl::Error&) {
+        // Stale or damaged, it is rebuilt from source.
+        return false;
+    }
+    return true;
+}
+
+template <typename net_t>
+void OpenCL<net_t>::save_program_binary(const std::string& filename) {
+    try {
+        const auto binaries = m_program.getInfo<CL_PROGRAM_BINARIES>();
+        if (binaries.size() != 1 || binaries[0].empty()) {
+            return;
+        }
+        // Written to a temporary first, as other processes may be
+        // starting up at the same time.
+        const auto tmpname = filename + ".tmp"
+            + std::to_string(std::hash<std::thread::id>()(
+                                 std::this_thread::get_id()));
+        {
+            std::ofstream file(tmpname, std::ofstream::binary);
+            file.write(reinterpret_cast<const char*>(binaries[0].data()),
+                       binaries[0].size());
+            if (!file) {
+                std::remove(tmpname.c_str());
+                return;
+            }
+        }
+        std::rename(tmpname.c_str(), filename.c_str());
+    } catch (const cl::Error&) {
+        // Not cached then.
+    }
+}
+
 template <typename net_t>
 void OpenCL<net_t>::initialize(const int channels, size_t batch_size) {
     m_batch_size = batch_size;
+    const auto source = sourceCode_common
+                      + sourceCode_config
+                      + sourceCode_convolve1
+                      + sourceCode_convolve3
+                      + sourceCode_sgemm;
     // Make program of the source code in the context
     try {
-        m_program = cl::Program(m_context,
-                                sourceCode_common
-                                + sourceCode_config
-                                + sourceCode_convolve1
-                                + sourceCode_convolve3
-                                + sourceCode_sgemm);
+        m_program = cl::Program(m_context, source);
     } catch (const cl::Error &e) {
         myprintf("Error getting kernels: %s: %d", e.what(), e.err());
         throw std::runtime_error("Error getting OpenCL kernels.");
@@ -1005,6 +1139,7 @@ void OpenCL<net_t>::initialize(const int channels, size_t batch_size) {
 
     auto sgemm_tuners =
         t.load_sgemm_tuners(channels, batch_size * WINOGRAD_P, channels, WINOGRAD_TILE);
+    auto conv_tuners = t.load_conv_tuners(channels, batch_size);
 
     // Some NVIDIA drivers are buggy and will fail to compile the rest of the
     // kernels after a tuning run.
@@ -1023,8 +1158,15 @@ void OpenCL<net_t>::initialize(const int channels, size_t batch_size) {
             args += " -DWINOGRAD_SIMD";
         }
 
-        args += sgemm_tuners;
-        m_program.build(args.c_str());
+        args += sgemm_tuners + conv_tuners;
+        const auto cache_file = program_cache_file(m_device, source, args);
+        if (load_program_binary(cache_file, args)) {
+            myprintf("Loaded compiled OpenCL kernels from %s\n",
+                     cache_file.c_str());
+        } else {
+            m_program.build(args.c_str());
+            save_program_binary(cache_file);
+        }
     } catch (const cl::Error&) {
         myprintf("Error building kernels: %s\n",
                  m_program.getBuildInfo<CL_PROGRAM_BUILD_LOG>(m_device).c_str());
@@ -1034,7 +1176,7 @@ void OpenCL<net_t>::initialize(const int channels, size_t batch_size) {
     OpenCLContext tdata;
     ensure_context_initialized(tdata);
 
-    process_tuners(sgemm_tuners);
+    process_tuners(sgemm_tuners + conv_tuners);
 
     m_wavefront_size =
         tdata.m_sgemm_kernel.getWorkGroupInfo<
@@ -1077,6 +1219,60 @@ std::string OpenCL<net_t>::get_device_name() {
     return ss.str();
 }
 
+template <typename net_t>
+std::string OpenCL<net_t>::get_driver_version() {
+    return m_device.getInfo<CL_DRIVER_VERSION>();
+}
+
+template <typename net_t>
+std::string OpenCL<net_t>::get_pci_address() {
+    // The PCI location is only available through vendor extensions,
+    // whose constants are missing from some versions of the headers.
+    constexpr cl_device_info PCI_BUS_ID_NV = 0x4008;
+    constexpr cl_device_info PCI_SLOT_ID_NV = 0x4009;
+    constexpr cl_device_info TOPOLOGY_AMD = 0x4037;
+    constexpr cl_uint TOPOLOGY_TYPE_PCIE_AMD = 1;
+
+    const auto extensions = m_device.getInfo<CL_DEVICE_EXTENSIONS>();
+    auto bus = 0u;
+    auto device = 0u;
+    auto function = 0u;
+    if (extensions.find("cl_nv_device_attribute_query") != std::string::npos) {
+        auto bus_id = cl_uint{0};
+        auto slot_id = cl_uint{0};
+        if (clGetDeviceInfo(m_device(), PCI_BUS_ID_NV, sizeof(bus_id),
+                            &bus_id, nullptr) != CL_SUCCESS
+            || clGetDeviceInfo(m_device(), PCI_SLOT_ID_NV, sizeof(slot_id),
+                               &slot_id, nullptr) != CL_SUCCESS) {
+            return "";
+        }
+        bus = bus_id;
+        device = slot_id >> 3;
+        function = slot_id & 7;
+    } else if (extensions.find("cl_amd_device_attribute_query") != std::string::npos) {
+        // Layout of cl_device_topology_amd for a PCIe device.
+        struct {
+            cl_uint type;
+            cl_char unused[17];
+            cl_char bus;
+            cl_char device;
+            cl_char function;
+        } topology;
+        if (clGetDeviceInfo(m_device(), TOPOLOGY_AMD, sizeof(topology),
+                            &topology, nullptr) != CL_SUCCESS
+            || topology.type != TOPOLOGY_TYPE_PCIE_AMD) {
+            return "";
+        }
+        bus = static_cast<unsigned char>(topology.bus);
+        device = static_cast<unsigned char>(topology.device);
+        function = static_cast<unsigned char>(topology.function);
+    } else {
+        return "";
+    }
+    return boost::str(boost::format("0000:%02x:%02x.%x")
+                      % bus % device % function);
+}
+
 template class OpenCL<float>;
 template class OpenCL_Network<float>;
 #ifdef USE_HALF
@@ -76,6 +76,11 @@ private:
 class OpenCLContext {
     template <typename> friend class OpenCL;
     template <typename> friend class OpenCL_Network;
+public:
+    OpenCLContext() = default;
+    OpenCLContext(const OpenCLContext&) = delete;
+    OpenCLContext& operator=(const OpenCLContext&) = delete;
+    ~OpenCLContext();
 private:
     bool m_is_initialized{false};
     cl::CommandQueue m_commandqueue;
@@ -89,9 +94,12 @@ private:
     cl::Buffer m_inBuffer2;
     cl::Buffer m_VBuffer;
     cl::Buffer m_MBuffer;
+    cl::Buffer m_pinnedInBuffer;
     cl::Buffer m_pinnedOutBuffer_pol;
     cl::Buffer m_pinnedOutBuffer_val;
     bool m_buffers_allocated{false};
+    // Size of the pinned buffers, counted in MemoryTracker::OPENCL_HOST.
+    size_t m_host_bytes{0};
 };
 
 template <typename net_t>
@@ -102,6 +110,10 @@ public:
         return m_opencl;
     }
 
+    void clear_layers() {
+        m_layers.clear();
+    }
+
     void push_input_convolution(unsigned int filter_size,
                        unsigned int channels,
                        unsigned int outputs,
@@ -240,6 +252,9 @@ public:
     void initialize(const int channels, size_t batch_size = 1);
     void ensure_context_initialized(OpenCLContext & opencl_context);
     std::string get_device_name();
+    std::string get_driver_version();
+    // "domain:bus:device.function" of the device, empty if unknown.
+    std::string get_pci_address();
     bool has_fp16_compute();
     bool has_tensor_cores();
 
@@ -249,6 +264,9 @@ public:
     cl::Context m_context;
 private:
     void process_tuners(std::string tuners);
+    bool load_program_binary(const std::string& filename,
+                             const std::string& args);
+    void save_program_binary(const std::string& filename);
 
     size_t m_batch_size = 1;
     cl::Program m_program;
@@ -262,6 +280,13 @@ private:
         size_t tce;
     };
     sgemm_tuners m_sgemm_tuners;
+    struct conv_tuners {
+        size_t in_wgs{0};  // 0 lets the driver pick
+        size_t out_kwg{32};
+        size_t out_bwg{2};
+        size_t conv1_items{8};  // log2
+    };
+    conv_tuners m_conv_tuners;
     size_t m_wavefront_size{0};
     size_t m_max_workgroup_size{0};
     std::vector<size_t> m_max_workgroup_dims;
@@ -272,5 +297,19 @@ private:
 
 extern const std::string sourceCode_sgemm;
 extern const std::string sourceCode_common;
+extern const std::string sourceCode_config;
+extern const std::string sourceCode_convolve1;
+extern const std::string sourceCode_convolve3;
+
+// Local work sizes of convolve1 for 2^log2_items items per work-group.
+struct Conv1Workgroup {
+    int items;
+    int sites;
+    int outputs;
+    int channels;
+    int channel_items;
+};
+Conv1Workgroup convolve1_workgroup(const int channels, const int outputs,
+                                   const int log2_items);
 
 #endif
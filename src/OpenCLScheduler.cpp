@@ -32,11 +32,17 @@
 
 #ifdef USE_OPENCL
 
+#include <algorithm>
+#include <cmath>
+#include <iomanip>
+#include <numeric>
+#include <sstream>
 #include <tuple>
 
 #include "GTP.h"
 #include "Random.h"
 #include "Network.h"
+#include "Numa.h"
 #include "Utils.h"
 #include "OpenCLScheduler.h"
 
@@ -107,6 +113,8 @@ OpenCLScheduler<net_t>::OpenCLScheduler() {
         auto net = std::make_unique<OpenCL_Network<net_t>>(*opencl);
         m_opencl.push_back(std::move(opencl));
         m_networks.push_back(std::move(net));
+        m_stats.emplace_back(std::make_unique<batch_stats_t>());
+        m_speed.emplace_back();
 
         // Starting next GPU, let's not dump full list of GPUs.
         silent = true;
@@ -115,18 +123,86 @@ OpenCLScheduler<net_t>::OpenCLScheduler() {
 
 template <typename net_t>
 void OpenCLScheduler<net_t>::initialize(const int channels) {
-    // Launch the worker threads.  Minimum 1 worker per GPU, but use enough threads
-    // so that we can at least concurrently schedule something to the GPU.
-    auto num_worker_threads = cfg_num_threads / cfg_batch_size / (m_opencl.size() + 1) + 1;
-    auto gnum = 0;
-    for (auto& opencl : m_opencl) {
-        opencl->initialize(channels, cfg_batch_size);
+    // Launch the worker threads.  Minimum 2 workers per GPU, so that while
+    // one batch is computing the next one can already be uploaded from its
+    // own command queue, but use enough threads so that we can at least
+    // concurrently schedule something to the GPU.
+    auto num_worker_threads = std::max(
+        size_t{2},
+        cfg_num_threads / cfg_batch_size / (m_opencl.size() + 1) + 1);
+
+    // Tune and build all GPUs at once. A GPU with the same name as one
+    // already being tuned waits for the next round, where it can load
+    // that tuning instead of repeating it.
+    auto pending = std::vector<size_t>(m_opencl.size());
+    std::iota(begin(pending), end(pending), size_t{0});
+    while (!pending.empty()) {
+        auto names = std::vector<std::string>{};
+        auto round = std::vector<size_t>{};
+        auto later = std::vector<size_t>{};
+        for (const auto gnum : pending) {
+            const auto name = m_opencl[gnum]->get_device_name();
+            if (std::find(begin(names), end(names), name) != end(names)) {
+                later.emplace_back(gnum);
+            } else {
+                names.emplace_back(name);
+                round.emplace_back(gnum);
+            }
+        }
+
+        auto errors = std::vector<std::exception_ptr>(round.size());
+        auto threads = std::vector<std::thread>{};
+        for (auto i = size_t{0}; i < round.size(); i++) {
+            threads.emplace_back([this, channels, &round, &errors, i]() {
+                try {
+                    m_opencl[round[i]]->initialize(channels, cfg_batch_size);
+                } catch (...) {
+                    errors[i] = std::current_exception();
+                }
+            });
+        }
+        for (auto& t : threads) {
+            t.join();
+        }
+        for (const auto& error : errors) {
+            if (error) {
+                std::rethrow_exception(error);
+            }
+        }
+        pending = later;
+    }
+
+    if (!cfg_tuner_export.empty()) {
+        tuner_export(cfg_tuner_export);
+    }
 
+    for (auto& speed : m_speed) {
+        speed.batch_size = cfg_batch_size;
+    }
+
+    for (auto gnum = size_t{0}; gnum < m_opencl.size(); gnum++) {
+        // With NUMA placement, the workers feeding a GPU run
+        // on the socket its PCIe slot is attached to.
+        auto node = -1;
+        if (Numa::num_nodes() > 1) {
+            const auto address = m_opencl[gnum]->get_pci_address();
+            if (!address.empty()) {
+                node = Numa::pci_device_node(address);
+            }
+            if (node >= 0) {
+                myprintf("GPU %zu (%s) is on NUMA node %d.\n",
+                         gnum, address.c_str(), node);
+            }
+        }
         for (auto i = unsigned{0}; i < num_worker_threads; i++) {
-            auto t = std::thread(&OpenCLScheduler<net_t>::batch_worker, this, gnum);
+            auto t = std::thread([this, gnum, node]() {
+                if (node >= 0) {
+                    Numa::bind_to_node(node);
+                }
+                batch_worker(gnum);
+            });
             m_worker_threads.push_back(std::move(t));
         }
-        gnum++;
     }
 
     // Exit immediately after tuning.  We should exit here because we skipped
@@ -159,6 +235,25 @@ bool OpenCLScheduler<net_t>::needs_autodetect() {
     return false;
 }
 
+template <typename net_t>
+std::string OpenCLScheduler<net_t>::get_device_names() {
+    auto names = std::string{};
+    for (auto& opencl : m_opencl) {
+        names += (names.empty() ? "" : ",") + opencl->get_device_name();
+    }
+    return names;
+}
+
+template <typename net_t>
+std::string OpenCLScheduler<net_t>::get_driver_versions() {
+    auto versions = std::string{};
+    for (auto& opencl : m_opencl) {
+        versions += (versions.empty() ? "" : ",")
+            + opencl->get_driver_version();
+    }
+    return versions;
+}
+
 template <typename net_t>
 void OpenCLScheduler<net_t>::push_input_convolution(
     unsigned int filter_size,
@@ -242,6 +337,11 @@ void OpenCLScheduler<net_t>::push_weights(
     unsigned int outputs,
     std::shared_ptr<const ForwardPipeWeights> weights) {
 
+    // Replacing the weights of a running pipe starts from scratch.
+    for (const auto& opencl_net : m_networks) {
+        opencl_net->clear_layers();
+    }
+
     auto weight_index = size_t{0};
 
     // Winograd filter transformation changes filter size to 4x4
@@ -290,27 +390,80 @@ template <typename net_t>
 void OpenCLScheduler<net_t>::forward(const std::vector<float>& input,
                                      std::vector<float>& output_pol,
                                      std::vector<float>& output_val) {
+    if (m_single_eval_in_progress.load()) {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        m_waittime += 2;
+    }
+    forward_async(input, output_pol, output_val).get();
+
+    if (m_draining) {
+        throw NetworkHaltException();
+    }
+}
+
+template <typename net_t>
+std::future<void> OpenCLScheduler<net_t>::forward_async(
+    const std::vector<float>& input,
+    std::vector<float>& output_pol,
+    std::vector<float>& output_val) {
     auto entry = std::make_shared<ForwardQueueEntry>(input, output_pol, output_val);
-    std::unique_lock<std::mutex> lk(entry->mutex);
+    auto result = entry->done.get_future();
     {
         std::unique_lock<std::mutex> lk(m_mutex);
         m_forward_queue.push_back(entry);
+    }
+    // With several GPUs the workers wait for different batch sizes,
+    // so the one woken up might not be the one able to proceed.
+    if (m_speed.size() > 1) {
+        m_cv.notify_all();
+    } else {
+        m_cv.notify_one();
+    }
+    return result;
+}
 
-        if (m_single_eval_in_progress.load()) {
-            m_waittime += 2;
-        }
+template <typename net_t>
+void OpenCLScheduler<net_t>::forward_batch(const std::vector<float>& input,
+                                           std::vector<float>& output_pol,
+                                           std::vector<float>& output_val,
+                                           const size_t batch_size) {
+    const auto in_size = input.size() / batch_size;
+    const auto pol_size = output_pol.size() / batch_size;
+    const auto val_size = output_val.size() / batch_size;
+
+    // Queue all positions at once so that the workers pick them
+    // up as full batches, without waiting for other threads.
+    auto inputs = std::vector<std::vector<float>>(batch_size);
+    auto pols = std::vector<std::vector<float>>(batch_size,
+                                                std::vector<float>(pol_size));
+    auto vals = std::vector<std::vector<float>>(batch_size,
+                                                std::vector<float>(val_size));
+    auto pending = std::vector<std::future<void>>();
+    for (auto i = size_t{0}; i < batch_size; i++) {
+        inputs[i].assign(begin(input) + i * in_size,
+                         begin(input) + (i + 1) * in_size);
+        pending.emplace_back(forward_async(inputs[i], pols[i], vals[i]));
     }
-    m_cv.notify_one();
-    entry->cv.wait(lk);
 
-    if (m_draining) {
+    // Wait for every entry even when draining, as the
+    // workers may still be writing into the buffers.
+    auto halted = false;
+    for (auto& result : pending) {
+        try {
+            result.get();
+        } catch (const NetworkHaltException&) {
+            halted = true;
+        }
+    }
+    if (halted || m_draining) {
         throw NetworkHaltException();
     }
-}
 
-#ifndef NDEBUG
-struct batch_stats_t batch_stats;
-#endif
+    for (auto i = size_t{0}; i < batch_size; i++) {
+        std::copy(begin(pols[i]), end(pols[i]), begin(output_pol) + i * pol_size);
+        std::copy(begin(vals[i]), end(vals[i]), begin(output_val) + i * val_size);
+    }
+}
 
 template <typename net_t>
 void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
@@ -333,28 +486,45 @@ void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
     // 2) if we picked up a single eval, but were getting additional evals
     // while that single eval was being processed, it means that we made
     // the wrong decision.  Wait 2ms longer next time.
+    //
+    // With --batch-latency, m_waittime is additionally steered so that
+    // the average time spent in the queue stays within that budget:
+    // shorter waits when it is exceeded, longer ones while batches are
+    // not full and there is still slack.
+    //
+    // With several GPUs each one has its own batch size, scaled with its
+    // measured speed (see update_speed()), and a batch that an idle
+    // faster GPU could take is left to it.
 
-    auto pickup_task = [this] () {
+    auto pickup_task = [this, gnum] () {
         std::list<std::shared_ptr<ForwardQueueEntry>> inputs;
         size_t count = 0;
 
+        const auto batch_ready = [this, gnum] () {
+            const auto queued = m_forward_queue.size();
+            return queued >= m_speed[gnum].batch_size
+                && !leave_to_faster_gpu(gnum, queued);
+        };
+
         std::unique_lock<std::mutex> lk(m_mutex);
         while (true) {
             if (!m_running) return inputs;
 
             count = m_forward_queue.size();
-            if (count >= cfg_batch_size) {
-                count = cfg_batch_size;
+            if (batch_ready()) {
+                count = m_speed[gnum].batch_size;
                 break;
             }
 
+            m_speed[gnum].idle++;
             bool timeout = !m_cv.wait_for(
                 lk,
                 std::chrono::milliseconds(m_waittime),
-                [this] () {
-                    return !m_running || m_forward_queue.size() >= cfg_batch_size;
+                [this, &batch_ready] () {
+                    return !m_running || batch_ready();
                 }
             );
+            m_speed[gnum].idle--;
 
             if (!m_forward_queue.empty()) {
                 if (timeout && m_single_eval_in_progress.exchange(true) == false) {
@@ -401,13 +571,22 @@ void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
             return;
         }
 
-#ifndef NDEBUG
+        auto& stats = *m_stats[gnum];
         if (count == 1) {
-            batch_stats.single_evals++;
+            stats.single_evals++;
         } else {
-            batch_stats.batch_evals++;
+            stats.batch_evals++;
         }
-#endif
+        stats.evals += count;
+
+        const auto start = std::chrono::steady_clock::now();
+        auto queue_wait_us = std::uint64_t{0};
+        for (auto& x : inputs) {
+            queue_wait_us += std::chrono::duration_cast<std::chrono::microseconds>(
+                start - x->queued).count();
+        }
+        stats.queue_wait_us += queue_wait_us;
+        adjust_waittime(count, queue_wait_us / 1000.0f / count);
 
         // prepare input for forward() call
         batch_input.resize(in_size * count);
@@ -416,7 +595,6 @@ void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
 
         auto index = size_t{0};
         for (auto& x : inputs) {
-            std::unique_lock<std::mutex> lk(x->mutex);
             std::copy(begin(x->in), end(x->in), begin(batch_input) + in_size * index);
             index++;
         }
@@ -424,6 +602,10 @@ void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
         // run the NN evaluation
         m_networks[gnum]->forward(
             batch_input, batch_output_pol, batch_output_val, context, count);
+        const auto busy_us = std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        stats.busy_us += busy_us;
+        update_speed(gnum, count, busy_us);
 
         // Get output and copy back
         index = 0;
@@ -434,7 +616,7 @@ void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
             std::copy(begin(batch_output_val) + out_val_size * index,
                       begin(batch_output_val) + out_val_size * (index + 1),
                       begin(x->out_va));
-            x->cv.notify_all();
+            x->done.set_value();
             index++;
         }
 
@@ -444,6 +626,123 @@ void OpenCLScheduler<net_t>::batch_worker(const size_t gnum) {
     }
 }
 
+template <typename net_t>
+void OpenCLScheduler<net_t>::adjust_waittime(const size_t count,
+                                             const float queue_wait_ms) {
+    if (cfg_batch_latency <= 0) {
+        return;
+    }
+    std::unique_lock<std::mutex> lk(m_mutex);
+    constexpr auto decay = 0.9f;
+    m_avg_queue_wait = decay * m_avg_queue_wait + (1.0f - decay) * queue_wait_ms;
+    if (m_avg_queue_wait > cfg_batch_latency) {
+        m_waittime--;
+    } else if (count < cfg_batch_size) {
+        m_waittime++;
+    }
+    m_waittime = std::max(1, std::min(m_waittime, cfg_batch_latency));
+}
+
+// Scale the batch size of every GPU with its speed relative to the
+// fastest one, so that their batches take about the same time. The
+// time of a full batch is extrapolated linearly from the batch just
+// run: this overestimates small batches because of the fixed cost of
+// a forward pass, but the batch size still settles where the batch
+// time matches that of the fastest GPU.
+template <typename net_t>
+void OpenCLScheduler<net_t>::update_speed(const size_t gnum,
+                                          const size_t count,
+                                          const std::uint64_t busy_us) {
+    if (m_speed.size() < 2) {
+        return;
+    }
+    std::unique_lock<std::mutex> lk(m_mutex);
+    constexpr auto decay = 0.9f;
+    const auto full_batch_ms = busy_us / 1000.0f * cfg_batch_size / count;
+    auto& speed = m_speed[gnum];
+    speed.full_batch_ms = speed.full_batch_ms > 0.0f ?
+        decay * speed.full_batch_ms + (1.0f - decay) * full_batch_ms :
+        full_batch_ms;
+
+    auto fastest_ms = speed.full_batch_ms;
+    for (const auto& other : m_speed) {
+        if (other.full_batch_ms > 0.0f) {
+            fastest_ms = std::min(fastest_ms, other.full_batch_ms);
+        }
+    }
+    for (auto& other : m_speed) {
+        if (other.full_batch_ms > 0.0f) {
+            const auto size = static_cast<size_t>(std::lround(
+                cfg_batch_size * fastest_ms / other.full_batch_ms));
+            other.batch_size = std::max(size_t{1},
+                                        std::min(size, size_t{cfg_batch_size}));
+        }
+    }
+}
+
+// True when a faster GPU has a worker waiting that could take
+// a batch from the count positions queued. Lock must be held.
+template <typename net_t>
+bool OpenCLScheduler<net_t>::leave_to_faster_gpu(const size_t gnum,
+                                                 const size_t count) const {
+    const auto& speed = m_speed[gnum];
+    for (auto other = size_t{0}; other < m_speed.size(); other++) {
+        const auto& faster = m_speed[other];
+        if (other != gnum && faster.idle > 0
+            && faster.full_batch_ms < speed.full_batch_ms
+            && count >= faster.batch_size) {
+            return true;
+        }
+    }
+    return false;
+}
+
+template <typename net_t>
+std::string OpenCLScheduler<net_t>::get_stats() {
+    auto out = std::ostringstream{};
+    {
+        std::unique_lock<std::mutex> lk(m_mutex);
+        out << "batch size " << cfg_batch_size
+            << ", wait time " << m_waittime << " ms";
+        if (cfg_batch_latency > 0) {
+            out << " (budget " << cfg_batch_latency << " ms)";
+        }
+        out << "\n";
+    }
+    out << std::fixed << std::setprecision(2);
+    for (auto gnum = size_t{0}; gnum < m_stats.size(); gnum++) {
+        const auto& stats = *m_stats[gnum];
+        const auto batches = stats.single_evals.load() + stats.batch_evals.load();
+        const auto evals = stats.evals.load();
+        const auto busy_s = stats.busy_us.load() / 1e6;
+        out << "GPU " << gnum << ": ";
+        if (m_speed.size() > 1) {
+            std::unique_lock<std::mutex> lk(m_mutex);
+            out << "batch size " << m_speed[gnum].batch_size << ", ";
+        }
+        out << batches << " batches, "
+            << stats.single_evals.load() << " single, "
+            << "avg fill " << (batches ? float(evals) / batches : 0.0f)
+            << ", avg queue wait "
+            << (evals ? stats.queue_wait_us.load() / 1000.0 / evals : 0.0) << " ms, "
+            << std::setprecision(0)
+            << (busy_s > 0 ? evals / busy_s : 0.0) << " evals/s busy\n"
+            << std::setprecision(2);
+    }
+    return out.str();
+}
+
+template <typename net_t>
+ForwardPipe::BatchCounters OpenCLScheduler<net_t>::get_batch_counters() {
+    auto counters = BatchCounters{};
+    for (const auto& stats : m_stats) {
+        counters.batches += stats->single_evals.load() + stats->batch_evals.load();
+    }
+    std::unique_lock<std::mutex> lk(m_mutex);
+    counters.queued = m_forward_queue.size();
+    return counters;
+}
+
 template <typename net_t>
 void OpenCLScheduler<net_t>::drain() {
     // When signaled to drain requests, this method picks up all pending requests and
@@ -460,11 +759,7 @@ void OpenCLScheduler<net_t>::drain() {
     }
 
     for (auto& x : fq) {
-        {
-            // dummy lock/unlock to make sure thread in forward() is sleeping
-            std::unique_lock<std::mutex> lk(x->mutex);
-        }
-        x->cv.notify_all();
+        x->done.set_exception(std::make_exception_ptr(NetworkHaltException()));
     }
 }
 
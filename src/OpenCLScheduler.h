@@ -32,7 +32,11 @@
 #define OPENCLSCHEDULER_H_INCLUDED
 #include "config.h"
 
+#include <chrono>
+#include <cstdint>
+#include <future>
 #include <list>
+#include <string>
 #include <vector>
 #include <thread>
 
@@ -41,24 +45,29 @@
 #include "OpenCL.h"
 #include "ThreadPool.h"
 
-#ifndef NDEBUG
+// Per-GPU batching statistics, see get_stats().
 struct batch_stats_t {
     std::atomic<size_t> single_evals{0};
     std::atomic<size_t> batch_evals{0};
+    // Positions evaluated.
+    std::atomic<size_t> evals{0};
+    // Time positions spent queued, summed over positions.
+    std::atomic<std::uint64_t> queue_wait_us{0};
+    // Time spent in OpenCL_Network::forward().
+    std::atomic<std::uint64_t> busy_us{0};
 };
-extern batch_stats_t batch_stats;
-#endif
 
 template <typename net_t>
 class OpenCLScheduler : public ForwardPipe {
     class ForwardQueueEntry {
     public:
-        std::mutex mutex;
-        std::condition_variable cv;
         const std::vector<float>& in;
         std::vector<float>& out_p;
         std::vector<float>& out_va;
         //        std::vector<float>& out_vb;
+        // Fulfilled once the outputs are filled, or failed on drain.
+        std::promise<void> done;
+        std::chrono::steady_clock::time_point queued{std::chrono::steady_clock::now()};
         ForwardQueueEntry(const std::vector<float>& input,
                           std::vector<float>& output_pol,
                           std::vector<float>& output_val)
@@ -73,7 +82,19 @@ public:
     virtual void forward(const std::vector<float>& input,
                          std::vector<float>& output_pol,
                          std::vector<float>& output_val);
+    virtual std::future<void> forward_async(const std::vector<float>& input,
+                                            std::vector<float>& output_pol,
+                                            std::vector<float>& output_val);
+    virtual void forward_batch(const std::vector<float>& input,
+                               std::vector<float>& output_pol,
+                               std::vector<float>& output_val,
+                               const size_t batch_size);
     virtual bool needs_autodetect();
+    // Names and driver versions of the devices, comma separated.
+    std::string get_device_names();
+    std::string get_driver_versions();
+    virtual std::string get_stats();
+    virtual BatchCounters get_batch_counters();
     virtual void push_weights(unsigned int filter_size,
                               unsigned int channels,
                               unsigned int outputs,
@@ -90,6 +111,23 @@ private:
     // start with 10 milliseconds : lock protected
     int m_waittime{10};
 
+    // Moving average of the queue wait per batch in milliseconds,
+    // used to keep m_waittime within cfg_batch_latency : lock protected
+    float m_avg_queue_wait{0.0f};
+
+    std::vector<std::unique_ptr<batch_stats_t>> m_stats;
+
+    // Per-GPU speed and batch size, so that on mixed hosts every GPU
+    // takes a batch that completes in about the same time : lock protected
+    struct device_speed_t {
+        // Moving average of the time a full batch would take.
+        float full_batch_ms{0.0f};
+        size_t batch_size{1};
+        // Workers of this GPU waiting for a batch.
+        int idle{0};
+    };
+    std::vector<device_speed_t> m_speed;
+
     // set to true when single (non-batch) eval is in progress
     std::atomic<bool> m_single_eval_in_progress{false};
 
@@ -97,6 +135,10 @@ private:
     std::list<std::thread> m_worker_threads;
 
     void batch_worker(const size_t gnum);
+    void adjust_waittime(const size_t count, const float queue_wait_ms);
+    void update_speed(const size_t gnum, const size_t count,
+                      const std::uint64_t busy_us);
+    bool leave_to_faster_gpu(const size_t gnum, const size_t count) const;
     void push_input_convolution(unsigned int filter_size,
                                 unsigned int channels,
                                 unsigned int outputs,
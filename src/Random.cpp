@@ -43,6 +43,10 @@ Random& Random::get_Rng() {
     return s_rng;
 }
 
+void Random::seed_thread(const std::uint64_t stream) {
+    get_Rng().seedrandom(cfg_rng_seed ^ (0x9e3779b97f4a7c15ULL * (stream + 1)));
+}
+
 Random::Random(std::uint64_t seed) {
     if (seed == 0) {
         size_t thread_id =
@@ -62,6 +62,10 @@ public:
 
     // return the thread local RNG
     static Random& get_Rng();
+    // Reseed the RNG of the calling thread from cfg_rng_seed and stream,
+    // instead of the thread id, so that the same work on any thread
+    // draws the same numbers.
+    static void seed_thread(std::uint64_t stream);
 
     // UniformRandomBitGenerator interface
     using result_type = std::uint64_t;
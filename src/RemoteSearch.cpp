@@ -0,0 +1,507 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#include "config.h"
+#include "RemoteSearch.h"
+
+#include <algorithm>
+#include <sstream>
+
+#ifndef _WIN32
+#include <csignal>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+#endif
+
+#include "FastBoard.h"
+#include "GameState.h"
+#include "UCTNode.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+
+using namespace Utils;
+
+// The workers send their root statistics every 100 ms, the interval of
+// lz-genmove_analyze is in centiseconds. think() merges what has come
+// at each pass of its loop, every 10 ms.
+static constexpr auto ANALYZE_INTERVAL_CENTIS = 10;
+
+// An info line has every searched root child with its variation.
+static constexpr auto MAX_LINE_LENGTH = size_t{1024 * 1024};
+
+// A worker that does not answer for a minute more than its search
+// should take is given up.
+static constexpr auto TIMEOUT_SECONDS = 60;
+
+#ifndef _WIN32
+// Wait for the first line of the response to a command, true if it
+// succeeded.
+static bool read_status(FILE* in, std::string& status) {
+    do {
+        if (!read_line(in, status, MAX_LINE_LENGTH)) {
+            status.clear();
+            return false;
+        }
+    } while (status.empty() || (status[0] != '=' && status[0] != '?'));
+    return status[0] == '=';
+}
+
+// The whole response to a command, true if it succeeded.
+static bool read_response(FILE* in, std::string& response) {
+    const auto ok = read_status(in, response);
+    auto line = std::string{};
+    while (read_line(in, line, MAX_LINE_LENGTH) && !line.empty()) {}
+    return ok;
+}
+
+static void set_timeout(const int fd, const int seconds) {
+    timeval tv{};
+    tv.tv_sec = seconds;
+    setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+}
+#endif
+
+RemoteSearch::RemoteSearch(const std::vector<std::string>& addresses,
+                           const std::uint64_t network_hash)
+    : m_network_hash(network_hash) {
+#ifndef _WIN32
+    // A worker going away must not kill the coordinator.
+    signal(SIGPIPE, SIG_IGN);
+#endif
+    for (const auto& address : addresses) {
+        m_workers.emplace_back(std::make_unique<Worker>());
+        m_workers.back()->address = address;
+    }
+}
+
+RemoteSearch::~RemoteSearch() {
+    stop();
+    finish();
+    for (auto& worker : m_workers) {
+        disconnect(*worker);
+    }
+}
+
+bool RemoteSearch::connect(Worker& worker) {
+#ifndef _WIN32
+    if (worker.fd >= 0) {
+        return true;
+    }
+    if (worker.refused) {
+        return false;
+    }
+    const auto colon = worker.address.rfind(':');
+    if (colon == std::string::npos) {
+        myprintf_error("Remote worker %s is not host:port.\n",
+                       worker.address.c_str());
+        return false;
+    }
+    const auto host = worker.address.substr(0, colon);
+    const auto port = worker.address.substr(colon + 1);
+    addrinfo hints{};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* addresses = nullptr;
+    if (getaddrinfo(host.c_str(), port.c_str(), &hints, &addresses) != 0) {
+        myprintf_error("Cannot resolve remote worker %s.\n",
+                       worker.address.c_str());
+        return false;
+    }
+    auto connected = -1;
+    for (auto a = addresses; a; a = a->ai_next) {
+        const auto fd = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+        if (fd < 0) {
+            continue;
+        }
+        if (::connect(fd, a->ai_addr, a->ai_addrlen) == 0) {
+            connected = fd;
+            break;
+        }
+        close(fd);
+    }
+    freeaddrinfo(addresses);
+    if (connected < 0) {
+        myprintf_error("Cannot connect to remote worker %s.\n",
+                       worker.address.c_str());
+        return false;
+    }
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.fd = connected;
+        worker.in = fdopen(worker.fd, "r");
+        worker.out = fdopen(dup(worker.fd), "w");
+    }
+    set_timeout(worker.fd, TIMEOUT_SECONDS);
+
+    // The statistics of another network do not add up with the local
+    // ones.
+    char hash[17];
+    snprintf(hash, sizeof(hash), "%016llx",
+             static_cast<unsigned long long>(m_network_hash));
+    auto response = std::string{};
+    if (send(worker, "sai-network_hash")) {
+        read_response(worker.in, response);
+    }
+    if (response.empty()) {
+        myprintf_error("Lost remote worker %s.\n", worker.address.c_str());
+        disconnect(worker);
+        return false;
+    }
+    if (response != std::string("= ") + hash) {
+        myprintf_error("Remote worker %s does not have the network of "
+                       "this search, not using it.\n",
+                       worker.address.c_str());
+        worker.refused = true;
+        disconnect(worker);
+        return false;
+    }
+    myprintf("Connected to remote worker %s.\n", worker.address.c_str());
+    return true;
+#else
+    (void)worker;
+    return false;
+#endif
+}
+
+void RemoteSearch::disconnect(Worker& worker) {
+#ifndef _WIN32
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.fd < 0) {
+        return;
+    }
+    if (worker.out) {
+        fprintf(worker.out, "quit\n");
+        fclose(worker.out);
+    }
+    fclose(worker.in);
+    worker.in = worker.out = nullptr;
+    worker.fd = -1;
+#else
+    (void)worker;
+#endif
+}
+
+bool RemoteSearch::send(Worker& worker, const std::string& command) {
+#ifndef _WIN32
+    return fprintf(worker.out, "%s\n", command.c_str()) > 0
+        && fflush(worker.out) == 0;
+#else
+    (void)worker;
+    (void)command;
+    return false;
+#endif
+}
+
+std::vector<std::string> RemoteSearch::replay(const GameState& state) {
+    // The workers replay the game: the stones of the start position, and
+    // the ones set_free_handicap played as moves, are the free handicap
+    // and the rest are moves of the color of their stone.
+    const auto movenum = static_cast<int>(state.get_movenum());
+    const auto root = state.get_past_state(movenum);
+    auto handicap = std::string{};
+    auto stones = 0;
+    for (auto y = 0; y < root->board.get_boardsize(); y++) {
+        for (auto x = 0; x < root->board.get_boardsize(); x++) {
+            const auto vertex = root->board.get_vertex(x, y);
+            const auto stone = root->board.get_state(vertex);
+            if (stone == FastBoard::WHITE) {
+                myprintf("The position has white stones that remote "
+                         "workers cannot be given, searching locally.\n");
+                return {};
+            }
+            if (stone == FastBoard::BLACK) {
+                handicap += " " + root->board.move_to_text(vertex);
+                stones++;
+            }
+        }
+    }
+    auto moves = std::vector<std::string>{};
+    for (auto i = 1; i <= movenum; i++) {
+        const auto past = state.get_past_state(movenum - i);
+        const auto move = past->get_last_move();
+        const auto mover = move == FastBoard::PASS
+            ? !past->board.get_to_move()
+            : static_cast<int>(past->board.get_state(move));
+        if (stones < state.get_handicap() && moves.empty()
+            && mover == FastBoard::BLACK && move != FastBoard::PASS) {
+            handicap += " " + past->board.move_to_text(move);
+            stones++;
+            continue;
+        }
+        moves.emplace_back(std::string("play ")
+                           + (mover == FastBoard::BLACK ? "b " : "w ")
+                           + past->board.move_to_text(move));
+    }
+
+    auto commands = std::vector<std::string>{
+        "boardsize " + std::to_string(BOARD_SIZE),
+        "clear_board"
+    };
+    if (stones > 0) {
+        commands.emplace_back("set_free_handicap" + handicap);
+    }
+    commands.insert(end(commands), begin(moves), end(moves));
+    auto komi = std::ostringstream{};
+    komi << "komi " << state.get_komi();
+    commands.emplace_back(komi.str());
+    commands.emplace_back("lz-setoption name pondering value false");
+    return commands;
+}
+
+void RemoteSearch::start(const GameState& state, const int color,
+                         const int centis, const int playouts,
+                         const int visits) {
+    finish();
+    auto commands = replay(state);
+    if (commands.empty()) {
+        return;
+    }
+
+    // Each worker is asked for its share of the limits, as if all the
+    // hosts were as fast. The local limits still stop the whole search.
+    const auto share = [this](const int limit) {
+        if (limit >= UCTSearch::UNLIMITED_PLAYOUTS) {
+            return 0;
+        }
+        const auto hosts = static_cast<int>(m_workers.size()) + 1;
+        return std::max(1, (limit + hosts - 1) / hosts);
+    };
+    commands.emplace_back("lz-setoption name playouts value "
+                          + std::to_string(share(playouts)));
+    commands.emplace_back("lz-setoption name visits value "
+                          + std::to_string(share(visits)));
+    commands.emplace_back("time_settings 0 "
+                          + std::to_string(std::max(1, (centis + 99) / 100))
+                          + " 1");
+    commands.emplace_back(std::string("lz-genmove_analyze ")
+                          + (color == FastBoard::BLACK ? "b " : "w ")
+                          + std::to_string(ANALYZE_INTERVAL_CENTIS));
+    launch(commands, centis / 100 + TIMEOUT_SECONDS);
+}
+
+void RemoteSearch::start_analysis(const GameState& state) {
+    finish();
+    auto commands = replay(state);
+    if (commands.empty()) {
+        return;
+    }
+    commands.emplace_back("lz-setoption name playouts value 0");
+    commands.emplace_back("lz-setoption name visits value 0");
+    commands.emplace_back(std::string("lz-analyze ")
+                          + (state.board.get_to_move() == FastBoard::BLACK
+                             ? "b " : "w ")
+                          + std::to_string(ANALYZE_INTERVAL_CENTIS));
+    launch(commands, TIMEOUT_SECONDS);
+}
+
+void RemoteSearch::launch(const std::vector<std::string>& commands,
+                          const int timeout) {
+    for (auto& worker : m_workers) {
+        {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->reported.clear();
+            worker->merged.clear();
+            worker->searching = true;
+            worker->stopped = false;
+        }
+        auto& w = *worker;
+        worker->thread = std::thread([this, &w, commands, timeout]() {
+            search(w, commands, timeout);
+            auto stopped = false;
+            {
+                std::lock_guard<std::mutex> lock(w.mutex);
+                w.searching = false;
+                stopped = w.stopped;
+            }
+            // stop() may have closed the connection under any command.
+            if (stopped) {
+                disconnect(w);
+            }
+        });
+    }
+}
+
+void RemoteSearch::search(Worker& worker,
+                          const std::vector<std::string>& commands,
+                          const int timeout) {
+#ifndef _WIN32
+    // After stop(), the connection can be closed under any command.
+    const auto stopped = [&worker]() {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        return worker.stopped;
+    };
+    if (stopped() || !connect(worker)) {
+        return;
+    }
+    set_timeout(worker.fd, timeout);
+
+    auto response = std::string{};
+    for (auto i = size_t{0}; i + 1 < commands.size(); i++) {
+        if (stopped()) {
+            return;
+        }
+        response.clear();
+        if (!send(worker, commands[i])
+            || !read_response(worker.in, response)) {
+            if (!stopped()) {
+                myprintf_error("Remote worker %s failed on %s: %s\n",
+                               worker.address.c_str(), commands[i].c_str(),
+                               response.c_str());
+            }
+            // A lost connection or a position out of sync are not
+            // recovered on this connection.
+            disconnect(worker);
+            return;
+        }
+    }
+    if (stopped()) {
+        return;
+    }
+
+    // lz-genmove_analyze and lz-analyze answer with lines of info, then
+    // the move of lz-genmove_analyze and an empty line.
+    auto line = std::string{};
+    auto ok = send(worker, commands.back())
+        && read_status(worker.in, response);
+    while (ok && (ok = read_line(worker.in, line, MAX_LINE_LENGTH))
+           && !line.empty()) {
+        if (line.find("info ") == 0) {
+            report(worker, line);
+        }
+    }
+    if (!ok) {
+        if (!stopped()) {
+            myprintf_error("Remote worker %s did not complete the search.\n",
+                           worker.address.c_str());
+        }
+        disconnect(worker);
+    }
+#else
+    (void)worker;
+    (void)commands;
+    (void)timeout;
+#endif
+}
+
+RemoteSearch::Report RemoteSearch::parse_info(const std::string& line) {
+    // info move X visits N winrate W ... pv X ... info move Y ...
+    auto is = std::istringstream{line};
+    auto token = std::string{};
+    auto move = std::string{};
+    auto stats = MoveStats{};
+    auto reported = Report{};
+    while (is >> token) {
+        if (token == "move") {
+            is >> move;
+            stats = MoveStats{};
+        } else if (token == "visits") {
+            is >> stats.visits;
+        } else if (token == "winrate") {
+            is >> stats.winrate;
+            stats.winrate /= 10000.0f;
+            if (!move.empty()) {
+                reported[move] = stats;
+            }
+        }
+    }
+    return reported;
+}
+
+void RemoteSearch::report(Worker& worker, const std::string& line) {
+    const auto reported = parse_info(line);
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    for (const auto& entry : reported) {
+        worker.reported[entry.first] = entry.second;
+    }
+}
+
+int RemoteSearch::merge(FastState& state, UCTNode& root) {
+    const auto color = state.board.get_to_move();
+    const auto blackeval = [color](const MoveStats& stats) {
+        return color == FastBoard::BLACK ?
+            stats.winrate : 1.0f - stats.winrate;
+    };
+    auto visits = 0;
+    auto blackevals = 0.0;
+    for (const auto& child : root.get_children()) {
+        // The replies left out of pondering stay out.
+        if (!child.active()) {
+            continue;
+        }
+        const auto text = state.move_to_text(child.get_move());
+        for (auto& worker : m_workers) {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            const auto reported = worker->reported.find(text);
+            if (reported == end(worker->reported)) {
+                continue;
+            }
+            auto& merged = worker->merged[text];
+            const auto new_visits = reported->second.visits - merged.visits;
+            if (new_visits <= 0) {
+                continue;
+            }
+            const auto new_blackevals =
+                double(reported->second.visits) * blackeval(reported->second)
+                - double(merged.visits) * blackeval(merged);
+            child.inflate();
+            child->add_visits(new_visits, new_blackevals);
+            merged = reported->second;
+            visits += new_visits;
+            blackevals += new_blackevals;
+        }
+    }
+    if (visits > 0) {
+        root.add_visits(visits, blackevals);
+    }
+    return visits;
+}
+
+void RemoteSearch::stop() {
+#ifndef _WIN32
+    for (auto& worker : m_workers) {
+        std::lock_guard<std::mutex> lock(worker->mutex);
+        if (worker->searching) {
+            worker->stopped = true;
+            if (worker->fd >= 0) {
+                shutdown(worker->fd, SHUT_RDWR);
+            }
+        }
+    }
+#endif
+}
+
+void RemoteSearch::finish() {
+    for (auto& worker : m_workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+}
@@ -0,0 +1,130 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+#ifndef REMOTESEARCH_H_INCLUDED
+#define REMOTESEARCH_H_INCLUDED
+
+#include "config.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+class GameState;
+class FastState;
+class UCTNode;
+
+// Root parallel search on other hosts, for --remote: each address is a
+// sai --server, which gets the position of the root and searches it with
+// lz-genmove_analyze, or lz-analyze when pondering, while the local
+// threads search it too. The visits and the winrates of the root
+// children in its info lines are added to the local root children, as
+// if the local search had made them, so the local threads spread to the
+// other moves and get_best_move() and output_analysis() see the sum of
+// all the searches.
+//
+// Only the visits and the winrates travel: the score quantiles, the eval
+// variance (and so the LCB) and the subtrees stay those of the local
+// search. A worker with another network is not used, and on other hosts
+// the workers need a --server-address other than loopback.
+class RemoteSearch {
+    friend class LeelaTest;
+
+public:
+    RemoteSearch(const std::vector<std::string>& addresses,
+                 std::uint64_t network_hash);
+    ~RemoteSearch();
+
+    // Send the position of state to the workers and start their search
+    // for color, with at most centis of time each and the share of
+    // playouts and visits of the limits (UNLIMITED_PLAYOUTS for none)
+    // that comes to each of them.
+    void start(const GameState& state, int color, int centis,
+               int playouts, int visits);
+    // Same, for an analysis of the side to move without limits, which
+    // goes on until stop().
+    void start_analysis(const GameState& state);
+    // Add to the children of root the statistics the workers sent since
+    // the last call. Returns the number of visits added.
+    int merge(FastState& state, UCTNode& root);
+    // Make the workers that are still searching give up: their
+    // connection is closed, which ends the search of their session.
+    void stop();
+    // Wait for the workers to end their search.
+    void finish();
+
+private:
+    // Root child statistics as a worker reports them, the winrate for
+    // the side to move.
+    struct MoveStats {
+        int visits{0};
+        float winrate{0.0f};
+    };
+    using Report = std::unordered_map<std::string, MoveStats>;
+
+    struct Worker {
+        std::string address;
+        int fd{-1};
+        FILE* in{nullptr};
+        FILE* out{nullptr};
+        std::thread thread;
+        // Guards the reports, and the connection against stop().
+        std::mutex mutex;
+        bool searching{false};
+        bool stopped{false};
+        // Its network is not the one of the local search.
+        bool refused{false};
+        // Last reported by the worker and already added to the root.
+        Report reported;
+        Report merged;
+    };
+
+    // The statistics of the root children in an info line.
+    static Report parse_info(const std::string& line);
+    // The commands that set up the game of state on a worker, empty if
+    // it cannot be set up.
+    static std::vector<std::string> replay(const GameState& state);
+    void launch(const std::vector<std::string>& commands, int timeout);
+    void report(Worker& worker, const std::string& line);
+    bool connect(Worker& worker);
+    void disconnect(Worker& worker);
+    bool send(Worker& worker, const std::string& command);
+    void search(Worker& worker, const std::vector<std::string>& commands,
+                int timeout);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::uint64_t m_network_hash;
+};
+
+#endif
@@ -31,13 +31,99 @@
 
 #include <cassert>
 #include <cctype>
+#include <cstring>
 #include <fstream>
+#include <iterator>
 #include <stdexcept>
 #include <string>
-
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "GTP.h"
 #include "SGFTree.h"
 #include "Utils.h"
 
+SGFFile::SGFFile(const std::string& filename) {
+#ifndef _WIN32
+    auto fd = ::open(filename.c_str(), O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) ::close(fd);
+        throw std::runtime_error("Error opening file");
+    }
+    m_size = size_t(st.st_size);
+    if (m_size > 0) {
+        auto mapping = mmap(nullptr, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping != MAP_FAILED) {
+            m_mapping = mapping;
+            m_data = static_cast<const char*>(mapping);
+        }
+    }
+    ::close(fd);
+    if (m_mapping) {
+        return;
+    }
+#endif
+    std::ifstream ins(filename.c_str(), std::ifstream::binary | std::ifstream::in);
+    if (ins.fail()) {
+        throw std::runtime_error("Error opening file");
+    }
+    m_buffer.assign(std::istreambuf_iterator<char>(ins),
+                    std::istreambuf_iterator<char>());
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+}
+
+SGFFile::~SGFFile() {
+#ifndef _WIN32
+    if (m_mapping) {
+        munmap(m_mapping, m_size);
+    }
+#endif
+}
+
+std::vector<int> SGFMainline::get_mainline() const {
+    auto result = std::vector<int>{};
+    result.reserve(moves.size());
+    for (const auto& move : moves) {
+        result.push_back(move.second);
+    }
+    return result;
+}
+
+GameState SGFMainline::follow_mainline_state() const {
+    // The setup stones are part of the root state, as in SGFTree.
+    KoState root;
+    root.init_game(boardsize, komi);
+    root.set_handicap(handicap);
+    for (const auto color : {FastBoard::BLACK, FastBoard::WHITE}) {
+        const auto& stones =
+            color == FastBoard::BLACK ? black_stones : white_stones;
+        for (const auto vertex : stones) {
+            if (root.board.get_state(vertex) == FastBoard::EMPTY) {
+                root.play_move(color, vertex);
+            }
+        }
+    }
+    if (to_move != FastBoard::INVAL) {
+        root.set_to_move(to_move);
+    }
+
+    GameState result(&root);
+    for (const auto& move : moves) {
+        if (move.second != FastBoard::PASS
+            && result.board.get_state(move.second) != FastBoard::EMPTY) {
+            break;
+        }
+        result.play_move(move.first, move.second);
+    }
+    return result;
+}
+
 std::vector<std::string> SGFParser::chop_stream(std::istream& ins,
                                                 size_t stopat) {
     std::vector<std::string> result;
@@ -233,3 +319,196 @@ void SGFParser::parse(std::istringstream & strm, SGFTree * node) {
         }
     }
 }
+
+std::vector<SGFParser::GameView> SGFParser::chop_view(const char* data,
+                                                     size_t size,
+                                                     size_t stopat) {
+    std::vector<GameView> result;
+    const auto end = data + size;
+
+    int nesting = 0;      // parentheses
+    bool intag = false;   // brackets
+    auto game = data;
+
+    for (auto pos = data; pos < end && result.size() <= stopat; pos++) {
+        auto c = *pos;
+        if (c == '\\') {
+            // Skip the literal char
+            pos++;
+            continue;
+        }
+
+        if (c == '(' && !intag) {
+            if (nesting == 0) {
+                // eat ; too
+                do {
+                    pos++;
+                } while (pos < end && std::isspace(static_cast<unsigned char>(*pos))
+                         && *pos != ';');
+                game = pos + 1;
+            }
+            nesting++;
+        } else if (c == ')' && !intag) {
+            nesting--;
+
+            if (nesting == 0) {
+                result.emplace_back(game, pos + 1);
+            }
+        } else if (c == '[' && !intag) {
+            intag = true;
+        } else if (c == ']') {
+            intag = false;
+        }
+    }
+
+    // No game found? Assume closing tag was missing (OGS)
+    if (result.size() == 0) {
+        result.emplace_back(std::min(game, end), end);
+    }
+
+    return result;
+}
+
+static bool parse_sgf_vertex(const KoState& state, const char* begin,
+                             const char* end, int& vertex) {
+    const auto length = end - begin;
+    const auto bsize = state.board.get_boardsize();
+    if (length == 0 || (bsize <= 19 && length == 2
+                        && begin[0] == 't' && begin[1] == 't')) {
+        vertex = FastBoard::PASS;
+        return true;
+    }
+    if (length < 2) {
+        return false;
+    }
+    auto coord = [](char c) {
+        return (c >= 'A' && c <= 'Z') ? 26 + c - 'A' : c - 'a';
+    };
+    const auto x = coord(begin[0]);
+    const auto y = bsize - coord(begin[1]) - 1;
+    if (x < 0 || x >= bsize || y < 0 || y >= bsize) {
+        return false;
+    }
+    vertex = state.board.get_vertex(x, y);
+    return true;
+}
+
+bool SGFParser::parse_mainline(GameView game, SGFMainline& mainline) {
+    mainline = SGFMainline{};
+    mainline.komi = cfg_komi;
+
+    // The values are converted at the end, once the board size is known.
+    struct Value {
+        char name;
+        const char* begin;
+        const char* end;
+    };
+    auto values = std::vector<Value>{};
+    auto random_result = false;
+    auto has_moves = false;
+    auto nodes = 0;
+
+    auto pos = game.first;
+    const auto end = game.second;
+    while (pos < end) {
+        const auto c = *pos;
+        if (c == ';') {
+            nodes++;
+            pos++;
+        } else if (c == ')') {
+            // The first variation is over and so is the mainline.
+            break;
+        } else if (std::isupper(static_cast<unsigned char>(c))) {
+            const auto name_begin = pos;
+            while (pos < end && std::isalpha(static_cast<unsigned char>(*pos))) {
+                pos++;
+            }
+            const auto name = std::string(name_begin, pos);
+            while (true) {
+                while (pos < end && std::isspace(static_cast<unsigned char>(*pos))) {
+                    pos++;
+                }
+                if (pos == end || *pos != '[') {
+                    break;
+                }
+                const auto value_begin = ++pos;
+                while (pos < end && *pos != ']') {
+                    pos += (*pos == '\\') ? 2 : 1;
+                }
+                const auto value_end = std::min(pos, end);
+                pos++;
+
+                const auto value = [&]() {
+                    return std::string(value_begin, value_end);
+                };
+                if (nodes == 0) {
+                    // Properties of the root node
+                    if (name == "GM" && value() != "1") {
+                        return false;
+                    } else if (name == "SZ") {
+                        mainline.boardsize = std::stoi(value());
+                    } else if (name == "KM") {
+                        mainline.komi = std::stof(value());
+                    } else if (name == "HA") {
+                        mainline.handicap = int(std::stof(value()));
+                    } else if (name == "RE") {
+                        const auto result = value();
+                        if (result.find("Time") != std::string::npos) {
+                            random_result = true;
+                        } else if (result.compare(0, 2, "W+") == 0) {
+                            mainline.winner = FastBoard::WHITE;
+                        } else if (result.compare(0, 2, "B+") == 0) {
+                            mainline.winner = FastBoard::BLACK;
+                        } else if (result.compare(0, 1, "0") == 0) {
+                            mainline.winner = FastBoard::EMPTY;
+                        }
+                    } else if (name == "PL") {
+                        mainline.to_move = (value() == "W") ?
+                            FastBoard::WHITE : FastBoard::BLACK;
+                    }
+                }
+                if (name == "B" || name == "W") {
+                    values.push_back({name[0], value_begin, value_end});
+                    has_moves = true;
+                } else if ((name == "AB" || name == "AW") && !has_moves) {
+                    // Setup stones, sometimes wrongly put in the first
+                    // node after the root.
+                    values.push_back({char(std::tolower(name[1])),
+                                      value_begin, value_end});
+                }
+            }
+        } else {
+            pos++;
+        }
+    }
+    if (random_result) {
+        mainline.winner = FastBoard::INVAL;
+    }
+    if (mainline.boardsize != BOARD_SIZE) {
+        return false;
+    }
+
+    KoState board;
+    board.init_game(mainline.boardsize, mainline.komi);
+    for (const auto& value : values) {
+        auto vertex = 0;
+        if (!parse_sgf_vertex(board, value.begin, value.end, vertex)) {
+            return false;
+        }
+        switch (value.name) {
+        case 'B':
+            mainline.moves.emplace_back(FastBoard::BLACK, vertex);
+            break;
+        case 'W':
+            mainline.moves.emplace_back(FastBoard::WHITE, vertex);
+            break;
+        case 'b':
+            mainline.black_stones.push_back(vertex);
+            break;
+        case 'w':
+            mainline.white_stones.push_back(vertex);
+            break;
+        }
+    }
+    return true;
+}
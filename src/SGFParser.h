@@ -37,19 +37,67 @@
 #include <string>
 #include <vector>
 
+#include "GameState.h"
 #include "SGFTree.h"
 
+// The contents of a whole SGF file. The file is memory mapped where
+// possible, so that its games can be looked at without copying them.
+class SGFFile {
+public:
+    explicit SGFFile(const std::string& filename);
+    ~SGFFile();
+    SGFFile(const SGFFile&) = delete;
+    SGFFile& operator=(const SGFFile&) = delete;
+
+    const char* data() const { return m_data; }
+    size_t size() const { return m_size; }
+
+private:
+    const char* m_data{nullptr};
+    size_t m_size{0};
+    void* m_mapping{nullptr};
+    std::string m_buffer;
+};
+
+// What the mainline fast path reads from a game: enough to replay it,
+// without building a property tree or a state for every node.
+struct SGFMainline {
+    int boardsize{19};
+    float komi;
+    int handicap{0};
+    // Set by PL, otherwise the setup stones decide.
+    int to_move{FastBoard::INVAL};
+    FastBoard::vertex_t winner{FastBoard::INVAL};
+    std::vector<int> black_stones;
+    std::vector<int> white_stones;
+    // Colors and vertices of the moves.
+    std::vector<std::pair<int, int>> moves;
+
+    std::vector<int> get_mainline() const;
+    // Stops at the first move on an occupied intersection, like
+    // SGFTree::follow_mainline_state.
+    GameState follow_mainline_state() const;
+};
+
 class SGFParser {
 private:
     static std::string parse_property_name(std::istringstream & strm);
     static bool parse_property_value(std::istringstream & strm, std::string & result);
 public:
+    using GameView = std::pair<const char*, const char*>;
     static std::string chop_from_file(std::string fname, size_t index);
     static std::vector<std::string> chop_all(std::string fname,
                                              size_t stopat = SIZE_MAX);
     static std::vector<std::string> chop_stream(std::istream& ins,
                                                 size_t stopat = SIZE_MAX);
     static void parse(std::istringstream & strm, SGFTree * node);
+
+    // Same as chop_stream, but the games point into the data.
+    static std::vector<GameView> chop_view(const char* data, size_t size,
+                                           size_t stopat = SIZE_MAX);
+    // Reads the mainline of a game as chopped by chop_view or
+    // chop_stream. Returns false for games SGFTree would not load.
+    static bool parse_mainline(GameView game, SGFMainline& mainline);
 };
 
 
@@ -0,0 +1,124 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#include "config.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "SearchProfiler.h"
+
+std::atomic<bool> SearchProfiler::s_enabled{false};
+std::mutex SearchProfiler::s_registry_mutex;
+std::vector<std::shared_ptr<SearchProfiler::Counters>> SearchProfiler::s_registry;
+
+namespace {
+    thread_local SearchProfiler::Scope* s_current_scope = nullptr;
+
+    const char* const s_phase_names[SearchProfiler::NUM_PHASES] = {
+        "select", "play", "cache probe", "NN wait",
+        "expand", "backup", "wait expanded"
+    };
+}
+
+SearchProfiler::Counters& SearchProfiler::local_counters() {
+    thread_local auto counters = [] {
+        auto ptr = std::make_shared<Counters>();
+        std::lock_guard<std::mutex> lock(s_registry_mutex);
+        s_registry.push_back(ptr);
+        return ptr;
+    }();
+    return *counters;
+}
+
+void SearchProfiler::set_enabled(bool enabled) {
+    s_enabled.store(enabled, std::memory_order_relaxed);
+}
+
+void SearchProfiler::reset() {
+    std::lock_guard<std::mutex> lock(s_registry_mutex);
+    for (const auto& counters : s_registry) {
+        for (auto i = 0; i < NUM_PHASES; i++) {
+            counters->ns[i].store(0, std::memory_order_relaxed);
+            counters->count[i].store(0, std::memory_order_relaxed);
+        }
+    }
+}
+
+std::string SearchProfiler::report() {
+    auto ns = std::array<std::uint64_t, NUM_PHASES>{};
+    auto count = std::array<std::uint64_t, NUM_PHASES>{};
+    {
+        std::lock_guard<std::mutex> lock(s_registry_mutex);
+        for (const auto& counters : s_registry) {
+            for (auto i = 0; i < NUM_PHASES; i++) {
+                ns[i] += counters->ns[i].load(std::memory_order_relaxed);
+                count[i] += counters->count[i].load(std::memory_order_relaxed);
+            }
+        }
+    }
+    auto total = std::uint64_t{0};
+    for (const auto t : ns) {
+        total += t;
+    }
+
+    auto out = std::string{};
+    char line[128];
+    for (auto i = 0; i < NUM_PHASES; i++) {
+        std::snprintf(line, sizeof(line),
+                      "%-14s %10.1f ms %10llu calls %8.2f us/call %5.1f%%\n",
+                      s_phase_names[i], ns[i] / 1e6,
+                      static_cast<unsigned long long>(count[i]),
+                      count[i] ? ns[i] / 1e3 / count[i] : 0.0,
+                      total ? 100.0 * ns[i] / total : 0.0);
+        out += line;
+    }
+    return out;
+}
+
+void SearchProfiler::Scope::start() {
+    m_parent = s_current_scope;
+    s_current_scope = this;
+    m_start = std::chrono::steady_clock::now();
+}
+
+void SearchProfiler::Scope::finish() {
+    const auto elapsed = std::chrono::steady_clock::now() - m_start;
+    s_current_scope = m_parent;
+    if (m_parent) {
+        m_parent->m_nested += elapsed;
+    }
+    const auto own = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        elapsed - m_nested).count();
+    auto& counters = local_counters();
+    counters.ns[m_phase].fetch_add(std::max<std::int64_t>(own, 0),
+                                   std::memory_order_relaxed);
+    counters.count[m_phase].fetch_add(1, std::memory_order_relaxed);
+}
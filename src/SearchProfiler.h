@@ -0,0 +1,120 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#ifndef SEARCHPROFILER_H_INCLUDED
+#define SEARCHPROFILER_H_INCLUDED
+
+#include "config.h"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Time spent by the search threads in each phase of a playout.
+//
+// A Scope times the code until the end of its block, minus the time of
+// the scopes nested in it, so phases never overlap and add up to the
+// profiled time. Every thread accumulates in counters of its own, which
+// can be read while the search runs. When profiling is off a Scope only
+// tests a flag.
+class SearchProfiler {
+public:
+    enum Phase {
+        SELECT,         // uct_select_child()
+        PLAY,           // copying the root state and playing the moves
+        CACHE_PROBE,    // NN cache lookups
+        NN_WAIT,        // waiting for the network evaluation
+        EXPAND,         // create_children() and link_nodelist()
+        BACKUP,         // update() and update_all_quantiles()
+        WAIT_EXPANDED,  // spinning in wait_expanded()
+        NUM_PHASES
+    };
+
+    class Scope {
+    public:
+        explicit Scope(Phase phase)
+            : m_phase(phase), m_active(SearchProfiler::enabled()) {
+            if (m_active) {
+                start();
+            }
+        }
+        ~Scope() {
+            if (m_active) {
+                finish();
+            }
+        }
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+    private:
+        void start();
+        void finish();
+
+        Phase m_phase;
+        bool m_active;
+        Scope* m_parent{nullptr};
+        std::chrono::steady_clock::duration m_nested{0};
+        std::chrono::steady_clock::time_point m_start;
+    };
+
+    static bool enabled() {
+        return s_enabled.load(std::memory_order_relaxed);
+    }
+    static void set_enabled(bool enabled);
+
+    // Clear the counters of all threads.
+    static void reset();
+
+    // One line per phase with the total time, the number of times it
+    // was entered and its share of the profiled time.
+    static std::string report();
+
+private:
+    struct Counters {
+        std::array<std::atomic<std::uint64_t>, NUM_PHASES> ns{};
+        std::array<std::atomic<std::uint64_t>, NUM_PHASES> count{};
+    };
+
+    static Counters& local_counters();
+
+    static std::atomic<bool> s_enabled;
+
+    // The counters of every thread that ever profiled, kept after the
+    // thread exits so that its time is still reported.
+    static std::mutex s_registry_mutex;
+    static std::vector<std::shared_ptr<Counters>> s_registry;
+};
+
+#endif
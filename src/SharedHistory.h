@@ -0,0 +1,218 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+#ifndef SHAREDHISTORY_H_INCLUDED
+#define SHAREDHISTORY_H_INCLUDED
+
+#include "config.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <vector>
+
+#include "MemoryTracker.h"
+
+// Append-only sequence that is cheap to copy. The most recent elements
+// live in a fixed-capacity stack inside the object; when it fills up they
+// are moved to an immutable chunk that all the copies share. Copying one
+// therefore costs a shared_ptr and at most TAIL_SIZE elements, however
+// long the sequence is, and a copy can be played on and truncated
+// without disturbing the original.
+//
+// With FilterBits > 0 every chunk also keeps a Bloom filter of all the
+// elements up to its end, so contains() usually answers without walking
+// the chunks. A filter hit is confirmed by the exact scan.
+template <typename T, size_t FilterBits = 0>
+class SharedHistory {
+public:
+    static constexpr size_t TAIL_SIZE = 16;
+    static_assert(FilterBits == 0
+                  || (FilterBits % 64 == 0 && FilterBits <= (1 << 21)
+                      && (FilterBits & (FilterBits - 1)) == 0),
+                  "FilterBits must be a power of two from 64 to 2^21");
+
+    size_t size() const {
+        return m_chunked + m_tail_size;
+    }
+
+    bool empty() const {
+        return size() == 0;
+    }
+
+    const T& operator[](size_t idx) const {
+        assert(idx < size());
+        if (idx >= m_chunked) {
+            return m_tail[idx - m_chunked];
+        }
+        auto chunk = m_chunks.get();
+        while (idx < chunk->start) {
+            chunk = chunk->parent.get();
+        }
+        return chunk->items[idx - chunk->start];
+    }
+
+    const T& back() const {
+        return (*this)[size() - 1];
+    }
+
+    void push_back(const T& value) {
+        if (m_tail_size == TAIL_SIZE) {
+            auto chunk = std::allocate_shared<Chunk>(
+                TrackedAllocator<Chunk, MemoryTracker::HISTORY>{});
+            chunk->parent = std::move(m_chunks);
+            chunk->start = m_chunked;
+            chunk->items.assign(begin(m_tail), end(m_tail));
+            if (chunk->parent) {
+                chunk->filter = chunk->parent->filter;
+            }
+            for (const auto& item : m_tail) {
+                chunk->add_to_filter(item);
+            }
+            m_chunks = std::move(chunk);
+            m_chunked += m_tail_size;
+            m_tail_size = 0;
+            m_tail.fill(T{});
+        }
+        m_tail[m_tail_size++] = value;
+    }
+
+    // Only shrinks, like when undoing moves.
+    void resize(size_t new_size) {
+        assert(new_size <= size());
+        if (new_size >= m_chunked) {
+            while (m_tail_size > new_size - m_chunked) {
+                m_tail[--m_tail_size] = T{};
+            }
+            return;
+        }
+        m_tail.fill(T{});
+        m_tail_size = 0;
+        while (m_chunks && m_chunks->start >= new_size) {
+            m_chunks = m_chunks->parent;
+        }
+        m_chunked = new_size;
+    }
+
+    void clear() {
+        resize(0);
+    }
+
+    // Whether value is among the first count elements.
+    bool contains(const T& value, size_t count) const {
+        assert(count <= size());
+        for (auto i = m_chunked; i < count; i++) {
+            if (m_tail[i - m_chunked] == value) {
+                return true;
+            }
+        }
+        // The newest chunk filter covers all the older ones, and also
+        // any element truncated away since, which only costs a scan.
+        if (!m_chunks || !m_chunks->may_contain(value)) {
+            return false;
+        }
+        // Elements of a chunk past the start of a newer one were
+        // truncated away.
+        auto end = std::min(count, m_chunked);
+        for (auto chunk = m_chunks.get(); chunk; chunk = chunk->parent.get()) {
+            for (auto i = chunk->start; i < end; i++) {
+                if (chunk->items[i - chunk->start] == value) {
+                    return true;
+                }
+            }
+            end = std::min(end, chunk->start);
+        }
+        return false;
+    }
+
+    std::vector<T> to_vector() const {
+        auto result = std::vector<T>(size());
+        for (auto i = m_chunked; i < size(); i++) {
+            result[i] = m_tail[i - m_chunked];
+        }
+        auto end = m_chunked;
+        for (auto chunk = m_chunks.get(); chunk; chunk = chunk->parent.get()) {
+            for (auto i = chunk->start; i < end; i++) {
+                result[i] = chunk->items[i - chunk->start];
+            }
+            end = chunk->start;
+        }
+        return result;
+    }
+
+private:
+    struct Chunk {
+        std::shared_ptr<const Chunk> parent;
+        // Index of items[0] in the sequence.
+        size_t start;
+        TrackedVector<T, MemoryTracker::HISTORY> items;
+        std::array<std::uint64_t, FilterBits / 64> filter{};
+
+        // Three bits from the top of a 64 bit mix of the hash.
+        static std::uint64_t mix(const T& value) {
+            return std::uint64_t(std::hash<T>{}(value))
+                * 0x9E3779B97F4A7C15ULL;
+        }
+        void add_to_filter(const T& value) {
+            if (FilterBits == 0) {
+                return;
+            }
+            auto h = mix(value);
+            for (auto k = 0; k < 3; k++, h <<= 21) {
+                const auto bit = (h >> 43) & (FilterBits - 1);
+                filter[bit / 64] |= std::uint64_t{1} << (bit % 64);
+            }
+        }
+        bool may_contain(const T& value) const {
+            if (FilterBits == 0) {
+                return true;
+            }
+            auto h = mix(value);
+            for (auto k = 0; k < 3; k++, h <<= 21) {
+                const auto bit = (h >> 43) & (FilterBits - 1);
+                if (!(filter[bit / 64] & (std::uint64_t{1} << (bit % 64)))) {
+                    return false;
+                }
+            }
+            return true;
+        }
+    };
+
+    std::shared_ptr<const Chunk> m_chunks;
+    size_t m_chunked{0};
+    std::array<T, TAIL_SIZE> m_tail{};
+    size_t m_tail_size{0};
+};
+
+#endif
@@ -26,63 +26,254 @@
     distribution.
 */
 
+#include <array>
+#include <atomic>
 #include <cstddef>
+#include <deque>
 #include <vector>
 #include <thread>
-#include <queue>
 #include <mutex>
 #include <condition_variable>
 #include <memory>
 #include <future>
 #include <functional>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "Numa.h"
 
 namespace Utils {
 
+// A move-only void() callable. Callables up to INLINE_SIZE bytes,
+// such as a packaged_task, are stored in place instead of on the heap.
+class Task {
+public:
+    static constexpr std::size_t INLINE_SIZE = 48;
+
+    Task() = default;
+
+    template<class F, class = typename std::enable_if<
+        !std::is_same<typename std::decay<F>::type, Task>::value>::type>
+    Task(F&& f) {
+        using T = typename std::decay<F>::type;
+        if (sizeof(T) <= INLINE_SIZE
+            && alignof(T) <= alignof(std::max_align_t)
+            && std::is_nothrow_move_constructible<T>::value) {
+            new (&m_storage) T(std::forward<F>(f));
+            m_ops = &Inline<T>::ops;
+        } else {
+            *reinterpret_cast<T**>(&m_storage) = new T(std::forward<F>(f));
+            m_ops = &Heap<T>::ops;
+        }
+    }
+
+    Task(Task&& other) noexcept { move_from(other); }
+    Task& operator=(Task&& other) noexcept {
+        if (this != &other) {
+            reset();
+            move_from(other);
+        }
+        return *this;
+    }
+    Task(const Task&) = delete;
+    Task& operator=(const Task&) = delete;
+    ~Task() { reset(); }
+
+    void operator()() { m_ops->invoke(&m_storage); }
+
+private:
+    struct Ops {
+        void (*invoke)(void*);
+        // Move constructs into dst and destroys src.
+        void (*relocate)(void* dst, void* src);
+        void (*destroy)(void*);
+    };
+
+    template<class T>
+    struct Inline {
+        static void invoke(void* p) { (*static_cast<T*>(p))(); }
+        static void relocate(void* dst, void* src) {
+            new (dst) T(std::move(*static_cast<T*>(src)));
+            static_cast<T*>(src)->~T();
+        }
+        static void destroy(void* p) { static_cast<T*>(p)->~T(); }
+        static const Ops ops;
+    };
+
+    template<class T>
+    struct Heap {
+        static void invoke(void* p) { (**static_cast<T**>(p))(); }
+        static void relocate(void* dst, void* src) {
+            *static_cast<T**>(dst) = *static_cast<T**>(src);
+        }
+        static void destroy(void* p) { delete *static_cast<T**>(p); }
+        static const Ops ops;
+    };
+
+    void move_from(Task& other) noexcept {
+        m_ops = other.m_ops;
+        if (m_ops) {
+            m_ops->relocate(&m_storage, &other.m_storage);
+            other.m_ops = nullptr;
+        }
+    }
+
+    void reset() {
+        if (m_ops) {
+            m_ops->destroy(&m_storage);
+            m_ops = nullptr;
+        }
+    }
+
+    typename std::aligned_storage<INLINE_SIZE,
+                                  alignof(std::max_align_t)>::type m_storage;
+    const Ops* m_ops{nullptr};
+};
+
+template<class T>
+const Task::Ops Task::Inline<T>::ops = {&invoke, &relocate, &destroy};
+template<class T>
+const Task::Ops Task::Heap<T>::ops = {&invoke, &relocate, &destroy};
+
+// Work-stealing thread pool. Every thread owns a queue: tasks added by
+// a pool thread go to the back of its own queue and it runs them last in
+// first out, tasks added from outside are spread round robin. A thread
+// with nothing to do steals from the front of the other queues, and only
+// sleeps when there is no queued task at all.
 class ThreadPool {
 public:
-    ThreadPool() = default;
+    ThreadPool();
     ~ThreadPool();
 
-    // create worker threads.  This version has no initializers.
+    // create worker threads.  This version has no initializers,
+    // other than the NUMA placement of each thread.
     void initialize(std::size_t);
 
     // add an extra thread.  The thread calls initializer() before doing anything,
     // so that the user can initialize per-thread data structures before doing work.
     void add_thread(std::function<void()> initializer);
+    std::size_t size() const { return m_threads.size(); }
     template<class F, class... Args>
     auto add_task(F&& f, Args&&... args)
         -> std::future<typename std::result_of<F(Args...)>::type>;
 private:
+    // Threads beyond this share queues.
+    static constexpr std::size_t MAX_QUEUES = 256;
+
+    struct Queue {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    void push(Task&& task);
+    bool pop(std::size_t index, Task& task);
+    void worker(std::size_t index);
+
+    // Queue of the calling thread if it belongs to this pool.
+    static ThreadPool*& current_pool() {
+        static thread_local ThreadPool* pool = nullptr;
+        return pool;
+    }
+    static std::size_t& current_queue() {
+        static thread_local std::size_t queue = 0;
+        return queue;
+    }
+
     std::vector<std::thread> m_threads;
-    std::queue<std::function<void()>> m_tasks;
+    std::array<std::unique_ptr<Queue>, MAX_QUEUES> m_queues;
+    // Queues in m_queues that are ready, published after creation.
+    // The first one exists even before any thread is added.
+    std::atomic<std::size_t> m_num_queues{1};
+    std::atomic<std::size_t> m_next_queue{0};
+    // Tasks pushed and not yet popped. Incremented before the push,
+    // so it never underestimates.
+    std::atomic<std::size_t> m_pending{0};
 
     std::mutex m_mutex;
     std::condition_variable m_condvar;
     bool m_exit{false};
 };
 
+inline ThreadPool::ThreadPool() {
+    m_queues[0] = std::make_unique<Queue>();
+}
+
 inline void ThreadPool::add_thread(std::function<void()> initializer) {
-    m_threads.emplace_back([this, initializer] {
+    const auto index = m_threads.size();
+    if (index > 0 && index < MAX_QUEUES) {
+        m_queues[index] = std::make_unique<Queue>();
+        m_num_queues.store(index + 1, std::memory_order_release);
+    }
+    m_threads.emplace_back([this, index, initializer] {
         initializer();
-        for (;;) {
-            std::function<void()> task;
-            {
-                std::unique_lock<std::mutex> lock(m_mutex);
-                m_condvar.wait(lock, [this]{ return m_exit || !m_tasks.empty(); });
-                if (m_exit && m_tasks.empty()) {
-                    return;
-                }
-                task = std::move(m_tasks.front());
-                m_tasks.pop();
-            }
-            task();
-        }
+        worker(index % MAX_QUEUES);
     });
 }
 
 inline void ThreadPool::initialize(size_t threads) {
     for (size_t i = 0; i < threads; i++) {
-        add_thread([](){} /* null function */);
+        add_thread([i]() { Numa::bind_thread(i); });
+    }
+}
+
+inline void ThreadPool::push(Task&& task) {
+    const auto queues = m_num_queues.load(std::memory_order_acquire);
+    auto index = current_queue();
+    if (current_pool() != this) {
+        index = m_next_queue++ % queues;
+    }
+    m_pending++;
+    {
+        std::lock_guard<std::mutex> lock(m_queues[index]->mutex);
+        m_queues[index]->tasks.emplace_back(std::move(task));
+    }
+    // Taking the lock orders the push against a thread that
+    // just found nothing and is about to sleep.
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_condvar.notify_one();
+}
+
+inline bool ThreadPool::pop(std::size_t index, Task& task) {
+    {
+        auto& own = *m_queues[index];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+            return true;
+        }
+    }
+    const auto queues = m_num_queues.load(std::memory_order_acquire);
+    for (auto i = std::size_t{1}; i < queues; i++) {
+        auto& other = *m_queues[(index + i) % queues];
+        std::lock_guard<std::mutex> lock(other.mutex);
+        if (!other.tasks.empty()) {
+            task = std::move(other.tasks.front());
+            other.tasks.pop_front();
+            return true;
+        }
+    }
+    return false;
+}
+
+inline void ThreadPool::worker(std::size_t index) {
+    current_pool() = this;
+    current_queue() = index;
+    for (;;) {
+        auto task = Task{};
+        if (pop(index, task)) {
+            m_pending--;
+            task();
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condvar.wait(lock, [this]{ return m_exit || m_pending.load() > 0; });
+        if (m_exit && m_pending.load() == 0) {
+            return;
+        }
     }
 }
 
@@ -91,16 +282,12 @@ auto ThreadPool::add_task(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type> {
     using return_type = typename std::result_of<F(Args...)>::type;
 
-    auto task = std::make_shared< std::packaged_task<return_type()> >(
+    auto task = std::packaged_task<return_type()>(
         std::bind(std::forward<F>(f), std::forward<Args>(args)...)
     );
 
-    std::future<return_type> res = task->get_future();
-    {
-        std::unique_lock<std::mutex> lock(m_mutex);
-        m_tasks.emplace([task](){(*task)();});
-    }
-    m_condvar.notify_one();
+    std::future<return_type> res = task.get_future();
+    push(Task(std::move(task)));
     return res;
 }
 
@@ -128,6 +315,7 @@ public:
         for (auto && result : m_taskresults) {
             result.get();
         }
+        m_taskresults.clear();
     }
 private:
     ThreadPool & m_pool;
@@ -271,6 +271,23 @@ int TimeControl::max_time_for_move(int boardsize,
     return base_time + inc_time;
 }
 
+// Extra time a move may take beyond max_time_for_move() when the search
+// finds it contested. It is only granted when the time can be saved up
+// again on later moves, and never more than a quarter of what is left.
+int TimeControl::max_extension_for_move(int boardsize,
+                                        int color, size_t movenum) const {
+    if (cfg_time_extension <= 0.0f || !can_accumulate_time(color)) {
+        return 0;
+    }
+    const auto base_time = max_time_for_move(boardsize, color, movenum);
+    const auto usable_time =
+        std::max(m_remaining_time[color] - cfg_lagbuffer_cs, 0);
+    const auto extension = std::min(
+        static_cast<int>(base_time * cfg_time_extension),
+        usable_time / 4 - base_time);
+    return std::max(extension, 0);
+}
+
 void TimeControl::adjust_time(int color, int time, int stones) {
     m_remaining_time[color] = time;
     // From pachi: some GTP things send 0 0 at the end of main time
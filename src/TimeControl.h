@@ -50,6 +50,7 @@ public:
     void start(int color);
     void stop(int color);
     int max_time_for_move(int boardsize, int color, size_t movenum) const;
+    int max_extension_for_move(int boardsize, int color, size_t movenum) const;
     void adjust_time(int color, int time, int stones);
     void display_times();
     void reset_clocks();
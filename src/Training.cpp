@@ -31,30 +31,39 @@
 #include "Training.h"
 
 #include <algorithm>
+#include <atomic>
 #include <bitset>
 #include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <iostream>
 #include <iterator>
+#include <limits>
 #include <memory>
+#include <numeric>
 #include <sstream>
 #include <stdexcept>
 #include <utility>
 
+#include <boost/filesystem.hpp>
+
 #include "FastBoard.h"
 #include "FullBoard.h"
 #include "GTP.h"
 #include "GameState.h"
 #include "Random.h"
 #include "SGFParser.h"
-#include "SGFTree.h"
+#include "ThreadPool.h"
 #include "Timing.h"
 #include "UCTNode.h"
 #include "Utils.h"
+#include "half/half.hpp"
 #include "string.h"
 #include "zlib.h"
 
-std::vector<TimeStep> Training::m_data{};
+thread_local TimeStepRing Training::m_data{};
 
 std::ostream& operator <<(std::ostream& stream, const TimeStep& timestep) {
     stream << timestep.planes.size() << ' ';
@@ -96,6 +105,109 @@ std::istream& operator>> (std::istream& stream, TimeStep& timestep) {
     return stream;
 }
 
+TimeStepRing::~TimeStepRing() {
+    clear();
+}
+
+void TimeStepRing::clear() {
+    m_begin = 0;
+    m_count = 0;
+    m_spilled = 0;
+    if (m_spill.is_open()) {
+        m_spill.close();
+        std::remove(m_spill_name.c_str());
+    }
+}
+
+TimeStep& TimeStepRing::push_back() {
+    if (cfg_max_training_steps > 0 && m_count >= cfg_max_training_steps) {
+        spill_front();
+    }
+    if (m_count == m_slots.size()) {
+        // The ring only wraps around once it is at full capacity.
+        assert(m_begin == 0);
+        m_slots.emplace_back();
+    }
+    auto& step = slot(m_count++);
+
+    // Keep the buffers of the slot, reset everything else.
+    auto planes = std::move(step.planes);
+    auto probabilities = std::move(step.probabilities);
+    step = TimeStep{};
+    step.planes = std::move(planes);
+    step.planes.clear();
+    step.probabilities = std::move(probabilities);
+    step.probabilities.clear();
+    return step;
+}
+
+void TimeStepRing::pop_back() {
+    assert(m_count > 0);
+    m_count--;
+}
+
+void TimeStepRing::for_each(const std::function<void(const TimeStep&)>& f) {
+    if (m_spilled > 0) {
+        m_spill.seekg(0);
+        auto step = TimeStep{};
+        for (auto i = size_t{0}; i < m_spilled; i++) {
+            step.planes.clear();
+            step.probabilities.clear();
+            read_spilled(m_spill, step);
+            f(step);
+        }
+        if (!m_spill) {
+            throw std::runtime_error("Error reading the training spill file");
+        }
+    }
+    for (auto i = size_t{0}; i < m_count; i++) {
+        f(slot(i));
+    }
+}
+
+void TimeStepRing::spill_front() {
+    if (!m_spill.is_open()) {
+        const auto name = boost::filesystem::temp_directory_path()
+            / boost::filesystem::unique_path("sai-%%%%-%%%%-%%%%.train");
+        m_spill_name = name.string();
+        m_spill.open(m_spill_name, std::fstream::in | std::fstream::out
+                                   | std::fstream::trunc);
+        if (!m_spill) {
+            throw std::runtime_error("Cannot create the training spill file "
+                                     + m_spill_name);
+        }
+        m_spill.precision(std::numeric_limits<float>::max_digits10);
+    }
+    m_spill.seekp(0, std::fstream::end);
+    write_spilled(m_spill, slot(0));
+    m_begin = (m_begin + 1) % m_slots.size();
+    m_count--;
+    m_spilled++;
+}
+
+// The save_training record, followed by the fields it does not keep.
+void TimeStepRing::write_spilled(std::ostream& out, const TimeStep& step) {
+    out << step;
+    out << step.komi << ' '
+        << step.movenum << ' '
+        << step.is_blunder << ' '
+        << step.is_fast_search << ' '
+        << step.uct_stats.alpkt_tree << ' '
+        << step.uct_stats.beta_tree << ' '
+        << step.uct_stats.azwinrate_avg << std::endl;
+}
+
+void TimeStepRing::read_spilled(std::istream& in, TimeStep& step) {
+    in >> step;
+    in >> step.komi
+       >> step.movenum
+       >> step.is_blunder
+       >> step.is_fast_search
+       >> step.uct_stats.alpkt_tree
+       >> step.uct_stats.beta_tree
+       >> step.uct_stats.azwinrate_avg;
+}
+
 std::string OutputChunker::gen_chunk_name() const {
     auto base = std::string{m_basename};
     base.append("." + std::to_string(m_chunk_count) + ".gz");
@@ -109,6 +221,7 @@ OutputChunker::OutputChunker(const std::string& basename,
 
 OutputChunker::~OutputChunker() {
     flush_chunks();
+    wait_pending();
 }
 
 void OutputChunker::append(const std::string& str) {
@@ -119,21 +232,29 @@ void OutputChunker::append(const std::string& str) {
     }
 }
 
+void OutputChunker::wait_pending() {
+    if (m_pending.valid()) {
+        m_pending.get();
+    }
+}
+
 void OutputChunker::flush_chunks() {
     if (m_compress) {
+        // Only one chunk is compressed at a time.
+        wait_pending();
         auto chunk_name = gen_chunk_name();
-        auto out = gzopen(chunk_name.c_str(), "wb9");
-
-        auto in_buff_size = m_buffer.size();
-        auto in_buff = std::make_unique<char[]>(in_buff_size);
-        memcpy(in_buff.get(), m_buffer.data(), in_buff_size);
-
-        auto comp_size = gzwrite(out, in_buff.get(), in_buff_size);
-        if (in_buff_size && !comp_size) {
-            throw std::runtime_error("Error in gzip output");
-        }
-        Utils::myprintf("Writing chunk %d\n",  m_chunk_count);
-        gzclose(out);
+        auto mode = "wb" + std::to_string(cfg_chunk_compression);
+        auto chunk_number = m_chunk_count;
+        m_pending = std::async(std::launch::async,
+            [chunk_name, mode, chunk_number, buffer = std::move(m_buffer)]() {
+                auto out = gzopen(chunk_name.c_str(), mode.c_str());
+                auto comp_size = gzwrite(out, buffer.data(), buffer.size());
+                if (buffer.size() && !comp_size) {
+                    throw std::runtime_error("Error in gzip output");
+                }
+                Utils::myprintf("Writing chunk %d\n", chunk_number);
+                gzclose(out);
+            });
     } else {
         auto chunk_name = m_basename;
         auto flags = std::ofstream::out | std::ofstream::app;
@@ -151,14 +272,14 @@ void Training::clear_training() {
     Training::m_data.clear();
 }
 
-TimeStep::NNPlanes Training::get_planes(const GameState* const state) {
+void Training::get_planes(const GameState* const state,
+                          TimeStep::NNPlanes& planes) {
     const auto default_input_moves = (cfg_chainlibs_features || cfg_chainsize_features) ?
         Network::MINIMIZED_INPUT_MOVES :
         (cfg_adv_features ? Network::REDUCED_INPUT_MOVES : Network::DEFAULT_INPUT_MOVES);
     const auto input_data =
         Network::gather_features(state, 0, default_input_moves, cfg_adv_features,
                                  cfg_chainlibs_features, cfg_chainsize_features, false);
-    auto planes = TimeStep::NNPlanes{};
 
     // for now the number of planes coding the position is always 16,
     // but in general it is a number of feature planes (2 or 4
@@ -176,17 +297,18 @@ TimeStep::NNPlanes Training::get_planes(const GameState* const state) {
             planes[c][idx] = bool(input_data[c * NUM_INTERSECTIONS + idx]);
         }
     }
-    return planes;
 }
 
-void Training::record(Network & network, GameState& state, UCTNode& root) {
-    auto step = TimeStep{};
+void Training::record(Network & network, GameState& state, UCTNode& root,
+                      bool fast_search) {
+    auto& step = m_data.push_back();
     step.to_move = state.board.get_to_move();
-    step.planes = get_planes(&state);
+    get_planes(&state, step.planes);
     const auto komi = state.get_komi_adj();
     step.komi = komi;
     step.movenum = state.get_movenum();
     step.is_blunder = state.is_blunder();
+    step.is_fast_search = fast_search;
     step.uct_stats = root.get_uct_stats();
 
     const auto result =
@@ -218,15 +340,14 @@ void Training::record(Network & network, GameState& state, UCTNode& root) {
         // will not able to accumulate search results on them because every attempt
         // to evaluate will bail immediately. So in this case there will be 0 total
         // visits, and we should not construct the (non-existent) probabilities.
+        m_data.pop_back();
         return;
     }
-
-    m_data.emplace_back(step);
 }
 
 void Training::dump_training(int winner_color, const std::string& filename,
                              const std::string& hash) {
-    auto chunker = OutputChunker{filename, true};
+    OutputChunker chunker{filename, true};
     dump_training(winner_color, chunker, hash);
 }
 
@@ -244,17 +365,15 @@ void Training::load_training(const std::string& filename) {
 
 void Training::save_training(std::ofstream& out) {
     out << m_data.size() << ' ';
-    for (const auto& step : m_data) {
+    m_data.for_each([&out](const TimeStep& step) {
         out << step;
-    }
+    });
 }
 void Training::load_training(std::ifstream& in) {
     int steps;
     in >> steps;
     for (auto i = 0; i < steps; ++i) {
-        TimeStep step;
-        in >> step;
-        m_data.push_back(step);
+        in >> m_data.push_back();
     }
 }
 
@@ -262,29 +381,46 @@ void Training::dump_training(int winner_color,
                              OutputChunker& outchunk,
                              const std::string& sgfhash) {
     auto training_str = std::string{};
+    if (append_training(winner_color, sgfhash, training_str)) {
+        outchunk.append(training_str);
+    }
+}
 
+bool Training::append_training(int winner_color, const std::string& sgfhash,
+                               std::string& training_str) {
     if (m_data.size()==0) {
-        return;
+        return false;
     }
 
-    auto it = m_data.end()-1;
-    for ( ; it!=m_data.begin() ; --it ) {
-        if (it->is_blunder) {
-            break;
+    // Only the positions from the last blunder on are written.
+    auto first = size_t{0};
+    auto movenum = size_t{0};
+    m_data.for_each([&](const TimeStep& step) {
+        if (step.is_blunder) {
+            first = movenum;
         }
-    }
+        movenum++;
+    });
 
-    for ( ; it!=m_data.end() ; ++it ) {
+    movenum = size_t{0};
+    m_data.for_each([&](const TimeStep& step) {
+        if (movenum++ < first || step.is_fast_search) {
+            return;
+        }
+        if (cfg_binary_chunks) {
+            append_binary_record(training_str, step, winner_color);
+            return;
+        }
         // // Stop writing training if below losing threshold, as
         // // positions tend to be irregular and quite meaningless
-        // if (it->root_uct_winrate <=
+        // if (step.root_uct_winrate <=
         //     std::max(cfg_resign_threshold, cfg_losing_thr)) {
-        //     break;
+        //     return;
         // }
         auto out = std::stringstream{};
         // First output all input feature planes
-        for (auto p = size_t{0}; p < it->planes.size() ; p++) {
-            const auto& plane = it->planes[p];
+        for (auto p = size_t{0}; p < step.planes.size() ; p++) {
+            const auto& plane = step.planes[p];
             // Write it out as a string of hex characters
             for (auto bit = size_t{0}; bit + 3 < plane.size(); bit += 4) {
                 auto hexbyte =  plane[bit]     << 3
@@ -301,43 +437,103 @@ void Training::dump_training(int winner_color,
         }
         // The side to move planes can be compactly encoded into a single
         // bit, 0 = black to move.
-        out << (it->to_move == FastBoard::BLACK ? "0" : "1")
-            << " " << it->komi
+        out << (step.to_move == FastBoard::BLACK ? "0" : "1")
+            << " " << step.komi
             << " " << sgfhash
-            << " " << it->movenum
+            << " " << step.movenum
             << std::endl;
         // Then a POTENTIAL_MOVES long array of float probabilities
-        for (auto its = begin(it->probabilities);
-            its != end(it->probabilities); ++its) {
+        for (auto its = begin(step.probabilities);
+            its != end(step.probabilities); ++its) {
             out << *its;
-            if (next(its) != end(it->probabilities)) {
+            if (next(its) != end(step.probabilities)) {
                 out << " ";
             }
         }
         out << std::endl;
         // And the game result for the side to move
-        if (it->to_move == winner_color) {
+        if (step.to_move == winner_color) {
             out << "1";
         } else if (winner_color == FastBoard::WHITE &&
-                   it->to_move == FastBoard::BLACK) {
+                   step.to_move == FastBoard::BLACK) {
             out << "-1";
         } else if (winner_color == FastBoard::BLACK &&
-                   it->to_move == FastBoard::WHITE) {
+                   step.to_move == FastBoard::WHITE) {
             out << "-1";
         } else if (winner_color == FastBoard::EMPTY) {
             out << "0";
         }
-        out << " " << it->uct_stats.alpkt_tree
-            << " " << it->uct_stats.beta_tree
-            << " " << it->uct_stats.azwinrate_avg
+        out << " " << step.uct_stats.alpkt_tree
+            << " " << step.uct_stats.beta_tree
+            << " " << step.uct_stats.azwinrate_avg
             << std::endl;
         training_str.append(out.str());
+    });
+    return true;
+}
+
+// Binary training records, read by training/tf/chunkparser.py. All
+// fields are little endian and packed:
+//   int32   version, always 2
+//   float16 probabilities[POTENTIAL_MOVES], normalized
+//   uint8   planes[], the input planes one after the other, as bits
+//           starting from the most significant one
+//   uint8   side to move, 0 = black
+//   float32 komi
+//   uint8   1 + result for the side to move
+//   float32 alpkt, beta and average winrate of the search tree
+//   uint16  move number
+template <typename T>
+static void append_le(std::string& out, T value) {
+    auto bits = std::uint32_t{0};
+    static_assert(sizeof(T) <= sizeof(bits), "append_le takes up to 32 bits");
+    std::memcpy(&bits, &value, sizeof(T));
+    for (auto i = size_t{0}; i < sizeof(T); i++) {
+        out.push_back(char(bits >> (8 * i)));
+    }
+}
+
+void Training::append_binary_record(std::string& out, const TimeStep& step,
+                                    int winner_color) {
+    append_le(out, std::int32_t{2});
+
+    const auto total = std::accumulate(begin(step.probabilities),
+                                       end(step.probabilities), 0.0f);
+    for (const auto prob : step.probabilities) {
+        const auto half = half_float::half(total > 0.0f ? prob / total : prob);
+        append_le(out, half);
+    }
+
+    auto byte = 0;
+    auto bit = 0;
+    for (const auto& plane : step.planes) {
+        for (auto idx = size_t{0}; idx < plane.size(); idx++) {
+            byte = (byte << 1) | int(plane[idx]);
+            if (++bit == 8) {
+                out.push_back(char(byte));
+                byte = bit = 0;
+            }
+        }
+    }
+    if (bit > 0) {
+        out.push_back(char(byte << (8 - bit)));
+    }
+
+    append_le(out, std::uint8_t(step.to_move == FastBoard::BLACK ? 0 : 1));
+    append_le(out, step.komi);
+    auto result = 0;
+    if (winner_color != FastBoard::EMPTY) {
+        result = step.to_move == winner_color ? 1 : -1;
     }
-    outchunk.append(training_str);
+    append_le(out, std::uint8_t(1 + result));
+    append_le(out, step.uct_stats.alpkt_tree);
+    append_le(out, step.uct_stats.beta_tree);
+    append_le(out, step.uct_stats.azwinrate_avg);
+    append_le(out, std::uint16_t(step.movenum));
 }
 
 void Training::dump_debug(const std::string& filename) {
-    auto chunker = OutputChunker{filename, true};
+    OutputChunker chunker{filename, true};
     dump_debug(chunker);
 }
 
@@ -349,20 +545,20 @@ void Training::dump_debug(OutputChunker& outchunk) {
         out << cfg_resignpct << " " << cfg_weightsfile << std::endl;
         debug_str.append(out.str());
     }
-    for (const auto& step : m_data) {
+    m_data.for_each([&debug_str](const TimeStep& step) {
         auto out = std::stringstream{};
         out << step.net_winrate
             << " " << step.root_uct_winrate
             << " " << step.child_uct_winrate
             << " " << step.bestmove_visits << std::endl;
         debug_str.append(out.str());
-    }
+    });
     outchunk.append(debug_str);
 }
 
-void Training::process_game(GameState& state, size_t& train_pos, int who_won,
-                            const std::vector<int>& tree_moves,
-                            OutputChunker& outchunker) {
+size_t Training::process_game(GameState& state, int who_won,
+                              const std::vector<int>& tree_moves,
+                              std::string& out) {
     clear_training();
     auto counter = size_t{0};
     state.rewind();
@@ -377,7 +573,7 @@ void Training::process_game(GameState& state, size_t& train_pos, int who_won,
         if (!state.is_move_legal(to_move, move_vertex)) {
             std::cout << "Mainline move not found: " << move_vertex
                       << std::endl;
-            return;
+            return 0;
         }
 
         if (move_vertex != FastBoard::PASS) {
@@ -388,29 +584,60 @@ void Training::process_game(GameState& state, size_t& train_pos, int who_won,
             move_idx = NUM_INTERSECTIONS; // PASS
         }
 
-        auto step = TimeStep{};
+        auto& step = m_data.push_back();
         step.to_move = to_move;
-        step.planes = get_planes(&state);
+        get_planes(&state, step.planes);
         step.komi = komi;
 
         step.probabilities.resize(POTENTIAL_MOVES);
         step.probabilities[move_idx] = 1.0f;
 
-        train_pos++;
-        m_data.emplace_back(step);
-
         counter++;
     } while (state.forward_move() && counter < tree_moves.size());
 
-    dump_training(who_won, outchunker);
+    append_training(who_won, "", out);
+    return counter;
+}
+
+// Returns the number of positions of the SGF game written to out.
+size_t Training::convert_sgf_game(const SGFParser::GameView& game,
+                                  std::string& out) {
+    auto mainline = SGFMainline{};
+    try {
+        if (!SGFParser::parse_mainline(game, mainline)) {
+            return 0;
+        }
+    } catch (...) {
+        return 0;
+    };
+
+    auto tree_moves = mainline.get_mainline();
+    // Empty game or couldn't be parsed?
+    if (tree_moves.size() == 0) {
+        return 0;
+    }
+
+    auto who_won = mainline.winner;
+    // Accept all komis and handicaps, but reject no usable result
+    if (who_won != FastBoard::BLACK &&
+        who_won != FastBoard::WHITE &&
+        who_won != FastBoard::EMPTY) {
+        return 0;
+    }
+
+    auto state = std::make_unique<GameState>(mainline.follow_mainline_state());
+    return process_game(*state, who_won, tree_moves, out);
 }
 
 void Training::dump_supervised(const std::string& sgf_name,
-                               const std::string& out_filename) {
-    auto outchunker = OutputChunker{out_filename, true};
-    auto games = SGFParser::chop_all(sgf_name);
+                               const std::string& out_filename,
+                               size_t threads, bool ordered) {
+    // Only the mainlines are needed, so the games are read straight
+    // from the mapped file instead of going through SGFTree.
+    const SGFFile sgf_file{sgf_name};
+    auto games = SGFParser::chop_view(sgf_file.data(), sgf_file.size());
     auto gametotal = games.size();
-    auto train_pos = size_t{0};
+    threads = std::max(size_t{1}, std::min(threads, gametotal));
 
     std::cout << "Total games in file: " << gametotal << std::endl;
     // Shuffle games around
@@ -418,47 +645,83 @@ void Training::dump_supervised(const std::string& sgf_name,
     std::shuffle(begin(games), end(games), Random::get_Rng());
     std::cout << "done." << std::endl;
 
+    while (thread_pool.size() < threads) {
+        thread_pool.add_thread([]() {});
+    }
+    auto run_workers = [threads](const std::function<void()>& worker) {
+        if (threads == 1) {
+            worker();
+            return;
+        }
+        Utils::ThreadGroup tg(thread_pool);
+        for (auto t = size_t{0}; t < threads; t++) {
+            tg.add_task(worker);
+        }
+        tg.wait_all();
+    };
+
     Time start;
-    for (auto gamecount = size_t{0}; gamecount < gametotal; gamecount++) {
-        auto sgftree = std::make_unique<SGFTree>();
-        try {
-            sgftree->load_from_string(games[gamecount]);
-        } catch (...) {
-            continue;
-        };
-
-        if (gamecount > 0 && gamecount % 1000 == 0) {
+    std::atomic<size_t> next_game{0};
+    std::atomic<size_t> games_done{0};
+    std::atomic<size_t> train_pos{0};
+    auto convert = [&](size_t gamecount, std::string& out) {
+        const auto positions = convert_sgf_game(games[gamecount], out);
+        const auto total_pos = train_pos += positions;
+        const auto done = ++games_done;
+        if (done % 1000 == 0) {
             Time elapsed;
             auto elapsed_s = Time::timediff_seconds(start, elapsed);
             Utils::myprintf(
                 "Game %5d, %5d positions in %5.2f seconds -> %d pos/s\n",
-                gamecount, train_pos, elapsed_s, int(train_pos / elapsed_s));
-        }
-
-        auto tree_moves = sgftree->get_mainline();
-        // Empty game or couldn't be parsed?
-        if (tree_moves.size() == 0) {
-            continue;
-        }
-
-        auto who_won = sgftree->get_winner();
-        // Accept all komis and handicaps, but reject no usable result
-        if (who_won != FastBoard::BLACK &&
-            who_won != FastBoard::WHITE &&
-            who_won != FastBoard::EMPTY) {
-            continue;
+                done, total_pos, elapsed_s, int(total_pos / elapsed_s));
         }
-
-        auto state =
-            std::make_unique<GameState>(sgftree->follow_mainline_state());
-        // Our board size is hardcoded in several places
-        if (state->board.get_boardsize() != BOARD_SIZE) {
-            continue;
+        return positions > 0;
+    };
+
+    if (ordered || threads == 1) {
+        // The games are converted in batches and written in their
+        // order, so the output is the same for any number of threads.
+        OutputChunker outchunker{out_filename, true};
+        const auto batch_size = threads * 64;
+        auto results = std::vector<std::string>(batch_size);
+        auto converted = std::vector<char>(batch_size);
+        for (auto first = size_t{0}; first < gametotal; first += batch_size) {
+            const auto last = std::min(gametotal, first + batch_size);
+            next_game = first;
+            run_workers([&]() {
+                for (auto g = next_game++; g < last; g = next_game++) {
+                    converted[g - first] = convert(g, results[g - first]);
+                }
+            });
+            for (auto g = first; g < last; g++) {
+                if (converted[g - first]) {
+                    outchunker.append(results[g - first]);
+                }
+                results[g - first].clear();
+            }
         }
-
-        process_game(*state, train_pos, who_won, tree_moves,
-                    outchunker);
+    } else {
+        // Every thread goes through the games as they come and writes
+        // its own chunks, named after out_filename and the thread.
+        std::atomic<size_t> next_worker{0};
+        run_workers([&]() {
+            const auto worker = next_worker++;
+            OutputChunker outchunker{
+                out_filename + "_" + std::to_string(worker), true};
+            auto str = std::string{};
+            for (auto g = next_game++; g < gametotal; g = next_game++) {
+                if (convert(g, str)) {
+                    outchunker.append(str);
+                }
+                str.clear();
+            }
+        });
     }
 
+    Time elapsed;
+    auto elapsed_s = Time::timediff_seconds(start, elapsed);
     std::cout << "Dumped " << train_pos << " training positions." << std::endl;
+    Utils::myprintf("%d games in %5.2f seconds -> %d games/s, %d pos/s\n",
+                    gametotal, elapsed_s, int(gametotal / elapsed_s),
+                    int(train_pos / elapsed_s));
 }
@@ -35,18 +35,23 @@
 
 #include <bitset>
 #include <cstddef>
+#include <fstream>
+#include <functional>
+#include <future>
 #include <string>
 #include <utility>
 #include <vector>
 
 #include "GameState.h"
+#include "MemoryTracker.h"
 #include "Network.h"
+#include "SGFParser.h"
 #include "UCTNode.h"
 
 class TimeStep {
 public:
     using BoardPlane = std::bitset<NUM_INTERSECTIONS>;
-    using NNPlanes = std::vector<BoardPlane>;
+    using NNPlanes = TrackedVector<BoardPlane, MemoryTracker::TRAINING>;
     NNPlanes planes;
     std::vector<float> probabilities;
     int to_move;
@@ -57,12 +62,50 @@ public:
     float komi;
     size_t movenum;
     bool is_blunder;
+    // Searched with cfg_fast_visits: played, but not written out.
+    bool is_fast_search;
     UCTStats uct_stats;
 };
 
 std::ostream& operator<< (std::ostream& stream, const TimeStep& timestep);
 std::istream& operator>> (std::istream& stream, TimeStep& timestep);
 
+// The positions recorded for the current game. Slots are kept between
+// games, so recording a move stops allocating once they are warmed up.
+// With cfg_max_training_steps set, the oldest positions go to a spill
+// file when the ring is full and are read back one by one when the
+// game is dumped, so memory does not grow with the game length.
+class TimeStepRing {
+public:
+    TimeStepRing() = default;
+    TimeStepRing(const TimeStepRing&) = delete;
+    TimeStepRing& operator=(const TimeStepRing&) = delete;
+    ~TimeStepRing();
+
+    void clear();
+    size_t size() const { return m_spilled + m_count; }
+    // Returns a cleared slot for a new last position.
+    TimeStep& push_back();
+    void pop_back();
+    // Calls f on every position, in the order they were recorded.
+    void for_each(const std::function<void(const TimeStep&)>& f);
+
+private:
+    TimeStep& slot(size_t i) {
+        return m_slots[(m_begin + i) % m_slots.size()];
+    }
+    void spill_front();
+    static void write_spilled(std::ostream& out, const TimeStep& step);
+    static void read_spilled(std::istream& in, TimeStep& step);
+
+    TrackedVector<TimeStep, MemoryTracker::TRAINING> m_slots;
+    size_t m_begin{0};
+    size_t m_count{0};
+    size_t m_spilled{0};
+    std::string m_spill_name;
+    std::fstream m_spill;
+};
+
 class OutputChunker {
 public:
     OutputChunker(const std::string& basename, bool compress = false);
@@ -74,11 +117,16 @@ public:
 private:
     std::string gen_chunk_name() const;
     void flush_chunks();
+    void wait_pending();
     size_t m_game_count{0};
     size_t m_chunk_count{0};
     std::string m_buffer;
     std::string m_basename;
     bool m_compress{false};
+    // A full chunk is compressed in the background while the next one
+    // fills up. The destructor waits for it, so the files are complete
+    // when the chunker goes away.
+    std::future<void> m_pending;
 };
 
 class Training {
@@ -88,25 +136,38 @@ public:
                               const std::string& out_filename,
                               const std::string& hash);
     static void dump_debug(const std::string& out_filename);
-    static void record(Network & network, GameState& state, UCTNode& node);
+    static void record(Network & network, GameState& state, UCTNode& node,
+                       bool fast_search = false);
 
+    // With more than one thread, each thread writes its own chunks
+    // unless ordered is set.
     static void dump_supervised(const std::string& sgf_file,
-                                const std::string& out_filename);
+                                const std::string& out_filename,
+                                size_t threads = 1, bool ordered = false);
     static void save_training(const std::string& filename);
     static void load_training(const std::string& filename);
 
 private:
-    static TimeStep::NNPlanes get_planes(const GameState* const state);
-    static void process_game(GameState& state, size_t& train_pos, int who_won,
-                             const std::vector<int>& tree_moves,
-                             OutputChunker& outchunker);
+    static void get_planes(const GameState* const state,
+                           TimeStep::NNPlanes& planes);
+    static size_t process_game(GameState& state, int who_won,
+                               const std::vector<int>& tree_moves,
+                               std::string& out);
+    static size_t convert_sgf_game(const SGFParser::GameView& game,
+                                   std::string& out);
     static void dump_training(int winner_color,
                               OutputChunker& outchunker,
                               const std::string& hash = "");
+    static bool append_training(int winner_color, const std::string& hash,
+                                std::string& training_str);
+    static void append_binary_record(std::string& out, const TimeStep& step,
+                                     int winner_color);
     static void dump_debug(OutputChunker& outchunker);
     static void save_training(std::ofstream& out);
     static void load_training(std::ifstream& in);
-    static std::vector<TimeStep> m_data;
+    // Each thread records its own game, so that self-play games can
+    // run side by side.
+    static thread_local TimeStepRing m_data;
 };
 
 #endif
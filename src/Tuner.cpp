@@ -31,6 +31,7 @@
 #include "config.h"
 
 #ifdef USE_OPENCL
+#include <algorithm>
 #include <array>
 #include <cassert>
 #include <iostream>
@@ -40,6 +41,10 @@
 #include <random>
 #include <cmath>
 #include <fstream>
+#include <chrono>
+#include <cstdio>
+#include <limits>
+#include <mutex>
 #ifndef USE_BLAS
 #include <Eigen/Dense>
 #endif
@@ -50,11 +55,226 @@
 #include "Utils.h"
 #include "Random.h"
 
+using namespace Utils;
+
 const auto TUNER_FILE_LOCAL = std::string("sai_opencl_tuning");
 
 template <typename net_t>
 std::vector<std::string> Tuner<net_t>::tuned_devices;
 
+// GPUs are tuned in parallel, this protects the tuner file and
+// tuned_devices.
+static std::mutex tuner_mutex;
+
+// Fields of a tuner file line:
+// version;kernel;m;n;k;batch_size;tuners;device
+// and, from version 2 on,
+// ...;driver;board_size;tried;total;best_time
+static constexpr auto V1_FIELDS = size_t{8};
+static constexpr auto V2_FIELDS = size_t{13};
+
+static std::string tuner_filename() {
+    if (!cfg_tuner_file.empty()) {
+        return cfg_tuner_file;
+    }
+    return leelaz_file(TUNER_FILE_LOCAL);
+}
+
+static std::vector<std::string> split_tuner_line(const std::string& line) {
+    auto s = std::vector<std::string>{};
+    auto ss = std::stringstream{line};
+    auto item = std::string{};
+    while (std::getline(ss, item, ';')) {
+        s.emplace_back(item);
+    }
+    return s;
+}
+
+// Everything but the result, empty if the line is not a tuning.
+static std::string tuning_key(const std::vector<std::string>& s) {
+    if (s.size() != V1_FIELDS && s.size() != V2_FIELDS) {
+        return "";
+    }
+    auto key = std::string{};
+    for (auto i = size_t{0}; i < s.size() && i < 10; i++) {
+        if (i != 6) {
+            key += s[i] + ";";
+        }
+    }
+    return key;
+}
+
+// Configurations tried, or the maximum for a finished tuning.
+static size_t tuning_tried(const std::vector<std::string>& s) {
+    if (s.size() != V2_FIELDS) {
+        return std::numeric_limits<size_t>::max();
+    }
+    const auto tried = std::stoull(s[10]);
+    const auto total = std::stoull(s[11]);
+    if (tried >= total) {
+        return std::numeric_limits<size_t>::max();
+    }
+    return tried;
+}
+
+static std::vector<std::string> read_tuner_lines(const std::string& filename) {
+    auto lines = std::vector<std::string>{};
+    auto file = std::ifstream{filename};
+    auto line = std::string{};
+    while (std::getline(file, line)) {
+        lines.emplace_back(line);
+    }
+    return lines;
+}
+
+// Replaces the file in one go, so that other processes sharing it never
+// see a partial write.
+static bool write_tuner_lines(const std::string& filename,
+                              const std::vector<std::string>& lines) {
+    // Not the thread RNG, see build_valid_params().
+    const auto tmp_name = filename + ".tmp"
+        + std::to_string(std::random_device{}());
+    {
+        auto file = std::ofstream{tmp_name};
+        for (const auto& line : lines) {
+            file << line << std::endl;
+        }
+        if (file.fail()) {
+            std::remove(tmp_name.c_str());
+            return false;
+        }
+    }
+    if (std::rename(tmp_name.c_str(), filename.c_str()) != 0) {
+        // Windows does not replace existing files.
+        std::remove(filename.c_str());
+        if (std::rename(tmp_name.c_str(), filename.c_str()) != 0) {
+            std::remove(tmp_name.c_str());
+            return false;
+        }
+    }
+    return true;
+}
+
+bool tuner_import(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(tuner_mutex);
+    auto imported = read_tuner_lines(filename);
+    if (imported.empty()) {
+        myprintf("Could not read tunings from %s.\n", filename.c_str());
+        return false;
+    }
+    const auto tuner_file = tuner_filename();
+    auto lines = read_tuner_lines(tuner_file);
+    auto count = 0;
+    for (const auto& line : imported) {
+        const auto s = split_tuner_line(line);
+        const auto key = tuning_key(s);
+        if (key.empty()) {
+            continue;
+        }
+        auto keep = true;
+        auto it = begin(lines);
+        while (it != end(lines)) {
+            const auto t = split_tuner_line(*it);
+            if (tuning_key(t) == key) {
+                if (tuning_tried(t) > tuning_tried(s)) {
+                    keep = false;
+                    ++it;
+                } else {
+                    it = lines.erase(it);
+                }
+            } else {
+                ++it;
+            }
+        }
+        if (keep) {
+            lines.emplace_back(line);
+            count++;
+        }
+    }
+    if (!write_tuner_lines(tuner_file, lines)) {
+        myprintf("Could not write %s.\n", tuner_file.c_str());
+        return false;
+    }
+    myprintf("Imported %d tunings from %s.\n", count, filename.c_str());
+    return true;
+}
+
+bool tuner_export(const std::string& filename) {
+    std::lock_guard<std::mutex> lock(tuner_mutex);
+    const auto lines = read_tuner_lines(tuner_filename());
+    if (!write_tuner_lines(filename, lines)) {
+        myprintf("Could not write %s.\n", filename.c_str());
+        return false;
+    }
+    myprintf("Exported %zu tunings to %s.\n", lines.size(), filename.c_str());
+    return true;
+}
+
+// A precision line has the fields of a tuning, with the network shape
+// for m, n and k, and the speeds for the tuners.
+static const auto PRECISION_KERNEL = std::string("Precision");
+
+static std::string precision_line_prefix(const int channels,
+                                         const int blocks) {
+    return std::to_string(Tuner<float>::TUNER_VERSION) + ";"
+        + PRECISION_KERNEL + ";" + std::to_string(channels) + ";"
+        + std::to_string(blocks) + ";0;" + std::to_string(cfg_batch_size)
+        + ";";
+}
+
+bool load_precision_choice(const std::string& devices,
+                           const std::string& drivers, const int channels,
+                           const int blocks, PrecisionChoice& choice) {
+    auto lines = std::vector<std::string>{};
+    {
+        std::lock_guard<std::mutex> lock(tuner_mutex);
+        lines = read_tuner_lines(tuner_filename());
+    }
+    const auto prefix = precision_line_prefix(channels, blocks);
+    for (const auto& line : lines) {
+        const auto s = split_tuner_line(line);
+        if (s.size() != V2_FIELDS || line.compare(0, prefix.size(), prefix)
+            || s[7] != devices || s[8] != drivers
+            || s[9] != std::to_string(BOARD_SIZE)) {
+            continue;
+        }
+        auto ss = std::istringstream{s[6]};
+        auto half = 0;
+        if (ss >> half >> choice.single_speed >> choice.half_speed) {
+            choice.half = half != 0;
+            return true;
+        }
+    }
+    return false;
+}
+
+void store_precision_choice(const std::string& devices,
+                            const std::string& drivers, const int channels,
+                            const int blocks, const PrecisionChoice& choice) {
+    auto speeds = std::ostringstream{};
+    speeds << int(choice.half) << " " << choice.single_speed << " "
+           << choice.half_speed;
+    const auto line = precision_line_prefix(channels, blocks)
+        + speeds.str() + ";" + devices + ";" + drivers + ";"
+        + std::to_string(BOARD_SIZE) + ";1;1;"
+        + std::to_string(choice.half ? choice.half_speed : choice.single_speed);
+    const auto key = tuning_key(split_tuner_line(line));
+
+    std::lock_guard<std::mutex> lock(tuner_mutex);
+    const auto tuner_file = tuner_filename();
+    auto lines = std::vector<std::string>{};
+    for (const auto& old : read_tuner_lines(tuner_file)) {
+        if (tuning_key(split_tuner_line(old)) != key) {
+            lines.emplace_back(old);
+        }
+    }
+    lines.emplace_back(line);
+    if (!write_tuner_lines(tuner_file, lines)) {
+        myprintf("Could not save the precision choice to %s.\n",
+                 tuner_file.c_str());
+    }
+}
+
 #ifndef USE_BLAS
 // Eigen helpers
 template <typename T>
@@ -72,6 +292,13 @@ template <> std::string getTunerKernel<float>() {
     return std::string("XgemmBatched");
 }
 
+// The work-group shapes of the Winograd transforms and of convolve1.
+template <typename net_t> static std::string getConvTunerKernel();
+
+template <> std::string getConvTunerKernel<float>() {
+    return std::string("Convolve");
+}
+
 template <> float getTunerMaxError<float>() {
     return 1e-4f;
 }
@@ -81,13 +308,15 @@ template <> std::string getTunerKernel<half_float::half>() {
     return std::string("XgemmBatchedHalf");
 }
 
+template <> std::string getConvTunerKernel<half_float::half>() {
+    return std::string("ConvolveHalf");
+}
+
 template <> float getTunerMaxError<half_float::half>() {
     return 1e-1f;
 }
 #endif
 
-using namespace Utils;
-
 template <typename net_t>
 static void sgemmBatched_ref(const std::vector<net_t>& a,
                              const std::vector<net_t>& b,
@@ -408,8 +637,9 @@ std::vector<Parameters> Tuner<net_t>::build_valid_params() {
 }
 
 template <typename net_t>
-std::string Tuner<net_t>::tune_sgemm(const int m, const int n, const int k,
-                              const int batch_size, const int runs) {
+void Tuner<net_t>::tune_sgemm(const int m, const int n, const int k,
+                              const int batch_size, Tuning& progress,
+                              const int runs) {
     // This needs to be at minimum the maximum (MNK/WG) values above.
     auto m_max = std::max(256, m);
     auto n_max = std::max(256, n);
@@ -448,10 +678,18 @@ std::string Tuner<net_t>::tune_sgemm(const int m, const int n, const int k,
 
     auto valid_params = build_valid_params();
 
-    myprintf("Will try %zu valid configurations.\n", valid_params.size());
+    if (progress.tried > 0 && progress.total == valid_params.size()) {
+        myprintf("Resuming at configuration %zu of %zu.\n",
+                 progress.tried + 1, valid_params.size());
+    } else {
+        myprintf("Will try %zu valid configurations.\n", valid_params.size());
+        progress = Tuning{};
+    }
+    progress.total = valid_params.size();
 
-    std::string best_params;
-    auto best_time = unsigned{0};
+    std::string best_params = progress.tuners;
+    auto best_time = progress.best_time;
+    const auto start = std::chrono::steady_clock::now();
 
     auto queue = cl::CommandQueue(m_context,
                                   m_device,
@@ -462,14 +700,21 @@ std::string Tuner<net_t>::tune_sgemm(const int m, const int n, const int k,
     auto m_ceil_prev = 0;
     auto n_ceil_prev = 0;
     auto k_ceil_prev = 0;
-    auto param_counter = size_t{0};
+    auto param_counter = progress.tried;
     auto min_error = 100.0f;
     auto failed_compile = 0;
     auto failed_enqueue = 0;
     auto failed_error = 0;
 
-    for (auto & p : valid_params) {
-        param_counter++;
+    for (auto i = progress.tried; i < valid_params.size(); i++) {
+        // Stop at the time limit once there is a working configuration.
+        const auto elapsed = std::chrono::duration_cast<std::chrono::seconds>(
+            std::chrono::steady_clock::now() - start).count();
+        if (cfg_tune_time > 0 && best_time != 0 && elapsed >= cfg_tune_time) {
+            break;
+        }
+        auto & p = valid_params[i];
+        param_counter = i + 1;
 
         auto defines = parameters_to_defines(p);
 
@@ -593,47 +838,308 @@ std::string Tuner<net_t>::tune_sgemm(const int m, const int n, const int k,
         myprintf_error("Minimum error: %f. Error bound: %f\n", min_error, getTunerMaxError<net_t>());
         throw std::runtime_error("Tuner failed to find working configuration.");
     }
-    return best_params;
+    if (param_counter < valid_params.size()) {
+        myprintf("Tuning time limit reached after %zu of %zu configurations,\n"
+                 "it will continue on the next start.\n",
+                 param_counter, valid_params.size());
+    }
+    progress.tuners = best_params;
+    progress.tried = param_counter;
+    progress.best_time = best_time;
 }
 
 template <typename net_t>
-void Tuner<net_t>::store_sgemm_tuners(const int m, const int n, const int k,
-                               const int batch_size, std::string tuners) {
-    auto tuner_file = leelaz_file(TUNER_FILE_LOCAL);
-    auto file_contents = std::vector<std::string>();
-    {
-        // Read the previous contents to string
-        auto file = std::ifstream{tuner_file};
-        if (file.good()) {
-            auto line = std::string{};
-            while (std::getline(file, line)) {
-                file_contents.emplace_back(line);
+void Tuner<net_t>::tune_conv(const int channels, const int batch_size,
+                             Tuning& progress, const int runs) {
+    const auto tiles = batch_size * WINOGRAD_P;
+    // Any padding is fine for the transforms.
+    const auto kpad = int(ceilMultiple(channels, 64));
+    const auto ppad = int(ceilMultiple(tiles, 64));
+    const auto sites = batch_size * NUM_INTERSECTIONS;
+    const auto in_size = size_t(sites) * channels;
+    const auto vm_size = size_t(WINOGRAD_TILE) * kpad * ppad;
+
+    auto in = std::vector<net_t>(in_size);
+    auto m = std::vector<net_t>(vm_size);
+    auto weights = std::vector<net_t>(size_t(channels) * channels);
+    auto means = std::vector<net_t>(channels);
+    auto stddivs = std::vector<net_t>(channels);
+    for (auto i = size_t{0}; i < in_size; i++) {
+        in[i] = (int((i * 7919) % 256) - 128) / 256.0f;
+    }
+    for (auto i = size_t{0}; i < vm_size; i++) {
+        m[i] = (int((i * 104729) % 256) - 128) / 256.0f;
+    }
+    for (auto i = size_t{0}; i < weights.size(); i++) {
+        weights[i] = (int((i * 31) % 64) - 32) / 256.0f;
+    }
+    for (auto i = 0; i < channels; i++) {
+        means[i] = (i % 8) / 64.0f;
+        stddivs[i] = 1.0f;
+    }
+
+    auto make_buffer = [this](std::vector<net_t>& data) {
+        return cl::Buffer(m_context, CL_MEM_READ_WRITE | CL_MEM_COPY_HOST_PTR,
+                          data.size() * sizeof(net_t), data.data());
+    };
+    auto inBuffer = make_buffer(in);
+    auto mBuffer = make_buffer(m);
+    auto weightsBuffer = make_buffer(weights);
+    auto meansBuffer = make_buffer(means);
+    auto stddivsBuffer = make_buffer(stddivs);
+    auto outBuffer = cl::Buffer(m_context, CL_MEM_READ_WRITE,
+                                std::max(vm_size, in_size) * sizeof(net_t));
+
+    const auto max_wgs = m_device.getInfo<CL_DEVICE_MAX_WORK_GROUP_SIZE>();
+    const auto local_mem = m_device.getInfo<CL_DEVICE_LOCAL_MEM_SIZE>();
+
+    auto queue = cl::CommandQueue(m_context, m_device,
+                                  CL_QUEUE_PROFILING_ENABLE);
+    const auto zeros = std::vector<net_t>(std::max(vm_size, in_size));
+
+    // Runs kernel, returns the average time in ns and the output, or 0 if
+    // it cannot run.
+    auto run = [&queue, &outBuffer, &zeros, runs](
+        cl::Kernel& kernel, const cl::NDRange& global,
+        const cl::NDRange& local, const size_t out_size,
+        std::vector<net_t>& out) {
+        auto sum = 0.0f;
+        try {
+            queue.enqueueWriteBuffer(outBuffer, CL_TRUE, 0,
+                                     out_size * sizeof(net_t), zeros.data());
+            auto event = cl::Event();
+            for (auto r = 0; r < runs; r++) {
+                queue.enqueueNDRangeKernel(kernel, cl::NullRange,
+                                           global, local, nullptr, &event);
+                queue.finish();
+                sum += event.getProfilingInfo<CL_PROFILING_COMMAND_END>()
+                    - event.getProfilingInfo<CL_PROFILING_COMMAND_START>();
             }
+            out.resize(out_size);
+            queue.enqueueReadBuffer(outBuffer, CL_TRUE, 0,
+                                    out_size * sizeof(net_t), out.data());
+        } catch (const cl::Error&) {
+            return 0.0f;
+        }
+        return sum / runs;
+    };
+    auto error = [](const std::vector<net_t>& x,
+                    const std::vector<net_t>& ref) {
+        if (ref.empty() || x.size() != ref.size()) {
+            // No reference to compare with.
+            return std::numeric_limits<float>::max();
         }
+        auto sum = 0.0f;
+        for (auto i = size_t{0}; i < ref.size(); i++) {
+            const auto d = float(x[i]) - float(ref[i]);
+            sum += d * d;
+        }
+        return sum / ref.size();
+    };
+
+    const auto source = sourceCode_common + sourceCode_config
+        + sourceCode_convolve1 + sourceCode_convolve3;
+    auto build = [this, &source](const std::string& defines) {
+        auto program = cl::Program(m_context, source);
+        program.build((m_opencl.m_cl_args + " " + defines).c_str());
+        return program;
+    };
+
+    myprintf("\nStarted OpenCL convolution tuner.\n");
+
+    // The first value of each parameter is the untuned default, and its
+    // output is the reference for the others.
+    const auto in_wgs_opts = std::vector<size_t>{0, 16, 32, 64, 128, 256};
+    const auto out_kwg_opts = std::vector<size_t>{32, 8, 16, 64};
+    const auto out_bwg_opts = std::vector<size_t>{2, 1, 4, 8};
+    const auto conv1_opts = std::vector<size_t>{8, 6, 7, 9};
+    progress = Tuning{};
+    progress.total = in_wgs_opts.size()
+        + out_kwg_opts.size() * out_bwg_opts.size() + conv1_opts.size();
+
+    auto best = Parameters{{"IN_WGS", in_wgs_opts[0]},
+                           {"OUT_KWG", out_kwg_opts[0]},
+                           {"OUT_BWG", out_bwg_opts[0]},
+                           {"CONV1_ITEMS", conv1_opts[0]}};
+    auto best_times = std::array<float, 3>{};
+    auto report = [&progress](const std::string& kernel, const Parameters& p,
+                              const float time) {
+        auto params = std::string{};
+        for (const auto& x : p) {
+            params += " " + x.first + "=" + std::to_string(x.second);
+        }
+        myprintf("(%zu/%zu) %s%s %.4f ms\n", progress.tried, progress.total,
+                 kernel.c_str(), params.c_str(), 1e-6f * time);
+    };
+
+    try {
+        auto program = build("");
+        auto out = std::vector<net_t>{};
+        auto ref = std::vector<net_t>{};
+
+        auto in_kernel = cl::Kernel(program, "in_transform");
+        in_kernel.setArg(0, inBuffer);
+        in_kernel.setArg(1, outBuffer);
+        in_kernel.setArg(2, channels);
+        in_kernel.setArg(3, kpad);
+        in_kernel.setArg(4, ppad);
+        in_kernel.setArg(5, batch_size);
+        const auto wavefront = in_kernel.getWorkGroupInfo<
+            CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE>(m_device);
+        for (const auto in_wgs : in_wgs_opts) {
+            progress.tried++;
+            if (in_wgs > max_wgs) {
+                continue;
+            }
+            const auto global = cl::NDRange(
+                ceilMultiple(tiles, in_wgs ? in_wgs : wavefront), channels);
+            const auto local = in_wgs ? cl::NDRange(in_wgs, 1) : cl::NullRange;
+            const auto time = run(in_kernel, global, local, vm_size,
+                                  in_wgs == in_wgs_opts[0] ? ref : out);
+            if (time == 0.0f || (in_wgs != in_wgs_opts[0]
+                                 && error(out, ref) >= getTunerMaxError<net_t>())) {
+                continue;
+            }
+            if (best_times[0] == 0.0f || time < best_times[0]) {
+                best_times[0] = time;
+                best["IN_WGS"] = in_wgs;
+                report("in_transform", {{"IN_WGS", in_wgs}}, time);
+            }
+        }
+
+        auto conv1_kernel = cl::Kernel(program, "convolve1");
+        const cl_int4 conv1_sizes{sites, channels, channels, 0};
+        for (const auto log2_items : conv1_opts) {
+            progress.tried++;
+            if ((size_t{1} << log2_items) > max_wgs) {
+                continue;
+            }
+            const auto wg = convolve1_workgroup(channels, channels, log2_items);
+            conv1_kernel.setArg(0, inBuffer);
+            conv1_kernel.setArg(1, outBuffer);
+            conv1_kernel.setArg(2, weightsBuffer);
+            conv1_kernel.setArg(3, meansBuffer);
+            conv1_kernel.setArg(4, stddivsBuffer);
+            conv1_kernel.setArg(5, cl::Local(wg.sites * wg.channels * sizeof(float)));
+            conv1_kernel.setArg(6, cl::Local(wg.outputs * wg.channels * sizeof(float)));
+            conv1_kernel.setArg(7, cl::Local((size_t{1} << log2_items) * sizeof(float)));
+            conv1_kernel.setArg(8, conv1_sizes);
+            conv1_kernel.setArg(9, 0);
+            const auto global = cl::NDRange(ceilMultiple(sites, wg.sites),
+                                            ceilMultiple(channels, wg.outputs),
+                                            wg.channel_items);
+            const auto local = cl::NDRange(wg.sites, wg.outputs,
+                                           wg.channel_items);
+            const auto time = run(conv1_kernel, global, local, in_size,
+                                  log2_items == conv1_opts[0] ? ref : out);
+            if (time == 0.0f || (log2_items != conv1_opts[0]
+                                 && error(out, ref) >= getTunerMaxError<net_t>())) {
+                continue;
+            }
+            if (best_times[2] == 0.0f || time < best_times[2]) {
+                best_times[2] = time;
+                best["CONV1_ITEMS"] = log2_items;
+                report("convolve1", {{"CONV1_ITEMS", log2_items}}, time);
+            }
+        }
+    } catch (const cl::Error& e) {
+        myprintf("Could not tune the convolutions: %s: %d\n", e.what(), e.err());
     }
-    auto file = std::ofstream{tuner_file};
+
+    // OUT_KWG and OUT_BWG are the required work-group size of
+    // out_transform_fused_bn, so every pair is a build of its own.
+    auto ref = std::vector<net_t>{};
+    auto out = std::vector<net_t>{};
+    for (const auto kwg : out_kwg_opts) {
+        for (const auto bwg : out_bwg_opts) {
+            progress.tried++;
+            const auto is_default = kwg == out_kwg_opts[0]
+                && bwg == out_bwg_opts[0];
+            // out_buf, in single precision at most.
+            const auto buf_size = kwg * bwg * WINOGRAD_M * (WINOGRAD_M + 1)
+                * sizeof(float);
+            if (kwg * bwg > max_wgs || buf_size > local_mem) {
+                continue;
+            }
+            auto time = 0.0f;
+            try {
+                auto program = build(" -DOUT_KWG=" + std::to_string(kwg)
+                                     + " -DOUT_BWG=" + std::to_string(bwg));
+                auto out_kernel = cl::Kernel(program, "out_transform_fused_bn");
+                out_kernel.setArg(0, mBuffer);
+                out_kernel.setArg(1, outBuffer);
+                out_kernel.setArg(2, channels);
+                out_kernel.setArg(3, kpad);
+                out_kernel.setArg(4, ppad);
+                out_kernel.setArg(5, batch_size);
+                out_kernel.setArg(6, nullptr);
+                out_kernel.setArg(7, meansBuffer);
+                out_kernel.setArg(8, stddivsBuffer);
+                const auto global = cl::NDRange(ceilMultiple(channels, kwg),
+                                                ceilMultiple(tiles, bwg));
+                time = run(out_kernel, global, cl::NDRange(kwg, bwg),
+                           in_size, is_default ? ref : out);
+            } catch (const cl::Error&) {
+                // Failed to compile, try the next one.
+                continue;
+            }
+            if (time == 0.0f || (!is_default
+                                 && error(out, ref) >= getTunerMaxError<net_t>())) {
+                continue;
+            }
+            if (best_times[1] == 0.0f || time < best_times[1]) {
+                best_times[1] = time;
+                best["OUT_KWG"] = kwg;
+                best["OUT_BWG"] = bwg;
+                report("out_transform", {{"OUT_KWG", kwg}, {"OUT_BWG", bwg}},
+                       time);
+            }
+        }
+    }
+
+    if (best_times[0] == 0.0f && best_times[1] == 0.0f
+        && best_times[2] == 0.0f) {
+        // Not even the defaults ran: keep them and tune again next time.
+        myprintf("Could not time the convolutions, using the defaults.\n");
+        progress.tried = 0;
+    }
+    progress.tuners = parameters_to_defines(best);
+    progress.best_time = best_times[0] + best_times[1] + best_times[2];
+}
+
+template <typename net_t>
+void Tuner<net_t>::store_tuners(const std::string& kernel,
+                                const int m, const int n, const int k,
+                                const int batch_size, const Tuning& tuning) {
+    auto tuner_file = tuner_filename();
 
     auto device_name = m_opencl.get_device_name();
     auto tuning_params = std::stringstream{};
     tuning_params << m << ";" << n << ";" << k << ";" << batch_size;
 
     auto tuning_line_prefix = std::to_string(TUNER_VERSION) + ";"
-        + getTunerKernel<net_t>() + ";" + tuning_params.str() + ";";
-    auto tuning_line = tuning_line_prefix + tuners + ";" + device_name;
+        + kernel + ";" + tuning_params.str() + ";";
+    auto tuning_line = tuning_line_prefix + tuning.tuners + ";" + device_name
+        + ";" + m_opencl.get_driver_version() + ";" + std::to_string(BOARD_SIZE)
+        + ";" + std::to_string(tuning.tried) + ";" + std::to_string(tuning.total)
+        + ";" + std::to_string(tuning.best_time);
+    const auto key = tuning_key(split_tuner_line(tuning_line));
+
+    std::lock_guard<std::mutex> lock(tuner_mutex);
 
     // Write back previous data as long as it's not the device and
     // tuning we just tuned
-    for (const auto& line : file_contents) {
-        if (line.find(tuning_line_prefix) == std::string::npos
-            || line.find(device_name) == std::string::npos) {
-            file << line << std::endl;
+    auto file_contents = std::vector<std::string>();
+    for (const auto& line : read_tuner_lines(tuner_file)) {
+        if (tuning_key(split_tuner_line(line)) != key) {
+            file_contents.emplace_back(line);
         }
     }
 
     // Write new tuning
-    file << tuning_line << std::endl;
+    file_contents.emplace_back(tuning_line);
 
-    if (file.fail()) {
+    if (!write_tuner_lines(tuner_file, file_contents)) {
         myprintf("Could not save the tuning result.\n");
         myprintf("Do I have write permissions on %s?\n",
             tuner_file.c_str());
@@ -641,87 +1147,143 @@ void Tuner<net_t>::store_sgemm_tuners(const int m, const int n, const int k,
 }
 
 template <typename net_t>
-std::string Tuner<net_t>::sgemm_tuners_from_line(std::string line,
-                                          const int m, const int n, const int k,
-                                          const int batch_size) {
-    auto s = std::vector<std::string>{};
-    auto ss = std::stringstream{line};
-    auto item = std::string{};
-
-    while (std::getline(ss, item, ';')) {
-        s.emplace_back(item);
+bool Tuner<net_t>::tuners_from_line(std::string line,
+                                    const std::string& kernel,
+                                    const int m, const int n, const int k,
+                                    const int batch_size, Tuning& tuning) {
+    auto s = split_tuner_line(line);
+
+    if (s.size() != V1_FIELDS && s.size() != V2_FIELDS) {
+        return false;
     }
 
-    if (s.size() != 8) {
-        return "";
+    // Version 1 tunings are finished and still valid, but were not keyed
+    // by driver or board size.
+    const auto version = s[0];
+    if (version != std::to_string(TUNER_VERSION) && version != "1") {
+        return false;
     }
-
-    if (s[0] != std::to_string(TUNER_VERSION)) {
-        return "";
+    if (version == "1" && s.size() != V1_FIELDS) {
+        return false;
+    }
+    if (version != "1" && s.size() != V2_FIELDS) {
+        return false;
     }
 
-    if (s[1] != getTunerKernel<net_t>()) {
-        return "";
+    if (s[1] != kernel) {
+        return false;
     }
 
     if (s[2] != std::to_string(m)) {
-        return "";
+        return false;
     }
 
     if (s[3] != std::to_string(n)) {
-        return "";
+        return false;
     }
 
     if (s[4] != std::to_string(k)) {
-        return "";
+        return false;
     }
 
     if (s[5] != std::to_string(batch_size)) {
-        return "";
+        return false;
     }
 
     if (s[7] != m_opencl.get_device_name()) {
-        return "";
+        return false;
+    }
+
+    tuning = Tuning{};
+    tuning.tuners = s[6];
+    if (version == "1") {
+        tuning.tried = tuning.total = std::numeric_limits<size_t>::max();
+        return true;
     }
 
-    return s[6];
+    if (s[8] != m_opencl.get_driver_version()
+        || s[9] != std::to_string(BOARD_SIZE)) {
+        return false;
+    }
+    tuning.tried = std::stoull(s[10]);
+    tuning.total = std::stoull(s[11]);
+    tuning.best_time = std::stof(s[12]);
+    return true;
 }
 
 template <typename net_t>
 std::string Tuner<net_t>::load_sgemm_tuners(const int m, const int n, const int k,
                                      const int batch_size) {
-    auto tuner_file = leelaz_file(TUNER_FILE_LOCAL);
-    auto file = std::ifstream{tuner_file};
-
-    auto try_prior_tuning = file.good();
-
-    // If we want full tuning, don't reuse previously tuned results
-    // except if the tuning was created from this run from a different
-    // GPU instance with the same name.  This prevents the tuner running
-    // for multiple times if the system has multiple same GPUs.
-    if (try_prior_tuning && cfg_sgemm_exhaustive) {
-        auto dev = m_opencl.get_device_name();
-        try_prior_tuning = std::any_of(
-            begin(tuned_devices),
-            end(tuned_devices),
-            [&dev](const std::string & x) { return dev == x; }
-        );
+    auto tuner_file = tuner_filename();
+    auto lines = std::vector<std::string>{};
+    auto try_prior_tuning = true;
+    {
+        std::lock_guard<std::mutex> lock(tuner_mutex);
+        lines = read_tuner_lines(tuner_file);
+
+        // If we want full tuning, don't reuse previously tuned results
+        // except if the tuning was created from this run from a different
+        // GPU instance with the same name.  This prevents the tuner running
+        // for multiple times if the system has multiple same GPUs.
+        if (cfg_sgemm_exhaustive) {
+            auto dev = m_opencl.get_device_name();
+            try_prior_tuning = std::any_of(
+                begin(tuned_devices),
+                end(tuned_devices),
+                [&dev](const std::string & x) { return dev == x; }
+            );
+        }
+        tuned_devices.emplace_back(m_opencl.get_device_name());
     }
-    tuned_devices.emplace_back(m_opencl.get_device_name());
 
+    auto progress = Tuning{};
     if (try_prior_tuning) {
-        auto line = std::string{};
-        while (std::getline(file, line)) {
-            auto tuners = sgemm_tuners_from_line(line, m, n, k, batch_size);
-            if (tuners.size() != 0) {
-                myprintf("Loaded existing SGEMM tuning.\n");
-                return tuners;
-            }
+        progress = find_tuning(lines, getTunerKernel<net_t>(),
+                               m, n, k, batch_size);
+        if (!progress.tuners.empty() && progress.tried >= progress.total) {
+            myprintf("Loaded existing SGEMM tuning.\n");
+            return progress.tuners;
         }
     }
-    auto tuners = tune_sgemm(m, n, k, batch_size);
-    store_sgemm_tuners(m, n, k, batch_size, tuners);
-    return tuners;
+    tune_sgemm(m, n, k, batch_size, progress);
+    store_tuners(getTunerKernel<net_t>(), m, n, k, batch_size, progress);
+    return progress.tuners;
+}
+
+template <typename net_t>
+typename Tuner<net_t>::Tuning Tuner<net_t>::find_tuning(
+    const std::vector<std::string>& lines, const std::string& kernel,
+    const int m, const int n, const int k, const int batch_size) {
+    auto progress = Tuning{};
+    for (const auto& line : lines) {
+        auto tuning = Tuning{};
+        if (tuners_from_line(line, kernel, m, n, k, batch_size, tuning)
+            && (progress.tuners.empty() || tuning.tried > progress.tried)) {
+            progress = tuning;
+        }
+    }
+    return progress;
+}
+
+template <typename net_t>
+std::string Tuner<net_t>::load_conv_tuners(const int channels,
+                                           const int batch_size) {
+    const auto n = batch_size * WINOGRAD_P;
+    auto lines = std::vector<std::string>{};
+    {
+        std::lock_guard<std::mutex> lock(tuner_mutex);
+        lines = read_tuner_lines(tuner_filename());
+    }
+    auto progress = find_tuning(lines, getConvTunerKernel<net_t>(),
+                                channels, n, channels, batch_size);
+    if (!progress.tuners.empty() && progress.tried >= progress.total) {
+        myprintf("Loaded existing convolution tuning.\n");
+        return progress.tuners;
+    }
+    tune_conv(channels, batch_size, progress);
+    store_tuners(getConvTunerKernel<net_t>(), channels, n, channels,
+                 batch_size, progress);
+    return progress.tuners;
 }
 
 template <typename net_t>
@@ -48,10 +48,26 @@ class Tuner {
     cl::Device m_device;
     bool m_use_tensorcore = false;
 public:
-    std::string tune_sgemm(const int m, const int n, const int k,
-                           const int batch_size, const int runs = 4);
+    // Result of a possibly unfinished tuning run: the best parameters
+    // found after trying the first tried of total configurations.
+    struct Tuning {
+        std::string tuners;
+        size_t tried{0};
+        size_t total{0};
+        float best_time{0.0f};
+    };
+
+    // Continues the tuning in progress for up to cfg_tune_time seconds.
+    void tune_sgemm(const int m, const int n, const int k,
+                    const int batch_size, Tuning& progress,
+                    const int runs = 4);
     std::string load_sgemm_tuners(const int m, const int n, const int k,
                                   const int batch_size);
+    // Work-group sizes of the Winograd transforms and of convolve1, each
+    // timed on its own with the other kernels at their defaults.
+    void tune_conv(const int channels, const int batch_size,
+                   Tuning& progress, const int runs = 4);
+    std::string load_conv_tuners(const int channels, const int batch_size);
 
     // list of device types that was tuned in this run.
     // This is to prevent the same device from being tuned multiple times.
@@ -59,24 +75,51 @@ public:
 
     // version 0 : Initial release
     // version 1 : Tuner with additional tensor cores (parameter TCE)
-    static constexpr auto TUNER_VERSION = 1;
+    // version 2 : Keyed by driver and board size, saves partial tunings
+    static constexpr auto TUNER_VERSION = 2;
 
     Tuner(OpenCL<net_t> & opencl, cl::Context context, cl::Device device) :
         m_opencl(opencl), m_context(context), m_device(device) {}
 
     void enable_tensorcore();
 private:
-    void store_sgemm_tuners(const int m, const int n, const int k,
-                            const int batch_size, std::string tuners);
+    void store_tuners(const std::string& kernel, const int m, const int n,
+                      const int k, const int batch_size,
+                      const Tuning& tuning);
     bool valid_config_sgemm(Parameters p, bool exhaustive);
     std::string parameters_to_defines(const Parameters& p);
     std::string parameters_to_string(const Parameters& p);
     Parameters get_parameters_by_int(const std::vector<Configurations>& opts,
                                      const int n);
-    std::string sgemm_tuners_from_line(std::string line, const int m,
-                                       const int n, const int k,
-                                       const int batch_size);
+    bool tuners_from_line(std::string line, const std::string& kernel,
+                          const int m, const int n, const int k,
+                          const int batch_size, Tuning& tuning);
+    // The most complete tuning of kernel for this device and size in lines.
+    Tuning find_tuning(const std::vector<std::string>& lines,
+                       const std::string& kernel, const int m, const int n,
+                       const int k, const int batch_size);
     std::vector<Parameters> build_valid_params();
 };
 
+// The result of a precision autodetection, saved in the tuner file for
+// the devices, their drivers and the network shape.
+struct PrecisionChoice {
+    bool half{false};
+    // Evaluations per second, negative if that precision failed to run.
+    float single_speed{-1.0f};
+    float half_speed{-1.0f};
+};
+bool load_precision_choice(const std::string& devices,
+                           const std::string& drivers, const int channels,
+                           const int blocks, PrecisionChoice& choice);
+void store_precision_choice(const std::string& devices,
+                            const std::string& drivers, const int channels,
+                            const int blocks, const PrecisionChoice& choice);
+
+// Merge the tunings of another file into the tuner file, keeping for
+// each device and size the more complete one.
+bool tuner_import(const std::string& filename);
+// Copy the tuner file.
+bool tuner_export(const std::string& filename);
+
 #endif
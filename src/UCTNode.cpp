@@ -34,12 +34,16 @@
 #include <cstdio>
 #include <cstdint>
 #include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstring>
 #include <functional>
 #include <iterator>
 #include <limits>
 #include <numeric>
 #include <random>
+#include <string>
+#include <type_traits>
 #include <utility>
 #include <vector>
 
@@ -48,14 +52,64 @@
 #include "FastState.h"
 #include "GTP.h"
 #include "GameState.h"
+#include "Lockstep.h"
 #include "Network.h"
+#include "NodePool.h"
 #include "Random.h"
+#include "SearchProfiler.h"
 #include "Utils.h"
 #include "UCTSearch.h"
 
 using namespace Utils;
 
-UCTNode::UCTNode(int vertex, float policy) : m_move(vertex), m_policy(policy) {
+std::atomic<size_t> UCTNode::s_expand_waits{0};
+std::atomic<size_t> UCTNode::s_expand_wait_us{0};
+std::atomic<size_t> UCTNode::s_expand_skips{0};
+std::atomic<size_t> UCTNode::s_expand_collisions{0};
+
+UCTNode::UCTNode(int vertex, float policy) : m_policy(policy), m_move(vertex) {
+}
+
+UCTNode::~UCTNode() {
+    delete m_agent_quantiles.load();
+}
+
+void* UCTNode::operator new(size_t size) {
+    assert(size == sizeof(UCTNode));
+    (void)size;
+    return NodePool<UCTNode>::allocate();
+}
+
+void UCTNode::operator delete(void* ptr) {
+    if (ptr) {
+        NodePool<UCTNode>::deallocate(ptr);
+    }
+}
+
+void* UCTNodeQuantiles::operator new(size_t size) {
+    assert(size == sizeof(UCTNodeQuantiles));
+    (void)size;
+    return NodePool<UCTNodeQuantiles>::allocate();
+}
+
+void UCTNodeQuantiles::operator delete(void* ptr) {
+    if (ptr) {
+        NodePool<UCTNodeQuantiles>::deallocate(ptr);
+    }
+}
+
+UCTNodeQuantiles& UCTNode::agent_quantiles() {
+    auto quantiles = m_agent_quantiles.load();
+    if (quantiles == nullptr) {
+        auto created = new UCTNodeQuantiles;
+        if (m_agent_quantiles.compare_exchange_strong(quantiles, created)) {
+            quantiles = created;
+        } else {
+            // Another thread got there first, quantiles now holds its block.
+            delete created;
+        }
+    }
+    return *quantiles;
 }
 
 bool UCTNode::first_visit() const {
@@ -78,6 +132,9 @@ bool UCTNode::create_children(Network & network,
 
     // acquire the lock
     if (!acquire_expanding()) {
+        if (m_expand_state.load() == ExpandState::EXPANDING) {
+            s_expand_collisions++;
+        }
         return false;
     }
 
@@ -89,9 +146,30 @@ bool UCTNode::create_children(Network & network,
 
     NNCache::Netresult raw_netlist;
     try {
-        raw_netlist = network.get_output(
-            &state, Network::Ensemble::RANDOM_SYMMETRY,
-            -1, cfg_use_nncache, cfg_use_nncache);
+        if (Lockstep::active()) {
+            // The cache is probed during the descent and filled during
+            // the backup, so that its hits don't depend on the timing
+            // of the evaluations of the other threads.
+            auto cached = false;
+            if (cfg_use_nncache) {
+                SearchProfiler::Scope scope{SearchProfiler::CACHE_PROBE};
+                cached = network.probe_cache(&state, raw_netlist);
+            }
+            Lockstep::end_descent();
+            if (!cached) {
+                raw_netlist = network.get_output(
+                    &state, Network::Ensemble::RANDOM_SYMMETRY,
+                    -1, false, false);
+            }
+            Lockstep::begin_backup();
+            if (!cached && cfg_use_nncache) {
+                network.store_cache(&state, raw_netlist);
+            }
+        } else {
+            raw_netlist = network.get_output(
+                &state, Network::Ensemble::RANDOM_SYMMETRY,
+                -1, cfg_use_nncache, cfg_use_nncache);
+        }
     } catch (NetworkHaltException&) {
         expand_cancel();
         throw;
@@ -117,22 +195,17 @@ bool UCTNode::create_children(Network & network,
         m_net_pi = value;
     }
 
-    std::vector<int> stabilizer_subgroup;
-
-    for (auto i = 0; i < 8; i++) {
-        if(i == 0 || (cfg_exploit_symmetries && state.is_symmetry_invariant(i))) {
-            stabilizer_subgroup.emplace_back(i);
-        }
-    }
+    const auto stabilizer_subgroup = state.get_stabilizer_subgroup();
 
     std::vector<Network::PolicyVertexPair> nodelist;
     std::array<bool, NUM_INTERSECTIONS> taken_already{};
     auto unif_law = std::uniform_real_distribution<float>{0.0, 1.0};
 
+    const auto legal_moves = state.get_legal_moves(to_move);
     auto legal_sum = 0.0f;
     for (auto i = 0; i < NUM_INTERSECTIONS; i++) {
-        const auto vertex = state.board.get_vertex(i);
-        if (state.is_move_legal(to_move, vertex) && !taken_already[i]) {
+        if (legal_moves[i] && !taken_already[i]) {
+            const auto vertex = state.board.get_vertex(i);
             auto taken_policy = 0.0f;
             auto max_u = 0.0f;
             auto chosen_vertex = vertex;
@@ -202,13 +275,16 @@ bool UCTNode::create_children(Network & network,
     }
 
     link_nodelist(nodecount, nodelist, min_psa_ratio);
-    // Increment visit and assign eval.
-    const auto result = SearchResult::from_eval(value, alpkt, beta, beta2,
-                                                network.m_value_head_sai);
-    update(result);
-    if (network.m_value_head_sai) {
-        set_lambda_mu(state);
-        update_all_quantiles(alpkt, beta, beta2);
+    {
+        // Increment visit and assign eval.
+        SearchProfiler::Scope scope{SearchProfiler::BACKUP};
+        const auto result = SearchResult::from_eval(value, alpkt, beta, beta2,
+                                                    network.m_value_head_sai);
+        update(result);
+        if (network.m_value_head_sai) {
+            set_lambda_mu(state);
+            update_all_quantiles(alpkt, beta, beta2);
+        }
     }
     expand_done();
     return true;
@@ -252,7 +328,7 @@ void UCTNode::link_nodelist(std::atomic<int>& nodecount,
     m_min_psa_ratio_children = skipped_children ? min_psa_ratio : 0.0f;
 }
 
-const std::vector<UCTNodePointer>& UCTNode::get_children() const {
+const UCTNodeChildren& UCTNode::get_children() const {
     return m_children;
 }
 
@@ -262,11 +338,25 @@ int UCTNode::get_move() const {
 }
 
 void UCTNode::virtual_loss() {
-    m_virtual_loss += VIRTUAL_LOSS_COUNT;
+    m_virtual_loss++;
 }
 
 void UCTNode::virtual_loss_undo() {
-    m_virtual_loss -= VIRTUAL_LOSS_COUNT;
+    m_virtual_loss--;
+}
+
+// Losses counted in the eval of this node for the playouts in flight
+// through it, to encourage other threads to explore other parts of the
+// search tree. With many evaluations in flight, cfg_virtual_loss for
+// each of them pushes the threads away from the best line altogether,
+// so the adaptive mode only lets the total grow with the square root
+// of their number.
+float UCTNode::get_virtual_losses() const {
+    const auto in_flight = m_virtual_loss.load();
+    if (cfg_adaptive_vl) {
+        return cfg_virtual_loss * std::sqrt(static_cast<float>(in_flight));
+    }
+    return static_cast<float>(cfg_virtual_loss * in_flight);
 }
 
 float UCTNode::update(const SearchResult &result, bool forced) {
@@ -292,16 +382,28 @@ float UCTNode::update(const SearchResult &result, bool forced) {
     return eval;
 }
 
-void UCTNode::update_gxx_sums(std::atomic<float> &old_gxgp_sum,
-                              std::atomic<float> &old_gp_sum,
-                              float old_quantile, float new_alpkt,
-                              float new_beta, float new_beta2) {
-    const auto g_func = sigmoid(new_alpkt, new_beta, old_quantile, new_beta2);
+void UCTNode::add_visits(const int visits, const double blackevals) {
+    const auto variance = get_eval_variance();
+    m_visits += visits;
+    atomic_add(m_blackevals, blackevals);
+    atomic_add(m_squared_eval_diff, variance * static_cast<float>(visits));
+    atomic_add(m_pi_sum, static_cast<float>(blackevals));
+}
+
+GxxSums UCTNode::update_gxx_sums(std::atomic<GxxSums> &sums,
+                                 float old_quantile, float new_alpkt,
+                                 float new_beta, float new_beta2) {
+    const auto g_func = sigmoid_fast(new_alpkt, new_beta, old_quantile, new_beta2);
     const auto right_beta = (new_beta2 > 0 && new_alpkt + old_quantile > 0) ? new_beta2 : new_beta;
     const auto gp_term = right_beta * g_func.first * g_func.second;
     const auto gxgp_term = g_func.first - old_quantile * gp_term;
-    atomic_add(old_gxgp_sum, gxgp_term);
-    atomic_add(old_gp_sum, gp_term);
+    auto old_sums = sums.load();
+    auto new_sums = GxxSums{};
+    do {
+        new_sums.gxgp = old_sums.gxgp + gxgp_term;
+        new_sums.gp = old_sums.gp + gp_term;
+    } while (!sums.compare_exchange_weak(old_sums, new_sums));
+    return new_sums;
 }
 
 float UCTNode::get_beta_tree() const {
@@ -310,14 +412,14 @@ float UCTNode::get_beta_tree() const {
         return get_beta_median();
     }
 
-    const auto sum_derivatives = static_cast<float>(m_gp_sum_one);
+    const auto sum_derivatives = m_sums_one.load().gp;
     return 4.0f * sum_derivatives / visits;
 }
 
 
 void UCTNode::update_quantile(std::atomic<float> &old_quantile,
-                              float old_gxgp_sum, float old_gp_sum,
-                              float parameter, int new_visits, float avg_pi,
+                              GxxSums sums, float parameter,
+                              int new_visits, float avg_pi,
                               float new_alpkt, float new_beta, float new_beta2) {
     if (std::abs(parameter) < 1e-5) {
         old_quantile = 0.0f;
@@ -333,38 +435,44 @@ void UCTNode::update_quantile(std::atomic<float> &old_quantile,
         const auto right_beta = (new_beta2 > 0 && avg_p > 0.5) ? new_beta2 : new_beta;
         old_quantile = (std::log(avg_p) - std::log1p(-avg_p)) / std::max(0.01f, right_beta) - new_alpkt;
     } else {
-        const auto avg_f_prime = old_gp_sum / float(new_visits);
-        const auto avg_f = old_gxgp_sum / float(new_visits)
+        const auto avg_f_prime = sums.gp / float(new_visits);
+        const auto avg_f = sums.gxgp / float(new_visits)
             + static_cast<float>(old_quantile) * avg_f_prime;
         const auto delta = (avg_p - avg_f) / std::max(0.1f, avg_f_prime);
         atomic_add(old_quantile, delta);
     }
 }
 
+static bool agent_parameters_used() {
+    const auto nonzero = [](float x) { return x != 0.0f; };
+    return std::any_of(begin(cfg_lambda), end(cfg_lambda), nonzero)
+        || std::any_of(begin(cfg_mu), end(cfg_mu), nonzero);
+}
+
 void UCTNode::update_all_quantiles(float new_alpkt, float new_beta, float new_beta2) {
     // Cache values to avoid race conditions.
     const auto avg_pi = get_avg_pi();
-    const auto old_q_lambda = static_cast<float>(m_quantile_lambda);
-    const auto old_q_mu = static_cast<float>(m_quantile_mu);
     const auto old_q_one = static_cast<float>(m_quantile_one);
     const auto new_visits = static_cast<int>(++m_quantile_updates);
-    update_gxx_sums(m_gxgp_sum_lambda, m_gp_sum_lambda, old_q_lambda,
-                    new_alpkt, new_beta, new_beta2);
-    update_gxx_sums(m_gxgp_sum_mu, m_gp_sum_mu, old_q_mu,
-                    new_alpkt, new_beta, new_beta2);
-    update_gxx_sums(m_gxgp_sum_one, m_gp_sum_one, old_q_one,
-                    new_alpkt, new_beta, new_beta2);
-    update_quantile(m_quantile_lambda,
-                    static_cast<float>(m_gxgp_sum_lambda),
-                    static_cast<float>(m_gp_sum_lambda),
-                    get_lambda(), new_visits, avg_pi, new_alpkt, new_beta, new_beta2);
-    update_quantile(m_quantile_mu,
-                    static_cast<float>(m_gxgp_sum_mu),
-                    static_cast<float>(m_gp_sum_mu),
-                    get_mu(), new_visits, avg_pi, new_alpkt, new_beta, new_beta2);
-    update_quantile(m_quantile_one,
-                    static_cast<float>(m_gxgp_sum_one),
-                    static_cast<float>(m_gp_sum_one),
+
+    // With every lambda and mu at zero the agent quantiles stay at zero,
+    // so they are not even allocated.
+    if (agent_parameters_used()) {
+        auto& aq = agent_quantiles();
+        const auto old_q_lambda = static_cast<float>(aq.quantile_lambda);
+        const auto old_q_mu = static_cast<float>(aq.quantile_mu);
+        const auto sums_lambda = update_gxx_sums(aq.sums_lambda, old_q_lambda,
+                                                 new_alpkt, new_beta, new_beta2);
+        const auto sums_mu = update_gxx_sums(aq.sums_mu, old_q_mu,
+                                             new_alpkt, new_beta, new_beta2);
+        update_quantile(aq.quantile_lambda, sums_lambda,
+                        get_lambda(), new_visits, avg_pi, new_alpkt, new_beta, new_beta2);
+        update_quantile(aq.quantile_mu, sums_mu,
+                        get_mu(), new_visits, avg_pi, new_alpkt, new_beta, new_beta2);
+    }
+    const auto sums_one = update_gxx_sums(m_sums_one, old_q_one,
+                                          new_alpkt, new_beta, new_beta2);
+    update_quantile(m_quantile_one, sums_one,
                     1, new_visits, avg_pi, new_alpkt, new_beta, new_beta2);
 }
 
@@ -401,11 +509,15 @@ void UCTNode::set_policy(float policy) {
 #ifdef USE_EVALCMD
 void UCTNode::set_progid(int id) {
     assert(id >= 0);
-    m_progid.push_back(id);
+    if (!m_progid) {
+        m_progid = std::make_unique<std::vector<int>>();
+    }
+    m_progid->push_back(id);
 }
 
-std::vector<int>& UCTNode::get_progid() {
-    return m_progid;
+const std::vector<int>& UCTNode::get_progid() const {
+    static const auto none = std::vector<int>{};
+    return m_progid ? *m_progid : none;
 }
 #endif
 
@@ -433,10 +545,13 @@ int UCTNode::get_visits() const {
 }
 
 int UCTNode::get_denom() const {
+    // In adaptive mode, playouts in flight also count as visits
+    // for the exploration term.
+    const auto virtual_visits = cfg_adaptive_vl ? m_virtual_loss.load() : 0;
     if (cfg_laddercode) {
-        return 1 + m_visits - m_forced;
+        return 1 + m_visits + virtual_visits - m_forced;
     } else {
-        return 1 + m_visits;
+        return 1 + m_visits + virtual_visits;
     }
 }
 
@@ -469,7 +584,21 @@ float UCTNode::get_eval_lcb(int color) const {
     return mean - z * stddev;
 }
 
-float UCTNode::get_raw_eval(int tomove, int virtual_loss) const {
+float UCTNode::get_eval_ucb(int color) const {
+    // Upper confidence bound of winrate, see get_eval_lcb().
+    auto visits = get_visits();
+    if (visits < 2) {
+        return 1e6f - visits;
+    }
+    auto mean = get_raw_eval(color);
+
+    auto stddev = std::sqrt(get_eval_variance(1.0f) / visits);
+    auto z = cached_t_quantile(visits - 1);
+
+    return mean + z * stddev;
+}
+
+float UCTNode::get_raw_eval(int tomove, float virtual_loss) const {
     auto visits = get_visits() + virtual_loss;
     assert(visits > 0);
     auto blackeval = get_blackevals();
@@ -487,7 +616,7 @@ float UCTNode::get_eval(int tomove) const {
     // Due to the use of atomic updates and virtual losses, it is
     // possible for the visit count to change underneath us. Make sure
     // to return a consistent result to the caller by caching the values.
-    return get_raw_eval(tomove, m_virtual_loss);
+    return get_raw_eval(tomove, get_virtual_losses());
 }
 
 float UCTNode::get_net_pi(int tomove) const {
@@ -507,17 +636,42 @@ float UCTNode::get_avg_pi(int tomove) const {
 }
 
 float UCTNode::get_quantile_lambda(int tomove) const {
+    const auto aq = m_agent_quantiles.load();
+    const auto quantile = aq ? aq->quantile_lambda.load() : 0.0f;
     if (tomove == FastBoard::WHITE) {
-        return -m_quantile_lambda;
+        return -quantile;
     }
-    return m_quantile_lambda;
+    return quantile;
 }
 
 float UCTNode::get_quantile_mu(int tomove) const {
+    const auto aq = m_agent_quantiles.load();
+    const auto quantile = aq ? aq->quantile_mu.load() : 0.0f;
     if (tomove == FastBoard::WHITE) {
-        return -m_quantile_mu;
+        return -quantile;
+    }
+    return quantile;
+}
+
+float UCTNode::get_father_quantile_lambda() const {
+    const auto aq = m_agent_quantiles.load();
+    return aq ? aq->father_quantile_lambda.load() : 0.0f;
+}
+
+float UCTNode::get_father_quantile_mu() const {
+    const auto aq = m_agent_quantiles.load();
+    return aq ? aq->father_quantile_mu.load() : 0.0f;
+}
+
+void UCTNode::set_father_quantiles(const UCTNode* father) {
+    const auto lambda = father->get_quantile_lambda();
+    const auto mu = father->get_quantile_mu();
+    if (lambda == 0.0f && mu == 0.0f && !m_agent_quantiles.load()) {
+        return;
     }
-    return m_quantile_mu;
+    auto& aq = agent_quantiles();
+    aq.father_quantile_lambda = lambda;
+    aq.father_quantile_mu = mu;
 }
 
 double UCTNode::get_blackevals() const {
@@ -528,42 +682,119 @@ void UCTNode::accumulate_eval(float eval) {
     atomic_add(m_blackevals, double(eval));
 }
 
-float UCTNode::get_fpu_eval(int color, bool is_root, size_t &parentvisits) const {
-    // fpu reduction is computed on the largest of the children which
-    // have already been visited,
-    auto total_visited_policy = 0.0f;
-    auto max_eval = 0.0f;
-    parentvisits = size_t{0};
+namespace {
+
+// Accumulates the visited children of a node into the eval for the
+// unvisited ones, see UCTNode::get_fpu_eval().
+class FpuEval {
+public:
+    void add(float child_eval, int child_visits, float child_policy) {
+        // fpu reduction is computed on the largest of the children which
+        // have already been visited,
+        m_max_eval = std::max(m_max_eval, child_eval);
+        m_parentvisits += child_visits;
+        m_total_visited_policy += child_policy;
+
+        ++m_n;
+        m_avg_eval += (child_eval - m_avg_eval) / m_n;
+    }
+
+    size_t parentvisits() const {
+        return m_parentvisits;
+    }
+
+    float eval(bool is_root) const {
+        if (cfg_fpuavg) {
+            // We want the average of children except for the best one
+            auto avg_eval = m_avg_eval;
+            if (m_n > 1) {
+                avg_eval -= (m_max_eval - avg_eval) / (m_n - 1);
+            }
+            return avg_eval;
+        }
+
+        const auto fpu_reduction = (is_root ? cfg_fpu_root_reduction : cfg_fpu_reduction) * std::sqrt(m_total_visited_policy);
+        // Estimated eval for unknown nodes = parent (not NN) eval - reduction
+        return cfg_fpuzero ? 0.0f : m_max_eval - fpu_reduction;
+    }
+
+private:
+    float m_total_visited_policy{0.0f};
+    float m_max_eval{0.0f};
+    size_t m_parentvisits{0};
 
     // fpu average requires these variables
-    auto n = 0;
-    auto avg_eval = 0.0f;
+    int m_n{0};
+    float m_avg_eval{0.0f};
+};
+
+// The children uct_select_child() can choose and the terms of their
+// PUCT values, one array per term so that the values are computed in
+// a loop over contiguous memory. Unvisited children take the fpu eval,
+// known only once all the children were read: their winrate is the
+// offset to add to it, and fpu is 1 instead of 0.
+struct SelectCandidates {
+    std::vector<std::uint32_t> index;
+    std::vector<float> winrate;
+    std::vector<float> fpu;
+    std::vector<float> policy;
+    std::vector<float> denom;
+    std::vector<float> value;
+
+    void clear() {
+        index.clear();
+        winrate.clear();
+        fpu.clear();
+        policy.clear();
+        denom.clear();
+    }
+
+    void add(size_t i, float child_winrate, bool child_fpu,
+             float child_policy, int child_denom) {
+        index.emplace_back(static_cast<std::uint32_t>(i));
+        winrate.emplace_back(child_winrate);
+        fpu.emplace_back(child_fpu ? 1.0f : 0.0f);
+        policy.emplace_back(child_policy);
+        denom.emplace_back(static_cast<float>(child_denom));
+    }
+};
+
+// The PUCT values of the candidates, see UCTNode::get_uct_internal(),
+// and the position of the largest one, the first one on ties. Both
+// loops are left to the vectorizer.
+CPU_KERNEL
+size_t best_puct_value(const size_t count,
+                       const float* winrate, const float* fpu,
+                       const float* policy, const float* denom,
+                       const float fpu_eval, const float exploration,
+                       float* value) {
+    auto best_value = std::numeric_limits<float>::lowest();
+    for (auto j = size_t{0}; j < count; j++) {
+        value[j] = winrate[j] + fpu[j] * fpu_eval
+            + exploration * policy[j] / denom[j];
+        best_value = std::max(best_value, value[j]);
+    }
+    auto best = size_t{0};
+    while (best < count && value[best] != best_value) {
+        best++;
+    }
+    return best;
+}
+
+}
 
+float UCTNode::get_fpu_eval(int color, bool is_root, size_t &parentvisits) const {
+    auto fpu = FpuEval{};
     for (const auto& child : m_children) {
         if (child.valid()) {
             if (child.get_visits() > 0) {
-                const auto child_eval = child.get()->get_raw_eval(color);
-                max_eval = std::max (max_eval, child_eval);
-                parentvisits += child.get_visits();
-                total_visited_policy += child.get_policy();
-
-                ++n;
-                avg_eval += (child_eval - avg_eval) / n;
+                fpu.add(child.get()->get_raw_eval(color),
+                        child.get_visits(), child.get_policy());
             }
         }
     }
- 
-    if (cfg_fpuavg) {
-        // We want the average of children except for the best one
-        if (n>1) {
-            avg_eval -= (max_eval - avg_eval) / (n-1);
-        }
-        return avg_eval;
-    }
-
-    const auto fpu_reduction = (is_root ? cfg_fpu_root_reduction : cfg_fpu_reduction) * std::sqrt(total_visited_policy);
-    // Estimated eval for unknown nodes = parent (not NN) eval - reduction
-    return cfg_fpuzero ? 0.0f : max_eval - fpu_reduction;
+    parentvisits = fpu.parentvisits();
+    return fpu.eval(is_root);
 }
 
 float UCTNode::compute_numerator(int visits) {
@@ -593,42 +824,125 @@ float UCTNode::get_uct_internal(float winrate, float policy, double numerator, i
 }
 
 
+size_t UCTNode::selection_width() const {
+    if (cfg_widening == 0) {
+        return m_children.size();
+    }
+    auto width = cfg_widening;
+    for (auto visits = m_visits.load(); visits >= 4 && width < m_children.size();
+         visits /= 4) {
+        width *= 2;
+    }
+    return std::min(width, m_children.size());
+}
+
 UCTNode* UCTNode::uct_select_child(const GameState & currstate,
                                    bool is_root,
                                    int max_visits,
                                    const std::vector<int> & move_list,
-                                   bool nopass) {
+                                   bool nopass,
+                                   int root_group) {
+    // A lockstep search can't wait: the expansion ends in the backup of
+    // its thread, after all the descents of the round.
+    if ((!cfg_expand_wait || Lockstep::active())
+        && m_expand_state.load() == ExpandState::EXPANDING) {
+        // Let the caller give up this playout: the virtual losses it
+        // leaves on the way steer the next one elsewhere.
+        s_expand_skips++;
+        return nullptr;
+    }
     wait_expanded();
-    auto parentvisits = size_t{0};
 
-    const auto color = currstate.get_to_move();
-    // Count parentvisits manually to avoid issues with transpositions.
-    const auto fpu_eval = get_fpu_eval(color, is_root, parentvisits);
-
-    const auto numerator = compute_numerator(parentvisits);
-
-    auto best = static_cast<UCTNodePointer*>(nullptr);
-    auto best_value = std::numeric_limits<double>::lowest();
+    // With cfg_root_split, each group of threads only searches the root
+    // children whose index falls in its share, so that the threads don't
+    // all update the statistics of the same few children. Fall back to
+    // all children when none of the share can be chosen.
+    const auto groups = static_cast<int>(cfg_root_split);
+    auto split = is_root && groups > 1;
+    if (split) {
+        split = false;
+        for (auto i = size_t(root_group); i < m_children.size(); i += groups) {
+            if (m_children[i].active()) {
+                split = true;
+                break;
+            }
+        }
+    }
 
-#ifndef NDEBUG
-    auto b_psa = 0.0f;
-    auto b_q = 0.0f;
-    auto b_denom = 0.0f;
-#endif
+    const auto color = currstate.get_to_move();
+    // After a pass, passing again must stay in reach.
+    const auto width = (is_root || max_visits > 0
+                        || currstate.get_passes() >= 1)
+        ? m_children.size() : selection_width();
+
+    // Read each child once, with a single load for the unvisited ones
+    // that are not inflated yet, for both the fpu eval and the terms of
+    // the PUCT value.
+    thread_local auto candidates = SelectCandidates{};
+    candidates.clear();
+    auto fpu = FpuEval{};
+    const auto scan_end =
+        std::max(width, static_cast<size_t>(m_visited_end.load()));
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        auto psa = 0.0f;
+        const auto child = m_children[i].peek(psa);
+        // Past the width only the unvisited children are left out:
+        // visited ones can be there after max_visits roll-outs, a pass
+        // or a tree loaded from disk, and they must still count in the
+        // fpu eval. Past m_visited_end there are no visited ones left.
+        if (i >= width && !candidates.index.empty()
+            && (!child || child->get_visits() == 0)) {
+            if (i >= scan_end) {
+                break;
+            }
+            continue;
+        }
+        auto visits = 0;
+        auto denom = 1;
+        auto variance = 0.25f;
+        auto winrate = 0.0f;
+        auto use_fpu = true;
+        auto move = 0;
+        if (child) {
+            if (!child->valid()) {
+                continue;
+            }
+            visits = child->get_visits();
+            psa = child->get_policy();
+            if (visits > 0) {
+                // Count parentvisits manually to avoid issues with
+                // transpositions.
+                fpu.add(child->get_raw_eval(color), visits, psa);
+            }
+            if (!child->active()) {
+                continue;
+            }
+            if (child->m_expand_state.load() == ExpandState::EXPANDING) {
+                // Someone else is expanding this node, never select it
+                // if we can avoid so, because we'd block on it.
+                winrate = -1.0f;
+                use_fpu = false;
+            } else if (visits > 0) {
+                winrate = child->get_eval(color);
+                use_fpu = false;
+            }
+            denom = child->get_denom();
+            variance = child->get_eval_variance(0.25f);
+            move = child->get_move();
+        } else {
+            move = m_children[i].get_move();
+        }
 
-    for (auto& child : m_children) {
-        if (!child.active()) {
+        if (split && static_cast<int>(i % groups) != root_group) {
             continue;
         }
 
         if( !move_list.empty() &&
             std::find( begin(move_list), end(move_list),
-                       child.get_move() ) == end(move_list) ) {
+                       move ) == end(move_list) ) {
           continue;
         }
 
-        const auto visits = child.get_visits();
-
         // If max_visits is specified, then stop choosing nodes that
         // already have enough visits. This guarantees that
         // exploration is wide enough and not too deep when doing fast
@@ -637,50 +951,52 @@ UCTNode* UCTNode::uct_select_child(const GameState & currstate,
             continue;
         }
 
-        auto winrate = fpu_eval;
-        if (child.is_inflated() &&
-            child->m_expand_state.load() == ExpandState::EXPANDING) {
-            // Someone else is expanding this node, never select it
-            // if we can avoid so, because we'd block on it.
-            winrate = -1.0f;
-        } else if (visits > 0) {
-            winrate = child.get_eval(color);
-        }
-        auto psa = child.get_policy();
-
-        if (nopass && child.get_move() == FastBoard::PASS) {
+        if (nopass && move == FastBoard::PASS) {
             psa = 0.0;
             winrate -= 0.05; // is this correct?
         }
 
         if (currstate.get_passes() >= 1 &&
-            child.get_move() == FastBoard::PASS) {
+            move == FastBoard::PASS) {
             psa += 0.2;
         }
 
         if (cfg_stdevuct) {
-            const auto stdev = std::sqrt(child.get_eval_variance(0.25f));
+            const auto stdev = std::sqrt(variance);
             // maximum stdev is 0.5 so double it to get something of
             // order 1; still this term will increase the relative
             // weight of winrate, so also consider increasing cfg_puct
             psa *= 2.0f * stdev;
         }
 
-        auto value = child.get_uct_internal(winrate, psa, numerator);
-        assert(value > std::numeric_limits<double>::lowest());
+        candidates.add(i, winrate, use_fpu, psa, denom);
+    }
 
-        if (value > best_value) {
-            best_value = value;
-            best = &child;
+    const auto fpu_eval = fpu.eval(is_root);
+    const auto numerator = compute_numerator(fpu.parentvisits());
+
+    const auto count = candidates.index.size();
+    candidates.value.resize(count);
+    const auto j = best_puct_value(count,
+                                   candidates.winrate.data(),
+                                   candidates.fpu.data(),
+                                   candidates.policy.data(),
+                                   candidates.denom.data(),
+                                   fpu_eval, cfg_puct * numerator,
+                                   candidates.value.data());
+    assert(j < count);
+    const auto best = &m_children[candidates.index[j]];
+    const auto end = static_cast<std::uint16_t>(candidates.index[j] + 1);
+    auto visited_end = m_visited_end.load();
+    while (visited_end < end
+           && !m_visited_end.compare_exchange_weak(visited_end, end)) {}
 #ifndef NDEBUG
-            b_psa = psa;
-            b_q = winrate;
-            b_denom = get_denom();
+    const auto best_value = candidates.value[j];
+    const auto b_psa = candidates.policy[j];
+    const auto b_q = candidates.winrate[j] + candidates.fpu[j] * fpu_eval;
+    const auto b_denom = static_cast<float>(get_denom());
 #endif
-        }
-    }
 
-    assert(best != nullptr);
     if(best->get_visits() == 0) {
         best->inflate();
         best->get()->set_values(m_net_pi, m_net_alpkt, m_net_beta, m_net_beta2);
@@ -752,6 +1068,8 @@ private:
 
 void UCTNode::sort_children(int color, float lcb_min_visits) {
     std::stable_sort(rbegin(m_children), rend(m_children), NodeComp(color, lcb_min_visits));
+    // The visited children can be anywhere now.
+    m_visited_end = static_cast<std::uint16_t>(m_children.size());
 }
 
 class NodeCompByPolicy : public std::binary_function<UCTNodePointer&,
@@ -765,6 +1083,7 @@ public:
 
 void UCTNode::sort_children_by_policy() {
     std::stable_sort(rbegin(m_children), rend(m_children), NodeCompByPolicy());
+    m_visited_end = static_cast<std::uint16_t>(m_children.size());
 }
 
 UCTNode& UCTNode::get_best_root_child(int color) {
@@ -798,6 +1117,215 @@ size_t UCTNode::count_nodes_and_clear_expand_state() {
     return nodecount;
 }
 
+// Detaches the subtree below this node, which keeps its own statistics
+// and is a leaf again: the next playout through it expands it anew,
+// usually from the NNCache. No search may be running.
+UCTNodeChildren UCTNode::prune_children() {
+    auto children = release_children();
+    m_expand_state = ExpandState::INITIAL;
+    return children;
+}
+
+namespace {
+// The records written by UCTNode::save_subtree(), raw: a NodeRecord,
+// a ChildRecord for each child, then the subtrees of the inflated
+// children in the same order. The move and policy of a node are in
+// the ChildRecord of its parent.
+struct NodeRecord {
+    double blackevals;
+    std::int32_t visits;
+    std::int32_t forced;
+    float squared_eval_diff;
+    float net_pi;
+    float pi_sum;
+    float min_psa_ratio_children;
+    float net_alpkt;
+    float net_beta;
+    float net_beta2;
+    float lambda;
+    float mu;
+    std::int32_t quantile_updates;
+    float quantile_one;
+    GxxSums sums_one;
+    float quantile_lambda;
+    float quantile_mu;
+    GxxSums sums_lambda;
+    GxxSums sums_mu;
+    float father_quantile_lambda;
+    float father_quantile_mu;
+    std::uint16_t children;
+    std::uint8_t status;
+    std::uint8_t has_quantiles;
+};
+
+struct ChildRecord {
+    float policy;
+    std::int16_t move;
+    std::uint8_t inflated;
+    std::uint8_t padding;
+};
+
+static_assert(std::is_trivially_copyable<NodeRecord>::value
+              && std::is_trivially_copyable<ChildRecord>::value,
+              "Tree records are written raw");
+
+template <typename T>
+void append_record(std::string& out, const T& record) {
+    out.append(reinterpret_cast<const char*>(&record), sizeof(T));
+}
+
+template <typename T>
+bool read_record(const char*& pos, const char* end, T& record) {
+    if (end - pos < static_cast<std::ptrdiff_t>(sizeof(T))) {
+        return false;
+    }
+    std::memcpy(&record, pos, sizeof(T));
+    pos += sizeof(T);
+    return true;
+}
+}
+
+size_t UCTNode::save_subtree(std::string& out, float min_policy) const {
+    // The children kept must all have a higher policy than the ones
+    // dropped, so that link_nodelist() adds back exactly those.
+    auto max_psa = 0.0f;
+    auto cut = min_policy;
+    for (const auto& child : m_children) {
+        auto policy = 0.0f;
+        const auto node = child.peek(policy);
+        if (node) {
+            policy = node->get_policy();
+            if (node->get_visits() > 0) {
+                cut = std::min(cut, policy);
+            }
+        }
+        max_psa = std::max(max_psa, policy);
+    }
+
+    auto kept = std::vector<ChildRecord>{};
+    kept.reserve(m_children.size());
+    for (const auto& child : m_children) {
+        auto record = ChildRecord{};
+        const auto node = child.peek(record.policy);
+        if (node) {
+            record.policy = node->get_policy();
+            record.inflated = 1;
+        }
+        if (record.policy >= cut) {
+            record.move = static_cast<std::int16_t>(child.get_move());
+            kept.push_back(record);
+        }
+    }
+
+    auto min_psa_ratio = m_min_psa_ratio_children.load();
+    if (kept.size() < m_children.size()) {
+        min_psa_ratio = kept.empty() ? 2.0f : cut / max_psa;
+    }
+
+    auto record = NodeRecord{};
+    record.blackevals = m_blackevals;
+    record.visits = m_visits;
+    record.forced = m_forced;
+    record.squared_eval_diff = m_squared_eval_diff;
+    record.net_pi = m_net_pi;
+    record.pi_sum = m_pi_sum;
+    record.min_psa_ratio_children = min_psa_ratio;
+    record.net_alpkt = m_net_alpkt;
+    record.net_beta = m_net_beta;
+    record.net_beta2 = m_net_beta2;
+    record.lambda = m_lambda;
+    record.mu = m_mu;
+    record.quantile_updates = m_quantile_updates;
+    record.quantile_one = m_quantile_one;
+    record.sums_one = m_sums_one;
+    if (const auto aq = m_agent_quantiles.load()) {
+        record.has_quantiles = 1;
+        record.quantile_lambda = aq->quantile_lambda;
+        record.quantile_mu = aq->quantile_mu;
+        record.sums_lambda = aq->sums_lambda;
+        record.sums_mu = aq->sums_mu;
+        record.father_quantile_lambda = aq->father_quantile_lambda;
+        record.father_quantile_mu = aq->father_quantile_mu;
+    }
+    record.children = static_cast<std::uint16_t>(kept.size());
+    record.status = m_status;
+    append_record(out, record);
+    for (const auto& child : kept) {
+        append_record(out, child);
+    }
+
+    auto nodecount = kept.size();
+    for (const auto& child : m_children) {
+        auto policy = 0.0f;
+        const auto node = child.peek(policy);
+        if (node && node->get_policy() >= cut) {
+            nodecount += node->save_subtree(out, min_policy);
+        }
+    }
+    return nodecount;
+}
+
+bool UCTNode::load_subtree(const char*& pos, const char* end) {
+    assert(m_children.empty());
+    auto record = NodeRecord{};
+    if (!read_record(pos, end, record)
+        || record.status > ACTIVE
+        || record.children > POTENTIAL_MOVES) {
+        return false;
+    }
+    m_blackevals = record.blackevals;
+    m_visits = record.visits;
+    m_forced = record.forced;
+    m_squared_eval_diff = record.squared_eval_diff;
+    m_net_pi = record.net_pi;
+    m_pi_sum = record.pi_sum;
+    m_min_psa_ratio_children = record.min_psa_ratio_children;
+    m_net_alpkt = record.net_alpkt;
+    m_net_beta = record.net_beta;
+    m_net_beta2 = record.net_beta2;
+    m_lambda = record.lambda;
+    m_mu = record.mu;
+    m_quantile_updates = record.quantile_updates;
+    m_quantile_one = record.quantile_one;
+    m_sums_one = record.sums_one;
+    if (record.has_quantiles) {
+        auto& aq = agent_quantiles();
+        aq.quantile_lambda = record.quantile_lambda;
+        aq.quantile_mu = record.quantile_mu;
+        aq.sums_lambda = record.sums_lambda;
+        aq.sums_mu = record.sums_mu;
+        aq.father_quantile_lambda = record.father_quantile_lambda;
+        aq.father_quantile_mu = record.father_quantile_mu;
+    }
+    m_status = static_cast<Status>(record.status);
+
+    m_children.reserve(record.children);
+    for (auto i = 0; i < record.children; i++) {
+        auto child = ChildRecord{};
+        if (!read_record(pos, end, child)
+            || child.move < FastBoard::PASS
+            || child.move >= FastBoard::NUM_VERTICES) {
+            return false;
+        }
+        m_children.emplace_back(child.move, child.policy);
+        if (child.inflated) {
+            m_children.back().inflate();
+        }
+    }
+    for (auto i = size_t{0}; i < m_children.size(); i++) {
+        auto& child = m_children[i];
+        if (child.is_inflated() && !child->load_subtree(pos, end)) {
+            return false;
+        }
+        if (child.get_visits() > 0) {
+            m_visited_end = static_cast<std::uint16_t>(i + 1);
+        }
+    }
+    m_expand_state = has_children() ? ExpandState::EXPANDED
+                                    : ExpandState::INITIAL;
+    return true;
+}
+
 void UCTNode::invalidate() {
     m_status = INVALID;
 }
@@ -942,7 +1470,15 @@ void UCTNode::expand_cancel() {
     assert(v == ExpandState::EXPANDING);
 }
 void UCTNode::wait_expanded() {
-    while (m_expand_state.load() == ExpandState::EXPANDING) {}
+    if (m_expand_state.load() == ExpandState::EXPANDING) {
+        SearchProfiler::Scope scope{SearchProfiler::WAIT_EXPANDED};
+        const auto start = std::chrono::steady_clock::now();
+        while (m_expand_state.load() == ExpandState::EXPANDING) {}
+        const auto waited = std::chrono::steady_clock::now() - start;
+        s_expand_waits++;
+        s_expand_wait_us += std::chrono::duration_cast<
+            std::chrono::microseconds>(waited).count();
+    }
     auto v = m_expand_state.load();
 #ifdef NDEBUG
     (void)v;
@@ -950,19 +1486,35 @@ void UCTNode::wait_expanded() {
     assert(v == ExpandState::EXPANDED);
 }
 
+ExpandWaitStats UCTNode::get_expand_wait_stats() {
+    return {s_expand_waits.load(), s_expand_wait_us.load(),
+            s_expand_skips.load(), s_expand_collisions.load()};
+}
+
+void UCTNode::reset_expand_wait_stats() {
+    s_expand_waits = 0;
+    s_expand_wait_us = 0;
+    s_expand_skips = 0;
+    s_expand_collisions = 0;
+}
+
 StateEval UCTNode::state_eval() const {
     StateEval ev(get_visits(), m_net_alpkt, get_beta_tree(), m_net_pi,
-                 m_quantile_lambda, m_quantile_mu,
+                 get_quantile_lambda(), get_quantile_mu(),
                  get_eval(), -m_quantile_one);
     return ev;
 }
 
 void UCTNode::set_lambda_mu(const GameState &state) {
+    set_lambda_mu(state.is_cpu_color(), state.get_to_move());
+}
+
+void UCTNode::set_lambda_mu(bool cpu_to_move, int to_move) {
     auto i = 0;
-    if (!state.is_cpu_color()) {
+    if (!cpu_to_move) {
         i = 2;
     }
-    if (get_raw_eval(state.get_to_move()) < 0.5f) {
+    if (get_raw_eval(to_move) < 0.5f) {
         i++;
     }
 
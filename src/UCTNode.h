@@ -39,6 +39,7 @@
 #include <tuple>
 #include <cassert>
 #include <cstring>
+#include <string>
 
 #include "GameState.h"
 #include "Network.h"
@@ -46,6 +47,15 @@
 #include "UCTNodePointer.h"
 #include "UCTSearch.h"
 
+// How often search threads ran into a node another thread was
+// expanding, see UCTNode::wait_expanded().
+struct ExpandWaitStats {
+    size_t waits;
+    size_t wait_us; // time spent waiting, in microseconds
+    size_t skips; // playouts given up instead, see cfg_expand_wait
+    size_t collisions; // playouts reaching a leaf already being evaluated
+};
+
 struct UCTStats {
     float alpkt_tree;
     float beta_tree;
@@ -54,16 +64,39 @@ struct UCTStats {
 
 class SearchResult;
 
+// Running sums of g(x) - x g'(x) and g'(x) for a quantile x, updated
+// together by a single compare and swap.
+struct GxxSums {
+    float gxgp{0.0f};
+    float gp{0.0f};
+};
+
+// Statistics for the agent quantiles of a node, only needed when some
+// cfg_lambda or cfg_mu is non-zero. See UCTNode::update_all_quantiles().
+struct UCTNodeQuantiles {
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr);
+
+    std::atomic<float> quantile_lambda{0.0f}; // x bar
+    std::atomic<float> quantile_mu{0.0f}; // x base
+    std::atomic<GxxSums> sums_lambda{GxxSums{}};
+    std::atomic<GxxSums> sums_mu{GxxSums{}};
+    std::atomic<float> father_quantile_lambda{0.0f}; // x bar of father node
+    std::atomic<float> father_quantile_mu{0.0f}; // x base of father node
+};
+
 class UCTNode {
 public:
-    // When we visit a node, add this amount of virtual losses
-    // to it to encourage other CPUs to explore other parts of the
-    // search tree.
+    // Default for cfg_virtual_loss.
     static constexpr auto VIRTUAL_LOSS_COUNT = 3;
     // Defined in UCTNode.cpp
     explicit UCTNode(int vertex, float policy);
     UCTNode() = delete;
-    ~UCTNode() = default;
+    ~UCTNode();
+
+    // Nodes are allocated from a NodePool.
+    static void* operator new(size_t size);
+    static void operator delete(void* ptr);
 
     bool create_children(Network & network,
                          std::atomic<int>& nodecount,
@@ -71,16 +104,25 @@ public:
                          float& beta, float& beta2,
                          float min_psa_ratio = 0.0f);
 
-    const std::vector<UCTNodePointer>& get_children() const;
+    const UCTNodeChildren& get_children() const;
     void sort_children_by_policy();
     void sort_children(int color, float lcb_min_visits);
     UCTNode& get_best_root_child(int color);
     UCTNode* uct_select_child(const GameState & currstate, bool is_root,
                               int max_visits,
                               const std::vector<int> & move_list,
-                              bool nopass = false);
+                              bool nopass = false,
+                              int root_group = 0);
 
     size_t count_nodes_and_clear_expand_state();
+    // Append this subtree to out, see UCTSearch::save_tree(). Children
+    // without visits and with policy below min_policy are left out, the
+    // node expands them again if the search needs them. Returns the
+    // number of nodes written.
+    size_t save_subtree(std::string& out, float min_policy) const;
+    // Rebuild the subtree saved by save_subtree() from the data at pos,
+    // which is moved past it. False if the data is malformed.
+    bool load_subtree(const char*& pos, const char* end);
     bool first_visit() const;
     bool has_children() const;
     bool expandable(const float min_psa_ratio = 0.0f) const;
@@ -96,13 +138,13 @@ public:
     void set_policy(float policy);
     float get_eval_variance(float default_var = 0.0f) const;
     float get_eval(int tomove = FastBoard::BLACK) const;
-    float get_raw_eval(int tomove, int virtual_loss = 0) const;
+    float get_raw_eval(int tomove, float virtual_loss = 0.0f) const;
     float get_net_pi(int tomove = FastBoard::BLACK) const;
     void set_values(float value, float alpkt, float beta, float beta2);
     bool low_visits_child(UCTNode* const child) const;
 #ifdef USE_EVALCMD
     void set_progid(int id);
-    std::vector<int>& get_progid();
+    const std::vector<int>& get_progid() const;
 #endif
 #ifndef NDEBUG
     void set_urgency(float urgency, float psa, float q,
@@ -111,8 +153,13 @@ public:
 #endif
     void virtual_loss();
     void virtual_loss_undo();
+    float get_virtual_losses() const;
     float update(const SearchResult &result, bool forced=false);
+    // Visits made by a search elsewhere, see RemoteSearch: their
+    // blackevals sum is added, the variance stays that of the local visits.
+    void add_visits(int visits, double blackevals);
     float get_eval_lcb(int color) const;
+    float get_eval_ucb(int color) const;
 
     // Defined in UCTNodeRoot.cpp, only to be called on m_root in UCTSearch
     FastState::move_flags_t
@@ -122,7 +169,8 @@ public:
                            std::atomic<int>& nodecount,
                            GameState& state,
                            bool fast_roll_out = false,
-                           bool verbose = true);
+                           bool verbose = true,
+                           bool add_noise = true);
     bool get_children_visits(const GameState& state, const UCTNode& root,
                              std::vector<float> & probabilities,
                              bool standardize = true);
@@ -131,6 +179,8 @@ public:
     UCTNode* get_second_child() const;
     UCTNode* get_nopass_child(FastState& state) const;
     std::unique_ptr<UCTNode> find_child(const int move);
+    UCTNodeChildren release_children();
+    UCTNodeChildren prune_children();
     void inflate_all_children();
     UCTNode* select_child(int move);
     float estimate_alpkt(int passes, bool is_tromptaylor_scoring = false) const;
@@ -138,9 +188,9 @@ public:
     float get_beta_tree() const;
     float get_azwinrate_avg() const;
     UCTStats get_uct_stats() const;
-    void update_quantile(std::atomic<float> &old_quantile, float old_gxgp_sum,
-                         float old_gp_sum, float parameter, int new_visits,
-                         float avg_pi, float new_alpkt, float new_beta, float new_beta2);
+    void update_quantile(std::atomic<float> &old_quantile, GxxSums sums,
+                         float parameter, int new_visits, float avg_pi,
+                         float new_alpkt, float new_beta, float new_beta2);
     void update_all_quantiles(float new_alpkt, float new_beta, float new_beta2);
     std::tuple<float, float, float> score_stats() const;
     void clear_expand_state();
@@ -154,21 +204,23 @@ public:
     float get_quantile_lambda(int tomove = FastBoard::BLACK) const;
     float get_quantile_mu(int tomove = FastBoard::BLACK) const;
     float get_quantile_one() const { return m_quantile_one; }
-    float get_father_quantile_lambda() const { return m_father_quantile_lambda; }
-    float get_father_quantile_mu() const { return m_father_quantile_mu; }
-    void set_father_quantiles(const UCTNode* father) {
-        m_father_quantile_lambda = father->get_quantile_lambda();
-        m_father_quantile_mu = father->get_quantile_mu();
-    }
+    float get_father_quantile_lambda() const;
+    float get_father_quantile_mu() const;
+    void set_father_quantiles(const UCTNode* father);
     StateEval state_eval() const;
     void set_lambda_mu(const GameState &state);
+    void set_lambda_mu(bool cpu_to_move, int to_move);
     AgentEval get_agent_eval() const {
-        return {m_lambda, m_mu, m_quantile_lambda, m_quantile_mu, -m_quantile_one};
+        return {m_lambda, m_mu, get_quantile_lambda(), get_quantile_mu(),
+                -m_quantile_one};
     }
     float get_fpu_eval(int color, bool is_root, size_t &parentvisits) const;
     float get_uct_root(const UCTNode &root, int color) const;
     float get_uct_internal(float winrate, float policy, double numerator) const;
 
+    static ExpandWaitStats get_expand_wait_stats();
+    static void reset_expand_wait_stats();
+
     static float compute_numerator(int visits);
     static float get_uct_internal(float winrate, float policy, double numerator, int denom);
 
@@ -178,6 +230,10 @@ private:
         PRUNED,
         ACTIVE
     };
+    // Among how many of the first children uct_select_child() considers
+    // the unvisited ones, with cfg_widening. Visited children are always
+    // considered.
+    size_t selection_width() const;
     void link_nodelist(std::atomic<int>& nodecount,
                        std::vector<Network::PolicyVertexPair>& nodelist,
                        float min_psa_ratio);
@@ -188,47 +244,14 @@ private:
                             bool is_tromptaylor_scoring) const;
     void get_subtree_betas(std::vector<float> & vector) const;
     void az_sum_recursion(float& sum, size_t& n) const;
-    void update_gxx_sums(std::atomic<float> &old_gxgp_sum,
-                         std::atomic<float> &old_gp_sum,
-                         float old_quantile, float new_alpkt,
-                         float new_beta, float new_beta2);
+    GxxSums update_gxx_sums(std::atomic<GxxSums> &sums,
+                            float old_quantile, float new_alpkt,
+                            float new_beta, float new_beta2);
 
     // Note : This class is very size-sensitive as we are going to create
     // tens of millions of instances of these.  Please put extra caution
     // if you want to add/remove/reorder any variables here.
 
-    // Move
-    std::int16_t m_move;
-    // UCT
-    std::atomic<std::int16_t> m_virtual_loss{0};
-    std::atomic<int> m_visits{0};
-    // number of forced moves visited after this node, to be
-    // subtracted from visits in the denominator of psa
-    std::atomic<int> m_forced{0};
-    // UCT eval
-    float m_policy;
-    // Original net eval for this node (not children, black's pov).
-    float m_net_pi{0.5f};
-
-#ifdef USE_EVALCMD
-    std::vector<int> m_progid; // progressive unique identifier,
-                               // typically it is just one integer,
-                               // but a second pass can be visited
-                               // more than once and in that case the
-                               // vector is used
-#endif
-#ifndef NDEBUG
-    std::array<float, 5> m_last_urgency;
-#endif
-
-    // Variable used for calculating variance of evaluations.
-    // Initialized to small non-zero value to avoid accidental zero variances
-    // at low visits.
-    std::atomic<float> m_squared_eval_diff{1e-4f};
-    std::atomic<double> m_blackevals{0.0};
-    std::atomic<Status> m_status{ACTIVE};
-    std::atomic<float> m_pi_sum{0.0f};
-
     // m_expand_state acts as the lock for m_children.
     // see manipulation methods below for possible state transition
     enum class ExpandState : std::uint8_t {
@@ -244,11 +267,39 @@ private:
         // context, until node is destroyed.
         EXPANDED,
     };
+
+    // The fields uct_select_child() reads for every child come first,
+    // they fit in 32 bytes and NodePool keeps them in one cache line.
+    std::atomic<double> m_blackevals{0.0};
+    std::atomic<int> m_visits{0};
+    // number of forced moves visited after this node, to be
+    // subtracted from visits in the denominator of psa
+    std::atomic<int> m_forced{0};
+    // UCT eval
+    float m_policy;
+    // Variable used for calculating variance of evaluations.
+    // Initialized to small non-zero value to avoid accidental zero variances
+    // at low visits.
+    std::atomic<float> m_squared_eval_diff{1e-4f};
+    // Move
+    std::int16_t m_move;
+    // Number of playouts in flight through this node,
+    // see get_virtual_losses().
+    std::atomic<std::int16_t> m_virtual_loss{0};
+    std::atomic<Status> m_status{ACTIVE};
     std::atomic<ExpandState> m_expand_state{ExpandState::INITIAL};
+    // One past the last child uct_select_child() chose, or that may have
+    // visits otherwise: past it and the width, the children are all
+    // unvisited. It fills the padding before m_net_pi.
+    std::atomic<std::uint16_t> m_visited_end{0};
+
+    // Original net eval for this node (not children, black's pov).
+    float m_net_pi{0.5f};
+    std::atomic<float> m_pi_sum{0.0f};
 
     // Tree data
     std::atomic<float> m_min_psa_ratio_children{2.0f};
-    std::vector<UCTNodePointer> m_children;
+    UCTNodeChildren m_children;
 
     // m_expand_state manipulation methods
     // INITIAL -> EXPANDING
@@ -264,6 +315,12 @@ private:
     // wait until we are on EXPANDED state
     void wait_expanded();
 
+    // Contention counters, shared by all nodes.
+    static std::atomic<size_t> s_expand_waits;
+    static std::atomic<size_t> s_expand_wait_us;
+    static std::atomic<size_t> s_expand_skips;
+    static std::atomic<size_t> s_expand_collisions;
+
     float m_net_alpkt{0.0f}; // alpha + \tilde k
     float m_net_beta{1.0f};
     float m_net_beta2{-1.0f};
@@ -273,17 +330,22 @@ private:
     // should be equal to m_visits in single threading
     std::atomic<int> m_quantile_updates{0};
 
-    std::atomic<float> m_quantile_lambda{0.0f}; // x bar
-    std::atomic<float> m_quantile_mu{0.0f}; // x base
     std::atomic<float> m_quantile_one{0.0f}; // quantile for parameter = 1, equals -alpkt
-    std::atomic<float> m_gxgp_sum_lambda{0.0f};
-    std::atomic<float> m_gxgp_sum_mu{0.0f};
-    std::atomic<float> m_gxgp_sum_one{0.0f};
-    std::atomic<float> m_gp_sum_lambda{0.0f};
-    std::atomic<float> m_gp_sum_mu{0.0f};
-    std::atomic<float> m_gp_sum_one{0.0f};
-    std::atomic<float> m_father_quantile_lambda{0.0f}; // x bar of father node
-    std::atomic<float> m_father_quantile_mu{0.0f}; // x base of father node
+    std::atomic<GxxSums> m_sums_one{GxxSums{}};
+
+    // Allocated on demand, null means all zero.
+    std::atomic<UCTNodeQuantiles*> m_agent_quantiles{nullptr};
+    UCTNodeQuantiles& agent_quantiles();
+
+#ifdef USE_EVALCMD
+    // progressive unique identifier, typically it is just one integer,
+    // but a second pass can be visited more than once and in that case
+    // the vector is used. Only set during eval, so allocated on demand.
+    std::unique_ptr<std::vector<int>> m_progid;
+#endif
+#ifndef NDEBUG
+    std::array<float, 5> m_last_urgency;
+#endif
 };
 
 #endif
@@ -37,6 +37,7 @@
 #include <cassert>
 #include <cstring>
 
+#include "MemoryTracker.h"
 #include "SMP.h"
 
 class UCTNode;
@@ -108,6 +109,18 @@ public:
         return is_inflated(m_data.load());
     }
 
+    // The node if inflated, else nullptr and the policy it will be
+    // inflated with, from a single load: for the loops that read the
+    // statistics of all the children of a node.
+    UCTNode* peek(float& policy) const {
+        auto v = m_data.load();
+        if (is_inflated(v)) {
+            return read_ptr(v);
+        }
+        policy = read_policy(v);
+        return nullptr;
+    }
+
     // methods from std::unique_ptr<UCTNode>
     typename std::add_lvalue_reference<UCTNode>::type operator*() const{
         return *read_ptr(m_data.load());
@@ -139,4 +152,8 @@ public:
     float get_uct_internal(float winrate, float policy, double numerator) const;
 };
 
+// The children of a UCTNode.
+using UCTNodeChildren =
+    TrackedVector<UCTNodePointer, MemoryTracker::TREE_CHILDREN>;
+
 #endif
@@ -79,10 +79,7 @@ void UCTNode::kill_superkos(const GameState& state) {
     for (auto& child : m_children) {
         auto move = child->get_move();
         if (move != FastBoard::PASS) {
-            KoState mystate = state;
-            mystate.play_move(move);
-
-            if (mystate.superko()) {
+            if (state.superko_move(move)) {
                 // Don't delete nodes for now, just mark them invalid.
                 child->invalidate();
             }
@@ -270,6 +267,14 @@ std::unique_ptr<UCTNode> UCTNode::find_child(const int move) {
     return nullptr;
 }
 
+// Leaves this node without children, e.g. to destroy them elsewhere.
+UCTNodeChildren UCTNode::release_children() {
+    auto children = UCTNodeChildren{};
+    children.swap(m_children);
+    m_min_psa_ratio_children = 2.0f;
+    return children;
+}
+
 void UCTNode::inflate_all_children() {
     for (const auto& node : get_children()) {
         node.inflate();
@@ -280,7 +285,8 @@ void UCTNode::prepare_root_node(Network & network, int color,
                                 std::atomic<int>& nodes,
                                 GameState& root_state,
                                 bool fast_roll_out,
-                                bool verbose) {
+                                bool verbose,
+                                bool add_noise) {
     float root_value, root_alpkt, root_beta, root_beta2;
 
     const auto had_children = has_children();
@@ -323,7 +329,7 @@ void UCTNode::prepare_root_node(Network & network, int color,
         return;
     }
 
-    if (cfg_noise) {
+    if (cfg_noise && add_noise) {
         // Adjust the Dirichlet noise's alpha constant to the board size
         auto alpha = cfg_noise_value * 361.0f / NUM_INTERSECTIONS;
         dirichlet_noise(cfg_noise_weight, alpha);
@@ -371,13 +377,7 @@ bool UCTNode::get_children_visits(const GameState& state, const UCTNode& root,
         sum_visits = 1.0;
     }
 
-    std::vector<int> stabilizer_subgroup;
-
-    for (auto i = 0; i < 8; i++) {
-        if(i == 0 || (cfg_exploit_symmetries && state.is_symmetry_invariant(i))) {
-            stabilizer_subgroup.emplace_back(i);
-        }
-    }
+    const auto stabilizer_subgroup = state.get_stabilizer_subgroup();
 
     for (const auto& child : root.get_children()) {
         auto prob = static_cast<float>(child->get_visits() / sum_visits);
@@ -34,18 +34,24 @@
 #include <boost/format.hpp>
 #include <boost/scope_exit.hpp>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
 #include <functional>
 #include <limits>
 #include <map>
 #include <memory>
+#include <random>
 #include <sstream>
 #include <string>
 #include <type_traits>
 #include <tuple>
 #include <algorithm>
 #include <iostream>
+#include <iterator>
 #ifndef NDEBUG
 #include <iomanip>
 #endif
@@ -64,6 +70,7 @@
 #endif
 #include "Network.h"
 #include "Random.h"
+#include "SearchProfiler.h"
 
 using namespace Utils;
 
@@ -71,31 +78,39 @@ constexpr int UCTSearch::UNLIMITED_PLAYOUTS;
 
 class OutputAnalysisData {
 public:
-    OutputAnalysisData(const std::string& move, int visits,
-                       float winrate, float policy_prior, std::string pv,
+    OutputAnalysisData(UCTNode* node, size_t index, int visits,
+                       float winrate, float policy_prior,
                        float lcb, float areas, bool lcb_ratio_exceeded)
-    : m_move(move), m_visits(visits), m_winrate(winrate),
-      m_policy_prior(policy_prior), m_pv(pv), m_lcb(lcb), m_areas(areas),
+    : m_node(node), m_index(index), m_visits(visits), m_winrate(winrate),
+      m_policy_prior(policy_prior), m_lcb(lcb), m_areas(areas),
       m_lcb_ratio_exceeded(lcb_ratio_exceeded) {};
 
-    std::string get_info_string(int order, int color) const {
+    UCTNode* get_node() const {
+        return m_node;
+    }
+
+    // Everything but the pv.
+    void append_info_string(std::string& out, FastState& state,
+                            int order, int color) const {
         auto score = color == FastBoard::BLACK ? m_areas : -m_areas;
-        auto tmp = "info move " + m_move
-                 + " visits " + std::to_string(m_visits)
-                 + " winrate "
-                 + std::to_string(static_cast<int>(m_winrate * 10000))
-                 + " prior "
-                 + std::to_string(static_cast<int>(m_policy_prior * 10000.0f))
-                 + " lcb " + std::to_string(static_cast<int>(std::max(0.0f, m_lcb) * 10000))
-                 + " scoreLead " + std::to_string(score)
-                 + " areas " + std::to_string(static_cast<int>(m_areas * 10000));
+        out.append("info move ")
+           .append(state.move_to_text(m_node->get_move()))
+           .append(" visits ").append(std::to_string(m_visits))
+           .append(" winrate ")
+           .append(std::to_string(static_cast<int>(m_winrate * 10000)))
+           .append(" prior ")
+           .append(std::to_string(static_cast<int>(m_policy_prior * 10000.0f)))
+           .append(" lcb ")
+           .append(std::to_string(static_cast<int>(std::max(0.0f, m_lcb) * 10000)))
+           .append(" scoreLead ").append(std::to_string(score))
+           .append(" areas ")
+           .append(std::to_string(static_cast<int>(m_areas * 10000)));
         if (order >= 0) {
-            tmp += " order " + std::to_string(order);
+            out.append(" order ").append(std::to_string(order));
         }
-        tmp += " pv " + m_pv;
-        return tmp;
     }
 
+    // Ties keep the order of the children.
     friend bool operator<(const OutputAnalysisData& a,
                           const OutputAnalysisData& b) {
         if (a.m_lcb_ratio_exceeded && b.m_lcb_ratio_exceeded) {
@@ -103,18 +118,21 @@ public:
                 return a.m_lcb < b.m_lcb;
             }
         }
-        if (a.m_visits == b.m_visits) {
+        if (a.m_visits != b.m_visits) {
+            return a.m_visits < b.m_visits;
+        }
+        if (a.m_winrate != b.m_winrate) {
             return a.m_winrate < b.m_winrate;
         }
-        return a.m_visits < b.m_visits;
+        return a.m_index > b.m_index;
     }
 
 private:
-    std::string m_move;
+    UCTNode* m_node;
+    size_t m_index;
     int m_visits;
     float m_winrate;
     float m_policy_prior;
-    std::string m_pv;
     float m_lcb;
     float m_areas;
     bool m_lcb_ratio_exceeded;
@@ -129,6 +147,15 @@ UCTSearch::UCTSearch(GameState& g, Network& network)
     m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
 }
 
+UCTSearch::~UCTSearch() {
+    // Subtrees of old roots may still be being freed by the thread pool,
+    // they must be gone when the search is.
+    while (!m_delete_futures.empty()) {
+        m_delete_futures.front().wait_all();
+        m_delete_futures.pop_front();
+    }
+}
+
 SearchResult SearchResult::from_node(const UCTNode* node, bool sai_head) {
     return SearchResult::from_eval(node->get_net_pi(), node->get_net_alpkt(),
                                    node->get_net_beta(), node->get_net_beta2(), sai_head);
@@ -175,16 +202,34 @@ bool UCTSearch::advance_to_new_rootstate() {
 
         test->forward_move();
         const auto move = test->get_last_move();
+        if (i == 0) {
+            count_ponder_hit(move);
+        }
 
         auto oldroot = std::move(m_root);
         m_root = oldroot->find_child(move);
 
         // Lazy tree destruction.  Instead of calling the destructor of the
-        // old root node on the main thread, send the old root to a separate
-        // thread and destroy it from the child thread.  This will save a
-        // bit of time when dealing with large trees.
-        auto p = oldroot.release();
-        tg.add_task([p]() { delete p; });
+        // old root node on the main thread, send the subtrees of the old
+        // root to the thread pool, split in a share for each thread, and
+        // destroy them from there.  Big trees are freed in parallel and
+        // their nodes are back in the NodePool before the search needs
+        // them.
+        auto children = oldroot->release_children();
+        const auto shares = std::max(size_t{1}, std::min(
+            size_t{cfg_num_threads}, children.size()));
+        auto garbage = std::vector<UCTNodeChildren>(shares);
+        for (auto i = size_t{0}; i < children.size(); i++) {
+            garbage[i % shares].emplace_back(std::move(children[i]));
+        }
+        children.clear();
+        for (auto& share : garbage) {
+            if (share.empty()) {
+                continue;
+            }
+            auto p = new UCTNodeChildren(std::move(share));
+            tg.add_task([p]() { delete p; });
+        }
         m_delete_futures.push_back(std::move(tg));
 
         if (!m_root) {
@@ -204,10 +249,73 @@ bool UCTSearch::advance_to_new_rootstate() {
     return true;
 }
 
+UCTNode* UCTSearch::find_current_root() const {
+    if (!m_root || !m_last_rootstate
+        || m_rootstate.get_komi() != m_last_rootstate->get_komi()
+        || m_rootstate.get_handicap() != m_last_rootstate->get_handicap()) {
+        return nullptr;
+    }
+    const auto depth = static_cast<ptrdiff_t>(m_rootstate.get_movenum() -
+                                              m_last_rootstate->get_movenum());
+    if (depth < 0) {
+        return nullptr;
+    }
+    auto test = std::make_unique<GameState>(m_rootstate);
+    for (auto i = 0; i < depth; i++) {
+        test->undo_move();
+    }
+    if (m_last_rootstate->board.get_hash() != test->board.get_hash()) {
+        return nullptr;
+    }
+
+    auto last = std::make_unique<GameState>(*m_last_rootstate);
+    auto node = m_root.get();
+    for (auto i = 0; i < depth && node; i++) {
+        test->forward_move();
+        const auto move = test->get_last_move();
+        auto next = static_cast<UCTNode*>(nullptr);
+        for (const auto& child : node->get_children()) {
+            if (child.get_move() == move && child.is_inflated()) {
+                next = child.get();
+                break;
+            }
+        }
+        node = next;
+        last->play_move(move);
+    }
+    // Different if the same player made several moves in a row.
+    if (last->board.get_hash() != test->board.get_hash()) {
+        return nullptr;
+    }
+    return node;
+}
+
+// Called with the opponent's move after pondering.
+void UCTSearch::count_ponder_hit(int move) {
+    if (m_ponder_moves.empty()) {
+        return;
+    }
+    m_ponder_replies++;
+    if (std::find(begin(m_ponder_moves), end(m_ponder_moves), move)
+        != end(m_ponder_moves)) {
+        m_ponder_hits++;
+    }
+    myprintf("Ponder hits: %d of %d opponent moves (%.0f%%)\n",
+             m_ponder_hits, m_ponder_replies,
+             100.0f * m_ponder_hits / m_ponder_replies);
+}
+
 void UCTSearch::update_root(bool is_evaluating) {
     // Definition of m_playouts is playouts per search call.
     // So reset this count now.
     m_playouts = 0;
+    UCTNode::reset_expand_wait_stats();
+    SearchProfiler::set_enabled(cfg_profile_search);
+    SearchProfiler::reset();
+
+    // The old tree is about to be destroyed.
+    m_transpositions.clear();
+    m_transposition_playouts = 0;
 
 #ifndef NDEBUG
     auto start_nodes = m_root->count_nodes_and_clear_expand_state();
@@ -216,6 +324,7 @@ void UCTSearch::update_root(bool is_evaluating) {
     if ( (!advance_to_new_rootstate() && !is_evaluating) || !m_root) {
         m_root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
     }
+    m_ponder_moves.clear();
 
     // Clear last_rootstate to prevent accidental use.
     m_last_rootstate.reset(nullptr);
@@ -231,6 +340,237 @@ void UCTSearch::update_root(bool is_evaluating) {
     #endif
 }
 
+std::uint64_t UCTSearch::transposition_key(const GameState& state) {
+    // The hash has the stones, the prisoners, the player to move and the
+    // ko point, the positional hash is mixed in on top.
+    return state.board.get_hash()
+        ^ (state.board.get_ko_hash() * 0x9E3779B97F4A7C15ULL);
+}
+
+// With cfg_transpositions, the node expanded for the position of the
+// unexpanded node, if there is one.
+UCTNode* UCTSearch::find_transposition(const GameState& state,
+                                       UCTNode* node) {
+    if (!cfg_transpositions || node->has_children()) {
+        return nullptr;
+    }
+    std::lock_guard<std::mutex> lock(m_transpositions_mutex);
+    const auto it = m_transpositions.find(transposition_key(state));
+    if (it == end(m_transpositions) || it->second == node
+        || !it->second->has_children()) {
+        return nullptr;
+    }
+    return it->second;
+}
+
+// Record node as the one expanded for this position, unless another
+// node still has children for it.
+void UCTSearch::add_transposition(std::uint64_t key, UCTNode* node) {
+    std::lock_guard<std::mutex> lock(m_transpositions_mutex);
+    const auto it = m_transpositions.emplace(key, node);
+    if (!it.second && !it.first->second->has_children()) {
+        it.first->second = node;
+    }
+}
+
+namespace {
+    struct PruneCandidate {
+        int visits;
+        int depth;
+        UCTNode* node;
+    };
+
+    // The expanded nodes below the children of the root.
+    void collect_prune_candidates(const UCTNode& node, const int depth,
+                                  std::vector<PruneCandidate>& candidates) {
+        for (const auto& child : node.get_children()) {
+            if (!child.is_inflated() || !child->has_children()) {
+                continue;
+            }
+            if (depth >= 1) {
+                candidates.push_back({child->get_visits(), depth + 1,
+                                      child.get()});
+            }
+            collect_prune_candidates(*child, depth + 1, candidates);
+        }
+    }
+
+    // The tree size UCTNodePointer accounts for the subtree below node,
+    // optionally collecting its nodes.
+    size_t subtree_size(const UCTNode& node,
+                        std::vector<const UCTNode*>* nodes) {
+        auto size = size_t{0};
+        for (const auto& child : node.get_children()) {
+            size += sizeof(UCTNodePointer);
+            if (child.is_inflated()) {
+                size += sizeof(UCTNode) + subtree_size(*child, nodes);
+                if (nodes) {
+                    nodes->push_back(child.get());
+                }
+            }
+        }
+        return size;
+    }
+}
+
+// Detaches the least visited subtrees until the tree would be down to
+// target_size, and returns them: the caller frees them once the search
+// is running again. Nodes below the children of the root are candidates,
+// each keeping its statistics and becoming a leaf. A node has at least
+// the visits of its descendants, so these go first and no candidate is
+// freed under another. Only to be called while no search runs.
+UCTNodeChildren UCTSearch::prune_tree(const size_t target_size) {
+    auto candidates = std::vector<PruneCandidate>{};
+    collect_prune_candidates(*m_root, 0, candidates);
+    std::sort(begin(candidates), end(candidates),
+        [](const PruneCandidate& a, const PruneCandidate& b) {
+            return a.visits != b.visits ? a.visits < b.visits
+                                        : a.depth > b.depth;
+        });
+
+    auto garbage = UCTNodeChildren{};
+    auto freed_nodes = std::vector<const UCTNode*>{};
+    const auto track_nodes = !m_transpositions.empty();
+    auto size = UCTNodePointer::get_tree_size();
+    auto pruned = size_t{0};
+    for (const auto& candidate : candidates) {
+        if (size <= target_size) {
+            break;
+        }
+        size -= std::min(size, subtree_size(*candidate.node,
+                                            track_nodes ? &freed_nodes : nullptr));
+        auto children = candidate.node->prune_children();
+        std::move(begin(children), end(children), std::back_inserter(garbage));
+        pruned++;
+    }
+
+    // The transpositions must not point to the nodes about to go.
+    if (!freed_nodes.empty()) {
+        std::sort(begin(freed_nodes), end(freed_nodes));
+        for (auto it = begin(m_transpositions); it != end(m_transpositions);) {
+            if (std::binary_search(cbegin(freed_nodes), cend(freed_nodes),
+                                   it->second)) {
+                it = m_transpositions.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    // Partially expanded nodes may use the room to expand further.
+    m_nodes = m_root->count_nodes_and_clear_expand_state();
+
+    myprintf("Pruned %zu subtrees, tree at %zu MiB.\n", pruned, size / MiB);
+    return garbage;
+}
+
+namespace {
+constexpr char TREE_FILE_MAGIC[8] = "SAITREE";
+constexpr std::uint32_t TREE_FILE_VERSION = 1;
+
+struct TreeFileHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t board_size;
+    std::uint64_t network_hash;
+    std::uint64_t position_hash;
+    float komi;
+    float min_policy;
+    std::uint64_t nodes;
+    std::uint64_t bytes;
+};
+}
+
+size_t UCTSearch::save_tree(const std::string& filename,
+                            const float min_policy) {
+    // After genmove the tree is still rooted at the position before the
+    // move. The next search moves the root down to the current one,
+    // counting the ponder hit, saving only looks the node up.
+    const auto root = find_current_root();
+    if (!root) {
+        myprintf("No search tree for the current position.\n");
+        return 0;
+    }
+
+    auto data = std::string{};
+    const auto nodes = root->save_subtree(data, min_policy);
+
+    auto header = TreeFileHeader{};
+    std::memcpy(header.magic, TREE_FILE_MAGIC, sizeof(header.magic));
+    header.version = TREE_FILE_VERSION;
+    header.board_size = BOARD_SIZE;
+    header.network_hash = m_network.get_network_hash();
+    header.position_hash = m_rootstate.board.get_hash();
+    header.komi = m_rootstate.get_komi();
+    header.min_policy = min_policy;
+    header.nodes = nodes;
+    header.bytes = data.size();
+
+    std::ofstream file(filename, std::ofstream::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(data.data(), data.size());
+    if (!file) {
+        myprintf("Could not write search tree %s.\n", filename.c_str());
+        return 0;
+    }
+    myprintf("Saved %zu nodes (%.1f MiB) to %s.\n",
+             nodes, data.size() / static_cast<double>(MiB), filename.c_str());
+    return nodes;
+}
+
+size_t UCTSearch::load_tree(const std::string& filename) {
+    std::ifstream file(filename, std::ifstream::binary);
+    auto header = TreeFileHeader{};
+    file.read(reinterpret_cast<char*>(&header), sizeof(header));
+    if (!file
+        || std::memcmp(header.magic, TREE_FILE_MAGIC, sizeof(header.magic)) != 0
+        || header.version != TREE_FILE_VERSION
+        || header.board_size != BOARD_SIZE) {
+        myprintf("Search tree %s is invalid.\n", filename.c_str());
+        return 0;
+    }
+    if (header.network_hash != m_network.get_network_hash()) {
+        myprintf("Search tree %s belongs to another network.\n",
+                 filename.c_str());
+        return 0;
+    }
+    if (header.position_hash != m_rootstate.board.get_hash()
+        || header.komi != m_rootstate.get_komi()) {
+        myprintf("Search tree %s belongs to another position.\n",
+                 filename.c_str());
+        return 0;
+    }
+    // The records are about as big as the nodes they become.
+    if (header.bytes > cfg_max_tree_size) {
+        myprintf("Search tree %s does not fit in the tree memory.\n",
+                 filename.c_str());
+        return 0;
+    }
+
+    auto data = std::string(header.bytes, '\0');
+    file.read(&data[0], data.size());
+    if (!file) {
+        myprintf("Search tree %s is truncated.\n", filename.c_str());
+        return 0;
+    }
+
+    auto root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+    auto pos = data.data();
+    if (!root->load_subtree(pos, data.data() + data.size())
+        || pos != data.data() + data.size()) {
+        myprintf("Search tree %s is invalid.\n", filename.c_str());
+        return 0;
+    }
+
+    // The transpositions point into the old tree.
+    m_transpositions.clear();
+    m_root = std::move(root);
+    m_last_rootstate = std::make_unique<GameState>(m_rootstate);
+    m_nodes = m_root->count_nodes_and_clear_expand_state();
+    myprintf("Loaded %d nodes from %s.\n", m_nodes.load(), filename.c_str());
+    return static_cast<size_t>(m_nodes.load());
+}
+
 float UCTSearch::get_min_psa_ratio() const {
     const auto mem_full = UCTNodePointer::get_tree_size() / static_cast<float>(cfg_max_tree_size);
     // If we are halfway through our memory budget, start trimming
@@ -250,7 +590,8 @@ float UCTSearch::get_min_psa_ratio() const {
 }
 
 SearchResult UCTSearch::play_simulation(GameState & currstate,
-                                        UCTNode* const node) {
+                                        UCTNode* const node,
+                                        int root_group) {
     auto result = SearchResult{};
     auto new_node = false;
 
@@ -292,6 +633,28 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
             if (m_evaluating && m_root.get() != node) {
                 node->set_progid(m_nodecounter++);
             }
+#endif
+        } else if (const auto other = find_transposition(currstate, node)) {
+            // The same position was expanded through another move order:
+            // instead of a subtree of its own, this node goes on with the
+            // playout in the one of the other node, whose statistics
+            // gather the playouts of both paths. This node keeps counting
+            // the ones through it, for the selection of its parent. The
+            // hash includes the prisoners and the player to move, so
+            // without a cycle of passes, which ends the game, other is
+            // not above this node.
+            if (node->get_visits() == 0) {
+                node->set_values(other->get_net_pi(), other->get_net_alpkt(),
+                                 other->get_net_beta(),
+                                 other->get_net_beta2());
+            }
+            result = play_simulation(currstate, other, root_group);
+            if (result.valid()) {
+                m_transposition_playouts++;
+            }
+#ifndef NDEBUG
+            sminfo.leafstr = "transposition";
+            sminfo.score = other->get_net_alpkt();
 #endif
         } else {
             float value, alpkt, beta, beta2;
@@ -299,9 +662,13 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
 
             // Careful: create_children() can throw a NetworkHaltException when
             // another thread requests draining the search.
-            const auto success =
-                node->create_children(m_network, m_nodes, currstate, value, alpkt, beta, beta2,
-                                      get_min_psa_ratio());
+            auto success = false;
+            {
+                SearchProfiler::Scope scope{SearchProfiler::EXPAND};
+                success = node->create_children(m_network, m_nodes, currstate,
+                                                value, alpkt, beta, beta2,
+                                                get_min_psa_ratio());
+            }
             if (!had_children && success) {
 #ifdef USE_EVALCMD
                 if (m_evaluating && m_root.get() != node) {
@@ -310,6 +677,9 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
 #endif
                 result = SearchResult::from_eval(value, alpkt, beta, beta2, m_network.m_value_head_sai);
                 new_node = true;
+                if (cfg_transpositions) {
+                    add_transposition(transposition_key(currstate), node);
+                }
 #ifndef NDEBUG
                 sminfo.leafstr = "new";
                 sminfo.score = alpkt;
@@ -322,19 +692,29 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
         }
     }
 #ifndef NDEBUG
-    m_info.emplace_back(sminfo);
+    {
+        std::lock_guard<std::mutex> lock(m_info_mutex);
+        m_info.emplace_back(sminfo);
+    }
 #endif
 
     auto restrict_return = false;
     auto update_with_current = false;
 
-    const auto savestate = currstate;
+    // currstate is played on below, keep what updating this node needs.
+    const auto cpu_to_move = currstate.is_cpu_color();
+    const auto to_move = currstate.get_to_move();
     if (node->has_children() && !result.valid()) {
-        auto next = node->uct_select_child(currstate,
-                                           node == m_root.get(),
-                                           m_per_node_maxvisits,
-                                           m_allowed_root_children,
-                                           m_nopass);
+        auto next = static_cast<UCTNode*>(nullptr);
+        {
+            SearchProfiler::Scope scope{SearchProfiler::SELECT};
+            next = node->uct_select_child(currstate,
+                                          node == m_root.get(),
+                                          m_per_node_maxvisits,
+                                          m_allowed_root_children,
+                                          m_nopass,
+                                          root_group);
+        }
         if (next != nullptr) {
             auto move = next->get_move();
             next->set_father_quantiles(node);
@@ -343,8 +723,13 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
                                currstate.get_passes() == 1 &&
                                move == FastBoard::PASS);
 
-            currstate.play_move(move);
-            if (move != FastBoard::PASS && currstate.superko()) {
+            auto superko = false;
+            {
+                SearchProfiler::Scope scope{SearchProfiler::PLAY};
+                currstate.play_move(move);
+                superko = move != FastBoard::PASS && currstate.superko();
+            }
+            if (superko) {
                 next->invalidate();
             } else {
                 const auto allowed = m_allowed_root_children;
@@ -373,6 +758,10 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
         }
     }
 
+    // This is the leaf of a lockstep simulation if create_children()
+    // didn't already wait for the backup.
+    Lockstep::begin_backup();
+
     auto current_node_result = SearchResult::from_node(node, m_network.m_value_head_sai);
 
     // New node was updated in create_children.
@@ -395,9 +784,13 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
         // first pass again.
         const auto & result_for_updating = update_with_current ?
             current_node_result : result;
+        SearchProfiler::Scope backup_scope{SearchProfiler::BACKUP};
         const auto eval = node->update(result_for_updating, result.is_forced());
+        if (node == m_root.get() && !m_curve_komi.empty()) {
+            update_komi_curve(result_for_updating);
+        }
         if (m_network.m_value_head_sai) {
-            node->set_lambda_mu(savestate);
+            node->set_lambda_mu(cpu_to_move, to_move);
             node->update_all_quantiles(result_for_updating.get_alpkt(),
                                        result_for_updating.get_beta(),
                                        result_for_updating.get_beta2());
@@ -413,10 +806,15 @@ SearchResult UCTSearch::play_simulation(GameState & currstate,
         }
 #endif
 #ifndef NDEBUG
-        auto it = m_info.rbegin();
-        for ( ; it != m_info.rend() && it->eval>-0.5f ; it++);
-        it->eval = eval;
-        it->avg = node->get_raw_eval(FastBoard::BLACK,0);
+        {
+            std::lock_guard<std::mutex> lock(m_info_mutex);
+            auto it = m_info.rbegin();
+            for ( ; it != m_info.rend() && it->eval>-0.5f ; it++);
+            if (it != m_info.rend()) {
+                it->eval = eval;
+                it->avg = node->get_raw_eval(FastBoard::BLACK);
+            }
+        }
 #endif
         if (m_stopping_visits >= 1 && m_stopping_moves.size() >= 1) {
             if (node->get_visits() >= m_stopping_visits) {
@@ -581,8 +979,12 @@ void UCTSearch::dump_stats(FastState & state, UCTNode & parent,
 }
 
 void UCTSearch::output_analysis(FastState & state, UCTNode & parent) {
-    // We need to make a copy of the data before sorting
-    auto sortable_data = std::vector<OutputAnalysisData>();
+    // This runs every few centiseconds during lz-analyze, so the data,
+    // the output line and the state for the pvs are kept between calls.
+    auto& sortable_data = m_analysis_data;
+    auto& out = m_analysis_output;
+    sortable_data.clear();
+    out.clear();
 
     if (!parent.has_children()) {
         return;
@@ -595,18 +997,15 @@ void UCTSearch::output_analysis(FastState & state, UCTNode & parent) {
         max_visits = std::max(max_visits, node->get_visits());
     }
 
-    for (const auto& node : parent.get_children()) {
+    const auto& children = parent.get_children();
+    for (auto i = size_t{0}; i < children.size(); i++) {
+        const auto& node = children[i];
         // Send only variations with visits, unless more moves were
         // requested explicitly.
         if (!node->get_visits()
             && sortable_data.size() >= cfg_analyze_tags.post_move_count()) {
             continue;
         }
-        auto move = state.move_to_text(node->get_move());
-        auto tmpstate = FastState{state};
-        tmpstate.play_move(node->get_move());
-        auto rest_of_pv = get_pv(tmpstate, *node);
-        auto pv = move + (rest_of_pv.empty() ? "" : " " + rest_of_pv);
         auto move_eval = node->get_visits() ? node->get_raw_eval(color) : 0.0f;
         auto policy = node->get_policy();
         auto lcb = node->get_eval_lcb(color);
@@ -616,25 +1015,40 @@ void UCTSearch::output_analysis(FastState & state, UCTNode & parent) {
         auto lcb_ratio_exceeded = visits > 2 &&
             visits > max_visits * cfg_lcb_min_visit_ratio;
         // Store data in array
-        sortable_data.emplace_back(move, visits,
-                                   move_eval, policy, pv, lcb, areas, lcb_ratio_exceeded);
+        sortable_data.emplace_back(node.get(), i, visits, move_eval, policy,
+                                   lcb, areas, lcb_ratio_exceeded);
+    }
+    // Sort only the moves that are sent, best first.
+    auto count = sortable_data.size();
+    if (cfg_analyze_tags.max_move_count() > 0) {
+        count = std::min(count, cfg_analyze_tags.max_move_count());
     }
-    // Sort array to decide order
-    std::stable_sort(rbegin(sortable_data), rend(sortable_data));
+    std::partial_sort(begin(sortable_data), begin(sortable_data) + count,
+                      end(sortable_data),
+                      [](const OutputAnalysisData& a,
+                         const OutputAnalysisData& b) { return b < a; });
 
-    auto i = 0;
     // Output analysis data in gtp stream
-    for (const auto& node : sortable_data) {
+    for (auto i = size_t{0}; i < count; i++) {
+        const auto& data = sortable_data[i];
         if (i > 0) {
-            gtp_printf_raw(" ");
+            out.push_back(' ');
         }
-        gtp_printf_raw(node.get_info_string(i, color).c_str());
-        i++;
-    }
-    gtp_printf_raw("\n");
+        data.append_info_string(out, state, i, color);
+        out.append(" pv ")
+           .append(state.move_to_text(data.get_node()->get_move()));
+        m_analysis_state = state;
+        m_analysis_state.play_move(data.get_node()->get_move());
+        append_pv(m_analysis_state, *data.get_node(), out);
+    }
+    out.push_back('\n');
+    gtp_printf_raw("%s", out.c_str());
 }
 
 void UCTSearch::tree_stats(const UCTNode& node) {
+    if (cfg_quiet) {
+        return;
+    }
     size_t nodes = 0;
     size_t non_leaf_nodes = 0;
     size_t depth_sum = 0;
@@ -948,8 +1362,19 @@ int UCTSearch::get_best_move(passflag_t passflag) {
 }
 
 std::string UCTSearch::get_pv(FastState & state, UCTNode& parent) {
+    auto res = std::string{};
+    append_pv(state, parent, res);
+    if (!res.empty()) {
+        // append_pv() puts a space before each move.
+        res.erase(0, 1);
+    }
+    return res;
+}
+
+void UCTSearch::append_pv(FastState & state, UCTNode& parent,
+                          std::string& out) {
     if (!parent.has_children()) {
-        return std::string();
+        return;
     }
 
     if (parent.expandable()) {
@@ -957,23 +1382,20 @@ std::string UCTSearch::get_pv(FastState & state, UCTNode& parent) {
         // the node while we want to traverse the children.
         // Avoid the race conditions and don't go through the rabbit hole
         // of trying to print things from this node.
-        return std::string();
+        return;
     }
 
     auto& best_child = parent.get_best_root_child(state.get_to_move());
     if (best_child.first_visit()) {
-        return std::string();
+        return;
     }
     auto best_move = best_child.get_move();
-    auto res = state.move_to_text(best_move);
+    out.push_back(' ');
+    out.append(state.move_to_text(best_move));
 
     state.play_move(best_move);
 
-    auto next = get_pv(state, best_child);
-    if (!next.empty()) {
-        res.append(" ").append(next);
-    }
-    return res;
+    append_pv(state, best_child, out);
 }
 
 std::string UCTSearch::get_analysis(int playouts) {
@@ -986,6 +1408,18 @@ std::string UCTSearch::get_analysis(int playouts) {
         % playouts % winrate % pvstring.c_str());
 }
 
+UCTSearch::RootSummary UCTSearch::get_root_summary() {
+    auto summary = RootSummary{};
+    FastState tempstate = m_rootstate;
+    summary.visits = m_root->get_visits();
+    summary.winrate = m_root->get_raw_eval(FastBoard::BLACK);
+    summary.alpkt = m_root->get_net_alpkt();
+    summary.beta = m_root->get_beta_tree();
+    summary.score = -m_root->get_quantile_one();
+    summary.pv = get_pv(tempstate, *m_root);
+    return summary;
+}
+
 bool UCTSearch::is_running() const {
     return m_run && UCTNodePointer::get_tree_size() < cfg_max_tree_size;
 }
@@ -996,11 +1430,14 @@ int UCTSearch::est_playouts_left(int elapsed_centis, int time_for_move) const {
         std::max(0, std::min(m_maxplayouts - playouts,
                              m_maxvisits - m_root->get_visits()));
     // Wait for at least 1 second and 100 playouts
-    // so we get a reliable playout_rate.
-    if (elapsed_centis < 100 || playouts < 100) {
+    // so we get a reliable playout_rate, unless one
+    // was measured on the previous moves.
+    auto playout_rate = m_playout_rate;
+    if (elapsed_centis >= 100 && playouts >= 100) {
+        playout_rate = 1.0f * playouts / elapsed_centis;
+    } else if (playout_rate <= 0.0f) {
         return playouts_left;
     }
-    const auto playout_rate = 1.0f * playouts / elapsed_centis;
     const auto time_left = std::max(0, time_for_move - elapsed_centis);
     return std::min(playouts_left,
                     static_cast<int>(std::ceil(playout_rate * time_left)));
@@ -1082,28 +1519,234 @@ bool UCTSearch::have_alternate_moves(int elapsed_centis, int time_for_move) {
     return false;
 }
 
+// True when more playouts are unlikely to change the move. Only the root
+// moves tried at least twice are considered: the lower confidence bound
+// of the best one (cfg_lcb_stop) must be above the upper bounds of all
+// the others, or their scores (cfg_score_stop) must all be within that
+// many points of each other.
+bool UCTSearch::is_move_settled(int color) const {
+    if (!cfg_lcb_stop && cfg_score_stop <= 0.0f) {
+        return false;
+    }
+    // Same as est_playouts_left(), the bounds are not reliable before.
+    if (m_playouts < 100) {
+        return false;
+    }
+    auto contenders = std::vector<const UCTNode*>{};
+    for (const auto& node : m_root->get_children()) {
+        if (node.is_inflated() && node->valid()
+            && node->get_visits() >= 2) {
+            contenders.emplace_back(node.get());
+        }
+    }
+    if (contenders.size() < 2) {
+        return false;
+    }
+
+    if (cfg_lcb_stop) {
+        const auto best = *std::max_element(
+            begin(contenders), end(contenders),
+            [color](const UCTNode* a, const UCTNode* b) {
+                return a->get_eval_lcb(color) < b->get_eval_lcb(color);
+            });
+        const auto best_lcb = best->get_eval_lcb(color);
+        const auto separated = std::all_of(
+            begin(contenders), end(contenders),
+            [best, best_lcb, color](const UCTNode* node) {
+                return node == best || node->get_eval_ucb(color) < best_lcb;
+            });
+        if (separated) {
+            return true;
+        }
+    }
+
+    if (cfg_score_stop > 0.0f && m_network.m_value_head_sai) {
+        const auto scores = std::minmax_element(
+            begin(contenders), end(contenders),
+            [](const UCTNode* a, const UCTNode* b) {
+                return a->get_quantile_one() < b->get_quantile_one();
+            });
+        if ((*scores.second)->get_quantile_one()
+            - (*scores.first)->get_quantile_one() <= cfg_score_stop) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// Extra centiseconds worth searching once the planned time has run out.
+// The move is contested when the two most visited root moves are not
+// separated by their confidence bounds and the game is not already
+// decided (by the score estimate of the SAI value head, or else by the
+// winrate). The whole extension is granted only when at the measured
+// playout rate the runner up could overtake the best move within it;
+// have_alternate_moves() then stops the search as soon as that becomes
+// impossible.
+int UCTSearch::contested_extension(int color, int elapsed_centis,
+                                   int max_extension) const {
+    if (max_extension <= 0 || m_playouts < 100) {
+        return 0;
+    }
+    const UCTNode* first = nullptr;
+    const UCTNode* second = nullptr;
+    for (const auto& node : m_root->get_children()) {
+        if (!node.is_inflated() || !node->valid()
+            || node->get_visits() < 2) {
+            continue;
+        }
+        if (!first || node->get_visits() > first->get_visits()) {
+            second = first;
+            first = node.get();
+        } else if (!second || node->get_visits() > second->get_visits()) {
+            second = node.get();
+        }
+    }
+    if (!second || first->get_eval_lcb(color) > second->get_eval_ucb(color)) {
+        return 0;
+    }
+
+    if (m_network.m_value_head_sai) {
+        float alpkt, beta, eval;
+        std::tie(alpkt, beta, eval) = m_root->score_stats();
+        if (std::abs(alpkt) * beta > 2.0f) {
+            return 0;
+        }
+    } else {
+        const auto winrate = first->get_raw_eval(color);
+        if (winrate < 0.1f || winrate > 0.9f) {
+            return 0;
+        }
+    }
+
+    const auto playout_rate = elapsed_centis >= 100 ?
+        1.0f * m_playouts / elapsed_centis : m_playout_rate;
+    if (playout_rate <= 0.0f) {
+        return 0;
+    }
+    const auto gap = first->get_visits() - second->get_visits();
+    if (gap > playout_rate * max_extension) {
+        return 0;
+    }
+    return max_extension;
+}
+
 bool UCTSearch::stop_thinking(int elapsed_centis, int time_for_move) const {
     return m_playouts >= m_maxplayouts
            || m_root->get_visits() >= m_maxvisits
            || elapsed_centis >= time_for_move;
 }
 
+UCTWorker::UCTWorker(GameState & state, UCTSearch * search, UCTNode * root,
+                     int root_group, Lockstep * lockstep, size_t index)
+    : m_rootstate(state), m_search(search), m_root(root),
+      m_analyze_tags(&cfg_analyze_tags), m_root_group(root_group),
+      m_lockstep(lockstep), m_index(index) {}
+
 void UCTWorker::operator()() {
+    const auto saved_tags = cfg_analyze_tags;
+    cfg_analyze_tags = *m_analyze_tags;
+    if (m_lockstep) {
+        m_lockstep->enter(m_index);
+    }
+    BOOST_SCOPE_EXIT(void) {
+        Lockstep::leave();
+    } BOOST_SCOPE_EXIT_END
+    // In lockstep the first thread decides for the whole round, on the
+    // limits reached by the previous rounds only.
+    const auto should_run = [this]() {
+        return m_search->is_running() && !m_search->limit_reached();
+    };
     try {
-        do {
-            auto currstate = std::make_unique<GameState>(m_rootstate);
-            auto result = m_search->play_simulation(*currstate, m_root);
+        for (;;) {
+            if (m_lockstep && !m_lockstep->begin_simulation(should_run)) {
+                break;
+            }
+            auto currstate = std::unique_ptr<GameState>{};
+            {
+                SearchProfiler::Scope scope{SearchProfiler::PLAY};
+                currstate = std::make_unique<GameState>(m_rootstate);
+            }
+            auto result = m_search->play_simulation(*currstate, m_root,
+                                                    m_root_group);
             if (result.valid()) {
                 m_search->increment_playouts();
             }
-        } while (m_search->is_running());
+            if (m_lockstep) {
+                Lockstep::end_simulation();
+            } else if (!m_search->is_running()) {
+                break;
+            }
+        }
     } catch (NetworkHaltException&) {
         // intentionally empty
+    } catch (...) {
+        // The network failed: stop the other threads, think() passes the
+        // error on when it waits for them.
+        m_search->stop();
+        cfg_analyze_tags = saved_tags;
+        throw;
+    }
+    cfg_analyze_tags = saved_tags;
+}
+
+std::atomic<std::uint64_t> UCTSearch::s_total_playouts{0};
+std::atomic<int> UCTSearch::s_running_searches{0};
+bool UCTSearch::s_share_threads = false;
+std::atomic<std::uint64_t> UCTSearch::s_cost_moves{0};
+std::atomic<std::uint64_t> UCTSearch::s_cost_fixed_us{0};
+std::atomic<std::uint64_t> UCTSearch::s_cost_search_us{0};
+std::atomic<std::uint64_t> UCTSearch::s_cost_playouts{0};
+
+void UCTSearch::reset_move_cost() {
+    s_cost_moves = 0;
+    s_cost_fixed_us = 0;
+    s_cost_search_us = 0;
+    s_cost_playouts = 0;
+}
+
+std::string UCTSearch::move_cost_report() {
+    const auto moves = s_cost_moves.load();
+    const auto playouts = s_cost_playouts.load();
+    return str(boost::format("%d moves, %d playouts: %.2f ms per move "
+                             "besides the search, %.1f us per playout")
+        % moves % playouts
+        % (s_cost_fixed_us / 1000.0 / std::max(moves, std::uint64_t{1}))
+        % (1.0 * s_cost_search_us / std::max(playouts, std::uint64_t{1})));
+}
+
+size_t UCTSearch::search_threads() {
+    if (!s_share_threads) {
+        return cfg_num_threads;
     }
+    const auto running = size_t(std::max(1, s_running_searches.load()));
+    return std::max(size_t{1}, cfg_num_threads / running);
+}
+
+namespace {
+    // Counts a search in UCTSearch::s_running_searches while it lives.
+    class RunningSearch {
+    public:
+        explicit RunningSearch(std::atomic<int>& count) : m_count(count) {
+            ++m_count;
+        }
+        ~RunningSearch() {
+            --m_count;
+        }
+    private:
+        std::atomic<int>& m_count;
+    };
 }
 
 void UCTSearch::increment_playouts() {
-    m_playouts++;
+    const auto playouts = ++m_playouts;
+    s_total_playouts.fetch_add(1, std::memory_order_relaxed);
+    if ((playouts >= m_maxplayouts || m_root->get_visits() >= m_maxvisits)
+        && !m_limit_reached.exchange(true)) {
+        // Taking the lock makes sure that think() is either waiting or
+        // still has to check m_limit_reached.
+        std::lock_guard<std::mutex> lock(m_limit_mutex);
+        m_limit_cv.notify_all();
+    }
     //    myprintf("\n");
 }
 
@@ -1143,21 +1786,65 @@ int UCTSearch::think(int color, passflag_t passflag) {
 
     // set up timing info
     Time start;
+    const auto think_start = std::chrono::steady_clock::now();
+    auto search_start = think_start;
+    auto search_end = think_start;
+    BOOST_SCOPE_EXIT(&think_start, &search_start, &search_end, this_) {
+        using namespace std::chrono;
+        const auto total = steady_clock::now() - think_start;
+        const auto search = search_end - search_start;
+        s_cost_moves++;
+        s_cost_playouts += this_->m_playouts;
+        s_cost_search_us += duration_cast<microseconds>(search).count();
+        s_cost_fixed_us += duration_cast<microseconds>(total - search).count();
+    } BOOST_SCOPE_EXIT_END
 
     update_root();
     // set side to move
     m_rootstate.board.set_to_move(color);
 
+    // The draws of the root preparation, like those of each search
+    // thread, don't depend on which thread of the pool runs them.
+    if (cfg_deterministic) {
+        Random::seed_thread(0);
+    }
+
     auto time_for_move =
         m_rootstate.get_timecontrol().max_time_for_move(
             m_rootstate.board.get_boardsize(),
             color, m_rootstate.get_movenum());
 
-    myprintf("Thinking at most %.1f seconds...\n", time_for_move/100.0f);
+    auto time_extension =
+        cfg_timemanage == TimeManagement::OFF ? 0 :
+        m_rootstate.get_timecontrol().max_extension_for_move(
+            m_rootstate.board.get_boardsize(),
+            color, m_rootstate.get_movenum());
+
+    if (time_extension > 0) {
+        myprintf("Thinking at most %.1f (+%.1f if contested) seconds...\n",
+                 time_for_move/100.0f, time_extension/100.0f);
+    } else {
+        myprintf("Thinking at most %.1f seconds...\n", time_for_move/100.0f);
+    }
+
+    // Playout cap randomization: past the random moves, most moves only
+    // get a fast search without noise and are not training data.
+    const auto full_visits = m_maxvisits;
+    auto unif_law = std::uniform_real_distribution<float>{0.0, 1.0};
+    const auto fast_search = cfg_fast_visits > 0
+        && m_rootstate.get_movenum() >= static_cast<size_t>(cfg_random_cnt)
+        && unif_law(Random::get_Rng()) >= cfg_full_search_prob;
+    BOOST_SCOPE_EXIT(&full_visits, this_) {
+        this_->m_maxvisits = full_visits;
+    } BOOST_SCOPE_EXIT_END
+    if (fast_search) {
+        m_maxvisits = std::min(m_maxvisits, cfg_fast_visits);
+    }
 
     // create a sorted list of legal moves (make sure we
     // play something legal and decent even in time trouble)
-    m_root->prepare_root_node(m_network, color, m_nodes, m_rootstate);
+    m_root->prepare_root_node(m_network, color, m_nodes, m_rootstate,
+                              false, true, !fast_search);
 
     if (m_rootstate.get_movenum() < static_cast<size_t>(cfg_random_cnt)) {
         m_per_node_maxvisits = static_cast<int>((1.0 - cfg_noise_weight) * m_maxvisits);
@@ -1178,18 +1865,38 @@ int UCTSearch::think(int color, passflag_t passflag) {
     }
 
     m_run = true;
-    int cpus = cfg_num_threads;
+    m_limit_reached = false;
+    RunningSearch running(s_running_searches);
+    const auto cpus = int(search_threads());
     myprintf("cpus=%i\n", cpus);
     ThreadGroup tg(thread_pool);
+    auto lockstep = std::unique_ptr<Lockstep>{};
+    if (cfg_deterministic) {
+        lockstep = std::make_unique<Lockstep>(cpus);
+    }
+    const auto remote = use_remote();
+    if (remote) {
+        m_remote->start(m_rootstate, color, time_for_move,
+                        m_maxplayouts, m_maxvisits);
+    }
+    search_start = std::chrono::steady_clock::now();
     for (int i = 0; i < cpus; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
+        tg.add_task(UCTWorker(m_rootstate, this, m_root.get(),
+                              i % cfg_root_split, lockstep.get(), i));
     }
 
     auto keeprunning = true;
     auto last_update = 0;
     auto last_output = 0;
     do {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        {
+            std::unique_lock<std::mutex> lock(m_limit_mutex);
+            m_limit_cv.wait_for(lock, std::chrono::milliseconds(10),
+                                [this]() { return m_limit_reached.load(); });
+        }
+        if (remote) {
+            m_remote->merge(m_rootstate, *m_root);
+        }
 	//        auto currstate = std::make_unique<GameState>(m_rootstate);
 	//        auto result = play_simulation(*currstate, m_root.get());
         // if (result.valid()) {
@@ -1242,10 +1949,30 @@ int UCTSearch::think(int color, passflag_t passflag) {
             last_update = elapsed_centis;
             myprintf("%s\n", get_analysis(m_playouts.load()).c_str());
         }
+        if (time_extension > 0 && elapsed_centis >= time_for_move) {
+            const auto extra =
+                contested_extension(color, elapsed_centis, time_extension);
+            if (extra > 0) {
+                myprintf("Move is contested, thinking %.1f seconds more.\n",
+                         extra/100.0f);
+                time_for_move += extra;
+            }
+            time_extension = 0;
+        }
         keeprunning  = is_running();
         keeprunning &= !stop_thinking(elapsed_centis, time_for_move);
-        if (m_per_node_maxvisits == 0) {
+        // Nobody is left to play the move of a session whose peer has
+        // gone, as when a --remote search stops its workers.
+        keeprunning &= !Utils::session_closed();
+        // The early stops look at the tree at times that depend on the
+        // speed, a deterministic search only stops at its limits.
+        if (m_per_node_maxvisits == 0 && !cfg_deterministic) {
             keeprunning &= have_alternate_moves(elapsed_centis, time_for_move);
+            if (keeprunning && is_move_settled(color)) {
+                myprintf("Best move settled after %d playouts, "
+                         "stopping early.\n", m_playouts.load());
+                keeprunning = false;
+            }
         }
     } while (keeprunning);
 
@@ -1259,6 +1986,26 @@ int UCTSearch::think(int color, passflag_t passflag) {
     m_network.drain_evals();
     tg.wait_all();
     m_network.resume_evals();
+    // The workers that have not reached their share of the limits or of
+    // the time are stopped with the local search.
+    if (remote) {
+        m_remote->stop();
+        m_remote->finish();
+        m_remote->merge(m_rootstate, *m_root);
+    }
+    search_end = std::chrono::steady_clock::now();
+
+    // Remember the playout rate for the time management of the next
+    // moves: it depends a lot on the hardware.
+    {
+        Time elapsed;
+        const auto elapsed_centis = Time::timediff_centis(start, elapsed);
+        if (elapsed_centis >= 100 && m_playouts >= 100) {
+            const auto rate = 1.0f * m_playouts / elapsed_centis;
+            m_playout_rate = m_playout_rate > 0.0f ?
+                0.5f * (m_playout_rate + rate) : rate;
+        }
+    }
 
     // Reactivate all pruned root children.
     for (const auto& node : m_root->get_children()) {
@@ -1287,7 +2034,11 @@ int UCTSearch::think(int color, passflag_t passflag) {
                      chn_endstate->get_komi());
 #endif
             auto FRO_tree = std::make_unique<UCTSearch>(*chn_endstate, m_network);
-            FRO_tree->fast_roll_out();
+            if (cfg_policy_rollouts > 0) {
+                FRO_tree->policy_roll_out();
+            } else {
+                FRO_tree->fast_roll_out();
+            }
 #ifndef NDEBUG
             myprintf("Roll-out completed.\n");
             chn_endstate->display_state();
@@ -1313,7 +2064,9 @@ int UCTSearch::think(int color, passflag_t passflag) {
     }
 
     // Write KoState with previous thinking evaluation
-    Training::record(m_network, m_rootstate, *m_root);
+    if (m_record_training) {
+        Training::record(m_network, m_rootstate, *m_root, fast_search);
+    }
 
     // Just before the previous move, our opponent gave an estimate of
     // its least-acceptable-score, using the visits of the subtree of
@@ -1392,15 +2145,21 @@ int UCTSearch::think(int color, passflag_t passflag) {
              m_nodes.load(),
              m_playouts.load(),
              (m_playouts * 100.0) / (elapsed_centis+1));
-
-#ifdef USE_OPENCL
-#ifndef NDEBUG
-    myprintf("batch stats: %d %d\n",
-        batch_stats.single_evals.load(),
-        batch_stats.batch_evals.load()
-    );
-#endif
-#endif
+    if (cfg_transpositions) {
+        myprintf("%d playouts went on in the subtree of a transposition.\n\n",
+                 m_transposition_playouts.load());
+    }
+    if (SearchProfiler::enabled()) {
+        myprintf("Search profile:\n%s\n", SearchProfiler::report().c_str());
+    }
+    const auto contention = UCTNode::get_expand_wait_stats();
+    if (contention.waits > 0 || contention.skips > 0
+        || contention.collisions > 0) {
+        myprintf("Expansion contention: %zu waits, %.1f ms waiting, "
+                 "%zu playouts given up, %zu leaf collisions\n\n",
+                 contention.waits, contention.wait_us / 1000.0,
+                 contention.skips, contention.collisions);
+    }
 
     //    int bestmove = get_best_move(passflag);
 
@@ -1684,7 +2443,7 @@ std::string UCTSearch::explain_last_think() const {
     return m_think_output;
 }
 
-void UCTSearch::ponder() {
+void UCTSearch::ponder(bool after_move) {
     auto disable_reuse = cfg_analyze_tags.has_move_restrictions();
     if (disable_reuse) {
         m_last_rootstate.reset(nullptr);
@@ -1695,22 +2454,53 @@ void UCTSearch::ponder() {
     m_root->prepare_root_node(m_network, m_rootstate.board.get_to_move(),
                               m_nodes, m_rootstate);
 
+    // With cfg_ponder_replies, spend the opponent's time only on the
+    // replies the policy finds most likely.
+    if (after_move && cfg_ponder_replies > 0
+        && cfg_ponder_replies < m_root->get_children().size()) {
+        auto policies = std::vector<float>{};
+        for (const auto& node : m_root->get_children()) {
+            policies.emplace_back(node->get_policy());
+        }
+        std::nth_element(begin(policies),
+                         begin(policies) + cfg_ponder_replies - 1,
+                         end(policies), std::greater<float>());
+        const auto min_policy = policies[cfg_ponder_replies - 1];
+        for (const auto& node : m_root->get_children()) {
+            node->set_active(node->get_policy() >= min_policy);
+        }
+    }
+
     // store the initial size of the MCTS subtrees before thinking
     std::map<int,int> initial_visits;
     for (const auto& node : m_root->get_children()) {
         const auto move = node->get_move();
         initial_visits[move] = node->get_visits();
     }
-    m_run = true;
+    RunningSearch running(s_running_searches);
+    const auto threads = search_threads();
     ThreadGroup tg(thread_pool);
-    for (auto i = size_t{0}; i < cfg_num_threads; i++) {
-        tg.add_task(UCTWorker(m_rootstate, this, m_root.get()));
+    const auto start_workers = [&]() {
+        m_run = true;
+        for (auto i = size_t{0}; i < threads; i++) {
+            tg.add_task(UCTWorker(m_rootstate, this, m_root.get(),
+                                  i % cfg_root_split));
+        }
+    };
+    start_workers();
+    const auto remote = use_remote();
+    if (remote) {
+        m_remote->start_analysis(m_rootstate);
     }
     Time start;
     auto keeprunning = true;
     auto last_output = 0;
+    auto input_arrived = false;
     do {
-        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        input_arrived = Utils::wait_input(10);
+        if (remote) {
+            m_remote->merge(m_rootstate, *m_root);
+        }
         if (cfg_analyze_tags.interval_centis()) {
             Time elapsed;
             int elapsed_centis = Time::timediff_centis(start, elapsed);
@@ -1719,9 +2509,21 @@ void UCTSearch::ponder() {
                 output_analysis(m_rootstate, *m_root);
             }
         }
+        if (cfg_prune_tree && !input_arrived
+            && UCTNodePointer::get_tree_size() > PRUNE_START * cfg_max_tree_size) {
+            // Pause the workers, which finish their playouts, to detach
+            // the cold subtrees. They are freed here while the search
+            // goes on.
+            m_run = false;
+            tg.wait_all();
+            auto garbage = prune_tree(
+                static_cast<size_t>(PRUNE_TARGET * cfg_max_tree_size));
+            start_workers();
+            garbage.clear();
+        }
         keeprunning  = is_running();
         keeprunning &= !stop_thinking(0, 1);
-    } while (!Utils::input_pending() && keeprunning);
+    } while (!input_arrived && keeprunning);
 
     // Make sure to post at least once.
     if (cfg_analyze_tags.interval_centis() && last_output == 0) {
@@ -1733,6 +2535,23 @@ void UCTSearch::ponder() {
     m_network.drain_evals();
     tg.wait_all();
     m_network.resume_evals();
+    if (remote) {
+        m_remote->stop();
+        m_remote->finish();
+        m_remote->merge(m_rootstate, *m_root);
+    }
+
+    // Remember what was searched to tell a ponder hit, and reactivate
+    // the replies left out.
+    m_ponder_moves.clear();
+    if (after_move) {
+        for (const auto& node : m_root->get_children()) {
+            if (node->active() && node->get_visits() > 0) {
+                m_ponder_moves.emplace_back(node->get_move());
+            }
+            node->set_active(true);
+        }
+    }
 
     // Display search info.
     myprintf("\n");
@@ -1746,6 +2565,22 @@ void UCTSearch::ponder() {
     }
 }
 
+// Whether to search on the --remote workers too. A deterministic search
+// stays local, the remote statistics come in at times that depend on the
+// network, and so does one with move restrictions, which the workers are
+// not given.
+bool UCTSearch::use_remote() {
+    if (cfg_remote_workers.empty() || cfg_deterministic
+        || cfg_analyze_tags.has_move_restrictions()) {
+        return false;
+    }
+    if (!m_remote) {
+        m_remote = std::make_unique<RemoteSearch>(
+            cfg_remote_workers, m_network.get_network_hash());
+    }
+    return true;
+}
+
 void UCTSearch::set_playout_limit(int playouts) {
     static_assert(std::is_convertible<decltype(playouts),
                                       decltype(m_maxplayouts)>::value,
@@ -1761,8 +2596,50 @@ void UCTSearch::set_visit_limit(int visits) {
     m_maxvisits = std::min(visits, UNLIMITED_PLAYOUTS);
 }
 
+void UCTSearch::set_komi_curve(const std::vector<float>& komi) {
+    std::lock_guard<std::mutex> lock(m_curve_mutex);
+    m_curve_komi = komi;
+    m_curve_sums.assign(komi.size(), 0.0);
+    m_curve_playouts = 0;
+}
+
+std::vector<std::pair<float, float>> UCTSearch::get_komi_curve() const {
+    std::lock_guard<std::mutex> lock(m_curve_mutex);
+    auto curve = std::vector<std::pair<float, float>>{};
+    for (auto i = size_t{0}; i < m_curve_komi.size(); i++) {
+        const auto winrate = m_curve_playouts > 0 ?
+            float(m_curve_sums[i] / m_curve_playouts) : 0.5f;
+        curve.emplace_back(m_curve_komi[i], winrate);
+    }
+    return curve;
+}
+
+void UCTSearch::update_komi_curve(const SearchResult& result) {
+    // The score of the result is for black at the komi of the game, so
+    // at komi k black is ahead komi - k points more.
+    const auto komi = m_rootstate.get_komi();
+    auto winrates = std::vector<float>(m_curve_komi.size());
+    for (auto i = size_t{0}; i < m_curve_komi.size(); i++) {
+        winrates[i] = sigmoid_fast(result.get_alpkt(), result.get_beta(),
+                                   komi - m_curve_komi[i],
+                                   result.get_beta2()).first;
+    }
+    std::lock_guard<std::mutex> lock(m_curve_mutex);
+    for (auto i = size_t{0}; i < winrates.size(); i++) {
+        m_curve_sums[i] += winrates[i];
+    }
+    m_curve_playouts++;
+}
+
 float SearchResult::eval_with_bonus(float xbar, float xbase) const {
-    return Utils::sigmoid_interval_avg(m_alpkt, m_beta, m_beta2, xbase, xbar);
+    if (!m_bonus_valid || xbar != m_bonus_xbar || xbase != m_bonus_xbase) {
+        m_bonus_eval = Utils::sigmoid_interval_avg(m_alpkt, m_beta, m_beta2,
+                                                   xbase, xbar);
+        m_bonus_xbar = xbar;
+        m_bonus_xbase = xbase;
+        m_bonus_valid = true;
+    }
+    return m_bonus_eval;
 }
 
 bool UCTSearch::is_better_move(int move1, int move2, float & estimated_score) {
@@ -1937,6 +2814,89 @@ void UCTSearch::fast_roll_out() {
     m_chn_scoring = scoring;
 }
 
+// Cheaper alternative to fast_roll_out(), with no tree: plays
+// cfg_policy_rollouts games to the end in lockstep, evaluating the
+// positions of all of them in one batch per move. The first game always
+// plays the move with the highest policy, the others sample it. Moves
+// filling an own eye are never played, so dead stones end up captured,
+// as with Tromp-Taylor scoring in fast_roll_out(). The game with the
+// median score is left in m_rootstate.
+void UCTSearch::policy_roll_out() {
+    m_rootstate.set_passes(0);
+
+    auto games = std::vector<GameState>(
+        std::max(1, cfg_policy_rollouts), m_rootstate);
+    const auto max_movenum = m_rootstate.get_movenum() + 2 * NUM_INTERSECTIONS;
+    auto unif_law = std::uniform_real_distribution<float>{0.0, 1.0};
+
+    auto playing = std::vector<GameState*>{};
+    for (auto& game : games) {
+        playing.emplace_back(&game);
+    }
+    while (!playing.empty()) {
+        const auto states =
+            std::vector<const GameState*>(begin(playing), end(playing));
+        const auto results = m_network.get_output_batch(
+            states, Network::Ensemble::RANDOM_SYMMETRY);
+
+        auto still_playing = std::vector<GameState*>{};
+        for (auto g = size_t{0}; g < playing.size(); g++) {
+            auto& state = *playing[g];
+            const auto color = state.get_to_move();
+            const auto size = state.board.get_boardsize();
+            const auto greedy = playing[g] == &games[0];
+
+            auto candidates = std::vector<Network::PolicyVertexPair>{};
+            auto policy_sum = 0.0f;
+            for (auto y = 0; y < size; y++) {
+                for (auto x = 0; x < size; x++) {
+                    const auto vertex = state.board.get_vertex(x, y);
+                    if (state.is_move_legal(color, vertex)
+                        && !state.board.is_eye(color, vertex)) {
+                        const auto policy =
+                            results[g].policy[state.board.get_index(vertex)];
+                        candidates.emplace_back(policy, vertex);
+                        policy_sum += policy;
+                    }
+                }
+            }
+
+            auto move = static_cast<int>(FastBoard::PASS);
+            if (!candidates.empty()) {
+                if (greedy || policy_sum <= 0.0f) {
+                    move = std::max_element(begin(candidates),
+                                            end(candidates))->second;
+                } else {
+                    auto threshold =
+                        unif_law(Random::get_Rng()) * policy_sum;
+                    move = candidates.back().second;
+                    for (const auto& candidate : candidates) {
+                        threshold -= candidate.first;
+                        if (threshold <= 0.0f) {
+                            move = candidate.second;
+                            break;
+                        }
+                    }
+                }
+            }
+            state.play_move(move);
+            if (state.get_passes() < 2 && state.get_movenum() < max_movenum) {
+                still_playing.emplace_back(&state);
+            }
+        }
+        playing = std::move(still_playing);
+    }
+
+    std::sort(begin(games), end(games),
+              [](const GameState& a, const GameState& b) {
+                  return a.final_score() < b.final_score();
+              });
+    const auto& median = games[games.size() / 2];
+    myprintf("Policy roll-outs: %zu games, median score %.1f.\n",
+             games.size(), median.final_score());
+    m_rootstate = median;
+}
+
 void UCTSearch::explore_move(int move) {
     const auto nodeptr = m_root->select_child(move);
 
@@ -2000,7 +2960,11 @@ float UCTSearch::final_japscore() {
     chn_endstate->set_komi(estimated_score - m_rootstate.get_handicap());
     auto FRO_tree = std::make_unique<UCTSearch>(*chn_endstate, m_network);
 
-    FRO_tree->fast_roll_out();
+    if (cfg_policy_rollouts > 0) {
+        FRO_tree->policy_roll_out();
+    } else {
+        FRO_tree->fast_roll_out();
+    }
 
     auto jap_endboard = std::make_unique<FullBoard>(m_rootstate.board);
     if (jap_endboard->remove_dead_stones(chn_endstate->board)) {
@@ -33,20 +33,26 @@
 
 #include <list>
 #include <atomic>
+#include <condition_variable>
 #include <map>
 #include <memory>
+#include <mutex>
 #include <string>
 #include <tuple>
 #include <future>
+#include <unordered_map>
 
 #include "ThreadPool.h"
 #include "FastBoard.h"
 #include "FastState.h"
 #include "GameState.h"
+#include "Lockstep.h"
 #include "UCTNode.h"
 #include "Utils.h"
 #include "Network.h"
+#include "RemoteSearch.h"
 
+class AnalyzeTags;
 
 class SearchResult {
 public:
@@ -78,6 +84,13 @@ private:
     float m_beta2{-1.0f};
     bool m_value_head_sai{true};
     bool m_forced{false};
+    // A result is backed up through every node of the path, and the
+    // bonus interval of those nodes is often the same, like all zero
+    // when no agent parameter is set. Remember the last one.
+    mutable bool m_bonus_valid{false};
+    mutable float m_bonus_xbar{0.0f};
+    mutable float m_bonus_xbase{0.0f};
+    mutable float m_bonus_eval{0.0f};
 };
 
 namespace TimeManagement {
@@ -86,6 +99,8 @@ namespace TimeManagement {
     };
 };
 
+class OutputAnalysisData;
+
 class UCTSearch {
 public:
     /*
@@ -110,6 +125,14 @@ public:
     */
     static constexpr size_t MIN_TREE_SPACE = 100'000'000;
 
+    /*
+        With cfg_prune_tree, ponder() frees the least visited subtrees
+        once the tree is over this share of cfg_max_tree_size, until it
+        is back to PRUNE_TARGET.
+    */
+    static constexpr auto PRUNE_START = 0.9f;
+    static constexpr auto PRUNE_TARGET = 0.7f;
+
     /*
         Value representing unlimited visits or playouts. Due to
         concurrent updates while multithreading, we need some
@@ -122,6 +145,7 @@ public:
     static constexpr auto EXPLORE_MOVE_VISITS = 30;
 
     UCTSearch(GameState& g, Network & network);
+    ~UCTSearch();
     int think(int color, passflag_t passflag = NORMAL);
 #ifdef USE_EVALCMD
     void set_firstmove(int move);
@@ -138,15 +162,73 @@ public:
 #endif
     void set_playout_limit(int playouts);
     void set_visit_limit(int visits);
-    void ponder();
+    // Whether think() records its position for the training data, on by
+    // default. Off for analysis, which plays no game of its own.
+    void set_record_training(bool record) { m_record_training = record; }
+    // Search until input arrives. after_move is set when pondering on
+    // the opponent's time after our own move: only then does
+    // cfg_ponder_replies narrow the root, and are the searched replies
+    // kept to count the ponder hits. lz-analyze leaves it unset.
+    void ponder(bool after_move = false);
     bool is_running() const;
+    // End the search early, as when a worker thread fails.
+    void stop() { m_run = false; }
+    // The playout or visit limit was reached.
+    bool limit_reached() const { return m_limit_reached; }
+    // With cfg_transpositions, the playouts of the last search that went
+    // on in the subtree of another node of the same position.
+    int get_transposition_playouts() const {
+        return m_transposition_playouts.load();
+    }
     void increment_playouts();
+    // Playouts of all the searches since the start.
+    static std::uint64_t get_total_playouts() { return s_total_playouts.load(); }
+    // Split cfg_num_threads between the searches running at the same
+    // time, as the sessions of the server do, instead of giving each
+    // search all of them.
+    static void set_share_threads(bool share) { s_share_threads = share; }
+    // Time think() spends outside of the search itself (tree reuse,
+    // root preparation, move choice, training record, output), per move,
+    // against the time of the search per playout, over all the moves
+    // since reset_move_cost().
+    static void reset_move_cost();
+    static std::string move_cost_report();
     float final_japscore();
     void tree_stats();
     std::string explain_last_think() const;
-    SearchResult play_simulation(GameState& currstate, UCTNode* const node);
+    SearchResult play_simulation(GameState& currstate, UCTNode* const node,
+                                 int root_group = 0);
     AgentEval get_root_agent_eval() const;
     void prepare_root_node();
+    // From the next search on, also average the winrate of black at each
+    // of these komi values, rescoring with the SAI sigmoid every result
+    // backed up at the root. The tree is still searched at the komi of
+    // the game, so values far from it are less accurate.
+    void set_komi_curve(const std::vector<float>& komi);
+    // The komi values and the winrate of black at each, over the playouts
+    // since set_komi_curve().
+    std::vector<std::pair<float, float>> get_komi_curve() const;
+    // Write the tree of the current position to filename, see
+    // UCTNode::save_subtree(). The search itself is left as it is.
+    // Returns the number of nodes written, 0 on failure.
+    size_t save_tree(const std::string& filename, float min_policy);
+    // Replace the tree with the one saved in filename, if it was searched
+    // by this network from the current position: the next search goes on
+    // from there. Returns the number of nodes loaded, 0 on failure.
+    size_t load_tree(const std::string& filename);
+
+    // The outcome of the last think() at its root, for black: winrate,
+    // alpkt and beta of the net, score estimate of the tree, and the
+    // principal variation.
+    struct RootSummary {
+        int visits;
+        float winrate;
+        float alpkt;
+        float beta;
+        float score;
+        std::string pv;
+    };
+    RootSummary get_root_summary();
 
 private:
     float get_min_psa_ratio() const;
@@ -155,6 +237,7 @@ private:
                                       int at_least_as_many, float probab_threash);
     void tree_stats(const UCTNode& node);
     std::string get_pv(FastState& state, UCTNode& parent);
+    void append_pv(FastState& state, UCTNode& parent, std::string& out);
     std::string get_analysis(int playouts);
     bool should_resign(passflag_t passflag, float besteval);
     bool have_alternate_moves(int elapsed_centis, int time_for_move);
@@ -162,9 +245,22 @@ private:
     size_t prune_noncontenders(int color, int elapsed_centis = 0, int time_for_move = 0,
                                bool prune = true);
     bool stop_thinking(int elapsed_centis = 0, int time_for_move = 0) const;
+    bool is_move_settled(int color) const;
+    int contested_extension(int color, int elapsed_centis,
+                            int max_extension) const;
     int get_best_move(passflag_t passflag);
     void update_root(bool is_evaluating = false);
     bool advance_to_new_rootstate();
+    // The node of m_rootstate in the tree, found as
+    // advance_to_new_rootstate() would but without moving m_root, or
+    // nullptr if the tree doesn't reach it.
+    UCTNode* find_current_root() const;
+    void count_ponder_hit(int move);
+    bool use_remote();
+    static std::uint64_t transposition_key(const GameState& state);
+    UCTNode* find_transposition(const GameState& state, UCTNode* node);
+    void add_transposition(std::uint64_t key, UCTNode* node);
+    UCTNodeChildren prune_tree(size_t target_size);
     void select_playable_dame(FullBoard *board);
     void select_dame_sequence(FullBoard *board);
     bool is_stopping (int move) const;
@@ -172,17 +268,43 @@ private:
     void explore_move(int move);
     void explore_root_nopass();
     void fast_roll_out();
+    void policy_roll_out();
     void output_analysis(FastState & state, UCTNode & parent);
+    void update_komi_curve(const SearchResult& result);
 
     GameState & m_rootstate;
     std::unique_ptr<GameState> m_last_rootstate;
     std::unique_ptr<UCTNode> m_root;
     std::atomic<int> m_nodes{0};
     std::atomic<int> m_playouts{0};
+    static std::atomic<std::uint64_t> s_total_playouts;
+    static std::atomic<int> s_running_searches;
+    static bool s_share_threads;
+    // See move_cost_report(), in microseconds.
+    static std::atomic<std::uint64_t> s_cost_moves;
+    static std::atomic<std::uint64_t> s_cost_fixed_us;
+    static std::atomic<std::uint64_t> s_cost_search_us;
+    static std::atomic<std::uint64_t> s_cost_playouts;
+    // Worker threads for a search starting now.
+    static size_t search_threads();
     std::atomic<bool> m_run{false};
+    // Set by the worker whose playout reaches the playout or visit
+    // limit, think() waits on m_limit_cv for it instead of polling.
+    std::atomic<bool> m_limit_reached{false};
+    std::mutex m_limit_mutex;
+    std::condition_variable m_limit_cv;
     int m_maxplayouts;
     int m_maxvisits;
+    // The other hosts searching with think(), for cfg_remote_workers.
+    std::unique_ptr<RemoteSearch> m_remote;
+    // Playouts per centisecond measured on the previous moves.
+    float m_playout_rate{0.0f};
     std::string m_think_output;
+    // See set_komi_curve().
+    std::vector<float> m_curve_komi;
+    std::vector<double> m_curve_sums;
+    int m_curve_playouts{0};
+    mutable std::mutex m_curve_mutex;
 
 #ifdef USE_EVALCMD
     int m_nodecounter=0;
@@ -200,7 +322,9 @@ private:
         float avg = -1.0f;
     };
 
+    // Filled by all the search threads.
     std::vector<sim_node_info> m_info;
+    std::mutex m_info_mutex;
 #endif
 
     // Advanced search parameters
@@ -217,6 +341,17 @@ private:
     // If empty it is ignored.
     std::vector<int> m_allowed_root_children = {};
 
+    // Scratch space of output_analysis().
+    std::vector<OutputAnalysisData> m_analysis_data;
+    std::string m_analysis_output;
+    FastState m_analysis_state;
+
+    // Root moves searched by the last ponder, and how often the
+    // opponent played one of them.
+    std::vector<int> m_ponder_moves;
+    int m_ponder_replies{0};
+    int m_ponder_hits{0};
+
     // If, during the search, any of these vertexes is the move of a
     // node with at least m_stopping_visits, the flag is set to
     // true.  If the vector is empty or the visits are 0 it is
@@ -225,24 +360,42 @@ private:
     int m_stopping_visits = 0;
     bool m_stopping_flag = false;
     bool m_nopass = false;
+    bool m_record_training = true;
     int m_last_resign_request = -1;
 
     int m_bestmove = FastBoard::PASS;
 
     std::list<Utils::ThreadGroup> m_delete_futures;
 
+    // With cfg_transpositions, the node expanded for each position, see
+    // transposition_key(). Nodes are only deleted when the root changes,
+    // which is when this gets cleared, and by prune_tree(), which erases
+    // them here.
+    std::unordered_map<std::uint64_t, UCTNode*> m_transpositions;
+    std::mutex m_transpositions_mutex;
+    std::atomic<int> m_transposition_playouts{0};
+
     Network & m_network;
 };
 
 class UCTWorker {
 public:
-    UCTWorker(GameState & state, UCTSearch * search, UCTNode * root)
-      : m_rootstate(state), m_search(search), m_root(root) {}
+    // With lockstep, the simulations run in its rounds as thread index.
+    UCTWorker(GameState & state, UCTSearch * search, UCTNode * root,
+              int root_group = 0, Lockstep * lockstep = nullptr,
+              size_t index = 0);
     void operator()();
 private:
     GameState & m_rootstate;
     UCTSearch * m_search;
     UCTNode * m_root;
+    // The tags of the session that started the search, as the workers
+    // run on the threads of the pool.
+    const AnalyzeTags* m_analyze_tags;
+    // Share of the root children searched, see cfg_root_split.
+    int m_root_group;
+    Lockstep * m_lockstep;
+    size_t m_index;
 };
 
 #endif
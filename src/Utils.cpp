@@ -33,7 +33,9 @@
 #include "Utils.h"
 
 #include <algorithm>
-#include <mutex>
+#include <array>
+#include <chrono>
+#include <iostream>
 #include <cstdarg>
 #include <cstdio>
 #include <cmath>
@@ -78,7 +80,127 @@ float Utils::cached_t_quantile(int v) {
     return z_lookup[z_entries - 1];
 }
 
+Utils::InputQueue::~InputQueue() {
+    if (m_reader.joinable()) {
+        m_reader.detach();
+    }
+}
+
+void Utils::InputQueue::start(std::function<bool(std::string&)> read_line) {
+    m_reader = std::thread([this, read_line] {
+        auto line = std::string{};
+        while (read_line(line)) {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_lines.emplace_back(std::move(line));
+            m_cv.notify_all();
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_eof = true;
+        m_cv.notify_all();
+    });
+}
+
+bool Utils::InputQueue::pop(std::string& line) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cv.wait(lock, [this] { return !m_lines.empty() || m_eof; });
+    if (m_lines.empty()) {
+        return false;
+    }
+    line = std::move(m_lines.front());
+    m_lines.pop_front();
+    return true;
+}
+
+bool Utils::InputQueue::wait(int timeout_ms) {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    return m_cv.wait_for(lock, std::chrono::milliseconds(timeout_ms), [this] {
+        return !m_lines.empty() || m_eof;
+    });
+}
+
+bool Utils::InputQueue::pending() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return !m_lines.empty() || m_eof;
+}
+
+bool Utils::InputQueue::closed() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_eof;
+}
+
+void Utils::InputQueue::join() {
+    m_reader.join();
+}
+
+// Never destroyed: the reader of standard input is still blocked in
+// getline when the program exits.
+static Utils::InputQueue* stdin_queue = nullptr;
+
+static thread_local Utils::InputQueue* session_input = nullptr;
+static thread_local FILE* session_output = nullptr;
+
+static Utils::InputQueue* current_input() {
+    return session_input ? session_input : stdin_queue;
+}
+
+static FILE* gtp_output() {
+    return session_output ? session_output : stdout;
+}
+
+void Utils::start_input_thread() {
+    if (stdin_queue) {
+        return;
+    }
+    stdin_queue = new InputQueue;
+    stdin_queue->start([](std::string& line) {
+        return bool(std::getline(std::cin, line));
+    });
+}
+
+void Utils::set_session_io(InputQueue* input, FILE* output) {
+    session_input = input;
+    session_output = output;
+}
+
+bool Utils::session_closed() {
+    return session_input && session_input->closed();
+}
+
+bool Utils::read_line(FILE* in, std::string& line, const size_t max_length) {
+    line.clear();
+    char buffer[1024];
+    while (fgets(buffer, sizeof(buffer), in)) {
+        line += buffer;
+        if (line.size() > max_length) {
+            return false;
+        }
+        if (line.back() == '\n') {
+            line.pop_back();
+            return true;
+        }
+    }
+    return !line.empty();
+}
+
+bool Utils::read_input_line(std::string& line) {
+    if (const auto input = current_input()) {
+        return input->pop(line);
+    }
+    return bool(std::getline(std::cin, line));
+}
+
+bool Utils::wait_input(int timeout_ms) {
+    if (const auto input = current_input()) {
+        return input->wait(timeout_ms);
+    }
+    std::this_thread::sleep_for(std::chrono::milliseconds(timeout_ms));
+    return input_pending();
+}
+
 bool Utils::input_pending() {
+    if (const auto input = current_input()) {
+        return input->pending();
+    }
 #ifdef HAVE_SELECT
     fd_set read_fds;
     FD_ZERO(&read_fds);
@@ -120,7 +242,99 @@ bool Utils::input_pending() {
 #endif
 }
 
-static std::mutex IOmutex;
+static std::string vformat(const char *fmt, va_list ap) {
+    va_list ap2;
+    va_copy(ap2, ap);
+    auto buf = std::array<char, 256>{};
+    const auto len = vsnprintf(buf.data(), buf.size(), fmt, ap);
+    auto out = std::string{};
+    if (len < 0) {
+        // Empty then.
+    } else if (size_t(len) < buf.size()) {
+        out.assign(buf.data(), len);
+    } else {
+        out.resize(len);
+        vsnprintf(&out[0], len + 1, fmt, ap2);
+    }
+    va_end(ap2);
+    return out;
+}
+
+// The log file is written by a thread of its own, so that a slow or
+// networked log volume does not stall the search. The other threads
+// only format their text and queue it.
+class LogWriter {
+public:
+    ~LogWriter() {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_exit = true;
+        }
+        m_cv.notify_all();
+        if (m_thread.joinable()) {
+            m_thread.join();
+        }
+    }
+
+    void write(std::string&& text) {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        // Wait if the log falls this far behind, rather than use up
+        // the memory.
+        constexpr auto MAX_PENDING = size_t{16} * 1024 * 1024;
+        m_cv.wait(lock, [this] { return m_pending < MAX_PENDING; });
+        if (!m_thread.joinable()) {
+            m_thread = std::thread(&LogWriter::run, this);
+        }
+        m_pending += text.size();
+        m_queue.emplace_back(std::move(text));
+        m_queued++;
+        m_cv.notify_all();
+    }
+
+    void flush() {
+        std::unique_lock<std::mutex> lock(m_mutex);
+        const auto target = m_queued;
+        m_cv.wait(lock, [this, target] { return m_written >= target; });
+    }
+
+private:
+    void run() {
+        auto batch = std::deque<std::string>{};
+        std::unique_lock<std::mutex> lock(m_mutex);
+        while (true) {
+            m_cv.wait(lock, [this] { return m_exit || !m_queue.empty(); });
+            if (m_queue.empty()) {
+                return;
+            }
+            std::swap(batch, m_queue);
+            lock.unlock();
+
+            auto bytes = size_t{0};
+            for (const auto& text : batch) {
+                fputs(text.c_str(), cfg_logfile_handle);
+                bytes += text.size();
+            }
+            fflush(cfg_logfile_handle);
+
+            lock.lock();
+            m_pending -= bytes;
+            m_written += batch.size();
+            batch.clear();
+            m_cv.notify_all();
+        }
+    }
+
+    std::mutex m_mutex;
+    std::condition_variable m_cv;
+    std::deque<std::string> m_queue;
+    size_t m_pending{0};
+    size_t m_queued{0};
+    size_t m_written{0};
+    bool m_exit{false};
+    std::thread m_thread;
+};
+
+static LogWriter log_writer;
 
 static void myprintf_base(const char *fmt, va_list ap) {
     va_list ap2;
@@ -129,8 +343,7 @@ static void myprintf_base(const char *fmt, va_list ap) {
     vfprintf(stderr, fmt, ap);
 
     if (cfg_logfile_handle) {
-        std::lock_guard<std::mutex> lock(IOmutex);
-        vfprintf(cfg_logfile_handle, fmt, ap2);
+        log_writer.write(vformat(fmt, ap2));
     }
     va_end(ap2);
 }
@@ -165,11 +378,13 @@ static void gtp_base_printf(int id, std::string prefix,
     if (id != -1) {
         prefix += std::to_string(id);
     }
-    gtp_fprintf(stdout, prefix, fmt, ap);
+    va_list ap2;
+    va_copy(ap2, ap);
+    gtp_fprintf(gtp_output(), prefix, fmt, ap);
     if (cfg_logfile_handle) {
-        std::lock_guard<std::mutex> lock(IOmutex);
-        gtp_fprintf(cfg_logfile_handle, prefix, fmt, ap);
+        log_writer.write(prefix + " " + vformat(fmt, ap2) + "\n\n");
     }
+    va_end(ap2);
 }
 
 void Utils::gtp_printf(int id, const char *fmt, ...) {
@@ -182,13 +397,12 @@ void Utils::gtp_printf(int id, const char *fmt, ...) {
 void Utils::gtp_printf_raw(const char *fmt, ...) {
     va_list ap;
     va_start(ap, fmt);
-    vfprintf(stdout, fmt, ap);
+    vfprintf(gtp_output(), fmt, ap);
     va_end(ap);
 
     if (cfg_logfile_handle) {
-        std::lock_guard<std::mutex> lock(IOmutex);
         va_start(ap, fmt);
-        vfprintf(cfg_logfile_handle, fmt, ap);
+        log_writer.write(vformat(fmt, ap));
         va_end(ap);
     }
 }
@@ -202,8 +416,21 @@ void Utils::gtp_fail_printf(int id, const char *fmt, ...) {
 
 void Utils::log_input(const std::string& input) {
     if (cfg_logfile_handle) {
-        std::lock_guard<std::mutex> lock(IOmutex);
-        fprintf(cfg_logfile_handle, ">>%s\n", input.c_str());
+        log_writer.write(">>" + input + "\n");
+    }
+}
+
+void Utils::log_line(const std::string& line) {
+    if (cfg_logfile_handle) {
+        log_writer.write(line + "\n");
+    } else {
+        fprintf(stderr, "%s\n", line.c_str());
+    }
+}
+
+void Utils::flush_log() {
+    if (cfg_logfile_handle) {
+        log_writer.flush();
     }
 }
 
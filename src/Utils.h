@@ -34,8 +34,14 @@
 #include "config.h"
 
 #include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <deque>
+#include <functional>
 #include <limits>
+#include <mutex>
 #include <string>
+#include <thread>
 
 #include "ThreadPool.h"
 
@@ -48,7 +54,55 @@ namespace Utils {
     void gtp_printf_raw(const char *fmt, ...);
     void gtp_fail_printf(int id, const char *fmt, ...);
     void log_input(const std::string& input);
+    // Write a line to the log file, or to stderr without one.
+    void log_line(const std::string& line);
+    // Wait until everything logged so far is in the log file.
+    void flush_log();
     bool input_pending();
+    // Lines of input read on a thread of their own and queued until the
+    // GTP loop takes them, so that a search can stop as soon as a new
+    // command arrives instead of polling the descriptor.
+    class InputQueue {
+    public:
+        ~InputQueue();
+        // Start the reader thread, which queues lines from read_line
+        // until it returns false.
+        void start(std::function<bool(std::string&)> read_line);
+        // Next line, blocking until one arrives. Returns false at end
+        // of input.
+        bool pop(std::string& line);
+        // Sleep up to timeout_ms, returning early with true on input.
+        bool wait(int timeout_ms);
+        bool pending();
+        // Whether read_line has failed.
+        bool closed();
+        // Wait for the reader thread, after read_line has failed.
+        void join();
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_cv;
+        std::deque<std::string> m_lines;
+        bool m_eof{false};
+        std::thread m_reader;
+    };
+    // Read standard input on a dedicated thread from now on.
+    void start_input_thread();
+    // Next line of input of the calling thread, blocking until one
+    // arrives. Returns false at end of input.
+    bool read_input_line(std::string& line);
+    // Sleep up to timeout_ms, returning early with true if input arrives.
+    bool wait_input(int timeout_ms);
+    // Make the calling thread take its input from the queue and write its
+    // GTP responses to the file, as a server session does. With nullptrs
+    // it goes back to standard input and output.
+    void set_session_io(InputQueue* input, FILE* output);
+    // Whether the calling thread serves a session whose peer has closed
+    // the connection.
+    bool session_closed();
+    // One line of in, without the newline. Returns false at the end of
+    // in, and as soon as the line grows over max_length, as the one of a
+    // peer that never ends its line would forever.
+    bool read_line(FILE* in, std::string& line, size_t max_length);
     float sigmoid_interval_avg(float alpkt, float beta, float beta2, float s, float t);
     double log_sigmoid(double x);
     float median(std::vector<float> & sample);
@@ -0,0 +1,404 @@
+/*
+    This file is part of SAI, which is a fork of Leela Zero.
+    Copyright (C) 2019 SAI Team
+
+    SAI is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    SAI is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with SAI.  If not, see <http://www.gnu.org/licenses/>.
+
+    Additional permission under GNU GPL version 3 section 7
+
+    If you modify this Program, or any covered work, by linking or
+    combining it with NVIDIA Corporation's libraries from the
+    NVIDIA CUDA Toolkit and/or the NVIDIA CUDA Deep Neural
+    Network library and/or the NVIDIA TensorRT inference library
+    (or a modified version of those libraries), containing parts covered
+    by the terms of the respective license agreement, the licensors of
+    this Program grant you additional permission to convey the resulting
+    work.
+*/
+
+
+// sai_bench: micro- and macro-benchmarks of the engine layers, so that a
+// regression can be traced to the board code, the tree, the cache or the
+// neural network. Results are printed as a table on stderr and as JSON.
+
+#include "config.h"
+
+#include <algorithm>
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <boost/program_options.hpp>
+
+#include "GTP.h"
+#include "GameState.h"
+#include "NNCache.h"
+#include "Network.h"
+#include "Random.h"
+#include "ThreadPool.h"
+#include "Timing.h"
+#include "UCTNode.h"
+#include "UCTNodePointer.h"
+#include "UCTSearch.h"
+#include "Utils.h"
+#include "Zobrist.h"
+
+using namespace Utils;
+
+namespace {
+
+struct BenchResult {
+    std::string name;
+    unsigned int threads;
+    double ops_per_second;
+    double seconds;
+    // For the deterministic searches: what was searched, equal between
+    // two builds when the difference of speed is not of the search.
+    std::string search;
+};
+
+std::vector<BenchResult> s_results;
+double s_min_seconds = 1.0;
+
+void record(const std::string& name, const unsigned int threads,
+            const double ops, const double seconds) {
+    const auto rate = ops / seconds;
+    std::cerr << name << " (" << threads << " threads): "
+              << rate << " ops/s, " << 1e9 / rate << " ns/op" << std::endl;
+    s_results.push_back({name, threads, rate, seconds, {}});
+}
+
+// Call f(), which returns the number of operations it did, until
+// s_min_seconds have passed.
+template <typename F>
+void run_timed(const std::string& name, F&& f) {
+    auto ops = 0.0;
+    const Time start;
+    auto elapsed = 0.0;
+    do {
+        ops += f();
+        elapsed = Time::timediff_seconds(start, Time{});
+    } while (elapsed < s_min_seconds);
+    record(name, 1, ops, elapsed);
+}
+
+// Run f(thread) on threads threads of the pool until s_min_seconds have
+// passed. f returns the number of operations it did.
+template <typename F>
+void run_threaded(const std::string& name, const unsigned int threads, F f) {
+    std::atomic<double> total{0.0};
+    ThreadGroup tg(thread_pool);
+    const Time start;
+    for (auto t = 0u; t < threads; t++) {
+        tg.add_task([&total, &f, start, t]() {
+            auto ops = 0.0;
+            do {
+                ops += f(t);
+            } while (Time::timediff_seconds(start, Time{}) < s_min_seconds);
+            atomic_add(total, ops);
+        });
+    }
+    tg.wait_all();
+    record(name, threads, total.load(), Time::timediff_seconds(start, Time{}));
+}
+
+std::vector<unsigned int> thread_counts(const unsigned int max_threads) {
+    auto counts = std::vector<unsigned int>{};
+    for (auto t = 1u; t < max_threads; t *= 2) {
+        counts.push_back(t);
+    }
+    counts.push_back(max_threads);
+    return counts;
+}
+
+// A game of random legal moves that do not fill own eyes.
+std::vector<std::pair<int, int>> random_game(const size_t max_moves) {
+    auto state = GameState{};
+    state.init_game(BOARD_SIZE, 7.5f);
+    auto moves = std::vector<std::pair<int, int>>{};
+    auto legal = std::vector<int>{};
+    while (moves.size() < max_moves) {
+        const auto color = state.get_to_move();
+        legal.clear();
+        for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
+            const auto vertex = state.board.get_vertex(idx);
+            if (state.is_move_legal(color, vertex)
+                && !state.board.is_eye(color, vertex)) {
+                legal.push_back(vertex);
+            }
+        }
+        if (legal.empty()) {
+            break;
+        }
+        const auto vertex = legal[Random::get_Rng().randuint64(legal.size())];
+        state.play_move(color, vertex);
+        moves.emplace_back(color, vertex);
+    }
+    return moves;
+}
+
+GameState position_after(const std::vector<std::pair<int, int>>& moves,
+                         const size_t count, const bool is_sai) {
+    auto state = GameState{};
+    state.init_game(BOARD_SIZE, 7.5f, is_sai);
+    for (auto i = size_t{0}; i < std::min(count, moves.size()); i++) {
+        state.play_move(moves[i].first, moves[i].second);
+    }
+    return state;
+}
+
+void bench_board(const std::vector<std::pair<int, int>>& game) {
+    run_timed("board.update_board", [&game]() {
+        auto board = FullBoard{};
+        board.reset_board(BOARD_SIZE);
+        for (const auto& move : game) {
+            board.update_board(move.first, move.second);
+        }
+        return double(game.size());
+    });
+
+    const auto state = position_after(game, game.size() / 2, false);
+    const auto color = state.get_to_move();
+    run_timed("board.is_suicide", [&state, color]() {
+        auto suicides = 0;
+        for (auto idx = 0; idx < NUM_INTERSECTIONS; idx++) {
+            const auto vertex = state.board.get_vertex(idx);
+            if (state.board.get_state(vertex) == FastBoard::EMPTY) {
+                suicides += state.board.is_suicide(vertex, color);
+            }
+        }
+        // Keep the loop from being optimized away.
+        return double(NUM_INTERSECTIONS + (suicides & 0));
+    });
+
+    run_timed("features.gather_features", [&state]() {
+        auto planes = Network::gather_features(&state, 0);
+        return double(planes.size() > 0);
+    });
+}
+
+void bench_nncache(const unsigned int max_threads) {
+    constexpr auto CACHE_SIZE = 1 << 18;
+    NNCache cache{CACHE_SIZE};
+    // Twice as many positions as the cache holds, for a mix of hits and
+    // replacements.
+    auto hashes = std::vector<std::uint64_t>(2 * CACHE_SIZE);
+    for (auto& hash : hashes) {
+        hash = Random::get_Rng().randuint64();
+    }
+    for (const auto threads : thread_counts(max_threads)) {
+        run_threaded("nncache.lookup_insert", threads,
+                     [&cache, &hashes, threads](unsigned int t) {
+            auto result = NNCache::Netresult{};
+            constexpr auto BATCH = 4096;
+            thread_local auto pos = size_t{0};
+            for (auto i = 0; i < BATCH; i++) {
+                pos = (pos + threads + t) % hashes.size();
+                if (!cache.lookup(hashes[pos], result)) {
+                    cache.insert(hashes[pos], result);
+                }
+            }
+            return double(BATCH);
+        });
+    }
+}
+
+void bench_select(Network& network) {
+    auto state = GameState{};
+    state.init_game(BOARD_SIZE, 7.5f, network.m_value_head_sai);
+    std::atomic<int> nodes{0};
+    UCTNode root{FastBoard::PASS, 1.0f};
+    float value, alpkt, beta, beta2;
+    root.create_children(network, nodes, state, value, alpkt, beta, beta2);
+    const auto to_move = state.get_to_move();
+    const auto cpu_to_move = state.is_cpu_color();
+    const auto no_moves = std::vector<int>{};
+
+    // Give the children visits, as a search would, so that the selection
+    // is not only ordered by policy.
+    auto visit = [&]() {
+        auto child = root.uct_select_child(state, true, 0, no_moves);
+        child->set_father_quantiles(&root);
+        const auto eval =
+            std::uniform_real_distribution<float>{0.0f, 1.0f}(Random::get_Rng());
+        const auto result = SearchResult::from_eval(eval, alpkt, beta, beta2,
+                                                    network.m_value_head_sai);
+        for (auto node : {child, &root}) {
+            node->update(result);
+            if (network.m_value_head_sai) {
+                node->set_lambda_mu(cpu_to_move, to_move);
+                node->update_all_quantiles(alpkt, beta, beta2);
+            }
+        }
+    };
+    for (auto i = 0; i < 1600; i++) {
+        visit();
+    }
+    run_timed("uct.select_child", [&]() {
+        constexpr auto BATCH = 256;
+        auto selected = 0;
+        for (auto i = 0; i < BATCH; i++) {
+            selected += root.uct_select_child(state, true, 0, no_moves) != nullptr;
+        }
+        return double(selected);
+    });
+}
+
+void bench_network(Network& network, const unsigned int max_threads) {
+    for (const auto threads : thread_counts(max_threads)) {
+        cfg_num_threads = threads;
+        const auto centis = std::max(1, int(100 * s_min_seconds));
+        const auto rate = network.benchmark_time(centis);
+        record("network.evaluations", threads, rate, s_min_seconds);
+    }
+}
+
+void bench_search(Network& network, const unsigned int max_threads,
+                  const int playouts) {
+    for (const auto threads : thread_counts(max_threads)) {
+        cfg_num_threads = threads;
+        network.nncache_clear();
+        auto game = GameState{};
+        game.init_game(BOARD_SIZE, 7.5f, network.m_value_head_sai);
+        game.set_timecontrol(0, 1, 0, 0);  // Infinite time.
+        const auto tree_size = UCTNodePointer::get_tree_size();
+        auto search = std::make_unique<UCTSearch>(game, network);
+        search->set_playout_limit(playouts);
+        const Time start;
+        search->think(game.get_to_move(), UCTSearch::NOPASS);
+        record("search.playouts", threads, playouts,
+               Time::timediff_seconds(start, Time{}));
+        if (cfg_deterministic) {
+            const auto root = search->get_root_summary();
+            auto out = std::ostringstream{};
+            out << "tree of " << UCTNodePointer::get_tree_size() - tree_size
+                << " bytes, " << root.visits << " visits, winrate "
+                << std::setprecision(9) << root.winrate << ", pv " << root.pv;
+            s_results.back().search = out.str();
+            std::cerr << "  " << out.str() << std::endl;
+        }
+    }
+}
+
+void write_json(std::ostream& out) {
+    out << "{\n  \"board_size\": " << BOARD_SIZE
+        << ",\n  \"weights\": \"" << cfg_weightsfile << "\""
+        << ",\n  \"results\": [";
+    for (auto i = size_t{0}; i < s_results.size(); i++) {
+        const auto& r = s_results[i];
+        out << (i ? ",\n" : "\n")
+            << "    {\"name\": \"" << r.name << "\", \"threads\": " << r.threads
+            << ", \"ops_per_second\": " << r.ops_per_second
+            << ", \"ns_per_op\": " << 1e9 / r.ops_per_second
+            << ", \"seconds\": " << r.seconds;
+        if (!r.search.empty()) {
+            out << ", \"search\": \"" << r.search << "\"";
+        }
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    namespace po = boost::program_options;
+
+    GTP::setup_default_parameters();
+    cfg_weightsfile = "";
+    cfg_quiet = true;
+
+    auto max_threads = std::max(1u, std::thread::hardware_concurrency());
+    auto playouts = 1600;
+    auto json_file = std::string{};
+
+    po::options_description desc("Options");
+    desc.add_options()
+        ("help,h", "Show commandline options.")
+        ("weights,w", po::value<std::string>(),
+                      "Network weights file. Without it only the board "
+                      "and cache benchmarks are run.")
+        ("threads,t", po::value<unsigned int>(&max_threads)->default_value(max_threads),
+                      "Largest number of threads to measure.")
+        ("seconds,s", po::value<double>(&s_min_seconds)->default_value(s_min_seconds),
+                      "Minimum duration of each benchmark.")
+        ("playouts,p", po::value<int>(&playouts)->default_value(playouts),
+                       "Playouts of each search benchmark.")
+        ("json,j", po::value<std::string>(&json_file),
+                   "Write the results to this file instead of stdout.")
+        ("deterministic,d", "Search in lockstep rounds with a fixed seed, and "
+                            "report the tree searched, to time two builds on "
+                            "the same search.")
+        ;
+    po::variables_map vm;
+    try {
+        po::store(po::parse_command_line(argc, argv, desc), vm);
+        po::notify(vm);
+    } catch(const boost::program_options::error& e) {
+        std::cerr << "ERROR: " << e.what() << std::endl;
+        std::cerr << desc << std::endl;
+        return 1;
+    }
+    if (vm.count("help")) {
+        std::cout << desc << std::endl;
+        return 0;
+    }
+    max_threads = std::max(1u, max_threads);
+
+    if (vm.count("deterministic")) {
+        cfg_deterministic = true;
+        cfg_rng_seed = 5489;
+    }
+
+    cfg_num_threads = max_threads;
+    cfg_max_playouts = playouts;
+    cfg_timemanage = TimeManagement::OFF;
+    cfg_allow_pondering = false;
+#ifndef USE_CPU_ONLY
+    cfg_cpu_only = false;
+#endif
+
+    thread_pool.initialize(max_threads);
+    auto rng = std::make_unique<Random>(5489);
+    Zobrist::init_zobrist(*rng);
+    Random::get_Rng().seedrandom(cfg_rng_seed);
+    Utils::create_z_table();
+
+    const auto game = random_game(NUM_INTERSECTIONS);
+    bench_board(game);
+    bench_nncache(max_threads);
+
+    if (vm.count("weights")) {
+        cfg_weightsfile = vm["weights"].as<std::string>();
+        auto network = std::make_unique<Network>();
+        network->initialize(playouts, cfg_weightsfile);
+        bench_select(*network);
+        bench_network(*network, max_threads);
+        bench_search(*network, max_threads, playouts);
+    }
+
+    if (json_file.empty()) {
+        write_json(std::cout);
+    } else {
+        std::ofstream out(json_file);
+        write_json(out);
+    }
+    return 0;
+}
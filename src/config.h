@@ -56,6 +56,44 @@ static_assert(BOARD_SIZE % 2 == 1,
 static constexpr auto NUM_INTERSECTIONS = BOARD_SIZE * BOARD_SIZE;
 static constexpr auto POTENTIAL_MOVES = NUM_INTERSECTIONS + 1; // including pass
 
+/*
+ * WINOGRAD_TILE_M: Output tile size of the Winograd F(m x m, 3x3)
+ * convolutions, 2, 4 or 6. Larger tiles need fewer multiplications per
+ * output, but the board is padded to a multiple of m and each SGEMM is as
+ * wide as the number of tiles. Up to 9x9 F(2x2) is the fastest (9x9 pads
+ * to 10x10 in 25 tiles against 12x12 in 9 tiles for F(4x4), 260 against
+ * 215 n/s on the CPU), from 13x13 on F(4x4) is. F(6x6) came last on the
+ * CPU; it can be defined here or on the compiler command line.
+ * The OpenCL kernels only have the F(4x4) transforms, so builds with
+ * OpenCL always use F(4x4).
+ */
+#ifndef WINOGRAD_TILE_M
+#if BOARD_SIZE <= 9 && defined(USE_CPU_ONLY)
+#define WINOGRAD_TILE_M 2
+#else
+#define WINOGRAD_TILE_M 4
+#endif
+#endif
+
+static_assert(WINOGRAD_TILE_M == 2 || WINOGRAD_TILE_M == 4
+              || WINOGRAD_TILE_M == 6,
+              "Winograd tiles must be F(2x2), F(4x4) or F(6x6)");
+#ifndef USE_CPU_ONLY
+static_assert(WINOGRAD_TILE_M == 4,
+              "The OpenCL kernels only implement F(4x4) Winograd tiles");
+#endif
+
+/*
+ * USE_BITBOARD: Let FastBoard do its flood fills (area scoring, dame, seki
+ * and territory detection) with shifts and masks over a bitboard of the
+ * letterboxed board instead of a vertex queue. On 9x9 the whole board fits
+ * in two 64-bit words, so it is enabled by default for small boards; it can
+ * also be defined on the compiler command line for larger ones.
+ */
+#if BOARD_SIZE <= 9 && !defined(USE_BITBOARD)
+#define USE_BITBOARD
+#endif
+
 /*
  * KOMI: Define the default komi to use when training.
  */
@@ -149,6 +187,20 @@ static constexpr auto MAX_CPUS = 256;
 static constexpr auto SELFCHECK_PROBABILITY   = 2000;
 #endif
 
+/*
+ * CPU_KERNEL: The hot loops of the CPU backend and of the search are built
+ * for several instruction sets and the best one for the running CPU is
+ * picked at load time. On targets without ifunc support (and on ARM, where
+ * NEON is baseline) the compiler's vectorization of the single default
+ * version is used.
+ */
+#if defined(__GNUC__) && !defined(__clang__) && defined(__linux__) \
+    && defined(__x86_64__)
+#define CPU_KERNEL __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define CPU_KERNEL
+#endif
+
 #if (_MSC_VER >= 1400) /* VC8+ Disable all deprecation warnings */
     #pragma warning(disable : 4996)
 #endif /* VC8+ */
@@ -30,19 +30,32 @@
 
 #include "config.h"
 
+#include <atomic>
 #include <cstdint>
+#include <cstdio>
 #include <algorithm>
+#include <cmath>
+#include <fstream>
 #include <iostream>
 #include <memory>
 #include <regex>
+#include <sstream>
+#include <stdexcept>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "GTP.h"
+#include "GTPServer.h"
 #include "GameState.h"
+#include "MemoryTracker.h"
 #include "NNCache.h"
 #include "Random.h"
+#include "RemoteSearch.h"
+#include "SharedHistory.h"
 #include "ThreadPool.h"
+#include "UCTNode.h"
+#include "UCTSearch.h"
 #include "Utils.h"
 #include "Zobrist.h"
 
@@ -116,6 +129,21 @@ public:
     }
     void test_analyze_cmd(std::string cmd, bool valid, int who, int interval,
             int avoidlen, int avoidcolor, int avoiduntil);
+    // The visits and the winrate of move in an info line, as RemoteSearch
+    // reads them.
+    static std::pair<int, float> remote_stats(const std::string& line,
+                                              const std::string& move) {
+        const auto reported = RemoteSearch::parse_info(line);
+        const auto stats = reported.find(move);
+        if (stats == end(reported)) {
+            return {0, 0.0f};
+        }
+        return {stats->second.visits, stats->second.winrate};
+    }
+    // An info line as if the first worker of remote had sent it.
+    static void remote_report(RemoteSearch& remote, const std::string& line) {
+        remote.report(*remote.m_workers.front(), line);
+    }
 
 private:
     std::unique_ptr<GameState> m_gamestate;
@@ -156,6 +184,21 @@ TEST_F(LeelaTest, Transposition) {
     EXPECT_EQ(ko_hash, maingame.board.get_ko_hash());
 }
 
+TEST_F(LeelaTest, StabilizerSubgroup) {
+    auto maingame = get_gamestate();
+
+    testing::internal::CaptureStdout();
+    GTP::execute(maingame, "clear_board");
+    EXPECT_EQ(8u, maingame.get_stabilizer_subgroup().size());
+
+    GTP::execute(maingame, "play b D4");
+    EXPECT_EQ(2u, maingame.get_stabilizer_subgroup().size());
+
+    GTP::execute(maingame, "play w Q4");
+    EXPECT_EQ(1u, maingame.get_stabilizer_subgroup().size());
+    std::string output = testing::internal::GetCapturedStdout();
+}
+
 TEST_F(LeelaTest, KoPntNotSame) {
     auto maingame = get_gamestate();
 
@@ -196,6 +239,167 @@ TEST_F(LeelaTest, KoPntNotSame) {
     EXPECT_NE(hash, maingame.board.get_hash());
 }
 
+// The game of the moves, played through a symmetry.
+static GameState play_symmetric(const std::vector<std::string>& moves,
+                                int symmetry) {
+    auto game = GameState{};
+    game.init_game(19, 7.5f);
+    for (const auto& move : moves) {
+        const auto vertex = game.board.text_to_move(move);
+        game.play_move(vertex == FastBoard::PASS ? vertex
+            : game.board.get_sym_move(vertex, symmetry));
+    }
+    return game;
+}
+
+TEST_F(LeelaTest, SymmetryHashes) {
+    auto maingame = get_gamestate();
+
+    // Compare with the hashes of the game played through each symmetry.
+    auto moves = std::vector<std::string>{};
+    auto check = [&]() {
+        for (auto sym = 0; sym < Network::NUM_SYMMETRIES; sym++) {
+            const auto symgame = play_symmetric(moves, sym);
+            EXPECT_EQ(symgame.board.get_hash(),
+                      maingame.board.get_symmetry_hash(sym));
+            EXPECT_EQ(symgame.board.get_hash() == maingame.board.get_hash(),
+                      maingame.is_symmetry_invariant(sym));
+        }
+    };
+
+    // Black E4 takes the ko at E5.
+    for (const auto& move : {"D5", "D4", "E6", "E3", "F5", "F4", "A1",
+                             "E5", "E4"}) {
+        moves.emplace_back(move);
+        maingame.play_move(maingame.board.text_to_move(move));
+    }
+    ASSERT_NE(maingame.board.get_hash(), maingame.board.calc_hash());
+    check();
+
+    moves.emplace_back("pass");
+    maingame.play_move(FastBoard::PASS);
+    check();
+}
+
+// Tromp-Taylor area of one color, by flooding from its stones.
+static int reach_color(const FastBoard& board, int color) {
+    const auto size = board.get_boardsize();
+    auto reached = std::vector<bool>(FastBoard::NUM_VERTICES, false);
+    auto open = std::vector<int>{};
+    for (auto x = 0; x < size; x++) {
+        for (auto y = 0; y < size; y++) {
+            if (board.get_state(x, y) == color) {
+                reached[board.get_vertex(x, y)] = true;
+                open.push_back(board.get_vertex(x, y));
+            }
+        }
+    }
+    auto count = open.size();
+    while (!open.empty()) {
+        const auto xy = board.get_xy(open.back());
+        open.pop_back();
+        const int dx[] = {-1, 1, 0, 0};
+        const int dy[] = {0, 0, -1, 1};
+        for (auto k = 0; k < 4; k++) {
+            const auto x = xy.first + dx[k];
+            const auto y = xy.second + dy[k];
+            if (x < 0 || y < 0 || x >= size || y >= size) {
+                continue;
+            }
+            const auto vertex = board.get_vertex(x, y);
+            if (!reached[vertex]
+                && board.get_state(vertex) == FastBoard::EMPTY) {
+                reached[vertex] = true;
+                open.push_back(vertex);
+                count++;
+            }
+        }
+    }
+    return count;
+}
+
+TEST_F(LeelaTest, AreaScoreMatchesFloodFill) {
+    auto& game = get_gamestate();
+    auto rng = Random{4321};
+    for (auto move = 0; move < 600; move++) {
+        auto vertex = int{FastBoard::PASS};
+        for (auto tries = 0; tries < 50; tries++) {
+            const auto candidate = game.board.get_vertex(
+                rng.randuint64(19), rng.randuint64(19));
+            if (game.is_move_legal(game.get_to_move(), candidate)) {
+                vertex = candidate;
+                break;
+            }
+        }
+        game.play_move(vertex);
+        const auto expected = reach_color(game.board, FastBoard::BLACK)
+            - reach_color(game.board, FastBoard::WHITE) - 7.5f;
+        ASSERT_EQ(game.board.area_score(7.5f), expected) << "move " << move;
+    }
+}
+
+TEST_F(LeelaTest, SuperkoMoveMatchesPlay) {
+    auto& game = get_gamestate();
+    auto rng = Random{8765};
+    for (auto move = 0; move < 600; move++) {
+        auto vertex = int{FastBoard::PASS};
+        for (auto tries = 0; tries < 50; tries++) {
+            const auto candidate = game.board.get_vertex(
+                rng.randuint64(19), rng.randuint64(19));
+            if (game.is_move_legal(game.get_to_move(), candidate)) {
+                vertex = candidate;
+                break;
+            }
+        }
+        game.play_move(vertex);
+        if (move % 5 != 0) {
+            continue;
+        }
+        for (auto i = 0; i < 19; i++) {
+            for (auto j = 0; j < 19; j++) {
+                const auto v = game.board.get_vertex(i, j);
+                if (!game.is_move_legal(game.get_to_move(), v)) {
+                    continue;
+                }
+                KoState played = game;
+                played.play_move(v);
+                ASSERT_EQ(game.superko_move(v), played.superko())
+                    << "move " << move << " vertex " << v;
+                auto hash = std::uint64_t{};
+                if (game.board.quiet_move_ko_hash(game.get_to_move(), v, hash)) {
+                    ASSERT_EQ(hash, played.board.get_ko_hash())
+                        << "move " << move << " vertex " << v;
+                }
+            }
+        }
+    }
+}
+
+TEST_F(LeelaTest, LegalMovesMatchIsMoveLegal) {
+    auto& game = get_gamestate();
+    auto rng = Random{4321};
+    for (auto move = 0; move < 600; move++) {
+        for (const auto color : {FastBoard::BLACK, FastBoard::WHITE}) {
+            const auto legal = game.get_legal_moves(color);
+            for (auto i = 0; i < NUM_INTERSECTIONS; i++) {
+                const auto vertex = game.board.get_vertex(i);
+                ASSERT_EQ(bool(legal[i]), game.is_move_legal(color, vertex))
+                    << "move " << move << " vertex " << vertex;
+            }
+        }
+        auto vertex = int{FastBoard::PASS};
+        for (auto tries = 0; tries < 50; tries++) {
+            const auto candidate = game.board.get_vertex(
+                rng.randuint64(19), rng.randuint64(19));
+            if (game.is_move_legal(game.get_to_move(), candidate)) {
+                vertex = candidate;
+                break;
+            }
+        }
+        game.play_move(vertex);
+    }
+}
+
 TEST_F(LeelaTest, MoveOnOccupiedPnt) {
     auto maingame = get_gamestate();
     std::string output;
@@ -384,3 +588,418 @@ TEST_F(LeelaTest, AnalyzeParseMinmoves) {
     // Expect to see at least 5 move priors
     expect_regex(result.first, "info.*?(prior\\s+\\d+\\s+.*?){5,}.*");
 }
+
+static std::string read_file(const std::string& filename) {
+    std::ifstream file(filename, std::ifstream::binary);
+    return {std::istreambuf_iterator<char>(file),
+            std::istreambuf_iterator<char>()};
+}
+
+TEST_F(LeelaTest, SaveTreeRoundtrip) {
+    gtp_execute("play b D4");
+    auto& game = get_gamestate();
+    auto& network = *GTP::s_network;
+
+    const auto saved_file = std::string{"test_tree.bin"};
+    const auto resaved_file = std::string{"test_tree_resaved.bin"};
+    const auto truncated_file = std::string{"test_tree_truncated.bin"};
+
+    UCTSearch search(game, network);
+    search.set_playout_limit(200);
+    search.set_visit_limit(200);
+    search.think(FastBoard::WHITE, UCTSearch::NORESIGN);
+    const auto nodes = search.save_tree(saved_file, 0.0f);
+    ASSERT_GT(nodes, size_t{1});
+    const auto before = search.get_root_summary();
+
+    UCTSearch loaded(game, network);
+    EXPECT_EQ(loaded.load_tree(saved_file), nodes);
+    const auto after = loaded.get_root_summary();
+    EXPECT_EQ(after.visits, before.visits);
+    EXPECT_EQ(after.winrate, before.winrate);
+    EXPECT_EQ(after.alpkt, before.alpkt);
+    EXPECT_EQ(after.beta, before.beta);
+    EXPECT_EQ(after.pv, before.pv);
+
+    // Every visit count and eval of the subtree comes back as it was.
+    EXPECT_EQ(loaded.save_tree(resaved_file, 0.0f), nodes);
+    const auto data = read_file(saved_file);
+    EXPECT_EQ(read_file(resaved_file), data);
+
+    {
+        std::ofstream file(truncated_file, std::ofstream::binary);
+        file.write(data.data(), data.size() - 1);
+    }
+    UCTSearch truncated(game, network);
+    EXPECT_EQ(truncated.load_tree(truncated_file), size_t{0});
+
+    // Only for the position it was searched from.
+    gtp_execute("play w Q16");
+    UCTSearch moved(game, network);
+    EXPECT_EQ(moved.load_tree(saved_file), size_t{0});
+
+    std::remove(saved_file.c_str());
+    std::remove(resaved_file.c_str());
+    std::remove(truncated_file.c_str());
+}
+
+TEST_F(LeelaTest, RemoteInfoParsing) {
+    const auto line = std::string{
+        "info move D4 visits 120 winrate 5350 prior 1200 lcb 5100 "
+        "scoreLead 1.5 areas 100 order 0 pv D4 Q16 "
+        "info move Q16 visits 30 winrate 4800 prior 900 lcb 4500 "
+        "scoreLead 0.5 areas 20 order 1 pv Q16 D4"};
+
+    EXPECT_EQ(remote_stats(line, "D4").first, 120);
+    EXPECT_NEAR(remote_stats(line, "D4").second, 0.535f, 1e-6f);
+    EXPECT_EQ(remote_stats(line, "Q16").first, 30);
+    EXPECT_NEAR(remote_stats(line, "Q16").second, 0.48f, 1e-6f);
+    EXPECT_EQ(remote_stats(line, "C3").first, 0);
+    EXPECT_EQ(remote_stats("", "D4").first, 0);
+}
+
+TEST_F(LeelaTest, RemoteMerge) {
+    // Without symmetries, so that D4 and Q16 are both root children.
+    gtp_execute("play w C5");
+    auto& game = get_gamestate();
+    game.set_to_move(FastBoard::BLACK);
+    auto& network = *GTP::s_network;
+
+    auto root = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+    std::atomic<int> nodes{0};
+    float value, alpkt, beta, beta2;
+    ASSERT_TRUE(root->create_children(network, nodes, game,
+                                      value, alpkt, beta, beta2));
+    const auto child = [&](const std::string& move) -> const UCTNodePointer& {
+        const auto vertex = game.board.text_to_move(move);
+        for (const auto& node : root->get_children()) {
+            if (node.get_move() == vertex) {
+                return node;
+            }
+        }
+        throw std::runtime_error("no child " + move);
+    };
+
+    // The visit of the expansion.
+    const auto root_visits = root->get_visits();
+    const auto root_blackevals =
+        root_visits * root->get_raw_eval(FastBoard::BLACK);
+
+    RemoteSearch remote({"localhost:0"}, network.get_network_hash());
+    remote_report(remote, "info move D4 visits 10 winrate 6000 pv D4 "
+                          "info move Q16 visits 5 winrate 3000 pv Q16");
+    EXPECT_EQ(remote.merge(game, *root), 15);
+    EXPECT_EQ(child("D4").get_visits(), 10);
+    EXPECT_NEAR(child("D4")->get_raw_eval(FastBoard::BLACK), 0.6f, 1e-5f);
+    EXPECT_EQ(child("Q16").get_visits(), 5);
+    EXPECT_NEAR(child("Q16")->get_raw_eval(FastBoard::BLACK), 0.3f, 1e-5f);
+    EXPECT_EQ(root->get_visits(), root_visits + 15);
+
+    // Only what is new since the last merge is added.
+    EXPECT_EQ(remote.merge(game, *root), 0);
+    remote_report(remote, "info move D4 visits 14 winrate 5000 pv D4");
+    EXPECT_EQ(remote.merge(game, *root), 4);
+    EXPECT_EQ(child("D4").get_visits(), 14);
+    EXPECT_NEAR(child("D4")->get_raw_eval(FastBoard::BLACK), 0.5f, 1e-5f);
+    EXPECT_EQ(child("Q16").get_visits(), 5);
+    EXPECT_EQ(root->get_visits(), root_visits + 19);
+    EXPECT_NEAR(root->get_raw_eval(FastBoard::BLACK),
+                (root_blackevals + 14 * 0.5f + 5 * 0.3f) / (root_visits + 19),
+                1e-5f);
+
+    // The winrates are for the side to move.
+    auto white = std::make_unique<UCTNode>(FastBoard::PASS, 0.0f);
+    game.set_to_move(FastBoard::WHITE);
+    ASSERT_TRUE(white->create_children(network, nodes, game,
+                                       value, alpkt, beta, beta2));
+    RemoteSearch remote_white({"localhost:0"}, network.get_network_hash());
+    remote_report(remote_white, "info move D4 visits 10 winrate 6000 pv D4");
+    EXPECT_EQ(remote_white.merge(game, *white), 10);
+    for (const auto& node : white->get_children()) {
+        if (node.get_move() == game.board.text_to_move("D4")) {
+            EXPECT_NEAR(node->get_raw_eval(FastBoard::WHITE), 0.6f, 1e-5f);
+        }
+    }
+}
+
+TEST_F(LeelaTest, TranspositionsShareSubtree) {
+    auto& game = get_gamestate();
+    auto& network = *GTP::s_network;
+
+    // The first moves of both players among the same four points, so
+    // that the tree reaches the same positions through several orders.
+    std::istringstream cmdstream("allow b C3,D4,Q16,R16 4 "
+                                 "allow w C3,D4,Q16,R16 4");
+    const auto tags = AnalyzeTags{cmdstream, game};
+    ASSERT_FALSE(tags.invalid());
+    cfg_analyze_tags = tags;
+
+    UCTSearch search(game, network);
+    search.set_playout_limit(300);
+    search.set_visit_limit(300);
+    search.think(FastBoard::BLACK, UCTSearch::NORESIGN);
+    EXPECT_EQ(search.get_transposition_playouts(), 0);
+
+    cfg_transpositions = true;
+    UCTSearch shared(game, network);
+    shared.set_playout_limit(300);
+    shared.set_visit_limit(300);
+    shared.think(FastBoard::BLACK, UCTSearch::NORESIGN);
+    EXPECT_GT(shared.get_transposition_playouts(), 0);
+    EXPECT_GE(shared.get_root_summary().visits, 300);
+
+    cfg_analyze_tags = AnalyzeTags{};
+}
+
+TEST(GTPServerTest, RefusesWhatExecuteRuns) {
+    const auto refused = [](const std::string& line) {
+        return GTPServer::is_refused(GTP::parse_input(line).second);
+    };
+    // GTP::execute() runs these as save_training and printsgf.
+    EXPECT_TRUE(refused("save_trainingx /tmp/x"));
+    EXPECT_TRUE(refused("printsgfz /tmp/x"));
+    EXPECT_TRUE(refused("7 dump_debugs /tmp/x"));
+    EXPECT_TRUE(refused("SAVE_TRAINING /tmp/x"));
+    EXPECT_TRUE(refused("save\x01_training /tmp/x"));
+    EXPECT_TRUE(refused("printsgf /tmp/x"));
+    // These change the network that the other sessions search with.
+    EXPECT_TRUE(refused("sai-addnet ../src/tests/0k.txt"));
+    EXPECT_TRUE(refused("2 sai-usenet 1"));
+    EXPECT_TRUE(refused("sai-loadnet x"));
+
+    EXPECT_FALSE(refused("printsgf"));
+    EXPECT_FALSE(refused("3 printsgf"));
+    EXPECT_FALSE(refused("genmove b"));
+}
+
+TEST(NNCacheTest, CompactRoundtrip) {
+    NNCache cache(NNCache::MIN_CACHE_COUNT);
+    cache.set_compact(true);
+
+    auto result = NNCache::Netresult{};
+    auto sum = 0.0f;
+    for (auto i = size_t{0}; i < result.policy.size(); i++) {
+        result.policy[i] = float(i + 1);
+        sum += result.policy[i];
+    }
+    for (auto& p : result.policy) {
+        p /= sum;
+    }
+    result.value = 0.3f;
+    result.alpha = 1.25f;
+    result.beta = 0.7f;
+    result.is_sai = true;
+    cache.insert(0x1234, result);
+
+    auto cached = NNCache::Netresult{};
+    ASSERT_TRUE(cache.lookup(0x1234, cached));
+    for (auto i = size_t{0}; i < result.policy.size(); i++) {
+        EXPECT_NEAR(cached.policy[i], result.policy[i],
+                    NNCache::COMPACT_MAX_ERROR);
+    }
+    EXPECT_EQ(cached.value, result.value);
+    EXPECT_EQ(cached.alpha, result.alpha);
+    EXPECT_EQ(cached.beta, result.beta);
+    EXPECT_TRUE(cached.is_sai);
+    EXPECT_FALSE(cache.lookup(0x4321, cached));
+}
+
+TEST_F(LeelaTest, BatchedForwardMatchesSingle) {
+    auto empty = get_gamestate();
+    gtp_execute("play b D4");
+    gtp_execute("play w Q16");
+    auto played = get_gamestate();
+
+    auto& network = *GTP::s_network;
+    const auto states = std::vector<const GameState*>{&empty, &played};
+    const auto batch = network.get_output_batch(states, Network::DIRECT, 0,
+                                                false, false);
+    ASSERT_EQ(batch.size(), states.size());
+    for (auto i = size_t{0}; i < states.size(); i++) {
+        const auto single = network.get_output(states[i], Network::DIRECT, 0,
+                                               false, false);
+        EXPECT_NEAR(batch[i].value, single.value, 1e-4f);
+        EXPECT_NEAR(batch[i].policy_pass, single.policy_pass, 1e-4f);
+        for (auto j = size_t{0}; j < single.policy.size(); j++) {
+            EXPECT_NEAR(batch[i].policy[j], single.policy[j], 1e-4f);
+        }
+    }
+}
+
+// Load the test network a second time, on the backend that the current
+// cfg_* settings select.
+static std::unique_ptr<Network> load_test_network() {
+    auto network = std::make_unique<Network>();
+    network->initialize(1, "../src/tests/0k.txt");
+    return network;
+}
+
+TEST_F(LeelaTest, Int8MatchesSingle) {
+    gtp_execute("play b D4");
+    gtp_execute("play w Q16");
+    gtp_execute("play b C3");
+    const auto& state = get_gamestate();
+
+#ifdef USE_OPENCL
+    cfg_cpu_only = true;
+#endif
+    const auto fp32 = load_test_network();
+    cfg_int8 = true;
+    const auto int8 = load_test_network();
+
+    // The quantization keeps the outputs within about 1%.
+    constexpr auto max_error = 0.01f;
+    for (auto symmetry = 0; symmetry < Network::NUM_SYMMETRIES; symmetry++) {
+        const auto ref = fp32->get_output(&state, Network::DIRECT, symmetry,
+                                          false, false);
+        const auto res = int8->get_output(&state, Network::DIRECT, symmetry,
+                                          false, false);
+        EXPECT_NEAR(res.value, ref.value, max_error);
+        EXPECT_NEAR(res.alpha, ref.alpha, max_error * std::abs(ref.alpha));
+        EXPECT_NEAR(res.beta, ref.beta, max_error * std::abs(ref.beta));
+        EXPECT_NEAR(res.policy_pass, ref.policy_pass,
+                    max_error * ref.policy_pass);
+        for (auto idx = size_t{0}; idx < ref.policy.size(); idx++) {
+            EXPECT_NEAR(res.policy[idx], ref.policy[idx],
+                        max_error * ref.policy[idx]);
+        }
+    }
+}
+
+#ifdef USE_OPENCL
+static void expect_matches_cpu(Network& network, const GameState& state) {
+    const auto gpu_only = cfg_cpu_only;
+    cfg_cpu_only = true;
+    const auto cpu = load_test_network();
+    cfg_cpu_only = gpu_only;
+
+    for (auto symmetry = 0; symmetry < Network::NUM_SYMMETRIES; symmetry++) {
+        const auto ref = cpu->get_output(&state, Network::DIRECT, symmetry,
+                                         false, false);
+        const auto res = network.get_output(&state, Network::DIRECT, symmetry,
+                                            false, false);
+        EXPECT_NEAR(res.value, ref.value, 1e-3f);
+        EXPECT_NEAR(res.policy_pass, ref.policy_pass, 1e-3f);
+        for (auto idx = size_t{0}; idx < ref.policy.size(); idx++) {
+            EXPECT_NEAR(res.policy[idx], ref.policy[idx], 1e-3f);
+        }
+    }
+}
+
+TEST_F(LeelaTest, OpenCLMatchesCPU) {
+    gtp_execute("play b D4");
+    gtp_execute("play w Q16");
+    gtp_execute("play b C3");
+
+#ifdef USE_HALF
+    cfg_precision = precision_t::SINGLE;
+#endif
+    const auto opencl = load_test_network();
+    expect_matches_cpu(*opencl, get_gamestate());
+
+    // The run-time self-check, forced the way the sanity runs do it.
+    auto& state = get_gamestate();
+    for (auto i = 0; i < Network::NUM_SYMMETRIES; i++) {
+        EXPECT_NO_THROW(opencl->get_output(&state, Network::RANDOM_SYMMETRY,
+                                           -1, false, false, true));
+    }
+}
+#endif
+
+TEST_F(LeelaTest, CanonicalCacheSharesSymmetries) {
+    cfg_canonical_nncache = true;
+    // As in self-play, where the cache is not probed for symmetries.
+    cfg_random_cnt = 30;
+    auto& network = *GTP::s_network;
+    network.nncache_clear();
+
+    const auto moves = std::vector<std::string>{"D4", "Q17", "C16"};
+    const auto game = play_symmetric(moves, Network::IDENTITY_SYMMETRY);
+    const auto symmetry = 5;
+    const auto symgame = play_symmetric(moves, symmetry);
+
+    const auto stored = network.get_output(&game, Network::DIRECT,
+                                           Network::IDENTITY_SYMMETRY,
+                                           false, true);
+    const auto hits = network.get_counters().cache_hit_rate.first;
+    const auto cached = network.get_output(&symgame, Network::DIRECT,
+                                           Network::IDENTITY_SYMMETRY,
+                                           true, false);
+    EXPECT_EQ(hits + 1, network.get_counters().cache_hit_rate.first);
+    EXPECT_EQ(stored.value, cached.value);
+    EXPECT_EQ(stored.policy_pass, cached.policy_pass);
+    for (auto idx = size_t{0}; idx < NUM_INTERSECTIONS; idx++) {
+        EXPECT_EQ(stored.policy[idx],
+                  cached.policy[symmetry_nn_idx_table[symmetry][idx]]);
+    }
+    network.nncache_clear();
+}
+
+TEST(NetworkTest, SigmoidFastMatchesSigmoid) {
+    for (auto x = -40.0f; x <= 40.0f; x += 0.37f) {
+        for (const auto beta2 : {-1.0f, 0.5f, 2.0f}) {
+            const auto exact = sigmoid(x, 0.8f, 0.25f, beta2);
+            const auto fast = sigmoid_fast(x, 0.8f, 0.25f, beta2);
+            EXPECT_NEAR(fast.first, exact.first, 1e-6f) << x;
+            EXPECT_NEAR(fast.second, exact.second, 1e-6f) << x;
+        }
+    }
+}
+
+template <typename History>
+static void check_history_matches_vector() {
+    auto history = History{};
+    auto expected = std::vector<int>{};
+    auto rng = Random{1234};
+    for (auto step = 0; step < 2000; step++) {
+        if (rng.randfix<8>() == 0 && !expected.empty()) {
+            const auto size = rng.randuint64(expected.size());
+            history.resize(size);
+            expected.resize(size);
+        } else {
+            history.push_back(step);
+            expected.push_back(step);
+        }
+        // A copy played on must leave the original alone.
+        auto copy = history;
+        for (auto i = 0; i < 20; i++) {
+            copy.push_back(-1);
+        }
+        ASSERT_EQ(history.to_vector(), expected);
+        if (!expected.empty()) {
+            EXPECT_EQ(history.back(), expected.back());
+            const auto value = expected[rng.randuint64(expected.size())];
+            EXPECT_TRUE(history.contains(value, history.size()));
+            // Values truncated away must not be found either.
+            const auto count = rng.randuint64(expected.size());
+            const auto found = std::find(begin(expected),
+                                         begin(expected) + count, value);
+            EXPECT_EQ(history.contains(value, count),
+                      found != begin(expected) + count);
+        }
+        EXPECT_FALSE(history.contains(-1, history.size()));
+        EXPECT_FALSE(history.contains(step + 1, history.size()));
+    }
+}
+
+TEST(SharedHistoryTest, MatchesVector) {
+    check_history_matches_vector<SharedHistory<int>>();
+}
+
+TEST(SharedHistoryTest, FilteredMatchesVector) {
+    // A small filter, so false positives get exercised.
+    check_history_matches_vector<SharedHistory<int, 256>>();
+}
+
+TEST(MemoryTrackerTest, CountsAcrossThreads) {
+    const auto before = MemoryTracker::get(MemoryTracker::HISTORY);
+    auto history = std::make_unique<SharedHistory<int>>();
+    for (auto i = 0; i < 1000; i++) {
+        history->push_back(i);
+    }
+    EXPECT_GE(MemoryTracker::get(MemoryTracker::HISTORY) - before,
+              std::int64_t((1000 - SharedHistory<int>::TAIL_SIZE) * sizeof(int)));
+    // Freed by another thread: the sum over the threads is back.
+    std::thread([&history]() { history.reset(); }).join();
+    EXPECT_EQ(MemoryTracker::get(MemoryTracker::HISTORY), before);
+}
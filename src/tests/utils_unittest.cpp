@@ -28,12 +28,15 @@
 */
 
 #include <boost/math/distributions/chi_squared.hpp>
+#include <atomic>
 #include <cstddef>
 #include <gtest/gtest.h>
 #include <limits>
+#include <memory>
 #include <vector>
 
 #include "Random.h"
+#include "ThreadPool.h"
 #include "Utils.h"
 
 // Test should fail about this often from distribution not looking uniform.
@@ -139,3 +142,58 @@ TEST(UtilsTest, Randuint64_max) {
     auto p = randomlyDistributedProbability(count, expected);
     EXPECT_PRED2(rngBucketsLookRandom, p, ALPHA);
 }
+
+TEST(UtilsTest, ThreadPoolNestedTasks) {
+    ThreadPool pool;
+    pool.initialize(4);
+
+    // Tasks adding tasks to queues of their own, to be stolen by the
+    // other threads, mixing small callables and ones stored on the heap.
+    std::atomic<int> count{0};
+    using inner_t = std::vector<std::future<int>>;
+    auto outer = std::vector<std::future<inner_t>>{};
+    for (auto i = 0; i < 8; i++) {
+        outer.emplace_back(pool.add_task([&pool, &count, i]() {
+            auto big = std::make_shared<std::vector<int>>(100, i);
+            auto inner = inner_t{};
+            for (auto j = 0; j < 100; j++) {
+                inner.emplace_back(pool.add_task(
+                    [&count, big, j]() { count++; return (*big)[j]; }));
+            }
+            return inner;
+        }));
+    }
+    for (auto i = 0; i < 8; i++) {
+        auto inner = outer[i].get();
+        auto sum = 0;
+        for (auto& f : inner) {
+            sum += f.get();
+        }
+        EXPECT_EQ(sum, 100 * i);
+    }
+    EXPECT_EQ(count.load(), 800);
+}
+
+TEST(UtilsTest, InputQueueKeepsOrderAndEnd) {
+    const auto lines = std::vector<std::string>{"name", "", "10 play b d4"};
+    auto next = size_t{0};
+    Utils::InputQueue input;
+    input.start([&lines, &next](std::string& line) {
+        if (next == lines.size()) {
+            return false;
+        }
+        line = lines[next++];
+        return true;
+    });
+
+    auto line = std::string{};
+    for (const auto& expected : lines) {
+        EXPECT_TRUE(input.pop(line));
+        EXPECT_EQ(line, expected);
+    }
+    // The end of input wakes a waiting search and is never consumed.
+    EXPECT_TRUE(input.wait(1000));
+    EXPECT_TRUE(input.pending());
+    EXPECT_FALSE(input.pop(line));
+    input.join();
+}
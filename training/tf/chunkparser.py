@@ -79,7 +79,7 @@ class ChunkParser:
             chunk: The name of a file containing chunkdata
 
             chunkdata: type Bytes. Either mutiple records of v1 format,
-            or multiple records of v2 format.
+            or multiple records of v2 or v3 format.
 
             v1: The original text format describing a move. 19 lines long.
             VERY slow to decode. Typically around 2500 bytes long.
@@ -92,6 +92,11 @@ class ChunkParser:
             Very fast to decode. Preferred format to use on disk.
             2176 bytes long on a 19x19.
 
+            v3: Binary format written directly by sai with --binarychunks.
+            Fixed length, little endian, float16 probabilities and
+            the SAI value targets. Converted to v2 on reading.
+            1470 bytes long on a 19x19 with 16 input planes.
+
             raw: A byte string holding raw tensors contenated together.
             This is used to pass data from the workers to the parent.
             Exists because TensorFlow doesn't have a fast way to
@@ -158,6 +163,18 @@ class ChunkParser:
         s2 = (BOARD_SQUARES * INPUT_PLANES + 7) // 8
         self.v2_struct = struct.Struct('4s'+str(s1)+'s'+str(s2)+'sBiB4s4s')
 
+        # V3 Format, packed and little endian
+        # int32 version (4 bytes)
+        # BOARD_SQUARES+1 float16 probabilities (724 bytes on a 19x19)
+        # BOARD_SQUARES*16 packed bit planes (722 bytes on a 19x19)
+        # uint8 side_to_move (1 byte)
+        # float32 komi
+        # uint8 1 + winner (1 byte)
+        # float32 alpkt, beta and average winrate
+        # uint16 move number
+        s4 = (BOARD_SQUARES+1)*2
+        self.v3_struct = struct.Struct('<i'+str(s4)+'s'+str(s2)+'sBfBfffH')
+
         # Struct used to return data from child workers.
         # float32 winner
         # float32 alpha
@@ -249,10 +266,6 @@ class ChunkParser:
         # probabilities here.
         probabilities = probabilities/sum(probabilities)
 
-        probs = probabilities.tobytes()
-        if not(len(probs) == (BOARD_SQUARES + 1) * 4):
-            return False, None
-
         # Load the game winner and other output values
         winner_and_values = text_item[INPUT_PLANES + 2].split()
         # For the moment, we drop the other values
@@ -271,6 +284,15 @@ class ChunkParser:
         beta = float(winner_and_values[2])       # average beta
         winrate = float(winner_and_values[3])    # average winrate
 
+        return self.pack_v2(probabilities, planes, stm, double_komi,
+                            winner, alphk, beta, winrate)
+
+    def pack_v2(self, probabilities, planes, stm, double_komi,
+                winner, alphk, beta, winrate):
+        """
+            Validate the output values of a position and pack it
+            as a v2 record. Shared by the v1 and v3 readers.
+        """
         # Some checks are due as sometimes there are wrong positions
         # in the training data
         if beta < 0.0001 or beta > 100 or abs(alphk) > 2 * BOARD_SQUARES or winrate < 0.0  or winrate > 1.0:
@@ -280,12 +302,44 @@ class ChunkParser:
             alphk = -alphk           #  alpkt from the point of view of current player
         alpha = alphk - 0.5 * double_komi
 
+        probs = probabilities.astype(np.float32).tobytes()
+        if not(len(probs) == (BOARD_SQUARES + 1) * 4):
+            return False, None
+
         alpha = struct.pack('f', alpha)
         beta = struct.pack('f', beta)
         version = struct.pack('i', 1)
 
         return True, self.v2_struct.pack(version, probs, planes, stm, double_komi, winner, alpha, beta)
 
+    def convert_v3_to_v2(self, content):
+        """
+            Convert a v3 binary record to v2 packed binary format,
+            with the same checks done on v1 records.
+        """
+        (ver, probs, planes, stm, komi, winner,
+         alphk, beta, winrate, movenum) = self.v3_struct.unpack(content)
+        if ver != 2 or not(stm == 0 or stm == 1) or winner > 2:
+            return False, None
+
+        double_komi = 2.0 * komi
+        if double_komi != int(double_komi):
+            return False, None
+        double_komi = int(double_komi)
+        if (stm == 0):
+            double_komi = -double_komi
+        if movenum > 2 * BOARD_SQUARES:
+            return False, None
+
+        probabilities = np.frombuffer(probs, dtype='<f2').astype(np.float32)
+        if np.any(np.isnan(probabilities)) or not(sum(probabilities) > 0.0):
+            return False, None
+        # Renormalize after the float16 rounding, as for v1
+        probabilities = probabilities/sum(probabilities)
+
+        return self.pack_v2(probabilities, planes, stm, double_komi,
+                            winner, alphk, beta, winrate)
+
     def v2_apply_symmetry(self, symmetry, content):
         """<
             Apply a random symmetry to a v2 record.
@@ -367,7 +421,18 @@ class ChunkParser:
             Take chunk of unknown format, and return it as a list of
             v2 format records.
         """
-        if chunkdata[0:4] == b'\1\0\0\0':
+        if chunkdata[0:4] == b'\2\0\0\0':
+            #print("V3 chunkdata")
+            for i in range(0, len(chunkdata), self.v3_struct.size):
+                if self.sample > 1:
+                    # Downsample, using only 1/Nth of the items.
+                    if random.randint(0, self.sample-1) != 0:
+                        continue  # Skip this record.
+                success, data = self.convert_v3_to_v2(
+                    chunkdata[i:i+self.v3_struct.size])
+                if success:
+                    yield data
+        elif chunkdata[0:4] == b'\1\0\0\0':
             #print("V2 chunkdata")
             for i in range(0, len(chunkdata), self.v2_struct.size):
                 if self.sample > 1:
@@ -1,3 +1,17 @@
+/*
+  This program computes the weighted panel score of a network, from
+  its results by color against the 15 nets of the reference panel.
+
+  It does not evaluate networks on positions: the input is the
+  (already played) panel matches.
+
+  Usage:
+  nncoloreval [-w] < results
+  where results starts with two header words, then has 15 lines
+  "<wins black> <wins white> <losses black> <losses white>";
+  -w uses the games with white only
+*/
+
 #include <array>
 #include <iostream>
 #include <string>
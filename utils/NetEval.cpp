@@ -1,3 +1,15 @@
+/*
+  This program computes the PCA score of a network from its results
+  against the 15 nets of the reference panel.
+
+  It does not evaluate networks on positions: the input is the
+  (already played) panel matches, one line per panel net.
+
+  Usage:
+  nneval < results
+  where results has 15 lines "<wins> <losses>"
+*/
+
 #include <array>
 #include <iostream>
 
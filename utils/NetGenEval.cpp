@@ -1,3 +1,15 @@
+/*
+  This program prints the panel scores of a network (weighted by
+  color, unweighted and old PCA) together with their standard
+  deviations.
+
+  It does not evaluate networks on positions: the input is the
+  (already played) panel matches, in the same format as nncoloreval.
+
+  Usage:
+  nngeneval < results
+*/
+
 #include <array>
 #include <cmath>
 #include <algorithm>
@@ -1,149 +1,377 @@
 /*
-  This program counts the (approximate) number of nodes created for
-  all the games in a chunk.
+  This program counts the games, the positions and the wins of each
+  color for every komi found in training chunks, text or binary.
 
   Usage:
-  gunzip * -c | nodecount
+  parsechunks [-t threads] [-s boardsize] [-p planes] chunk.gz...
+  gunzip * -c | parsechunks [-s boardsize]
+
+  The chunks given on the command line are read by threads threads
+  (default: all the cores), gzipped or not. Without files the text
+  chunks are read from standard input. Text chunks of any board size
+  are understood as they are; for binary chunks the board size and the
+  number of input planes must be given if they are not 19 and 16.
+
+  Build with:
+  g++ -std=c++14 -O2 -o parsechunks ParseChunks.cpp -lz -pthread
 */
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
 #include <iostream>
+#include <map>
+#include <mutex>
+#include <sstream>
 #include <string>
-#include <cmath>
-#include <cassert>
+#include <thread>
+#include <unordered_map>
 #include <vector>
-#include <algorithm>
 
-//#define VISITS 160
-#define GOBAN_SIZE 9
+#include <zlib.h>
 
 struct one_komi_stats {
-    float komi;
-    unsigned int bwg;
-    unsigned int bwm;
-    unsigned int wwg;
-    unsigned int wwm;
-    unsigned int mvs;
+    unsigned int bwg{0};    // black won games
+    unsigned int bwm{0};    // positions of the games black won
+    unsigned int wwg{0};
+    unsigned int wwm{0};
+    unsigned int mvs{0};    // positions with this komi
+};
+
+using komi_table = std::unordered_map<float, one_komi_stats>;
+
+struct scan_stats {
+    komi_table komis;
+    unsigned long long games{0};
+    unsigned long long records{0};
+    unsigned long long bytes{0};
+    unsigned long long bad_files{0};
 };
 
-bool compare(const one_komi_stats& a, const one_komi_stats& b) {
-    return a.komi<b.komi;    
+// The game being read, ended by the first record of the next one.
+struct game_state {
+    bool open{false};
+    float komi{0.0f};
+    int black_result{0};
+    unsigned int moves{0};
+    int last_movenum{-1};
+    std::string hash;
+};
+
+static void end_game(game_state& game, scan_stats& stats) {
+    if (!game.open) {
+        return;
+    }
+    ++stats.games;
+    auto& komi = stats.komis[game.komi];
+    if (game.black_result == 1) {
+        ++komi.bwg;
+        komi.bwm += game.moves;
+    } else if (game.black_result == -1) {
+        ++komi.wwg;
+        komi.wwm += game.moves;
+    }
+    game = game_state{};
 }
 
+// One record, of the game of hash if known, at movenum, or -1 if not
+// known. result is for the side to move.
+static void add_record(game_state& game, scan_stats& stats,
+                       const std::string& hash, int movenum,
+                       int stm, float komi, int result) {
+    const auto new_game = !game.open
+        || (!hash.empty() && hash != game.hash)
+        || (movenum >= 0 && movenum <= game.last_movenum);
+    if (new_game) {
+        end_game(game, stats);
+        game.open = true;
+        game.komi = komi;
+        game.black_result = stm == 0 ? result : -result;
+        game.hash = hash;
+    }
+    game.last_movenum = movenum;
+    ++game.moves;
+    ++stats.records;
+    ++stats.komis[komi].mvs;
+}
+
+// Reads a chunk file, gzipped or not, through zlib.
+class chunk_reader {
+public:
+    explicit chunk_reader(const std::string& filename) {
+        m_file = gzopen(filename.c_str(), "rb");
+        if (m_file) {
+            gzbuffer(m_file, 1 << 18);
+        }
+    }
+    ~chunk_reader() {
+        if (m_file) {
+            gzclose(m_file);
+        }
+    }
+    bool ok() const { return m_file != nullptr; }
+
+    // Next n bytes, false at the end of the file.
+    bool read(char* out, size_t n) {
+        while (n > 0) {
+            if (m_pos == m_end && !fill()) {
+                return false;
+            }
+            const auto count = std::min(n, m_end - m_pos);
+            std::memcpy(out, m_buf.data() + m_pos, count);
+            m_pos += count;
+            out += count;
+            n -= count;
+        }
+        return true;
+    }
+
+    bool getline(std::string& line) {
+        line.clear();
+        while (true) {
+            if (m_pos == m_end && !fill()) {
+                return !line.empty();
+            }
+            const auto begin = m_buf.data() + m_pos;
+            const auto end = static_cast<char*>(
+                std::memchr(begin, '\n', m_end - m_pos));
+            if (end) {
+                line.append(begin, end);
+                m_pos += end - begin + 1;
+                return true;
+            }
+            line.append(begin, m_end - m_pos);
+            m_pos = m_end;
+        }
+    }
+
+    // The first byte, without consuming it.
+    int peek() {
+        if (m_pos == m_end && !fill()) {
+            return -1;
+        }
+        return static_cast<unsigned char>(m_buf[m_pos]);
+    }
+
+    unsigned long long bytes() const { return m_bytes; }
+
+private:
+    bool fill() {
+        const auto n = gzread(m_file, m_buf.data(), m_buf.size());
+        if (n <= 0) {
+            return false;
+        }
+        m_pos = 0;
+        m_end = size_t(n);
+        m_bytes += n;
+        return true;
+    }
 
-unsigned int komi_index(float komi, std::vector<one_komi_stats> &stats) {
-    unsigned int j;
-    
-    for (j=0 ; j<stats.size() ; ++j) {
-	if (stats[j].komi == komi)
-	    break;
-    }
-    if (j == stats.size()) {
-	one_komi_stats p;
-	p.komi = komi;
-	p.bwg = 0;
-	p.bwm = 0;
-	p.wwg = 0;
-	p.wwm = 0;
-	p.mvs = 0;
-	stats.push_back(p);
-	std::cout << "Found new komi (" << j
-		  << "): " << komi << std::endl;
-    }
-    return j;
+    gzFile m_file{nullptr};
+    std::vector<char> m_buf = std::vector<char>(1 << 18);
+    size_t m_pos{0};
+    size_t m_end{0};
+    unsigned long long m_bytes{0};
+};
+
+// Text records are the input planes, one hex line each, then a line
+// with the side to move, the komi and, in newer chunks, the hash of
+// the game and the move number, then the policy and then the result
+// for the side to move, followed in newer chunks by the tree targets.
+template <typename GetLine>
+static void scan_text(GetLine getline, scan_stats& stats) {
+    auto game = game_state{};
+    auto line = std::string{};
+    auto empty_board = true;
+    while (getline(line)) {
+        if (line.find(' ') == std::string::npos) {
+            empty_board = empty_board
+                && line.find_first_not_of('0') == std::string::npos;
+            continue;
+        }
+        auto stm = 0;
+        auto komi = 0.0f;
+        auto hash = std::string{};
+        auto movenum = -1;
+        {
+            std::istringstream is(line);
+            is >> stm >> komi;
+            if (!is) {
+                break;
+            }
+            if (!(is >> hash >> movenum)) {
+                hash.clear();
+                movenum = -1;
+            }
+        }
+        // The policy, then the result.
+        if (!getline(line) || !getline(line)) {
+            break;
+        }
+        const auto result = std::atoi(line.c_str());
+        // Old chunks have neither hash nor move number: a game starts
+        // with the empty board, black to move.
+        if (movenum < 0) {
+            movenum = empty_board && stm == 0 ? 0 : game.last_movenum + 1;
+        }
+        add_record(game, stats, hash, movenum, stm, komi, result);
+        empty_board = true;
+    }
+    end_game(game, stats);
+}
+
+// See Training::append_binary_record().
+template <typename T>
+static T read_le(const unsigned char* p) {
+    auto bits = std::uint32_t{0};
+    for (auto i = size_t{0}; i < sizeof(T); i++) {
+        bits |= std::uint32_t(p[i]) << (8 * i);
+    }
+    auto value = T{};
+    std::memcpy(&value, &bits, sizeof(T));
+    return value;
+}
+
+static void scan_binary(chunk_reader& reader, int board_size, int planes,
+                        scan_stats& stats) {
+    const auto intersections = board_size * board_size;
+    const auto planes_bytes = (planes * intersections + 7) / 8;
+    const auto stm_offset = 4 + 2 * (intersections + 1) + planes_bytes;
+    const auto size = stm_offset + 1 + 4 + 1 + 3 * 4 + 2;
+
+    auto game = game_state{};
+    auto record = std::vector<unsigned char>(size);
+    while (reader.read(reinterpret_cast<char*>(record.data()), size)) {
+        if (read_le<std::int32_t>(record.data()) != 2) {
+            std::cerr << "Unexpected binary record, wrong size or planes?"
+                      << std::endl;
+            ++stats.bad_files;
+            break;
+        }
+        const auto p = record.data() + stm_offset;
+        const auto stm = int(p[0]);
+        const auto komi = read_le<float>(p + 1);
+        const auto result = int(p[5]) - 1;
+        const auto movenum = int(read_le<std::uint16_t>(p + 18));
+        add_record(game, stats, "", movenum, stm, komi, result);
+    }
+    end_game(game, stats);
+}
+
+static void scan_file(const std::string& filename, int board_size,
+                      int planes, scan_stats& stats) {
+    chunk_reader reader(filename);
+    if (!reader.ok()) {
+        std::cerr << "Cannot open " << filename << std::endl;
+        ++stats.bad_files;
+        return;
+    }
+    // Text chunks start with a hex digit, binary ones with the version.
+    if (reader.peek() == 2) {
+        scan_binary(reader, board_size, planes, stats);
+    } else {
+        scan_text([&reader](std::string& line) {
+            return reader.getline(line);
+        }, stats);
+    }
+    stats.bytes += reader.bytes();
+}
+
+static void merge(scan_stats& into, const scan_stats& from) {
+    for (const auto& k : from.komis) {
+        auto& s = into.komis[k.first];
+        s.bwg += k.second.bwg;
+        s.bwm += k.second.bwm;
+        s.wwg += k.second.wwg;
+        s.wwm += k.second.wwm;
+        s.mvs += k.second.mvs;
+    }
+    into.games += from.games;
+    into.records += from.records;
+    into.bytes += from.bytes;
+    into.bad_files += from.bad_files;
 }
 
+int main(int argc, char* argv[]) {
+    auto threads = int(std::thread::hardware_concurrency());
+    auto board_size = 19;
+    auto planes = 16;
+    auto files = std::vector<std::string>{};
+    for (auto i = 1; i < argc; i++) {
+        const auto arg = std::string{argv[i]};
+        if (arg == "-t" && i + 1 < argc) {
+            threads = std::atoi(argv[++i]);
+        } else if (arg == "-s" && i + 1 < argc) {
+            board_size = std::atoi(argv[++i]);
+        } else if (arg == "-p" && i + 1 < argc) {
+            planes = std::atoi(argv[++i]);
+        } else {
+            files.emplace_back(arg);
+        }
+    }
+    threads = std::max(1, threads);
+
+    const auto start = std::chrono::steady_clock::now();
+    auto stats = scan_stats{};
+    if (files.empty()) {
+        scan_text([&stats](std::string& line) {
+            if (!std::getline(std::cin, line)) {
+                return false;
+            }
+            stats.bytes += line.size() + 1;
+            return true;
+        }, stats);
+    } else {
+        std::atomic<size_t> next{0};
+        std::mutex mutex;
+        auto workers = std::vector<std::thread>{};
+        for (auto t = 0; t < threads; t++) {
+            workers.emplace_back([&]() {
+                auto local = scan_stats{};
+                for (auto n = next++; n < files.size(); n = next++) {
+                    scan_file(files[n], board_size, planes, local);
+                }
+                std::lock_guard<std::mutex> lock(mutex);
+                merge(stats, local);
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+    }
+    const auto seconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - start).count();
+
+    // Sorted by komi.
+    const auto komis = std::map<float, one_komi_stats>(begin(stats.komis),
+                                                       end(stats.komis));
+
+    std::cout << "Total games found: " << stats.games << std::endl;
+    auto j = 0;
+    for (const auto& k : komis) {
+        const auto& s = k.second;
+        const auto den = s.bwg + s.wwg;
+        std::cout << j++ << ". komi " << k.first
+                  << ", games: " << den
+                  << ", moves: " << s.mvs
+                  << ", black wins: " << s.bwg / (float)den
+                  << " (avg len) " << s.bwm / (float)s.bwg
+                  << ", white wins: " << s.wwg / (float)den
+                  << " (avg len) " << s.wwm / (float)s.wwg
+                  << std::endl;
+    }
+    const auto mib = stats.bytes / (1024.0 * 1024.0);
+    std::cerr << stats.records << " positions, "
+              << mib << " MiB in " << seconds << " s: "
+              << stats.records / std::max(seconds, 1e-6) << " positions/s, "
+              << mib / std::max(seconds, 1e-6) << " MiB/s";
+    if (stats.bad_files) {
+        std::cerr << ", " << stats.bad_files << " unreadable files";
+    }
+    std::cerr << std::endl;
 
-int main(){
-    std::string buf;
-    std::string hexnil((GOBAN_SIZE*GOBAN_SIZE+3)/4,'0');
-    int games=0, line=0, moves=0, lastwinner=0, winner=0;
-    float komi;
-    unsigned int j = 0;
-    std::vector<one_komi_stats> stats;
-    
-    while (std::cin >> buf) {
-	++line;
-      
-	// check whether the goban is empty
-	int chknil = buf.compare(hexnil); // 0 if goban empty (1/16)
-	for (int i=0; i<15; i++) {
-	    
-	    // skip the 16 lines describing the position
-	    std::cin >> buf;
-	    ++line;
-	    
-	    // check whether this is the starting position, otherwise 1 
-	    if (!chknil && buf.compare(hexnil))
-		chknil = 1;
-	}
-	
-	// skip line 17, with the player and komi
-	int stm;
-	std::cin >> stm;
-	std::cin >> komi;
-	++line;
-
-	j = komi_index(komi, stats);
-	++stats[j].mvs;
-	
-	for (int i=0; i<GOBAN_SIZE*GOBAN_SIZE+1; i++) {
-	    float polprb;
-	    
-	    // line 18 has the 50 probabilities, all of which are fractions
-	    // like k/99
-	    std::cin >> polprb;
-	    
-	    //	    assert (0 == ((int)round(1000*polprb*(VISITS-1)) % 1000));
-	}
-	++line;
-	
-	// skip line 19, with the winner
-	std::cin >> winner;
-	++line;
-	++moves;
-	
-	// if starting position, the former maxnodes should have never
-	// been subtracted, because after the last position there is no
-	// more tree re-use
-	if (!chknil && stm == 0) {
-	    assert (winner == 0 || winner == 1 || winner == -1);
-	    ++games;
-	    if (lastwinner == 1) {
-		++stats[j].bwg;
-		stats[j].bwm += moves;
-	    }
-	    else if (lastwinner == -1) {
-		++stats[j].wwg;
-		stats[j].wwm += moves;
-	    }
-	    moves = 0;
-	    lastwinner = winner;
-	}
-	
-    }
-    if (lastwinner == 1) {
-	++stats[j].bwg;
-	stats[j].bwm += moves;
-    }
-    else if (lastwinner == -1) {
-	++stats[j].wwg;
-	stats[j].wwm += moves;
-    }
-    
-    sort(stats.begin(), stats.end(), compare);
-    
-    std::cout << "Total games found: " << games << std::endl;
-    for (unsigned int j=0 ; j<stats.size() ; ++j) {
-	const auto den = stats[j].bwg+stats[j].wwg;
-	std::cout << j << ". komi " << stats[j].komi
-		  << ", games: " << den
-		  << ", moves: " << stats[j].mvs
-		  << ", black wins: " << stats[j].bwg/(float)den
-		  << " (avg len) " << stats[j].bwm/(float)stats[j].bwg
-		  << ", white wins: " << stats[j].wwg/(float)den
-		  << " (avg len) " << stats[j].wwm/(float)stats[j].wwg
-		  << std::endl;
-    }
-    
-    return 0;
+    return stats.bad_files ? 1 : 0;
 }
@@ -4,7 +4,10 @@
 #include <cmath>
 #include <fstream>
 #include <iostream>
+#include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 #include <map>
 
@@ -119,7 +122,20 @@ inline tags tag_type(const string & tag)
     return it == end(known_tags) ? NA : static_cast<tags>( distance(begin(known_tags), it) );
 }
 
-void get_first_line(ifstream & data, string & s, const int header_lines = 4) {
+// Slurp the whole file with a single read: the token parsers below
+// then work on memory instead of hitting the filesystem per token.
+bool read_file(const string & filename, istringstream & data) {
+    ifstream file(filename, ios::binary);
+    if (!file)
+        return false;
+
+    ostringstream contents;
+    contents << file.rdbuf();
+    data.str(contents.str());
+    return true;
+}
+
+void get_first_line(istream & data, string & s, const int header_lines = 4) {
     auto j = 0;
     auto position = data.tellg();
     do {
@@ -140,7 +156,7 @@ inline bool quote_opened(const string & s) noexcept {
     return n % 2;
 }
 
-inline void complete_quote(ifstream & netsdata, string & s) {
+inline void complete_quote(istream & netsdata, string & s) {
     string tmp;
     while (netsdata >> tmp) {
         s.append(tmp);
@@ -167,9 +183,21 @@ void sort_and_set_indices(vector<sainet> & nets, matches_t & matches) noexcept {
         net.index = i++;
     }
 
+    // hash the net list once, rather than scanning it for every match
+    unordered_map<string, int> by_hash;
+    by_hash.reserve(nets.size());
+    for(auto & net : nets){
+        by_hash.emplace(net.hash, net.index);
+    }
+
+    const auto lookup = [&by_hash](const string & hash){
+        const auto it = by_hash.find(hash);
+        return it == end(by_hash) ? -1 : it->second;
+    };
+
     for(auto & match : matches){
-        match.idx1 = get_index(nets, match.hash1);
-        match.idx2 = get_index(nets, match.hash2);
+        match.idx1 = lookup(match.hash1);
+        match.idx2 = lookup(match.hash2);
     }
 
     // drop matches against unknown or dropped nets
@@ -201,10 +229,9 @@ inline size_t count_rated_nets(const nets_t & nets) noexcept {
 } // end namespace
 
 nets_t load_netsdata(const string & filename) {
-    ifstream netsdata;
+    istringstream netsdata;
 
-    netsdata.open(filename);
-    if (!netsdata) {
+    if (!read_file(filename, netsdata)) {
         cerr << "Unable to open nets data file " << filename
              << "." << endl;
         exit (1);
@@ -347,18 +374,15 @@ nets_t load_netsdata(const string & filename) {
         }
     } 
 
-    netsdata.close();
-
     cerr << "Nets found: " << nets.size() << "\n";
 
     return nets;
 }
 
 matches_t load_matchdata(const string & filename) {
-    ifstream matchdata;
+    istringstream matchdata;
 
-    matchdata.open(filename);
-    if (!matchdata) {
+    if (!read_file(filename, matchdata)) {
         cerr << "Unable to open matchdata file " << filename
              << "." << endl;
         exit (1);
@@ -417,7 +441,6 @@ matches_t load_matchdata(const string & filename) {
             i = 0;
         }
     } 
-    matchdata.close();
 
     cerr << "Matches found: " << matches.size() << "\n";
 
@@ -446,30 +469,28 @@ stats_t get_stats(const matches_t & matches, size_t n, size_t hook_index){
             stat2.always_won = stat1.always_lost = false;
     }
 
-    // mark the hook net
-    stats[hook_index].hook_dist = 0;
-
-    int dist = 0;
-    bool modified;
-    do {
-        // cerr << "Loop: " << dist << "\n";
-        modified = false;
-        for (auto & match : matches) {
-            auto & stat1 = stats[match.idx1];
-            auto & stat2 = stats[match.idx2];
+    // breadth first visit from the hook net, so that every match
+    // is looked at twice instead of once per distance level
+    vector< vector<int> > adjacent(n);
+    for (auto & match : matches) {
+        adjacent[match.idx1].push_back(match.idx2);
+        adjacent[match.idx2].push_back(match.idx1);
+    }
 
-            if (stat1.hook_dist == -1 && stat2.hook_dist == dist){
-                stat1.hook_dist = 1 + dist;
-                modified = true;
-            }
+    vector<int> queue;
+    queue.reserve(n);
+    queue.push_back(hook_index);
+    stats[hook_index].hook_dist = 0;
 
-            if (stat2.hook_dist == -1 && stat1.hook_dist == dist){
-                stat2.hook_dist = 1 + dist;
-                modified = true;
+    for (size_t head = 0; head < queue.size(); ++head) {
+        const auto dist = stats[queue[head]].hook_dist;
+        for (auto next : adjacent[queue[head]]) {
+            if (stats[next].hook_dist == -1) {
+                stats[next].hook_dist = 1 + dist;
+                queue.push_back(next);
             }
         }
-        ++dist;
-    } while (modified);
+    }
 
     return stats;
 }
@@ -696,6 +717,177 @@ void rate_connected_nets(nets_t & nets, const matches_t & matches, float prior_e
     }
 }
 
+// Run body(i) for i in [0, n), split in contiguous ranges over threads.
+template <typename F>
+void parallel_for(size_t n, unsigned int threads, const F & body) {
+    const auto range = [&](unsigned int t) {
+        const size_t end = n * (t + 1) / threads;
+        for (size_t i = n * t / threads; i < end; ++i) {
+            body(i);
+        }
+    };
+
+    vector<thread> workers;
+    for (auto t = 1u; t < threads; ++t) {
+        workers.emplace_back(range, t);
+    }
+    range(0);
+    for (auto & worker : workers) {
+        worker.join();
+    }
+}
+
+// Maximum likelihood Bradley-Terry ratings on the sparse match list.
+// Each Newton step solves the (graph laplacian shaped) hessian system
+// with preconditioned conjugate gradient, so the cost is O(matches)
+// per product and nothing of size nets^2 is ever built. The prior is
+// turned into 2/T virtual wins for each side of every match, which
+// gives each pairwise difference the curvature of a gaussian of
+// variance T. Ratings from rate_connected_nets are the starting point
+// and the hook keeps its rating.
+void fit_bradley_terry(nets_t & nets, const matches_t & matches,
+                       const string & hook, float prior_elo_std,
+                       unsigned int threads) {
+    assert(( (void)"Indices must be set", check_indices(nets) ));
+
+    constexpr double ELO_FACTOR = 400.0 / log(10.0);
+    constexpr int MAX_NEWTON_STEPS = 50;
+    constexpr double MAX_STEP = 1.0;
+    constexpr double TOLERANCE = 1e-6;
+
+    const size_t n = nets.size();
+    const auto hook_index = get_index(nets, hook);
+    assert((hook_index != -1));
+
+    const double T = pow(prior_elo_std / ELO_FACTOR, 2.0);
+    const double virtual_wins = 2.0 / T;
+
+    // compressed adjacency: for each net, opponents and games played
+    vector<size_t> first(n + 1, 0);
+    for (auto & match : matches) {
+        ++first[match.idx1 + 1];
+        ++first[match.idx2 + 1];
+    }
+    for (size_t i = 0; i < n; ++i) {
+        first[i + 1] += first[i];
+    }
+
+    vector<int> opponent(first[n]);
+    vector<double> games(first[n]);
+    vector<double> wins(n, 0.0);
+    {
+        auto fill = first;
+        for (auto & match : matches) {
+            const double num = match.num + 2.0 * virtual_wins;
+            opponent[fill[match.idx1]] = match.idx2;
+            games[fill[match.idx1]++] = num;
+            opponent[fill[match.idx2]] = match.idx1;
+            games[fill[match.idx2]++] = num;
+
+            wins[match.idx1] += match.h1wins + 0.5 * match.jigos() + virtual_wins;
+            wins[match.idx2] += match.h2wins + 0.5 * match.jigos() + virtual_wins;
+        }
+    }
+
+    // small graphs are not worth the thread spawns
+    threads = max(1u, min<unsigned int>(threads, n / 1024));
+
+    vector<double> r(n);
+    for (size_t i = 0; i < n; ++i) {
+        r[i] = nets[i].rating / ELO_FACTOR;
+    }
+
+    // edge weights n_ij p_ij (1 - p_ij) of the hessian
+    vector<double> curv(first[n]);
+    vector<double> grad(n), diag(n), step(n);
+    vector<double> res(n), dir(n), prod(n), pre(n);
+
+    // hessian product restricted to the free nets (the hook is pinned)
+    const auto hessian = [&](const vector<double> & x, vector<double> & y) {
+        parallel_for(n, threads, [&](size_t i) {
+            auto sum = diag[i] * x[i];
+            for (auto k = first[i]; k < first[i + 1]; ++k) {
+                sum -= curv[k] * x[opponent[k]];
+            }
+            y[i] = (int(i) == hook_index) ? 0.0 : sum;
+        });
+    };
+
+    const auto dot = [n](const vector<double> & x, const vector<double> & y) {
+        auto sum = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            sum += x[i] * y[i];
+        }
+        return sum;
+    };
+
+    auto newton_steps = 0;
+    auto cg_iterations = size_t{0};
+    auto max_change = 0.0;
+    do {
+        parallel_for(n, threads, [&](size_t i) {
+            auto expected = 0.0;
+            auto d = 0.0;
+            for (auto k = first[i]; k < first[i + 1]; ++k) {
+                const auto p = 1.0 / (1.0 + exp(r[opponent[k]] - r[i]));
+                expected += games[k] * p;
+                curv[k] = games[k] * p * (1.0 - p);
+                d += curv[k];
+            }
+            diag[i] = d;
+            grad[i] = (int(i) == hook_index) ? 0.0 : wins[i] - expected;
+        });
+
+        // jacobi preconditioned conjugate gradient for hessian * step = grad
+        fill(begin(step), end(step), 0.0);
+        res = grad;
+        for (size_t i = 0; i < n; ++i) {
+            pre[i] = (int(i) == hook_index || diag[i] == 0.0) ? 0.0 : 1.0 / diag[i];
+            dir[i] = pre[i] * res[i];
+        }
+        auto rz = 0.0;
+        for (size_t i = 0; i < n; ++i) {
+            rz += res[i] * pre[i] * res[i];
+        }
+        const auto target = 1e-20 * max(rz, 1.0);
+        for (size_t it = 0; it < 4 * n && rz > target; ++it, ++cg_iterations) {
+            hessian(dir, prod);
+            const auto alpha = rz / dot(dir, prod);
+            for (size_t i = 0; i < n; ++i) {
+                step[i] += alpha * dir[i];
+                res[i] -= alpha * prod[i];
+            }
+            auto rz_next = 0.0;
+            for (size_t i = 0; i < n; ++i) {
+                rz_next += res[i] * pre[i] * res[i];
+            }
+            const auto beta = rz_next / rz;
+            rz = rz_next;
+            for (size_t i = 0; i < n; ++i) {
+                dir[i] = pre[i] * res[i] + beta * dir[i];
+            }
+        }
+
+        // damp steps too long for the quadratic model to be trusted
+        max_change = 0.0;
+        for (auto x : step) {
+            max_change = max(max_change, abs(x));
+        }
+        const auto scale = max_change > MAX_STEP ? MAX_STEP / max_change : 1.0;
+        for (size_t i = 0; i < n; ++i) {
+            r[i] += scale * step[i];
+        }
+    } while (++newton_steps < MAX_NEWTON_STEPS && max_change > TOLERANCE);
+
+    for (size_t i = 0; i < n; ++i) {
+        nets[i].rating = max(0.0, ELO_FACTOR * r[i]);
+    }
+
+    cerr << "Bradley-Terry fit: " << newton_steps << " Newton steps, "
+         << cg_iterations << " CG iterations on " << threads
+         << " threads, last step " << ELO_FACTOR * max_change << " Elo\n";
+}
+
 #if 0
 void random_init(vector<double> & vec) {
     random_device rd;
@@ -918,10 +1110,12 @@ void write_netlist(const string & filename, const nets_t & nets) {
 
 int main(int argc, char* argv[]) {
     if (argc <= 3) {
-        cerr << "Syntax: pseres <saiXX> <sha256hash> <stdev> [-p]" << endl
+        cerr << "Syntax: pseres <saiXX> <sha256hash> <stdev> [-p] [-b] [-t <threads>]" << endl
              << "net hash is hook/root with Elo fixed to 0" << endl
-             << "standard deviation [in Elo points] is for the prior rating difference"
-             << "  -p        prune leaf nodes" << endl;
+             << "standard deviation [in Elo points] is for the prior rating difference" << endl
+             << "  -p        prune leaf nodes" << endl
+             << "  -b        refine ratings with a Bradley-Terry fit" << endl
+             << "  -t N      threads for the fit (default: all cores)" << endl;
         exit (1);
     }
 
@@ -930,7 +1124,22 @@ int main(int argc, char* argv[]) {
 
     const float prior_elo_std = stof(string(argv[3]));
 
-    const bool prune = argc > 4 && string(argv[4]) == "-p";
+    auto prune = false;
+    auto bradley_terry = false;
+    auto threads = max(1u, thread::hardware_concurrency());
+    for (auto i = 4; i < argc; ++i) {
+        const string arg(argv[i]);
+        if (arg == "-p") {
+            prune = true;
+        } else if (arg == "-b") {
+            bradley_terry = true;
+        } else if (arg == "-t" && i + 1 < argc) {
+            threads = stoi(string(argv[++i]));
+        } else {
+            cerr << "Unknown option " << arg << endl;
+            exit (1);
+        }
+    }
 
     nets_t nets = load_netsdata(saiXX + "-netdata.xls");
 
@@ -946,6 +1155,9 @@ int main(int argc, char* argv[]) {
 
     load_existing_ratings(saiXX + "-ratings.csv", nets, hook_net_hash);
     rate_connected_nets(nets, matches, prior_elo_std);
+    if (bradley_terry) {
+        fit_bradley_terry(nets, matches, hook_net_hash, prior_elo_std, threads);
+    }
 
     write_netlist(saiXX + "-rated-nets.csv", nets);
 
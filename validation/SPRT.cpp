@@ -170,6 +170,10 @@ Sprt::Status Sprt::status() const
     status.lBound = std::log(m_beta / (1.0 - m_alpha));
     status.uBound = std::log((1.0 - m_beta) / m_alpha);
 
+    if (m_pentanomial) {
+        return pentanomialStatus(status);
+    }
+
     if (m_wins <= 0 || m_losses <= 0 || m_draws <= 0) {
         if (m_wins <= 0 && m_losses >= std::exp(fabs(status.lBound))) {
             status.result = AcceptH0;
@@ -204,6 +208,39 @@ Sprt::Status Sprt::status() const
     return status;
 }
 
+Sprt::Status Sprt::pentanomialStatus(Status status) const
+{
+    // Normal approximation of the generalized SPRT on the pair scores.
+    auto pairs = 0;
+    auto sum = 0.0;
+    auto sumSquares = 0.0;
+    for (auto i = size_t{0}; i < m_pairs.size(); i++) {
+        const auto score = i / 4.0;
+        pairs += m_pairs[i];
+        sum += m_pairs[i] * score;
+        sumSquares += m_pairs[i] * score * score;
+    }
+    if (pairs == 0) {
+        return status;
+    }
+    const auto mean = sum / pairs;
+    const auto variance = sumSquares / pairs - mean * mean;
+    if (variance <= 0.0) {
+        return status;
+    }
+    const auto score0 = 1.0 / (1.0 + std::pow(10.0, -m_elo0 / 400.0));
+    const auto score1 = 1.0 / (1.0 + std::pow(10.0, -m_elo1 / 400.0));
+    status.llr = pairs * (score1 - score0) * (2.0 * mean - score0 - score1)
+                 / (2.0 * variance);
+
+    if (status.llr > status.uBound)
+        status.result = AcceptH1;
+    else if (status.llr < status.lBound)
+        status.result = AcceptH0;
+
+    return status;
+}
+
 void Sprt::addGameResult(GameResult result)
 {
     QMutexLocker locker(&m_mutex);
@@ -215,6 +252,21 @@ void Sprt::addGameResult(GameResult result)
         m_losses++;
 }
 
+void Sprt::addPairResult(GameResult first, GameResult second)
+{
+    auto halfPoints = [](GameResult result) {
+        return result == Win ? 2 : (result == Draw ? 1 : 0);
+    };
+    QMutexLocker locker(&m_mutex);
+    m_pairs[halfPoints(first) + halfPoints(second)]++;
+}
+
+void Sprt::setPentanomial(bool pentanomial)
+{
+    QMutexLocker locker(&m_mutex);
+    m_pentanomial = pentanomial;
+}
+
 std::tuple<int, int, int> Sprt::getWDL() const
 {
     return std::make_tuple(m_wins, m_draws, m_losses);
@@ -224,7 +276,11 @@ QTextStream& operator<<(QTextStream& stream, const Sprt& sprt) {
     stream << sprt.m_elo0 << ' ' << sprt.m_elo1 << ' ';
     stream << sprt.m_alpha << ' ' << sprt.m_beta << ' ';
     stream << sprt.m_wins << ' ' << sprt.m_losses << ' ';
-    stream << sprt.m_draws << Qt::endl;
+    stream << sprt.m_draws;
+    for (const auto pairs : sprt.m_pairs) {
+        stream << ' ' << pairs;
+    }
+    stream << Qt::endl;
     return stream;
 }
 
@@ -236,5 +292,8 @@ QTextStream& operator>>(QTextStream& stream, Sprt& sprt) {
     stream >> sprt.m_wins;
     stream >> sprt.m_losses;
     stream >> sprt.m_draws;
+    for (auto& pairs : sprt.m_pairs) {
+        stream >> pairs;
+    }
     return stream;
 }
@@ -33,6 +33,7 @@
 
 #include <QMutex>
 #include <QTextStream>
+#include <array>
 #include <tuple>
 
 class Sprt
@@ -99,6 +100,23 @@ public:
      * check if H0 or H1 can be accepted.
      */
     void addGameResult(GameResult result);
+
+    /*!
+     * Records the results of a pair of games between the same players
+     * with colors swapped.
+     *
+     * The pairs are only used by the test once setPentanomial() is
+     * called.
+     */
+    void addPairResult(GameResult first, GameResult second);
+
+    /*!
+     * Makes status() test the pair results, whose five possible scores
+     * account for the correlation between the two games of a pair,
+     * instead of the single games. The Elo bounds are then logistic
+     * Elo differences instead of BayesElo ones.
+     */
+    void setPentanomial(bool pentanomial);
     friend QTextStream& operator<<(QTextStream& stream, const Sprt& sprt);
     friend QTextStream& operator>>(QTextStream& stream, Sprt& sprt);
 private:
@@ -109,7 +127,12 @@ private:
     int m_wins;
     int m_losses;
     int m_draws;
+    //! Pairs by total score of the first player, in half points.
+    std::array<int, 5> m_pairs{};
+    bool m_pentanomial{false};
     mutable QMutex m_mutex;
+
+    Status pentanomialStatus(Status status) const;
 };
 
 #endif // SPRT_H
@@ -26,18 +26,44 @@ using VersionTuple = std::tuple<int, int, int>;
 const VersionTuple min_leelaz_version{0, 16, 0};
 
 
+bool ValidationWorker::startPlayers() {
+    for (auto i = 0; i < 2; i++) {
+        // Keep the engine of the previous game if possible, it saves
+        // loading the network and setting up the GPU for every game.
+        if (m_players[i] && !m_players[i]->gameReuse(m_engines[i])) {
+            m_players[i]->gameQuit();
+            m_players[i].reset();
+        }
+        if (!m_players[i]) {
+            m_players[i] = std::make_unique<Game>(m_engines[i]);
+            if (!m_players[i]->gameStart(min_leelaz_version)) {
+                m_players[i].reset();
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void ValidationWorker::quitPlayers() {
+    for (auto& player : m_players) {
+        if (player) {
+            player->gameQuit();
+            player.reset();
+        }
+    }
+}
+
 void ValidationWorker::run() {
+    auto pairFirst = Sprt::NoResult;
     do {
-        Game first(m_engines[0]);
-        if (!first.gameStart(min_leelaz_version)) {
-            emit resultReady(Sprt::NoResult, Game::BLACK);
-            return;
-        }
-        Game second(m_engines[1]);
-        if (!second.gameStart(min_leelaz_version)) {
+        if (!startPlayers()) {
+            quitPlayers();
             emit resultReady(Sprt::NoResult, Game::BLACK);
             return;
         }
+        auto& first = *m_players[0];
+        auto& second = *m_players[1];
         QTextStream(stdout) << "starting:" << Qt::endl <<
             m_engines[0].getCmdLine() << Qt::endl <<
             "vs" << Qt::endl <<
@@ -48,6 +74,7 @@ void ValidationWorker::run() {
         do {
             first.move();
             if (!first.waitForMove()) {
+                quitPlayers();
                 emit resultReady(Sprt::NoResult, Game::BLACK);
                 return;
             }
@@ -58,6 +85,7 @@ void ValidationWorker::run() {
             second.setMove(bmove + first.getMove());
             second.move();
             if (!second.waitForMove()) {
+                quitPlayers();
                 emit resultReady(Sprt::NoResult, Game::BLACK);
                 return;
             }
@@ -66,44 +94,45 @@ void ValidationWorker::run() {
             second.nextMove();
         } while (first.nextMove() && m_state.loadRelaxed() == RUNNING);
 
-        if (m_state.loadRelaxed() == RUNNING) {
-            QTextStream(stdout) << "Game has ended." << Qt::endl;
-            int result = 0;
-            if (first.getScore()) {
-                result = first.getWinner();
-                if (!m_keepPath.isEmpty()) {
-                    first.writeSgf();
-                    QString prefix = m_keepPath + '/';
-                    if (m_expected == Game::BLACK) {
-                        prefix.append("black_");
-                    } else {
-                        prefix.append("white_");
-                    }
-                    QFile(first.getFile() + ".sgf").rename(prefix + first.getFile() + ".sgf");
+        if (m_state.loadRelaxed() != RUNNING) {
+            break;
+        }
+        QTextStream(stdout) << "Game has ended." << Qt::endl;
+        int result = 0;
+        if (first.getScore()) {
+            result = first.getWinner();
+            if (!m_keepPath.isEmpty()) {
+                first.writeSgf();
+                QString prefix = m_keepPath + '/';
+                if (m_expected == Game::BLACK) {
+                    prefix.append("black_");
+                } else {
+                    prefix.append("white_");
                 }
+                QFile(first.getFile() + ".sgf").rename(prefix + first.getFile() + ".sgf");
             }
-            QTextStream(stdout) << "Stopping engine." << Qt::endl;
-            first.gameQuit();
-            second.gameQuit();
+        }
 
-            // Game is finished, send the result
-            if (result == m_expected) {
-                emit resultReady(Sprt::Win, m_expected);
-            } else {
-                emit resultReady(Sprt::Loss, m_expected);
-            }
-            // Change color and play again
-            std::swap(m_engines[0], m_engines[1]);
-            if (m_expected == Game::BLACK) {
-                m_expected = Game::WHITE;
-            } else {
-                m_expected = Game::BLACK;
-            }
+        // Game is finished, send the result
+        const auto gameResult = (result == m_expected) ? Sprt::Win : Sprt::Loss;
+        emit resultReady(gameResult, m_expected);
+        if (pairFirst == Sprt::NoResult) {
+            pairFirst = gameResult;
+        } else {
+            emit pairReady(pairFirst, gameResult);
+            pairFirst = Sprt::NoResult;
+        }
+        // Change color and play again
+        std::swap(m_engines[0], m_engines[1]);
+        std::swap(m_players[0], m_players[1]);
+        if (m_expected == Game::BLACK) {
+            m_expected = Game::WHITE;
         } else {
-            first.gameQuit();
-            second.gameQuit();
+            m_expected = Game::BLACK;
         }
     } while (m_state.loadRelaxed() != FINISHING);
+    QTextStream(stdout) << "Stopping engine." << Qt::endl;
+    quitPlayers();
 }
 
 void ValidationWorker::init(const QString& gpuIndex,
@@ -127,7 +156,8 @@ Validation::Validation(const int gpus,
                        const QString& keep,
                        QMutex* mutex,
                        const float& h0,
-                       const float& h1) :
+                       const float& h1,
+                       const bool pentanomial) :
 
     m_mainMutex(mutex),
     m_syncMutex(),
@@ -138,6 +168,7 @@ Validation::Validation(const int gpus,
     m_engines(engines),
     m_keepPath(keep) {
     m_statistic.initialize(h0, h1, 0.05, 0.05);
+    m_statistic.setPentanomial(pentanomial);
     m_statistic.addGameResult(Sprt::Draw);
 }
 
@@ -150,6 +181,11 @@ void Validation::startGames() {
                     this,
                     &Validation::getResult,
                     Qt::DirectConnection);
+            connect(&m_gamesThreads[thread_index],
+                    &ValidationWorker::pairReady,
+                    this,
+                    &Validation::getPairResult,
+                    Qt::DirectConnection);
 
             auto engines = m_engines;
             auto expected = Game::BLACK;
@@ -226,10 +262,23 @@ void Validation::getResult(Sprt::GameResult result, int net_one_color) {
     m_statistic.addGameResult(result);
     m_results.addGameResult(result, net_one_color);
 
-    Sprt::Status status = m_statistic.status();
     auto wdl = m_statistic.getWDL();
     QTextStream(stdout) << std::get<0>(wdl) << " wins, "
                         << std::get<2>(wdl) << " losses" << Qt::endl;
+    checkSprt();
+    m_syncMutex.unlock();
+}
+
+void Validation::getPairResult(Sprt::GameResult first,
+                               Sprt::GameResult second) {
+    m_syncMutex.lock();
+    m_statistic.addPairResult(first, second);
+    checkSprt();
+    m_syncMutex.unlock();
+}
+
+void Validation::checkSprt() {
+    Sprt::Status status = m_statistic.status();
     if (status.result != Sprt::Continue) {
         quitThreads();
         QTextStream(stdout)
@@ -241,7 +290,6 @@ void Validation::getResult(Sprt::GameResult result, int net_one_color) {
     } else {
         printSprtStatus(status);
     }
-    m_syncMutex.unlock();
 }
 
 void Validation::quitThreads() {
@@ -24,6 +24,7 @@
 #include <QVector>
 #include <QAtomicInt>
 #include <QMutex>
+#include <memory>
 #include "SPRT.h"
 #include "../autogtp/Game.h"
 #include "Results.h"
@@ -48,7 +49,15 @@ public:
 
 signals:
     void resultReady(Sprt::GameResult r, int net_one_color);
+    // After every second game, the first one with colors swapped.
+    void pairReady(Sprt::GameResult first, Sprt::GameResult second);
 private:
+    // The engine processes, in the order of m_engines, kept running
+    // from one game to the next.
+    std::unique_ptr<Game> m_players[2];
+    bool startPlayers();
+    void quitPlayers();
+
     QVector<Engine> m_engines;
     int m_expected;
     QString m_keepPath;
@@ -65,7 +74,8 @@ public:
                const QString& keep,
                QMutex* mutex,
                const float& h0,
-               const float& h1);
+               const float& h1,
+               const bool pentanomial = false);
     ~Validation() = default;
     void startGames();
     void wait();
@@ -74,6 +84,7 @@ signals:
     void sendQuit();
 public slots:
     void getResult(Sprt::GameResult result, int net_one_color);
+    void getPairResult(Sprt::GameResult first, Sprt::GameResult second);
     void storeSprt();
 private:
     QMutex* m_mainMutex;
@@ -87,6 +98,7 @@ private:
     QVector<Engine>& m_engines;
     QString m_keepPath;
     void quitThreads();
+    void checkSprt();
     void saveSprt();
     void printSprtStatus(const Sprt::Status& status);
 };
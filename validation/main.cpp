@@ -60,6 +60,10 @@ int main(int argc, char *argv[]) {
         {"s", "sprt"},
             "Set the SPRT hypothesis (default '0.0:35.0').",
             "lower:upper", "0.0:35.0");
+    QCommandLineOption pentanomialOption(
+        {"p", "pentanomial"},
+            "Test pairs of games with colors swapped instead of single games. "
+            "The SPRT hypothesis is then in logistic Elo.");
     QCommandLineOption gamesNumOption(
         {"g", "gamesNum"},
             "Play 'gamesNum' games on one device (GPU/CPU) at the same time.",
@@ -76,6 +80,7 @@ int main(int argc, char *argv[]) {
     parser.addOption(gamesNumOption);
     parser.addOption(gpusOption);
     parser.addOption(sprtOption);
+    parser.addOption(pentanomialOption);
     parser.addOption(keepSgfOption);
     parser.addOption(networkOption);
     parser.addOption(optionsOption);
@@ -146,7 +151,8 @@ int main(int argc, char *argv[]) {
     Console *cons = nullptr;
     Validation *validate = new Validation(gpusNum, gamesNum, gpusList,
                                           engines, keepPath, &mutex,
-                                          h0, h1);
+                                          h0, h1,
+                                          parser.isSet(pentanomialOption));
     QObject::connect(&app, &QCoreApplication::aboutToQuit, validate, &Validation::storeSprt);
     validate->loadSprt();
     validate->startGames();